@@ -0,0 +1,306 @@
+#!/usr/bin/env python3
+"""
+Benchmark / soak harness: runs rtsptomqtt against local stand-ins (bench/rtsp_server.py serving looped MJPEG samples,
+and a mosquitto broker on a free loopback port) for every combination of capture mode, camera count, interval and frame
+size, and reports snapshots/s, p50/p99 capture latency (the 'frame' stage: capture start to frame in hand), p99 publish
+ack latency, CPU (rtsptomqtt plus its ffmpeg children), snapshots/s per core of CPU used and peak RSS, read from the
+metrics endpoint and /proc.
+
+  make bench
+  python3 bench/bench.py --cameras 1,8,32 --intervals 1,0.2 --sizes 1920x1080 --duration 30
+  python3 bench/bench.py --cameras 16 --duration 3600 --csv soak.csv       # soak: watch rss growth and failures
+  python3 bench/bench.py --modes persistent --encoders ffmpeg,libjpeg --set quality=6 --set workers-cpus=0-3
+                                                                          # JPEG encoding in ffmpeg or in the workers
+
+Samples are generated with ffmpeg (testsrc2) unless given with --sample name=file.mjpeg; use --broker host:port to
+use a running broker instead of starting mosquitto.
+"""
+
+import argparse
+import csv
+import os
+import shutil
+import signal
+import socket
+import subprocess
+import sys
+import tempfile
+import time
+import urllib.request
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+import rtsp_server  # noqa: E402
+
+
+def port_free():
+    with socket.socket() as s:
+        s.bind(("127.0.0.1", 0))
+        return s.getsockname()[1]
+
+
+def sample_generate(directory, size, fps):
+    path = os.path.join(directory, f"{size}.mjpeg")
+    command = ["ffmpeg", "-loglevel", "error", "-y", "-f", "lavfi", "-i", f"testsrc2=size={size}:rate={fps}", "-t", "5"]
+    command += ["-c:v", "mjpeg", "-pix_fmt", "yuvj420p", "-huffman", "default", "-q:v", "4", "-f", "mjpeg", path]
+    subprocess.run(command, check=True)
+    return path
+
+
+def broker_start(directory, binary):
+    port = port_free()
+    config = os.path.join(directory, "mosquitto.conf")
+    with open(config, "w") as f:
+        f.write(f"listener {port} 127.0.0.1\nallow_anonymous true\npersistence false\n")
+    process = subprocess.Popen([binary, "-c", config], stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+    for _ in range(50):
+        try:
+            socket.create_connection(("127.0.0.1", port), timeout=0.1).close()
+            return process, f"127.0.0.1:{port}"
+        except OSError:
+            time.sleep(0.1)
+    process.kill()
+    raise RuntimeError("mosquitto did not start")
+
+
+def metrics_scrape(port):
+    """{(name, labels): value} from the Prometheus text exposition"""
+    with urllib.request.urlopen(f"http://127.0.0.1:{port}/metrics", timeout=5) as response:
+        text = response.read().decode()
+    samples = {}
+    for line in text.splitlines():
+        if not line or line.startswith("#"):
+            continue
+        series, value = line.rsplit(" ", 1)
+        name, _, labels = series.partition("{")
+        labels = tuple(sorted(tuple(pair.split("=", 1)) for pair in labels.rstrip("}").split(",") if pair))
+        samples[(name, labels)] = float(value)
+    return samples
+
+
+def metrics_sum(samples, name):
+    return sum(value for (n, _), value in samples.items() if n == name)
+
+
+def metrics_quantile(before, after, stage, q):
+    """quantile of a stage histogram over the measurement window, all cameras together, in milliseconds"""
+    buckets = {}
+    for (name, labels), value in after.items():
+        label = dict(labels)
+        if name == "rtsptomqtt_stage_seconds_bucket" and label.get("stage") == f'"{stage}"':
+            le = label["le"].strip('"')
+            bound = float("inf") if le == "+Inf" else float(le)
+            buckets[bound] = buckets.get(bound, 0) + value - before.get((name, labels), 0)
+    bounds = sorted(buckets)
+    total = buckets[bounds[-1]] if bounds else 0
+    if total <= 0:
+        return float("nan")
+    rank, lower, below = q * total, 0.0, 0.0
+    for bound in bounds:
+        if buckets[bound] >= rank:
+            if bound == float("inf"):
+                return lower * 1000
+            return (lower + (bound - lower) * (rank - below) / max(buckets[bound] - below, 1e-9)) * 1000
+        lower, below = bound, buckets[bound]
+    return lower * 1000
+
+
+def process_cpu(pid):
+    """seconds of CPU used by the process, its reaped children and its live children (persistent ffmpeg)"""
+    ticks = os.sysconf("SC_CLK_TCK")
+
+    def stat(p, reaped):
+        with open(f"/proc/{p}/stat") as f:
+            fields = f.read().rsplit(")", 1)[1].split()
+        return sum(int(x) for x in fields[11:15 if reaped else 13])
+
+    total = stat(pid, True)
+    for task in os.listdir(f"/proc/{pid}/task"):
+        try:
+            with open(f"/proc/{pid}/task/{task}/children") as f:
+                for child in f.read().split():
+                    total += stat(child, False)
+        except OSError:
+            pass
+    return total / ticks
+
+
+def process_memory(pid, key):
+    with open(f"/proc/{pid}/status") as f:
+        for line in f:
+            if line.startswith(key + ":"):
+                return int(line.split()[1]) / 1024
+    return 0.0
+
+
+def run(arguments, directory, broker, rtsp_port, mode, encoder, cameras, interval, size):
+    metrics_port = port_free()
+    config = os.path.join(directory, "bench.cfg")
+    with open(config, "w") as f:
+        f.write(f"mqtt-server=mqtt://{broker}\nmqtt-client=bench\nmqtt-topic=bench\n")
+        f.write(f"interval={interval}\ncapture-mode={mode}\nencoder={encoder}\nmetrics-port={metrics_port}\n")
+        if arguments.workers:
+            f.write(f"workers={arguments.workers}\n")
+        for extra in arguments.set:
+            f.write(extra + "\n")
+        for camera in range(cameras):
+            f.write(f"[camera{camera}]\nrtsp-url=rtsp://127.0.0.1:{rtsp_port}/{size}\n")
+    log = open(os.path.join(directory, f"{mode}-{encoder}-{cameras}-{interval}-{size}.log"), "w")
+    process = subprocess.Popen([arguments.binary, "--config", config], stdout=log, stderr=subprocess.STDOUT)
+    result = {"mode": mode, "encoder": encoder, "cameras": cameras, "interval": interval, "size": size}
+    try:
+        for _ in range(100):
+            try:
+                metrics_scrape(metrics_port)
+                break
+            except OSError:
+                if process.poll() is not None:
+                    raise RuntimeError(f"rtsptomqtt exited (status {process.returncode}), see {log.name}")
+                time.sleep(0.1)
+        time.sleep(arguments.warmup)
+        before, cpu_before, rss_before, time_before = (
+            metrics_scrape(metrics_port),
+            process_cpu(process.pid),
+            process_memory(process.pid, "VmRSS"),
+            time.monotonic(),
+        )
+        time.sleep(arguments.duration)
+        after, cpu_after, rss_after, time_after = (
+            metrics_scrape(metrics_port),
+            process_cpu(process.pid),
+            process_memory(process.pid, "VmRSS"),
+            time.monotonic(),
+        )
+        elapsed = time_after - time_before
+
+        def delta(name):
+            return metrics_sum(after, name) - metrics_sum(before, name)
+
+        snapshots_s, cores = delta("rtsptomqtt_frames_total") / elapsed, (cpu_after - cpu_before) / elapsed
+        result.update(
+            {
+                "snapshots_s": snapshots_s,
+                "target_s": cameras / float(interval),
+                "frame_p50_ms": metrics_quantile(before, after, "frame", 0.50),
+                "frame_p99_ms": metrics_quantile(before, after, "frame", 0.99),
+                "ack_p99_ms": metrics_quantile(before, after, "ack", 0.99),
+                "encode_p50_ms": metrics_quantile(before, after, "encode", 0.50),
+                "cpu_pct": 100.0 * cores,
+                "per_core_s": snapshots_s / cores if cores > 0 else 0.0,
+                "rss_peak_mb": process_memory(process.pid, "VmHWM"),
+                "rss_growth_mb": rss_after - rss_before,
+                "failures": int(delta("rtsptomqtt_failures_total")),
+                "skips": int(delta("rtsptomqtt_skips_total")),
+                "drops": int(delta("rtsptomqtt_drops_total")),
+            }
+        )
+    finally:
+        process.send_signal(signal.SIGINT)
+        try:
+            process.wait(timeout=20)
+        except subprocess.TimeoutExpired:
+            process.kill()
+            process.wait()
+        log.close()
+    return result
+
+
+COLUMNS = [  # name, width, decimals (None for text and integers)
+    ("mode", 10, None),
+    ("encoder", 7, None),
+    ("cameras", 7, None),
+    ("interval", 8, None),
+    ("size", 9, None),
+    ("snapshots_s", 11, 2),
+    ("target_s", 8, 2),
+    ("frame_p50_ms", 12, 2),
+    ("frame_p99_ms", 12, 2),
+    ("ack_p99_ms", 10, 2),
+    ("encode_p50_ms", 13, 2),
+    ("cpu_pct", 7, 1),
+    ("per_core_s", 10, 2),
+    ("rss_peak_mb", 11, 1),
+    ("rss_growth_mb", 13, 1),
+    ("failures", 8, None),
+    ("skips", 5, None),
+    ("drops", 5, None),
+]
+
+
+def columns(row):
+    cells = []
+    for name, width, decimals in COLUMNS:
+        text = isinstance(row[name], str) or decimals is None
+        cells.append(f"{row[name]:>{width}}" if text else f"{row[name]:>{width}.{decimals}f}")
+    return " ".join(cells)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--binary", default="./rtsptomqtt")
+    parser.add_argument("--modes", default="rtsp", help="capture modes, e.g. rtsp,persistent,spawn")
+    parser.add_argument("--encoders", default="ffmpeg", help="e.g. ffmpeg,libjpeg (needs a LIBJPEG=1 build)")
+    parser.add_argument("--cameras", default="1,4,16")
+    parser.add_argument("--intervals", default="1,0.25", help="seconds")
+    parser.add_argument("--sizes", default="640x360,1920x1080")
+    parser.add_argument("--sample", action="append", default=[], metavar="SIZE=FILE", help="MJPEG file for a size")
+    parser.add_argument("--fps", type=float, default=10.0, help="stand-in camera frame rate")
+    parser.add_argument("--duration", type=float, default=15.0, help="seconds measured per run")
+    parser.add_argument("--warmup", type=float, default=3.0, help="seconds before measuring")
+    parser.add_argument("--workers", type=int, default=0)
+    parser.add_argument("--set", action="append", default=[], metavar="KEY=VALUE", help="extra config line")
+    parser.add_argument("--broker", help="host:port of a running broker (default: start mosquitto)")
+    parser.add_argument("--mosquitto", default="mosquitto")
+    parser.add_argument("--csv", help="also write the results here")
+    arguments = parser.parse_args()
+
+    if not os.access(arguments.binary, os.X_OK):
+        parser.error(f"{arguments.binary} not found, build it first (make)")
+    directory = tempfile.mkdtemp(prefix="rtsptomqtt-bench-")
+    samples = dict(sample.split("=", 1) for sample in arguments.sample)
+    sizes = list(samples) if samples else arguments.sizes.split(",")
+    broker_process = None
+    try:
+        for size in sizes:
+            if size not in samples:
+                if shutil.which("ffmpeg") is None:
+                    parser.error(f"ffmpeg is needed to generate samples (or pass --sample {size}=file.mjpeg)")
+                samples[size] = sample_generate(directory, size, arguments.fps)
+        server = rtsp_server.Server(samples, 0, arguments.fps).start()
+        broker = arguments.broker
+        if broker is None:
+            if shutil.which(arguments.mosquitto) is None:
+                parser.error("mosquitto not found (install it, or pass --broker host:port)")
+            broker_process, broker = broker_start(directory, arguments.mosquitto)
+        print(f"bench: rtsp stand-in on port {server.port}, broker {broker}, logs in {directory}")
+        print(columns({name: name for name, _, _ in COLUMNS}))
+        results, failed = [], False
+        for mode, encoder in ((m, e) for m in arguments.modes.split(",") for e in arguments.encoders.split(",")):
+            for cameras in (int(c) for c in arguments.cameras.split(",")):
+                for interval in arguments.intervals.split(","):
+                    for size in sizes:
+                        try:
+                            result = run(
+                                arguments, directory, broker, server.port, mode, encoder, cameras, interval, size
+                            )
+                        except (RuntimeError, OSError) as error:
+                            print(f"bench: {mode} {encoder} cameras={cameras} interval={interval} size={size}: {error}")
+                            failed = True
+                            continue
+                        failed |= result["snapshots_s"] == 0
+                        results.append(result)
+                        print(columns(result), flush=True)
+        if arguments.csv:
+            with open(arguments.csv, "w", newline="") as f:
+                writer = csv.DictWriter(f, fieldnames=[name for name, _, _ in COLUMNS])
+                writer.writeheader()
+                writer.writerows(results)
+        server.close()
+        return 1 if failed else 0
+    finally:
+        if broker_process is not None:
+            broker_process.terminate()
+            broker_process.wait()
+
+
+if __name__ == "__main__":
+    sys.exit(main())
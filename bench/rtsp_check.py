@@ -0,0 +1,143 @@
+#!/usr/bin/env python3
+"""
+Check of capture-mode=rtsp against the stand-in (bench/rtsp_server.py): for each codec, serves a sample, runs
+rtsptomqtt on it with a shared memory ring (shm, read as tools/shm_read.py does, so no broker is needed) and checks that
+JPEGs come out of it (SOI, a frame header, EOI); H.264 and H.265 need a LIBAV=1 build.
+
+  make LIBAV=1 check
+  python3 bench/rtsp_check.py --codecs h264,h265 --sample h264=recording.h264 --sample h265=recording.h265
+
+Samples are generated with ffmpeg (testsrc2, a keyframe every 10 frames) unless given with --sample codec=file; the
+stand-in takes the codec from the extension (.mjpeg, .h264, .h265).
+"""
+
+import argparse
+import os
+import shutil
+import signal
+import struct
+import subprocess
+import sys
+import tempfile
+import time
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.dirname(os.path.abspath(__file__))), "tools"))
+import rtsp_server  # noqa: E402
+import shm_read  # noqa: E402
+from bench import port_free  # noqa: E402
+
+ENCODERS = {  # codec: extension, ffmpeg output options
+    "mjpeg": (".mjpeg", ["-c:v", "mjpeg", "-pix_fmt", "yuvj420p", "-huffman", "default", "-q:v", "4", "-f", "mjpeg"]),
+    "h264": (".h264", ["-c:v", "libx264", "-pix_fmt", "yuv420p", "-g", "10", "-bf", "0", "-f", "h264"]),
+    "h265": (".h265", ["-c:v", "libx265", "-pix_fmt", "yuv420p", "-g", "10", "-bf", "0", "-f", "hevc"]),
+}
+
+
+def sample_generate(directory, codec, size, fps):
+    extension, options = ENCODERS[codec]
+    path = os.path.join(directory, f"{codec}{extension}")
+    command = ["ffmpeg", "-loglevel", "error", "-y", "-f", "lavfi", "-i", f"testsrc2=size={size}:rate={fps}", "-t", "3"]
+    subprocess.run(command + options + [path], check=True)
+    return path
+
+
+def jpeg_size(data):
+    """(width, height) from the frame header of a JPEG with SOI and EOI, or None"""
+    if not data.startswith(b"\xff\xd8") or not data.endswith(b"\xff\xd9"):
+        return None
+    p = 2
+    while p + 4 <= len(data) and data[p] == 0xFF:
+        marker, length = data[p + 1], (data[p + 2] << 8) | data[p + 3]
+        if 0xC0 <= marker <= 0xCF and marker not in (0xC4, 0xC8, 0xCC) and length >= 7:
+            height, width = struct.unpack("!HH", data[p + 5 : p + 9])
+            return width, height
+        if marker == 0xDA:
+            return None
+        p += 2 + length
+    return None
+
+
+def check(arguments, directory, port, codec):
+    name = f"/rtsptomqtt-check-{os.getpid()}-{codec}"
+    config = os.path.join(directory, f"{codec}.cfg")
+    with open(config, "w") as f:
+        # nothing listens on the broker port: the frames still reach the ring
+        f.write(f"mqtt-server=mqtt://127.0.0.1:{port_free()}\nmqtt-client=check\nmqtt-topic=check\n")
+        f.write(f"interval={arguments.interval}\ncapture-mode=rtsp\n")
+        f.write(f"[{codec}]\nrtsp-url=rtsp://127.0.0.1:{port}/{codec}\nshm=4\nshm-name={name}\n")
+    log = open(os.path.join(directory, f"{codec}.log"), "w")
+    process = subprocess.Popen([arguments.binary, "--config", config], stdout=log, stderr=subprocess.STDOUT)
+    ring, seen, deadline = None, {}, time.monotonic() + arguments.timeout
+    try:
+        while len(seen) < arguments.frames and time.monotonic() < deadline:
+            if process.poll() is not None:
+                return f"rtsptomqtt exited (status {process.returncode}), see {log.name}"
+            if ring is None:
+                try:
+                    ring = shm_read.Ring(name)
+                except (OSError, ValueError, struct.error):
+                    time.sleep(0.1)
+                    continue
+            latest = ring.latest()
+            if latest is not None and latest[0] not in seen:
+                seen[latest[0]] = jpeg_size(latest[2])
+                if seen[latest[0]] is None:
+                    return f"frame {latest[0]} is not a JPEG ({len(latest[2])} bytes), see {log.name}"
+            time.sleep(0.05)
+        if len(seen) < arguments.frames:
+            return f"{len(seen)} of {arguments.frames} frames in {arguments.timeout:g}s, see {log.name}"
+        width, height = next(iter(seen.values()))
+        return f"ok, {len(seen)} JPEGs of {width}x{height}"
+    finally:
+        process.send_signal(signal.SIGINT)
+        try:
+            process.wait(timeout=20)
+        except subprocess.TimeoutExpired:
+            process.kill()
+            process.wait()
+        log.close()
+        if ring is not None:
+            ring.close()
+        try:
+            os.unlink("/dev/shm" + name)
+        except OSError:
+            pass
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--binary", default="./rtsptomqtt")
+    parser.add_argument("--codecs", default="mjpeg,h264,h265", help="e.g. mjpeg (h264 and h265 need a LIBAV=1 build)")
+    parser.add_argument("--sample", action="append", default=[], metavar="CODEC=FILE", help="recorded file for a codec")
+    parser.add_argument("--size", default="640x360", help="of generated samples")
+    parser.add_argument("--fps", type=float, default=10.0, help="stand-in camera frame rate")
+    parser.add_argument("--interval", type=float, default=0.5, help="seconds")
+    parser.add_argument("--frames", type=int, default=3, help="JPEGs to see per codec")
+    parser.add_argument("--timeout", type=float, default=20.0, help="seconds per codec")
+    arguments = parser.parse_args()
+
+    if not os.access(arguments.binary, os.X_OK):
+        parser.error(f"{arguments.binary} not found, build it first (make, or make LIBAV=1)")
+    directory = tempfile.mkdtemp(prefix="rtsptomqtt-check-")
+    samples, codecs = dict(sample.split("=", 1) for sample in arguments.sample), arguments.codecs.split(",")
+    for codec in codecs:
+        if codec not in ENCODERS:
+            parser.error(f"unknown codec {codec} (mjpeg, h264, h265)")
+        if codec not in samples:
+            if shutil.which("ffmpeg") is None:
+                parser.error(f"ffmpeg is needed to generate samples (or pass --sample {codec}=file)")
+            samples[codec] = sample_generate(directory, codec, arguments.size, arguments.fps)
+    server = rtsp_server.Server({codec: samples[codec] for codec in codecs}, 0, arguments.fps).start()
+    print(f"check: rtsp stand-in on port {server.port}, logs in {directory}")
+    failed = False
+    for codec in codecs:
+        result = check(arguments, directory, server.port, codec)
+        failed |= not result.startswith("ok")
+        print(f"check: {codec} ({server.streams[codec].description}): {result}", flush=True)
+    server.close()
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,346 @@
+#!/usr/bin/env python3
+"""
+RTSP stand-in for benchmarks and checks: serves recorded files looped forever over TCP interleaved channels, one path
+per file, e.g.
+
+  python3 bench/rtsp_server.py --port 8554 sample=sample.mjpeg  ->  rtsp://127.0.0.1:8554/sample
+  python3 bench/rtsp_server.py --port 8554 camera=recording.h264 hevc=recording.h265
+
+MJPEG files (concatenated baseline JPEGs, e.g. ffmpeg -f mjpeg) are sent as RTP/JPEG (RFC 2435), with the quantisation
+tables in-band (Q=255) so frames arrive bit-exact; Huffman tables are not carried by RTP/JPEG, so the JPEGs must use the
+standard ones (ffmpeg -huffman default). H.264 (.h264, .264) and H.265 (.h265, .265, .hevc) files are Annex B byte
+streams (e.g. ffmpeg -c:v libx264 -f h264), sent an access unit per frame as RTP H.264 (RFC 6184) or H.265 (RFC 7798),
+single NAL unit or fragmented, with the first parameter sets of the file in the SDP as well as wherever the file has
+them. Sessions are independent, every client gets its own sender thread paced at --fps.
+"""
+
+import argparse
+import base64
+import os
+import socket
+import struct
+import sys
+import threading
+import time
+
+PAYLOAD_MAX = 1400
+H264_EXTENSIONS, H265_EXTENSIONS = (".h264", ".264"), (".h265", ".265", ".hevc")
+
+
+def jpeg_frames(data):
+    """splits concatenated JPEGs on SOI/EOI (marker segments are skipped so embedded thumbnails do not confuse it)"""
+    frames, position = [], 0
+    while True:
+        start = data.find(b"\xff\xd8", position)
+        if start < 0:
+            return frames
+        p = start + 2
+        while p + 4 <= len(data):
+            if data[p] != 0xFF:
+                break
+            marker = data[p + 1]
+            if marker == 0xDA:
+                end = data.find(b"\xff\xd9", p)
+                if end < 0:
+                    return frames
+                frames.append(data[start : end + 2])
+                position = end + 2
+                break
+            p += 2 + ((data[p + 2] << 8) | data[p + 3])
+        else:
+            return frames
+        if position <= start:  # not a JPEG after all, keep looking
+            position = start + 2
+
+
+def jpeg_parse(jpeg):
+    """(type, width, height, restart interval, 8-bit quantisation tables, entropy-coded data) for RTP/JPEG"""
+    tables, width, height, restart, sampling = {}, 0, 0, 0, None
+    p = 2
+    while p + 4 <= len(jpeg):
+        marker, length = jpeg[p + 1], (jpeg[p + 2] << 8) | jpeg[p + 3]
+        segment = jpeg[p + 4 : p + 2 + length]
+        if marker == 0xDB:
+            q = 0
+            while q < len(segment):
+                precision, index = segment[q] >> 4, segment[q] & 15
+                if precision != 0:
+                    raise ValueError("16-bit quantisation tables are not supported by RTP/JPEG")
+                tables[index] = segment[q + 1 : q + 65]
+                q += 65
+        elif marker in (0xC1, 0xC2, 0xC3, 0xC9, 0xCA, 0xCB):
+            raise ValueError("only baseline JPEG can be sent as RTP/JPEG")
+        elif marker == 0xC0:
+            height, width = struct.unpack("!HH", segment[1:5])
+            if segment[5] != 3:
+                raise ValueError("RTP/JPEG needs 3 component YCbCr frames")
+            sampling = segment[7]
+        elif marker == 0xDD:
+            restart = struct.unpack("!H", segment[:2])[0]
+        elif marker == 0xDA:
+            if sampling not in (0x21, 0x22):
+                raise ValueError("RTP/JPEG needs 4:2:2 or 4:2:0 luma sampling")
+            if width % 8 or height % 8 or width > 2040 or height > 2040:
+                raise ValueError("RTP/JPEG needs dimensions that are multiples of 8, up to 2040")
+            jpeg_type = (0 if sampling == 0x21 else 1) + (64 if restart else 0)
+            qtables = tables.get(0, b"") + tables.get(1, b"")
+            scan = jpeg[p + 2 + length :]
+            if scan.endswith(b"\xff\xd9"):
+                scan = scan[:-2]
+            return jpeg_type, width, height, restart, qtables, scan
+        p += 2 + length
+    raise ValueError("no scan in JPEG")
+
+
+def rtp_packet(payload_type, marker, sequence, timestamp, payload):
+    marker = 0x80 if marker else 0
+    rtp = struct.pack("!BBHII", 0x80, payload_type | marker, sequence & 0xFFFF, timestamp & 0xFFFFFFFF, 0x42)
+    return b"$\x00" + struct.pack("!H", len(rtp) + len(payload)) + rtp + payload
+
+
+def jpeg_packets(frame, sequence, timestamp):
+    jpeg_type, width, height, restart, qtables, scan = frame
+    offset = 0
+    while True:
+        header = struct.pack("!B", 0) + offset.to_bytes(3, "big")
+        header += struct.pack("!BBBB", jpeg_type, 255, width // 8, height // 8)
+        if restart:
+            header += struct.pack("!HH", restart, 0xFFFF)
+        if offset == 0:
+            header += struct.pack("!BBH", 0, 0, len(qtables)) + qtables
+        chunk = scan[offset : offset + PAYLOAD_MAX - len(header)]
+        offset += len(chunk)
+        last = offset >= len(scan)
+        yield rtp_packet(26, last, sequence, timestamp, header + chunk)
+        sequence += 1
+        if last:
+            return
+
+
+def annexb_units(data):
+    """splits an Annex B byte stream into NAL units, start codes (and the zero bytes before them) removed"""
+    units, position = [], data.find(b"\x00\x00\x01")
+    while position >= 0:
+        end = data.find(b"\x00\x00\x01", position + 3)
+        unit = data[position + 3 : end if end >= 0 else len(data)].rstrip(b"\x00")
+        if unit:
+            units.append(unit)
+        position = end
+    return units
+
+
+def h26x_type(unit, hevc):
+    return (unit[0] >> 1) & 0x3F if hevc else unit[0] & 0x1F
+
+
+def h26x_access_units(units, hevc):
+    """groups NAL units into access units: one starts at a parameter set, delimiter or SEI after a picture's slices, or
+    at a slice that is the first of its picture (first_mb_in_slice 0, first_slice_segment_in_pic_flag)"""
+    frames, frame, slices = [], [], False
+    for unit in units:
+        kind = h26x_type(unit, hevc)
+        if hevc:
+            vcl, prefix = kind < 32, kind in (32, 33, 34, 35, 39) or 41 <= kind <= 44 or 48 <= kind <= 55
+        else:
+            vcl, prefix = 1 <= kind <= 5, kind in (6, 7, 8, 9) or 14 <= kind <= 18
+        first = vcl and len(unit) > (2 if hevc else 1) and unit[2 if hevc else 1] & 0x80
+        if slices and (prefix or first):
+            frames.append(frame)
+            frame, slices = [], False
+        frame.append(unit)
+        slices |= vcl
+    if slices:
+        frames.append(frame)
+    return frames
+
+
+def h26x_keyframe(frame, hevc):
+    return any(16 <= h26x_type(unit, hevc) <= 21 if hevc else h26x_type(unit, hevc) == 5 for unit in frame)
+
+
+def h26x_fmtp(units, hevc):
+    """sprop parameters from the first VPS/SPS/PPS of the file"""
+    sets = {}
+    for unit in units:
+        sets.setdefault(h26x_type(unit, hevc), base64.b64encode(unit).decode())
+    if hevc:
+        names = (("vps", 32), ("sps", 33), ("pps", 34))
+        return ";".join(f"sprop-{name}={sets[kind]}" for name, kind in names if kind in sets)
+    sprop = ",".join(sets[kind] for kind in (7, 8) if kind in sets)
+    return "packetization-mode=1" + (f";sprop-parameter-sets={sprop}" if sprop else "")
+
+
+def h26x_packets(frame, sequence, timestamp, hevc):
+    """an access unit as single NAL unit packets, or fragmentation units (FU-A, type 28 / FU, type 49) when too large,
+    the marker on its last packet"""
+    header = 2 if hevc else 1
+    for index, unit in enumerate(frame):
+        last = index == len(frame) - 1
+        if len(unit) <= PAYLOAD_MAX:
+            yield rtp_packet(96, last, sequence, timestamp, unit)
+            sequence += 1
+            continue
+        kind = h26x_type(unit, hevc)
+        indicator = bytes(((unit[0] & 0x81) | (49 << 1), unit[1])) if hevc else bytes(((unit[0] & 0xE0) | 28,))
+        offset = header
+        while offset < len(unit):
+            chunk = unit[offset : offset + PAYLOAD_MAX - header - 1]
+            end = offset + len(chunk) >= len(unit)
+            fu = bytes((kind | (0x80 if offset == header else 0) | (0x40 if end else 0),))
+            yield rtp_packet(96, last and end, sequence, timestamp, indicator + fu + chunk)
+            offset += len(chunk)
+            sequence += 1
+
+
+class Stream:
+    """a file's frames, with the SDP media description and the packetiser for them"""
+
+    def __init__(self, path):
+        with open(path, "rb") as f:
+            data = f.read()
+        extension = os.path.splitext(path)[1].lower()
+        if extension in H264_EXTENSIONS + H265_EXTENSIONS:
+            hevc = extension in H265_EXTENSIONS
+            units = annexb_units(data)
+            self.frames = h26x_access_units(units, hevc)
+            keyframes = sum(h26x_keyframe(frame, hevc) for frame in self.frames)
+            if not keyframes:
+                raise ValueError(f"no keyframes in {path}")
+            encoding = "H265" if hevc else "H264"
+            fmtp = h26x_fmtp(units, hevc)
+            self.media = f"m=video 0 RTP/AVP 96\r\na=rtpmap:96 {encoding}/90000\r\na=fmtp:96 {fmtp}\r\n"
+            self.packets = lambda frame, sequence, timestamp: h26x_packets(frame, sequence, timestamp, hevc)
+            self.description = f"{encoding}, {len(self.frames)} frames, {keyframes} keyframes"
+        else:
+            self.frames = [jpeg_parse(jpeg) for jpeg in jpeg_frames(data)]
+            if not self.frames:
+                raise ValueError(f"no JPEG frames in {path}")
+            self.media = "m=video 0 RTP/AVP 26\r\na=rtpmap:26 JPEG/90000\r\n"
+            self.packets = jpeg_packets
+            self.description = f"JPEG, {len(self.frames)} frames, {self.frames[0][1]}x{self.frames[0][2]}"
+
+
+class Server:
+    def __init__(self, streams, port, fps, host="127.0.0.1"):
+        self.streams = {name: Stream(path) for name, path in streams.items()}
+        self.fps = fps
+        self.socket = socket.socket()
+        self.socket.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+        self.socket.bind((host, port))
+        self.socket.listen(128)
+        self.port = self.socket.getsockname()[1]
+        self.sessions = 0
+
+    def start(self):
+        threading.Thread(target=self.serve, daemon=True).start()
+        return self
+
+    def serve(self):
+        while True:
+            try:
+                connection, _ = self.socket.accept()
+            except OSError:
+                return
+            threading.Thread(target=self.session, args=(connection,), daemon=True).start()
+
+    def session(self, connection):
+        reader, playing, stream = connection.makefile("rb"), threading.Event(), None
+        try:
+            while True:
+                request = b""
+                while not request.endswith(b"\r\n\r\n"):
+                    byte = reader.read(1)
+                    if not byte:
+                        return
+                    if byte == b"$" and not request:  # interleaved data from the client (RTCP), skip it
+                        length = struct.unpack("!xH", reader.read(3))[0]
+                        reader.read(length)
+                        continue
+                    request += byte
+                lines = request.decode(errors="replace").split("\r\n")
+                method, url = lines[0].split(" ")[:2]
+                fields = (line.partition(":") for line in lines[1:] if ":" in line)
+                headers = {key.strip().lower(): value.strip() for key, _, value in fields}
+                cseq = headers.get("cseq", "0")
+                name = url.split("://", 1)[-1].split("/", 1)[-1].split("/")[0]
+                if method in ("OPTIONS", "GET_PARAMETER", "SET_PARAMETER"):
+                    self.reply(connection, cseq, "Public: OPTIONS, DESCRIBE, SETUP, PLAY, TEARDOWN, GET_PARAMETER\r\n")
+                elif method == "DESCRIBE":
+                    if name not in self.streams:
+                        self.reply(connection, cseq, status="404 Not Found")
+                        continue
+                    sdp = (
+                        "v=0\r\no=- 0 0 IN IP4 127.0.0.1\r\ns=bench\r\nt=0 0\r\n"
+                        f"{self.streams[name].media}a=control:track1\r\n"
+                    )
+                    self.reply(
+                        connection,
+                        cseq,
+                        f"Content-Base: {url.rstrip('/')}/\r\nContent-Type: application/sdp\r\n"
+                        f"Content-Length: {len(sdp)}\r\n",
+                        body=sdp,
+                    )
+                elif method == "SETUP":
+                    stream = self.streams.get(name)
+                    self.reply(
+                        connection, cseq, "Transport: RTP/AVP/TCP;unicast;interleaved=0-1\r\nSession: 1;timeout=60\r\n"
+                    )
+                elif method == "PLAY":
+                    if stream is None:
+                        self.reply(connection, cseq, status="455 Method Not Valid in This State")
+                        continue
+                    self.reply(connection, cseq, "Session: 1\r\n")
+                    if not playing.is_set():
+                        playing.set()
+                        self.sessions += 1
+                        threading.Thread(target=self.send, args=(connection, stream), daemon=True).start()
+                elif method == "TEARDOWN":
+                    self.reply(connection, cseq)
+                    return
+                else:
+                    self.reply(connection, cseq, status="501 Not Implemented")
+        except (OSError, ValueError):
+            pass
+        finally:
+            connection.close()
+
+    def reply(self, connection, cseq, headers="", body="", status="200 OK"):
+        connection.sendall(f"RTSP/1.0 {status}\r\nCSeq: {cseq}\r\n{headers}\r\n{body}".encode())
+
+    def send(self, connection, stream):
+        sequence, timestamp, index, period = 0, 0, 0, 1.0 / self.fps
+        deadline = time.monotonic()
+        try:
+            while True:
+                packets = list(stream.packets(stream.frames[index % len(stream.frames)], sequence, timestamp))
+                connection.sendall(b"".join(packets))
+                sequence, timestamp, index = sequence + len(packets), timestamp + int(90000 * period), index + 1
+                deadline += period
+                time.sleep(max(0.0, deadline - time.monotonic()))
+        except OSError:
+            pass
+
+    def close(self):
+        self.socket.close()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--port", type=int, default=8554)
+    parser.add_argument("--fps", type=float, default=10.0)
+    parser.add_argument("streams", nargs="+", metavar="name=file.mjpeg|.h264|.h265")
+    arguments = parser.parse_args()
+    streams = dict(stream.split("=", 1) for stream in arguments.streams)
+    server = Server(streams, arguments.port, arguments.fps).start()
+    for name, stream in server.streams.items():
+        print(f"rtsp://127.0.0.1:{server.port}/{name} ({stream.description})")
+    try:
+        while True:
+            time.sleep(3600)
+    except KeyboardInterrupt:
+        server.close()
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,194 @@
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// container packing several frames into one message, all integers big-endian:
+//
+//   offset  size  field
+//        0     4  magic "RTMB"
+//        4     1  version (1)
+//        5     1  flags (0)
+//        6     2  frame count
+//        8     4  index offset, from the start of the message
+//       12     4  index length
+//       16        frames, each a 4 byte length followed by that many bytes (a JPEG, or nothing for a frame that was
+//                 not published, e.g. unchanged)
+//    index        JSON object, {"camera":"<name>","frames":[<metadata of frame 0>,...]}, one entry per frame in order
+//
+// frames are appended as they come and the index follows them, so packing copies each frame once; a reader can walk
+// the frames with the length prefixes alone, or take the index first for the metadata
+
+#define BATCH_MAGIC "RTMB"
+#define BATCH_VERSION 1
+#define BATCH_HEADER_SIZE 16
+#define BATCH_FRAMES_MAX 65535
+
+typedef struct {
+    unsigned char *data; // header and frames, then the index once packed
+    size_t size, capacity;
+    char *index; // the frames array of the index, as added
+    size_t index_size, index_capacity;
+    int count;
+} batch_t;
+
+void __batch_put32(unsigned char *p, const uint32_t value) {
+    p[0] = (unsigned char)(value >> 24);
+    p[1] = (unsigned char)(value >> 16);
+    p[2] = (unsigned char)(value >> 8);
+    p[3] = (unsigned char)value;
+}
+
+uint32_t __batch_get32(const unsigned char *p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | (uint32_t)p[3];
+}
+
+bool __batch_reserve(void **buffer, size_t *capacity, const size_t size) {
+    if (size <= *capacity)
+        return true;
+    size_t capacity_new = *capacity ? *capacity : 64 * 1024;
+    while (capacity_new < size)
+        capacity_new *= 2;
+    void *buffer_new = realloc(*buffer, capacity_new);
+    if (buffer_new == NULL) {
+        fprintf(stderr, "batch: could not allocate %zu bytes\n", capacity_new);
+        return false;
+    }
+    *buffer = buffer_new;
+    *capacity = capacity_new;
+    return true;
+}
+
+// a JSON string's contents: '"' and '\\' escaped, control characters as \\u00XX; truncated to fit, never mid-escape
+void __batch_escape(char *escaped, const size_t size, const char *value) {
+    size_t length = 0;
+    for (; *value; value++) {
+        const unsigned char c = (unsigned char)*value;
+        const size_t need = c < 0x20 ? 6 : c == '"' || c == '\\' ? 2 : 1;
+        if (length + need >= size)
+            break;
+        if (c < 0x20)
+            length += (size_t)snprintf(escaped + length, size - length, "\\u%04x", c);
+        else {
+            if (need == 2)
+                escaped[length++] = '\\';
+            escaped[length++] = (char)c;
+        }
+    }
+    escaped[length] = '\0';
+}
+
+void batch_reset(batch_t *batch) {
+    batch->size = 0;
+    batch->index_size = 0;
+    batch->count = 0;
+}
+
+void batch_end(batch_t *batch) {
+    free(batch->data);
+    free(batch->index);
+    memset(batch, 0, sizeof(*batch));
+}
+
+// data may be NULL (with size 0) to record only the metadata, which must be a JSON object
+bool batch_add(batch_t *batch, const unsigned char *data, const size_t size, const char *metadata) {
+    if (batch->count >= BATCH_FRAMES_MAX || size > UINT32_MAX)
+        return false;
+    const size_t offset = batch->count == 0 ? BATCH_HEADER_SIZE : batch->size, metadata_size = strlen(metadata);
+    if (!__batch_reserve((void **)&batch->data, &batch->capacity, offset + 4 + size) ||
+        !__batch_reserve((void **)&batch->index, &batch->index_capacity, batch->index_size + 1 + metadata_size))
+        return false;
+    __batch_put32(batch->data + offset, (uint32_t)size);
+    if (size > 0)
+        memcpy(batch->data + offset + 4, data, size);
+    batch->size = offset + 4 + size;
+    if (batch->count > 0)
+        batch->index[batch->index_size++] = ',';
+    memcpy(batch->index + batch->index_size, metadata, metadata_size);
+    batch->index_size += metadata_size;
+    batch->count++;
+    return true;
+}
+
+// completes the message in batch->data (batch->size bytes), valid until the next batch_reset
+bool batch_pack(batch_t *batch, const char *camera) {
+    if (batch->count == 0)
+        return false;
+    const size_t index_offset = batch->size;
+    char name[512];
+    __batch_escape(name, sizeof(name), camera);
+    const int prefix = snprintf(NULL, 0, "{\"camera\":\"%s\",\"frames\":[", name);
+    const size_t index_length = (size_t)prefix + batch->index_size + 2;
+    if (index_offset + index_length > UINT32_MAX ||
+        !__batch_reserve((void **)&batch->data, &batch->capacity, index_offset + index_length + 1))
+        return false;
+    unsigned char *p = batch->data;
+    memcpy(p, BATCH_MAGIC, 4);
+    p[4] = BATCH_VERSION;
+    p[5] = 0;
+    p[6] = (unsigned char)(batch->count >> 8);
+    p[7] = (unsigned char)batch->count;
+    __batch_put32(p + 8, (uint32_t)index_offset);
+    __batch_put32(p + 12, (uint32_t)index_length);
+    snprintf((char *)p + index_offset, (size_t)prefix + 1, "{\"camera\":\"%s\",\"frames\":[", name);
+    memcpy(p + index_offset + prefix, batch->index, batch->index_size);
+    memcpy(p + index_offset + prefix + batch->index_size, "]}", 2);
+    batch->size = index_offset + index_length;
+    return true;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// reading a container, for subscribers written in C (tools/batch_decode.py does the same in Python):
+//
+//   batch_view_t view;
+//   if (batch_decode(payload, size, &view))
+//       for (size_t offset = 0; batch_frame(&view, &offset, &frame, &frame_size);)
+//           ... frame i, described by entry i of view.index ...
+
+typedef struct {
+    int count;
+    const char *index; // not terminated
+    size_t index_size;
+    const unsigned char *frames;
+    size_t frames_size;
+} batch_view_t;
+
+bool batch_decode(const unsigned char *data, const size_t size, batch_view_t *view) {
+    memset(view, 0, sizeof(*view));
+    if (size < BATCH_HEADER_SIZE || memcmp(data, BATCH_MAGIC, 4) != 0 || data[4] != BATCH_VERSION)
+        return false;
+    const size_t index_offset = __batch_get32(data + 8), index_size = __batch_get32(data + 12);
+    if (index_offset < BATCH_HEADER_SIZE || index_offset > size || index_size > size - index_offset)
+        return false;
+    view->count = data[6] << 8 | data[7];
+    view->index = (const char *)data + index_offset;
+    view->index_size = index_size;
+    view->frames = data + BATCH_HEADER_SIZE;
+    view->frames_size = index_offset - BATCH_HEADER_SIZE;
+    return true;
+}
+
+// the frame at *offset (start from 0), advancing it; false after the last or on a truncated container
+bool batch_frame(const batch_view_t *view, size_t *offset, const unsigned char **data, size_t *size) {
+    if (*offset + 4 > view->frames_size)
+        return false;
+    const size_t length = __batch_get32(view->frames + *offset);
+    if (length > view->frames_size - *offset - 4)
+        return false;
+    *data = view->frames + *offset + 4;
+    *size = length;
+    *offset += 4 + length;
+    return true;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
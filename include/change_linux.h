@@ -0,0 +1,126 @@
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// change detection on the luma DC grid of each frame (see jpeg_luma_dc): the score is the percentage of 8x8 blocks
+// whose mean luma moved by more than 'delta' since the last published frame, so a person crossing a corner counts
+// while sensor noise and recompression do not; a frame is published when the score reaches the threshold or when
+// nothing has been published for 'silence' seconds
+
+typedef struct {
+    double threshold; // percent of blocks
+    int delta;        // luma levels
+    int silence;      // seconds
+} ChangeConfig;
+
+typedef struct {
+    ChangeConfig config;
+    unsigned char *reference, *current;
+    size_t reference_capacity, current_capacity;
+    int reference_width, reference_height, current_width, current_height;
+    bool reference_valid;
+    time_t published;
+    unsigned long publishes, skips;
+} change_t;
+
+typedef struct {
+    bool publish;
+    const char *reason; // first, changed, silence, unchanged, undecodable
+    double score;       // negative when not computed
+} change_result_t;
+
+// number of positions where |a - b| > delta
+size_t change_count(const unsigned char *a, const unsigned char *b, const size_t size, const unsigned char delta) {
+    size_t count = 0, i = 0;
+#if defined(__SSE2__)
+    const __m128i threshold = _mm_set1_epi8((char)delta), zero = _mm_setzero_si128();
+    for (; i + 16 <= size; i += 16) {
+        const __m128i x = _mm_loadu_si128((const __m128i *)(a + i)), y = _mm_loadu_si128((const __m128i *)(b + i));
+        const __m128i difference = _mm_or_si128(_mm_subs_epu8(x, y), _mm_subs_epu8(y, x));
+        const int within = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_subs_epu8(difference, threshold), zero));
+        count += 16 - (size_t)__builtin_popcount((unsigned int)within);
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    const uint8x16_t threshold = vdupq_n_u8(delta);
+    for (; i + 16 <= size; i += 16) {
+        const uint8x16_t over = vcgtq_u8(vabdq_u8(vld1q_u8(a + i), vld1q_u8(b + i)), threshold);
+        count += vaddvq_u8(vshrq_n_u8(over, 7));
+    }
+#endif
+    for (; i < size; i++)
+        count += (a[i] > b[i] ? a[i] - b[i] : b[i] - a[i]) > delta;
+    return count;
+}
+
+bool change_begin(change_t *change, const ChangeConfig *config) {
+    memset(change, 0, sizeof(*change));
+    change->config = *config;
+    return true;
+}
+
+void change_end(change_t *change) {
+    free(change->reference);
+    free(change->current);
+    change->reference = change->current = NULL;
+    change->reference_capacity = change->current_capacity = 0;
+}
+
+// decides whether the frame is published; published frames become the reference for the next decision
+change_result_t change_evaluate(change_t *change, const unsigned char *data, const size_t size, const time_t now) {
+    change_result_t result = {.publish = true, .reason = "first", .score = -1.0};
+    if (!jpeg_luma_dc(data, size, &change->current, &change->current_capacity, &change->current_width,
+                      &change->current_height)) {
+        result.reason = "undecodable";
+        change->publishes++;
+        return result;
+    }
+    if (change->reference_valid && change->reference_width == change->current_width &&
+        change->reference_height == change->current_height) {
+        const size_t blocks = (size_t)change->current_width * (size_t)change->current_height;
+        const size_t changed = change_count(change->reference, change->current, blocks,
+                                            (unsigned char)(change->config.delta < 0     ? 0
+                                                            : change->config.delta > 255 ? 255
+                                                                                         : change->config.delta));
+        result.score = blocks ? 100.0 * (double)changed / (double)blocks : 0.0;
+        if (result.score >= change->config.threshold)
+            result.reason = "changed";
+        else if (change->config.silence > 0 && now - change->published >= change->config.silence)
+            result.reason = "silence";
+        else {
+            result.publish = false;
+            result.reason = "unchanged";
+        }
+    }
+    if (result.publish) {
+        unsigned char *reference = change->reference;
+        const size_t reference_capacity = change->reference_capacity;
+        change->reference = change->current;
+        change->reference_capacity = change->current_capacity;
+        change->reference_width = change->current_width;
+        change->reference_height = change->current_height;
+        change->reference_valid = true;
+        change->current = reference;
+        change->current_capacity = reference_capacity;
+        change->published = now;
+        change->publishes++;
+    } else
+        change->skips++;
+    return result;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
@@ -4,109 +4,316 @@
 
 #include <ctype.h>
 #include <getopt.h>
+#include <stdint.h>
 
-#define CONFIG_MAX_STRING 255
 #ifndef CONFIG_MAX_ENTRIES
-#define CONFIG_MAX_ENTRIES 32
+#define CONFIG_MAX_ENTRIES 32 // initial size of the table, which grows as needed
 #endif
+#ifndef CONFIG_MAX_SECTIONS
+#define CONFIG_MAX_SECTIONS 64
+#endif
+
+// entries live in an open addressing hash table (FNV-1a, linear probing, at most three quarters full) and are never
+// removed from it: a key that disappears on reload keeps its slot with a NULL value. Every load is a generation, and
+// each entry records the one that last set or removed it, so config_changed tells what a reload touched. Values
+// that change or go away are retired rather than freed, so pointers from config_get_string (and section names) stay
+// valid until config_release, once the reload has been applied; lookups and reloads are for one thread, the main one
 
 typedef struct {
     char *key;
-    char *value;
+    char *value;              // NULL once removed by a reload
+    unsigned long generation; // of the load that last set or removed it
+    bool seen;                // during a load
 } config_entry_t;
 
-config_entry_t config_entries[CONFIG_MAX_ENTRIES];
-int config_entry_count = 0;
+config_entry_t *config_entries = NULL;
+int config_entry_capacity = 0, config_entry_count = 0;
+unsigned long config_generation = 0;
+
+char **config_retired = NULL;
+int config_retired_count = 0, config_retired_capacity = 0;
+
+// '[name]' lines in the file start a section, whose keys are stored as 'name.key'
+char *config_sections[CONFIG_MAX_SECTIONS];
+int config_section_count = 0;
+
+// what config_load was given, for config_reload
+char *config_file_path = NULL;
+int config_argc = 0;
+const char **config_argv = NULL;
+const struct option *config_options_long = NULL;
+
+uint32_t __config_hash(const char *key) {
+    uint32_t hash = 2166136261u;
+    while (*key)
+        hash = (hash ^ (unsigned char)*key++) * 16777619u;
+    return hash;
+}
+
+// the slot holding key, or the empty one where it would go
+config_entry_t *__config_slot(config_entry_t *entries, const int capacity, const char *key) {
+    const uint32_t mask = (uint32_t)capacity - 1;
+    for (uint32_t i = __config_hash(key) & mask;; i = (i + 1) & mask)
+        if (entries[i].key == NULL || strcmp(entries[i].key, key) == 0)
+            return &entries[i];
+}
+
+config_entry_t *__config_find(const char *key) {
+    if (config_entry_capacity == 0)
+        return NULL;
+    config_entry_t *entry = __config_slot(config_entries, config_entry_capacity, key);
+    return entry->key != NULL ? entry : NULL;
+}
+
+bool __config_grow(void) {
+    int capacity = config_entry_capacity ? config_entry_capacity * 2 : 16;
+    while (capacity < CONFIG_MAX_ENTRIES)
+        capacity *= 2;
+    config_entry_t *entries = calloc((size_t)capacity, sizeof(config_entry_t));
+    if (entries == NULL)
+        return false;
+    for (int i = 0; i < config_entry_capacity; i++)
+        if (config_entries[i].key != NULL)
+            *__config_slot(entries, capacity, config_entries[i].key) = config_entries[i];
+    free(config_entries);
+    config_entries = entries;
+    config_entry_capacity = capacity;
+    return true;
+}
+
+void __config_retire(char *value) {
+    if (value == NULL)
+        return;
+    if (config_retired_count == config_retired_capacity) {
+        const int capacity = config_retired_capacity ? config_retired_capacity * 2 : 16;
+        char **retired = realloc(config_retired, (size_t)capacity * sizeof(char *));
+        if (retired == NULL) {
+            fprintf(stderr, "config: could not retire value, keeping it\n");
+            return;
+        }
+        config_retired = retired;
+        config_retired_capacity = capacity;
+    }
+    config_retired[config_retired_count++] = value;
+}
 
 void __config_set_value(const char *key, const char *value) {
-    for (int i = 0; i < config_entry_count; i++)
-        if (strcmp(config_entries[i].key, key) == 0) {
-            free(config_entries[i].value);
-            config_entries[i].value = strdup(value);
+    config_entry_t *entry = __config_find(key);
+    if (entry == NULL) {
+        if ((config_entry_count + 1) * 4 > config_entry_capacity * 3 && !__config_grow()) {
+            fprintf(stderr, "config: could not grow table, ignoring %s=%s\n", key, value);
             return;
         }
-    if (config_entry_count < CONFIG_MAX_ENTRIES) {
-        config_entries[config_entry_count].key = strdup(key);
-        config_entries[config_entry_count].value = strdup(value);
+        entry = __config_slot(config_entries, config_entry_capacity, key);
+        *entry = (config_entry_t){.key = strdup(key), .value = strdup(value), .generation = config_generation};
         config_entry_count++;
-    } else
-        fprintf(stderr, "config: too many entries, ignoring %s=%s\n", key, value);
+    } else if (entry->value == NULL || strcmp(entry->value, value) != 0) {
+        __config_retire(entry->value);
+        entry->value = strdup(value);
+        entry->generation = config_generation;
+    }
+    entry->seen = true;
+}
+
+// true when the last load set, changed or removed key
+bool config_changed(const char *key) {
+    const config_entry_t *entry = __config_find(key);
+    return entry != NULL && entry->generation == config_generation;
 }
 
 const char *config_get_string(const char *key, const char *default_value) {
-    for (int i = 0; i < config_entry_count; i++)
-        if (strcmp(config_entries[i].key, key) == 0)
-            return config_entries[i].value;
-    return default_value;
+    const config_entry_t *entry = __config_find(key);
+    return entry != NULL && entry->value != NULL ? entry->value : default_value;
 }
 
 int config_get_integer(const char *key, const int default_value) {
-    for (int i = 0; i < config_entry_count; i++)
-        if (strcmp(config_entries[i].key, key) == 0) {
-            char *endptr;
-            const long val = strtol(config_entries[i].value, &endptr, 0);
-            if (*endptr == '\0')
-                return (int)val;
-            else {
-                fprintf(stderr, "config: invalid integer value '%s' for key '%s', using default\n",
-                        config_entries[i].value, key);
-                return default_value;
-            }
-        }
+    const char *value = config_get_string(key, NULL);
+    if (value == NULL)
+        return default_value;
+    char *endptr;
+    const long val = strtol(value, &endptr, 0);
+    if (*endptr == '\0')
+        return (int)val;
+    fprintf(stderr, "config: invalid integer value '%s' for key '%s', using default\n", value, key);
+    return default_value;
+}
+
+double config_get_double(const char *key, const double default_value) {
+    const char *value = config_get_string(key, NULL);
+    if (value == NULL)
+        return default_value;
+    char *endptr;
+    const double val = strtod(value, &endptr);
+    if (*endptr == '\0')
+        return val;
+    fprintf(stderr, "config: invalid number value '%s' for key '%s', using default\n", value, key);
     return default_value;
 }
 
 bool config_get_bool(const char *key, const bool default_value) {
-    for (int i = 0; i < config_entry_count; i++)
-        if (strcmp(config_entries[i].key, key) == 0) {
-            if (strcasecmp(config_entries[i].value, "true") == 0 || strcmp(config_entries[i].value, "1") == 0)
-                return true;
-            else if (strcasecmp(config_entries[i].value, "false") == 0 || strcmp(config_entries[i].value, "0") == 0)
-                return false;
-            fprintf(stderr, "config: invalid boolean value '%s' for key '%s', using default\n", config_entries[i].value,
-                    key);
-        }
+    const char *value = config_get_string(key, NULL);
+    if (value == NULL)
+        return default_value;
+    if (strcasecmp(value, "true") == 0 || strcmp(value, "1") == 0)
+        return true;
+    else if (strcasecmp(value, "false") == 0 || strcmp(value, "0") == 0)
+        return false;
+    fprintf(stderr, "config: invalid boolean value '%s' for key '%s', using default\n", value, key);
     return default_value;
 }
 
 bool is_empty_or_comment(const char *line) {
-    if (*line == '\0')
-        return true;
-    while ((*line == ' ' || *line == '\t') && *line != '\0')
-        if (*line++ == '#')
-            return true;
-    return false;
+    while (*line == ' ' || *line == '\t')
+        line++;
+    return *line == '\0' || *line == '\r' || *line == '\n' || *line == '#';
 }
 
-void __config_load_file(const char *filename) {
-    FILE *file = fopen(filename, "r");
-    if (file == NULL) {
-        fprintf(stderr, "config: could not load '%s'\n", filename);
+// into the list being built by a load, keeping the name already known (and pointed to) where there is one
+void __config_add_section(char **sections, int *count, const char *name) {
+    for (int i = 0; i < *count; i++)
+        if (strcmp(sections[i], name) == 0)
+            return;
+    if (*count == CONFIG_MAX_SECTIONS) {
+        fprintf(stderr, "config: too many sections, ignoring [%s]\n", name);
         return;
     }
-    char line[CONFIG_MAX_STRING];
-    while (fgets(line, sizeof(line), file)) {
+    for (int i = 0; i < config_section_count; i++)
+        if (config_sections[i] != NULL && strcmp(config_sections[i], name) == 0) {
+            sections[(*count)++] = config_sections[i];
+            config_sections[i] = NULL;
+            return;
+        }
+    sections[(*count)++] = strdup(name);
+}
+
+int config_get_sections(const char **names, const int max) {
+    int count = 0;
+    for (int i = 0; i < config_section_count && count < max; i++)
+        names[count++] = config_sections[i];
+    return count;
+}
+
+bool config_has_section(const char *name) {
+    for (int i = 0; i < config_section_count; i++)
+        if (strcmp(config_sections[i], name) == 0)
+            return true;
+    return false;
+}
+
+// section key lookups fall back to the global key of the same name, then to the default; neither is length limited
+const char *config_get_section_string(const char *section, const char *key, const char *default_value) {
+    char section_key[strlen(section) + 1 + strlen(key) + 1];
+    snprintf(section_key, sizeof(section_key), "%s.%s", section, key);
+    return config_get_string(section_key, config_get_string(key, default_value));
+}
+
+int config_get_section_integer(const char *section, const char *key, const int default_value) {
+    char section_key[strlen(section) + 1 + strlen(key) + 1];
+    snprintf(section_key, sizeof(section_key), "%s.%s", section, key);
+    return config_get_integer(section_key, config_get_integer(key, default_value));
+}
+
+double config_get_section_double(const char *section, const char *key, const double default_value) {
+    char section_key[strlen(section) + 1 + strlen(key) + 1];
+    snprintf(section_key, sizeof(section_key), "%s.%s", section, key);
+    return config_get_double(section_key, config_get_double(key, default_value));
+}
+
+bool config_get_section_bool(const char *section, const char *key, const bool default_value) {
+    char section_key[strlen(section) + 1 + strlen(key) + 1];
+    snprintf(section_key, sizeof(section_key), "%s.%s", section, key);
+    return config_get_bool(section_key, config_get_bool(key, default_value));
+}
+
+char *__config_trim(char *text) {
+    while (*text && isspace((unsigned char)*text))
+        text++;
+    char *end = text + strlen(text);
+    while (end > text && isspace((unsigned char)end[-1]))
+        *--end = '\0';
+    return text;
+}
+
+void __config_load_file(FILE *file, char **sections, int *section_count) {
+    char *line = NULL, *section = NULL, *section_key = NULL;
+    size_t line_capacity = 0, section_key_capacity = 0;
+    while (getline(&line, &line_capacity, file) != -1) {
         if (is_empty_or_comment(line))
             continue;
+        char *start = line;
+        while (*start && isspace((unsigned char)*start))
+            start++;
+        char *close = strchr(start, ']');
+        if (*start == '[' && close) {
+            *close = '\0';
+            free(section);
+            section = start[1] ? strdup(start + 1) : NULL;
+            if (section)
+                __config_add_section(sections, section_count, section);
+            continue;
+        }
         char *equals = strchr(line, '=');
         if (equals) {
             *equals = '\0';
-            char *key = line;
-            char *value = equals + 1;
-            while (*key && isspace(*key))
-                key++;
-            char *end = key + strlen(key) - 1;
-            while (end > key && isspace(*end))
-                *end-- = '\0';
-            while (*value && isspace(*value))
-                value++;
-            end = value + strlen(value) - 1;
-            while (end > value && isspace(*end))
-                *end-- = '\0';
-            __config_set_value(key, value);
+            const char *key = __config_trim(line), *value = __config_trim(equals + 1);
+            if (section) {
+                const size_t size = strlen(section) + 1 + strlen(key) + 1;
+                if (size > section_key_capacity) {
+                    char *section_key_new = realloc(section_key, size);
+                    if (section_key_new == NULL)
+                        continue;
+                    section_key = section_key_new;
+                    section_key_capacity = size;
+                }
+                snprintf(section_key, size, "%s.%s", section, key);
+                __config_set_value(section_key, value);
+            } else
+                __config_set_value(key, value);
         }
     }
-    fclose(file);
+    free(section_key);
+    free(section);
+    free(line);
+}
+
+// one generation: the file, then the command line over it; what neither gives any more is removed. A file that cannot
+// be opened changes nothing
+bool __config_load(const bool required) {
+    FILE *file = fopen(config_file_path, "r");
+    if (file == NULL) {
+        fprintf(stderr, "config: could not load '%s'\n", config_file_path);
+        if (required)
+            return false;
+    }
+    config_generation++;
+    for (int i = 0; i < config_entry_capacity; i++)
+        config_entries[i].seen = false;
+    char *sections[CONFIG_MAX_SECTIONS];
+    int section_count = 0;
+    if (file != NULL) {
+        __config_load_file(file, sections, &section_count);
+        fclose(file);
+    }
+    int c, option_index = 0;
+    optind = 0;
+    while ((c = getopt_long(config_argc, (char **)config_argv, "", config_options_long, &option_index)) != -1) {
+        if (c == 0)
+            if (strcmp(config_options_long[option_index].name, "config") != 0)
+                __config_set_value(config_options_long[option_index].name, optarg);
+    }
+    for (int i = 0; i < config_entry_capacity; i++) {
+        config_entry_t *entry = &config_entries[i];
+        if (entry->key != NULL && !entry->seen && entry->value != NULL) {
+            __config_retire(entry->value);
+            entry->value = NULL;
+            entry->generation = config_generation;
+        }
+    }
+    for (int i = 0; i < config_section_count; i++)
+        __config_retire(config_sections[i]); // those still present were taken over, and are NULL here
+    memcpy(config_sections, sections, sizeof(sections[0]) * (size_t)section_count);
+    config_section_count = section_count;
+    return true;
 }
 
 bool config_load(const char *config_file, const int argc, const char *argv[], const struct option *options_long) {
@@ -120,16 +327,55 @@ bool config_load(const char *config_file, const int argc, const char *argv[], co
                 break;
             }
     }
-    __config_load_file(config_file);
-    optind = 0;
-    while ((c = getopt_long(argc, (char **)argv, "", options_long, &option_index)) != -1) {
-        if (c == 0)
-            if (strcmp(options_long[option_index].name, "config") != 0)
-                __config_set_value(options_long[option_index].name, optarg);
-    }
-    printf("config: loaded from '%s' and command line\n", config_file);
+    config_file_path = strdup(config_file);
+    config_argc = argc;
+    config_argv = argv;
+    config_options_long = options_long;
+    if (config_file_path == NULL || !__config_load(false))
+        return false;
+    printf("config: loaded from '%s' and command line (entries=%d, sections=%d)\n", config_file, config_entry_count,
+           config_section_count);
     return true;
 }
 
+// reads the same file and command line again; false, with the config left as it was, when the file cannot be read
+bool config_reload(void) {
+    if (!__config_load(true))
+        return false;
+    printf("config: reloaded from '%s' (generation=%lu, entries=%d, sections=%d)\n", config_file_path,
+           config_generation, config_entry_count, config_section_count);
+    return true;
+}
+
+// frees what reloads retired, for when nothing taken from the config before the last reload is held any more
+void config_release(void) {
+    for (int i = 0; i < config_retired_count; i++)
+        free(config_retired[i]);
+    config_retired_count = 0;
+}
+
+const char *config_path(void) {
+    return config_file_path;
+}
+
+void config_end(void) {
+    for (int i = 0; i < config_entry_capacity; i++) {
+        free(config_entries[i].key);
+        free(config_entries[i].value);
+    }
+    free(config_entries);
+    config_entries = NULL;
+    config_entry_capacity = config_entry_count = 0;
+    config_release();
+    free(config_retired);
+    config_retired = NULL;
+    config_retired_count = config_retired_capacity = 0;
+    for (int i = 0; i < config_section_count; i++)
+        free(config_sections[i]);
+    config_section_count = 0;
+    free(config_file_path);
+    config_file_path = NULL;
+}
+
 // -----------------------------------------------------------------------------------------------------------------------------------------
 // -----------------------------------------------------------------------------------------------------------------------------------------
@@ -4,58 +4,255 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <string.h>
+#include <sys/syscall.h>
 #include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
+extern char **environ;
+
 // -----------------------------------------------------------------------------------------------------------------------------------------
 // -----------------------------------------------------------------------------------------------------------------------------------------
 
-size_t exec(const char *command, const char *const arguments[], unsigned char *data, const size_t size) {
+#define EXEC_KILL_GRACE 1000 // milliseconds between SIGTERM and SIGKILL
+
+// posix_spawn rather than fork, so a large multi-threaded parent is not copied, and with the signal mask cleared
+// (the parent blocks SIGINT/SIGTERM to read them from a signalfd, which the child would otherwise inherit)
+pid_t __exec_spawn(const char *command, const char *const arguments[], int *fd) {
     int pipefd[2];
-    if (pipe(pipefd) == -1) {
-        perror("pipe");
-        return 0;
+    if (pipe2(pipefd, O_CLOEXEC) == -1) {
+        perror("pipe2");
+        return -1;
     }
-    pid_t pid = fork();
-    if (pid == -1) { // Error
-        perror("fork");
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, pipefd[1], STDOUT_FILENO);
+    posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+    posix_spawnattr_t attributes;
+    posix_spawnattr_init(&attributes);
+    sigset_t mask;
+    sigemptyset(&mask);
+    posix_spawnattr_setsigmask(&attributes, &mask);
+    posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETSIGMASK);
+    pid_t pid;
+    const int result = posix_spawnp(&pid, command, &actions, &attributes, (char *const *)arguments, environ);
+    posix_spawnattr_destroy(&attributes);
+    posix_spawn_file_actions_destroy(&actions);
+    close(pipefd[1]);
+    if (result != 0) {
+        fprintf(stderr, "command (%s) could not be started (%s)\n", command, strerror(result));
         close(pipefd[0]);
-        close(pipefd[1]);
-        return 0;
+        return -1;
     }
-    if (pid == 0) { // Child process
-        close(pipefd[0]);
-        dup2(pipefd[1], STDOUT_FILENO);
-        const int devnull = open("/dev/null", O_WRONLY);
-        if (devnull >= 0) {
-            dup2(devnull, STDERR_FILENO);
-            close(devnull);
+    *fd = pipefd[0];
+    return pid;
+}
+
+// SIGTERM, then SIGKILL if the child has not gone after grace milliseconds; returns the exit status, -1 if killed
+int __exec_reap(const pid_t pid, const int grace) {
+    int status = 0;
+    kill(pid, SIGTERM);
+    for (int waited = 0; waitpid(pid, &status, WNOHANG) == 0; waited += 10) {
+        if (waited >= grace) {
+            kill(pid, SIGKILL);
+            waitpid(pid, &status, 0);
+            break;
         }
-        close(pipefd[1]);
-        execvp(command, (char *const *)arguments);
-        perror("execvp");
-        exit(EXIT_FAILURE);
+        const struct timespec pause = {.tv_sec = 0, .tv_nsec = 10000000L};
+        nanosleep(&pause, NULL);
     }
-    // Parent process
-    close(pipefd[1]);
-    size_t total_bytes = 0;
-    ssize_t bytes_read;
-    while ((bytes_read = read(pipefd[0], data + total_bytes, size - total_bytes)) > 0) {
-        total_bytes += bytes_read;
-        if (total_bytes >= size) {
-            fprintf(stderr, "command (%s) data too large for buffer\n", command);
-            total_bytes = 0;
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+// makes room for at least one more byte, doubling up to limit (0 for none)
+bool __exec_reserve(const char *command, unsigned char **data, size_t *capacity, const size_t size,
+                    const size_t limit) {
+    if (size < *capacity)
+        return true;
+    if (limit && *capacity >= limit) {
+        fprintf(stderr, "command (%s) data exceeds limit (%zu bytes)\n", command, limit);
+        return false;
+    }
+    size_t capacity_new = *capacity ? *capacity * 2 : 64 * 1024;
+    if (limit && capacity_new > limit)
+        capacity_new = limit;
+    unsigned char *data_new = realloc(*data, capacity_new);
+    if (data_new == NULL) {
+        fprintf(stderr, "command (%s) data could not be buffered (%zu bytes)\n", command, capacity_new);
+        return false;
+    }
+    *data = data_new;
+    *capacity = capacity_new;
+    return true;
+}
+
+// CLOCK_MONOTONIC times of a run: child forked, first byte of output, output complete (zero if not reached)
+typedef struct {
+    struct timespec spawned, first_byte, completed;
+} exec_timing_t;
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// runs a command to completion without blocking, for an event loop: the caller watches fd (output, non-blocking) and
+// pidfd (readable once the child exits; -1 where pidfd_open is unavailable, the caller then polls exec_async_reap)
+// and calls exec_async_read and exec_async_reap as they become ready, which tolerate spurious wakeups; the run is over
+// once both report done, and exec_async_kill is how a deadline is enforced
+
+typedef struct {
+    const char *command;
+    pid_t pid;
+    int fd, pidfd;
+    bool eof, exited, killed;
+    int status;
+    size_t size;
+    exec_timing_t timing;
+} exec_async_t;
+
+bool exec_async_begin(exec_async_t *run, const char *command, const char *const arguments[]) {
+    memset(run, 0, sizeof(*run));
+    run->command = command;
+    run->fd = run->pidfd = -1;
+    if ((run->pid = __exec_spawn(command, arguments, &run->fd)) == -1)
+        return false;
+    clock_gettime(CLOCK_MONOTONIC, &run->timing.spawned);
+    fcntl(run->fd, F_SETFL, fcntl(run->fd, F_GETFL) | O_NONBLOCK);
+#ifdef SYS_pidfd_open
+    run->pidfd = (int)syscall(SYS_pidfd_open, run->pid, 0);
+    if (run->pidfd >= 0)
+        fcntl(run->pidfd, F_SETFD, FD_CLOEXEC);
+#endif
+    return true;
+}
+
+// reads what is available into *data; true while more may come, false at end of output or when over the limit (the
+// run is then killed)
+bool exec_async_read(exec_async_t *run, unsigned char **data, size_t *capacity, const size_t limit) {
+    while (!run->eof) {
+        if (!__exec_reserve(run->command, data, capacity, run->size, limit)) {
+            run->size = 0;
+            kill(run->pid, SIGKILL);
+            run->eof = run->killed = true;
             break;
         }
+        const ssize_t bytes_read = read(run->fd, *data + run->size, *capacity - run->size);
+        if (bytes_read > 0) {
+            if (run->size == 0)
+                clock_gettime(CLOCK_MONOTONIC, &run->timing.first_byte);
+            run->size += (size_t)bytes_read;
+        } else if (bytes_read == 0 || (errno != EINTR && errno != EAGAIN)) {
+            if (run->size > 0)
+                clock_gettime(CLOCK_MONOTONIC, &run->timing.completed);
+            run->eof = true;
+        } else if (errno == EAGAIN)
+            return true;
     }
-    close(pipefd[0]);
-    int status;
-    waitpid(pid, &status, 0);
-    if (WIFEXITED(status) && WEXITSTATUS(status) != 0) {
-        fprintf(stderr, "command (%s) exited with status %d\n", command, WEXITSTATUS(status));
+    return false;
+}
+
+// true once the child has exited and its status is collected
+bool exec_async_reap(exec_async_t *run) {
+    if (!run->exited && waitpid(run->pid, &run->status, WNOHANG) == run->pid)
+        run->exited = true;
+    return run->exited;
+}
+
+// a killed child may have left the pipe open to its own children, so its exit is enough
+bool exec_async_done(const exec_async_t *run) {
+    return run->exited && (run->eof || run->killed);
+}
+
+// the output, or 0 when the child failed, was killed or exceeded the limit
+size_t exec_async_result(const exec_async_t *run) {
+    if (run->killed || !WIFEXITED(run->status) || WEXITSTATUS(run->status) != 0)
         return 0;
+    return run->size;
+}
+
+void exec_async_kill(exec_async_t *run) {
+    if (run->pid > 0 && !run->exited) {
+        kill(run->pid, SIGKILL);
+        run->killed = true;
     }
-    return total_bytes;
+}
+
+// closes the descriptors, and kills and reaps the child when it is still there
+void exec_async_end(exec_async_t *run) {
+    if (run->fd >= 0)
+        close(run->fd);
+    if (run->pidfd >= 0)
+        close(run->pidfd);
+    run->fd = run->pidfd = -1;
+    if (run->pid > 0 && !run->exited) {
+        kill(run->pid, SIGKILL);
+        waitpid(run->pid, &run->status, 0);
+        run->exited = true;
+    }
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// long-lived child whose stdout is consumed incrementally (e.g. ffmpeg emitting a continuous image2pipe stream)
+
+typedef struct {
+    const char *command;
+    pid_t pid;
+    int fd;
+} exec_stream_t;
+
+bool exec_stream_begin(exec_stream_t *stream, const char *command, const char *const arguments[]) {
+    stream->command = command;
+    stream->pid = __exec_spawn(command, arguments, &stream->fd);
+    if (stream->pid == -1) {
+        stream->fd = -1;
+        return false;
+    }
+    return true;
+}
+
+// waits at most timeout seconds (0 for no limit) for output, -1 with errno ETIMEDOUT when none came
+ssize_t exec_stream_read(exec_stream_t *stream, unsigned char *data, const size_t size, const int timeout) {
+    if (timeout > 0) {
+        struct pollfd pfd = {.fd = stream->fd, .events = POLLIN};
+        int result;
+        while ((result = poll(&pfd, 1, timeout * 1000)) == -1 && errno == EINTR)
+            ;
+        if (result == 0) {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+    }
+    ssize_t bytes_read;
+    while ((bytes_read = read(stream->fd, data, size)) == -1 && errno == EINTR)
+        ;
+    return bytes_read;
+}
+
+void exec_stream_stop(exec_stream_t *stream) {
+    if (stream->pid > 0)
+        kill(stream->pid, SIGTERM);
+}
+
+// closes the pipe and takes the child out of the stream, to be reaped with exec_stream_reap outside any lock the
+// stream is guarded by
+pid_t exec_stream_detach(exec_stream_t *stream) {
+    const pid_t pid = stream->pid;
+    if (stream->fd >= 0) {
+        close(stream->fd);
+        stream->fd = -1;
+    }
+    stream->pid = -1;
+    return pid;
+}
+
+// a child that ignores SIGTERM (ffmpeg stuck on the network) is killed after EXEC_KILL_GRACE; -1 without one
+int exec_stream_reap(const pid_t pid) {
+    return pid > 0 ? __exec_reap(pid, EXEC_KILL_GRACE) : -1;
 }
 
 // -----------------------------------------------------------------------------------------------------------------------------------------
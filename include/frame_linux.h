@@ -0,0 +1,164 @@
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// refcounted frame buffers recycled through a per-source pool: new buffers are sized from the recent frame size
+// distribution (95th percentile plus headroom) and grow on demand up to the pool limit, so a frame is filled once and
+// then handed by reference to whoever publishes it
+
+#define FRAME_POOL_FREE_MAX 8
+#define FRAME_POOL_SAMPLES 64
+#define FRAME_POOL_GRANULE (64 * 1024)
+
+typedef struct frame_pool frame_pool_t;
+
+typedef struct {
+    unsigned char *data;
+    size_t size, capacity;
+    int width, height; // of raw (planar, not yet encoded) frames, 0 for JPEG
+    struct timespec time;
+    atomic_int references;
+    frame_pool_t *pool;
+} frame_t;
+
+struct frame_pool {
+    pthread_mutex_t mutex;
+    frame_t *free[FRAME_POOL_FREE_MAX];
+    int free_count;
+    size_t capacity, limit;
+    size_t samples[FRAME_POOL_SAMPLES];
+    int samples_count, samples_index;
+    unsigned long allocated, reused, grown, released;
+};
+
+bool frame_pool_begin(frame_pool_t *pool, const size_t capacity, const size_t limit) {
+    memset(pool, 0, sizeof(*pool));
+    pool->capacity = capacity;
+    pool->limit = limit;
+    return pthread_mutex_init(&pool->mutex, NULL) == 0;
+}
+
+void frame_pool_end(frame_pool_t *pool) {
+    for (int i = 0; i < pool->free_count; i++) {
+        free(pool->free[i]->data);
+        free(pool->free[i]);
+    }
+    pool->free_count = 0;
+    pthread_mutex_destroy(&pool->mutex);
+}
+
+int __frame_size_compare(const void *a, const void *b) {
+    const size_t x = *(const size_t *)a, y = *(const size_t *)b;
+    return (x > y) - (x < y);
+}
+
+void __frame_pool_sample(frame_pool_t *pool, const size_t size) {
+    pool->samples[pool->samples_index] = size;
+    pool->samples_index = (pool->samples_index + 1) % FRAME_POOL_SAMPLES;
+    if (pool->samples_count < FRAME_POOL_SAMPLES)
+        pool->samples_count++;
+    if (pool->samples_index % (FRAME_POOL_SAMPLES / 4) != 0)
+        return;
+    size_t sorted[FRAME_POOL_SAMPLES];
+    memcpy(sorted, pool->samples, sizeof(size_t) * (size_t)pool->samples_count);
+    qsort(sorted, (size_t)pool->samples_count, sizeof(size_t), __frame_size_compare);
+    const size_t p95 = sorted[(pool->samples_count * 95) / 100 < pool->samples_count ? (pool->samples_count * 95) / 100
+                                                                                     : pool->samples_count - 1];
+    size_t capacity = ((p95 + p95 / 8) / FRAME_POOL_GRANULE + 1) * FRAME_POOL_GRANULE;
+    if (pool->limit && capacity > pool->limit)
+        capacity = pool->limit;
+    pool->capacity = capacity;
+}
+
+frame_t *frame_alloc(frame_pool_t *pool) {
+    frame_t *frame = NULL;
+    pthread_mutex_lock(&pool->mutex);
+    if (pool->free_count > 0) {
+        frame = pool->free[--pool->free_count];
+        pool->reused++;
+    }
+    const size_t capacity = pool->capacity;
+    pthread_mutex_unlock(&pool->mutex);
+    if (frame == NULL) {
+        if ((frame = calloc(1, sizeof(frame_t))) == NULL)
+            return NULL;
+        if ((frame->data = malloc(capacity)) == NULL) {
+            free(frame);
+            return NULL;
+        }
+        frame->capacity = capacity;
+        frame->pool = pool;
+        pthread_mutex_lock(&pool->mutex);
+        pool->allocated++;
+        pthread_mutex_unlock(&pool->mutex);
+    }
+    frame->size = 0;
+    frame->width = frame->height = 0;
+    clock_gettime(CLOCK_REALTIME, &frame->time);
+    atomic_store(&frame->references, 1);
+    return frame;
+}
+
+// ensures room for size bytes, growing (doubling) the buffer rather than dropping oversize frames
+bool frame_reserve(frame_t *frame, const size_t size) {
+    if (size <= frame->capacity)
+        return true;
+    const size_t limit = frame->pool->limit;
+    if (limit && size > limit) {
+        fprintf(stderr, "frame: size %zu exceeds limit %zu\n", size, limit);
+        return false;
+    }
+    size_t capacity = frame->capacity ? frame->capacity : FRAME_POOL_GRANULE;
+    while (capacity < size)
+        capacity *= 2;
+    if (limit && capacity > limit)
+        capacity = limit;
+    unsigned char *data = realloc(frame->data, capacity);
+    if (data == NULL)
+        return false;
+    frame->data = data;
+    frame->capacity = capacity;
+    pthread_mutex_lock(&frame->pool->mutex);
+    frame->pool->grown++;
+    pthread_mutex_unlock(&frame->pool->mutex);
+    return true;
+}
+
+frame_t *frame_ref(frame_t *frame) {
+    atomic_fetch_add(&frame->references, 1);
+    return frame;
+}
+
+void frame_unref(frame_t *frame) {
+    if (frame == NULL || atomic_fetch_sub(&frame->references, 1) != 1)
+        return;
+    frame_pool_t *pool = frame->pool;
+    pthread_mutex_lock(&pool->mutex);
+    if (frame->size > 0)
+        __frame_pool_sample(pool, frame->size);
+    // keep the buffer unless the pool is full or it is far larger than frames currently need
+    const bool keep = pool->free_count < FRAME_POOL_FREE_MAX && frame->capacity <= pool->capacity * 2;
+    if (keep)
+        pool->free[pool->free_count++] = frame;
+    else
+        pool->released++;
+    pthread_mutex_unlock(&pool->mutex);
+    if (!keep) {
+        free(frame->data);
+        free(frame);
+    }
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
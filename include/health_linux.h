@@ -0,0 +1,92 @@
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// a circuit breaker over the outcomes of attempts at something that can go away (a camera): the first failure makes
+// it degraded, the limit in a row down (the breaker open), a success healthy again; every failure draws the time of the
+// next retry from a backoff that doubles from min to max, half of it fixed and half random so that things that failed
+// together do not come back together, and a success resets it. The outcomes come from one thread at a time, the state,
+// failures and retry may be read from any
+
+typedef enum { HEALTH_HEALTHY, HEALTH_DEGRADED, HEALTH_DOWN } health_state_t;
+
+const char *health_state_names[] = {"healthy", "degraded", "down"};
+
+typedef struct {
+    int limit;                        // failures in a row that make it down, 0 never
+    int64_t backoff_min, backoff_max; // nanoseconds
+    int64_t backoff;                  // the next one
+    unsigned int seed;                // rand_r
+    atomic_int state, failures;       // failures in a row
+    _Atomic int64_t retry, since;     // as the times given, of the next retry and the last change of state
+    atomic_bool known;                // any outcome yet
+    atomic_ulong trips;               // times it went down
+} health_t;
+
+void health_begin(health_t *health, const int limit, const int64_t backoff_min, const int64_t backoff_max,
+                  const unsigned int seed) {
+    health->limit = limit < 0 ? 0 : limit;
+    health->backoff_min = backoff_min > 0 ? backoff_min : 1;
+    health->backoff_max = backoff_max > health->backoff_min ? backoff_max : health->backoff_min;
+    health->backoff = health->backoff_min;
+    health->seed = seed;
+    atomic_init(&health->state, HEALTH_HEALTHY);
+    atomic_init(&health->failures, 0);
+    atomic_init(&health->retry, 0);
+    atomic_init(&health->since, 0);
+    atomic_init(&health->known, false);
+    atomic_init(&health->trips, 0);
+}
+
+bool __health_state(health_t *health, const health_state_t state, const int64_t now) {
+    const bool first = !atomic_exchange(&health->known, true);
+    const bool changed = atomic_exchange(&health->state, (int)state) != (int)state;
+    if (first || changed)
+        atomic_store(&health->since, now);
+    if (changed && state == HEALTH_DOWN)
+        atomic_fetch_add(&health->trips, 1);
+    return first || changed;
+}
+
+// true when the state changed, or was first known
+bool health_success(health_t *health, const int64_t now) {
+    atomic_store(&health->failures, 0);
+    health->backoff = health->backoff_min;
+    return __health_state(health, HEALTH_HEALTHY, now);
+}
+
+// true when the state changed, or was first known; the next retry is due at health_retry
+bool health_failure(health_t *health, const int64_t now) {
+    const int failures = atomic_fetch_add(&health->failures, 1) + 1;
+    const int64_t half = health->backoff / 2;
+    atomic_store(&health->retry,
+                 now + half + (int64_t)((double)rand_r(&health->seed) / RAND_MAX * (double)(health->backoff - half)));
+    health->backoff = health->backoff > health->backoff_max / 2 ? health->backoff_max : health->backoff * 2;
+    return __health_state(health, health->limit > 0 && failures >= health->limit ? HEALTH_DOWN : HEALTH_DEGRADED,
+                          now);
+}
+
+health_state_t health_state(const health_t *health) {
+    return (health_state_t)atomic_load(&health->state);
+}
+
+int64_t health_retry(const health_t *health) {
+    return atomic_load(&health->retry);
+}
+
+// whether an attempt may be made: while not down, or once the retry is due (half-open: the outcome of that attempt
+// closes the breaker or opens it again for a longer while)
+bool health_due(const health_t *health, const int64_t now) {
+    return health_state(health) != HEALTH_DOWN || now >= health_retry(health);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
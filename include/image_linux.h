@@ -0,0 +1,372 @@
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef IMAGE_LIBJPEG
+#include <jpeglib.h>
+#include <jerror.h>
+#include <setjmp.h>
+#endif
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// interleaved 8-bit images (YCbCr straight out of the JPEG decoder, so no colour conversion either way) and an
+// area-averaging downscaler: the vertical pass is a weighted sum of whole rows (plain loops that compilers vectorise)
+// and the horizontal pass runs on the already reduced rows; weights are exact pixel coverage in fixed point
+
+typedef struct {
+    unsigned char *pixels;
+    size_t capacity;
+    int width, height, components;
+} image_t;
+
+typedef struct {
+    int *start, *count;
+    uint16_t *weights; // per output position, count entries summing to 1 << IMAGE_WEIGHT_BITS
+    int *offset;
+} __image_axis_t;
+
+#define IMAGE_WEIGHT_BITS 14
+
+bool image_reserve(image_t *image, const int width, const int height, const int components) {
+    const size_t size = (size_t)width * (size_t)height * (size_t)components;
+    if (size > image->capacity) {
+        unsigned char *pixels = realloc(image->pixels, size);
+        if (pixels == NULL)
+            return false;
+        image->pixels = pixels;
+        image->capacity = size;
+    }
+    image->width = width;
+    image->height = height;
+    image->components = components;
+    return true;
+}
+
+void image_end(image_t *image) {
+    free(image->pixels);
+    memset(image, 0, sizeof(*image));
+}
+
+void __image_axis_end(__image_axis_t *axis) {
+    free(axis->start);
+    free(axis->count);
+    free(axis->offset);
+    free(axis->weights);
+}
+
+// coverage of each source pixel by each destination pixel, in fixed point, rounding error folded into the largest
+bool __image_axis_begin(__image_axis_t *axis, const int source, const int destination) {
+    const int span = (source + destination - 1) / destination + 1;
+    axis->start = malloc(sizeof(int) * (size_t)destination);
+    axis->count = malloc(sizeof(int) * (size_t)destination);
+    axis->offset = malloc(sizeof(int) * (size_t)destination);
+    axis->weights = malloc(sizeof(uint16_t) * (size_t)destination * (size_t)span);
+    if (!axis->start || !axis->count || !axis->offset || !axis->weights) {
+        __image_axis_end(axis);
+        return false;
+    }
+    int offset = 0;
+    for (int d = 0; d < destination; d++) {
+        // destination pixel d covers [d * source / destination, (d + 1) * source / destination) in source pixels,
+        // kept exact by working in units of 1 / destination
+        const long begin = (long)d * source, end = (long)(d + 1) * source;
+        const int first = (int)(begin / destination), last = (int)((end - 1) / destination);
+        axis->start[d] = first;
+        axis->count[d] = last - first + 1;
+        axis->offset[d] = offset;
+        int total = 0, largest = 0;
+        for (int s = first; s <= last; s++) {
+            const long covered_begin = (long)s * destination > begin ? (long)s * destination : begin;
+            const long covered_end = (long)(s + 1) * destination < end ? (long)(s + 1) * destination : end;
+            const int weight = (int)(((covered_end - covered_begin) << IMAGE_WEIGHT_BITS) / source);
+            axis->weights[offset + s - first] = (uint16_t)weight;
+            total += weight;
+            if (weight > axis->weights[offset + largest])
+                largest = s - first;
+        }
+        uint16_t *weight_largest = &axis->weights[offset + largest];
+        *weight_largest = (uint16_t)(*weight_largest + (1 << IMAGE_WEIGHT_BITS) - total);
+        offset += axis->count[d];
+    }
+    return true;
+}
+
+// area-averaging downscale (destination no larger than source in either axis)
+bool image_scale(const image_t *source, image_t *destination, const int width, const int height) {
+    if (width < 1 || height < 1 || width > source->width || height > source->height ||
+        !image_reserve(destination, width, height, source->components))
+        return false;
+    const int components = source->components, row_size = source->width * components;
+    __image_axis_t horizontal, vertical;
+    if (!__image_axis_begin(&horizontal, source->width, width))
+        return false;
+    if (!__image_axis_begin(&vertical, source->height, height)) {
+        __image_axis_end(&horizontal);
+        return false;
+    }
+    uint32_t *accumulator = malloc(sizeof(uint32_t) * (size_t)row_size);
+    uint16_t *row = malloc(sizeof(uint16_t) * (size_t)row_size);
+    if (accumulator == NULL || row == NULL) {
+        free(accumulator);
+        free(row);
+        __image_axis_end(&vertical);
+        __image_axis_end(&horizontal);
+        return false;
+    }
+    for (int y = 0; y < height; y++) {
+        // vertical: weighted sum of source rows, 8 fractional bits kept for the horizontal pass
+        memset(accumulator, 0, sizeof(uint32_t) * (size_t)row_size);
+        for (int i = 0; i < vertical.count[y]; i++) {
+            const unsigned char *source_row = source->pixels + (size_t)(vertical.start[y] + i) * (size_t)row_size;
+            const uint32_t weight = vertical.weights[vertical.offset[y] + i];
+            for (int x = 0; x < row_size; x++)
+                accumulator[x] += source_row[x] * weight;
+        }
+        for (int x = 0; x < row_size; x++)
+            row[x] = (uint16_t)((accumulator[x] + (1 << (IMAGE_WEIGHT_BITS - 9))) >> (IMAGE_WEIGHT_BITS - 8));
+        // horizontal
+        unsigned char *destination_row = destination->pixels + (size_t)y * (size_t)width * (size_t)components;
+        for (int x = 0; x < width; x++) {
+            const uint16_t *weights = horizontal.weights + horizontal.offset[x];
+            const uint16_t *source_pixel = row + (size_t)horizontal.start[x] * (size_t)components;
+            for (int c = 0; c < components; c++) {
+                uint32_t sum = 0;
+                for (int i = 0; i < horizontal.count[x]; i++)
+                    sum += (uint32_t)source_pixel[i * components + c] * weights[i];
+                const uint32_t value = (sum + (1U << (IMAGE_WEIGHT_BITS + 7))) >> (IMAGE_WEIGHT_BITS + 8);
+                destination_row[x * components + c] = (unsigned char)(value > 255 ? 255 : value);
+            }
+        }
+    }
+    free(row);
+    free(accumulator);
+    __image_axis_end(&vertical);
+    __image_axis_end(&horizontal);
+    return true;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+#ifdef IMAGE_LIBJPEG
+
+typedef struct {
+    struct jpeg_error_mgr manager;
+    jmp_buf jump;
+} __image_error_t;
+
+void __image_error_exit(j_common_ptr info) {
+    longjmp(((__image_error_t *)info->err)->jump, 1);
+}
+
+void __image_error_output(j_common_ptr info __attribute__((unused))) {}
+
+// decodes to YCbCr, letting the decoder's DCT scaling (1/2, 1/4, 1/8) do the first reduction whenever the result is
+// still at least width_minimum wide
+bool image_decode(image_t *image, const unsigned char *data, const size_t size, const int width_minimum) {
+    struct jpeg_decompress_struct info;
+    __image_error_t error;
+    info.err = jpeg_std_error(&error.manager);
+    error.manager.error_exit = __image_error_exit;
+    error.manager.output_message = __image_error_output;
+    if (setjmp(error.jump)) {
+        jpeg_destroy_decompress(&info);
+        return false;
+    }
+    jpeg_create_decompress(&info);
+    jpeg_mem_src(&info, (unsigned char *)data, (unsigned long)size);
+    if (jpeg_read_header(&info, TRUE) != JPEG_HEADER_OK) {
+        jpeg_destroy_decompress(&info);
+        return false;
+    }
+    unsigned int denominator = 1;
+    while (denominator < 8 && (int)((info.image_width + denominator * 2 - 1) / (denominator * 2)) >= width_minimum)
+        denominator *= 2;
+    info.scale_num = 1;
+    info.scale_denom = denominator;
+    info.out_color_space = info.num_components == 1 ? JCS_GRAYSCALE : JCS_YCbCr;
+    info.dct_method = JDCT_ISLOW;
+    jpeg_start_decompress(&info);
+    if (!image_reserve(image, (int)info.output_width, (int)info.output_height, info.output_components)) {
+        jpeg_destroy_decompress(&info);
+        return false;
+    }
+    const size_t stride = (size_t)image->width * (size_t)image->components;
+    while (info.output_scanline < info.output_height) {
+        JSAMPROW row = image->pixels + info.output_scanline * stride;
+        jpeg_read_scanlines(&info, &row, 1);
+    }
+    jpeg_finish_decompress(&info);
+    jpeg_destroy_decompress(&info);
+    return true;
+}
+
+// compressed output goes to a caller supplied buffer that is grown on demand (realloc), *size is the JPEG length
+
+typedef struct {
+    struct jpeg_destination_mgr manager;
+    unsigned char **data;
+    size_t *capacity;
+    bool failed;
+} __image_destination_t;
+
+boolean __image_destination_empty(j_compress_ptr info) {
+    __image_destination_t *destination = (__image_destination_t *)info->dest;
+    const size_t used = *destination->capacity, capacity = used ? used * 2 : 64 * 1024;
+    unsigned char *data = realloc(*destination->data, capacity);
+    if (data == NULL) {
+        destination->failed = true;
+        ERREXIT(info, JERR_OUT_OF_MEMORY);
+    }
+    *destination->data = data;
+    *destination->capacity = capacity;
+    destination->manager.next_output_byte = data + used;
+    destination->manager.free_in_buffer = capacity - used;
+    return TRUE;
+}
+
+void __image_destination_init(j_compress_ptr info) {
+    __image_destination_t *destination = (__image_destination_t *)info->dest;
+    destination->manager.next_output_byte = *destination->data;
+    destination->manager.free_in_buffer = *destination->capacity;
+    if (*destination->capacity == 0) // libjpeg stores a byte before it checks for room
+        __image_destination_empty(info);
+}
+
+void __image_destination_term(j_compress_ptr info __attribute__((unused))) {}
+
+// a compressor kept from frame to frame, by one thread at a time (e.g. one per worker): set up once, so encoding
+// allocates nothing beyond growing the output buffer (the caller's, e.g. a pooled frame's, kept between frames too)
+typedef struct {
+    struct jpeg_compress_struct info;
+    __image_error_t error;
+    __image_destination_t destination;
+    unsigned char *padded; // rows widened to whole blocks, for planes not a whole number of blocks wide
+    size_t padded_capacity;
+    bool active;
+} image_encoder_t;
+
+bool image_encoder_begin(image_encoder_t *encoder) {
+    memset(encoder, 0, sizeof(*encoder));
+    encoder->info.err = jpeg_std_error(&encoder->error.manager);
+    encoder->error.manager.error_exit = __image_error_exit;
+    encoder->error.manager.output_message = __image_error_output;
+    if (setjmp(encoder->error.jump))
+        return false;
+    jpeg_create_compress(&encoder->info);
+    encoder->destination.manager.init_destination = __image_destination_init;
+    encoder->destination.manager.empty_output_buffer = __image_destination_empty;
+    encoder->destination.manager.term_destination = __image_destination_term;
+    encoder->info.dest = &encoder->destination.manager;
+    encoder->active = true;
+    return true;
+}
+
+void image_encoder_end(image_encoder_t *encoder) {
+    if (encoder->active)
+        jpeg_destroy_compress(&encoder->info);
+    free(encoder->padded);
+    memset(encoder, 0, sizeof(*encoder));
+}
+
+void __image_encoder_setup(image_encoder_t *encoder, const int width, const int height, const int components,
+                           const int quality, unsigned char **data, size_t *capacity) {
+    j_compress_ptr info = &encoder->info;
+    encoder->destination.data = data;
+    encoder->destination.capacity = capacity;
+    encoder->destination.failed = false;
+    info->image_width = (JDIMENSION)width;
+    info->image_height = (JDIMENSION)height;
+    info->input_components = components;
+    info->in_color_space = components == 1 ? JCS_GRAYSCALE : JCS_YCbCr;
+    jpeg_set_defaults(info); // YCbCr comes out 4:2:0
+    jpeg_set_quality(info, quality, TRUE);
+    info->dct_method = JDCT_ISLOW;
+}
+
+bool image_encode(image_encoder_t *encoder, const image_t *image, const int quality, unsigned char **data,
+                  size_t *capacity, size_t *size) {
+    j_compress_ptr info = &encoder->info;
+    if (setjmp(encoder->error.jump)) {
+        jpeg_abort_compress(info);
+        return false;
+    }
+    __image_encoder_setup(encoder, image->width, image->height, image->components, quality, data, capacity);
+    jpeg_start_compress(info, TRUE);
+    const size_t stride = (size_t)image->width * (size_t)image->components;
+    while (info->next_scanline < info->image_height) {
+        JSAMPROW row = image->pixels + info->next_scanline * stride;
+        jpeg_write_scanlines(info, &row, 1);
+    }
+    jpeg_finish_compress(info);
+    *size = *capacity - encoder->destination.manager.free_in_buffer;
+    return true;
+}
+
+// planar 4:2:0 (I420: the Y plane, then Cb and Cr at half width and height, rounded up; e.g. ffmpeg's yuvj420p) goes
+// in as raw data, so neither colour conversion nor downsampling runs, only the (SIMD, in libjpeg-turbo) DCT and
+// entropy coding; the encoder reads whole 16 line blocks, so rows past the bottom repeat the last one, and rows
+// narrower than their blocks are copied out padded with their last pixel
+bool image_encode_planar(image_encoder_t *encoder, const unsigned char *planes, const int width, const int height,
+                         const int quality, unsigned char **data, size_t *capacity, size_t *size) {
+    j_compress_ptr info = &encoder->info;
+    const int chroma_width = (width + 1) / 2, chroma_height = (height + 1) / 2;
+    const unsigned char *plane[3] = {planes, planes + (size_t)width * (size_t)height,
+                                     planes + (size_t)width * (size_t)height +
+                                         (size_t)chroma_width * (size_t)chroma_height};
+    const int plane_width[3] = {width, chroma_width, chroma_width},
+              plane_height[3] = {height, chroma_height, chroma_height};
+    const size_t padded_stride = (size_t)(width + 15) / 16 * 16;
+    if (encoder->padded_capacity < padded_stride * 4 * DCTSIZE) {
+        unsigned char *padded = realloc(encoder->padded, padded_stride * 4 * DCTSIZE);
+        if (padded == NULL)
+            return false;
+        encoder->padded = padded;
+        encoder->padded_capacity = padded_stride * 4 * DCTSIZE;
+    }
+    if (setjmp(encoder->error.jump)) {
+        jpeg_abort_compress(info);
+        return false;
+    }
+    __image_encoder_setup(encoder, width, height, 3, quality, data, capacity);
+    info->raw_data_in = TRUE;
+    jpeg_start_compress(info, TRUE);
+    JSAMPROW rows[3][2 * DCTSIZE];
+    JSAMPARRAY arrays[3] = {rows[0], rows[1], rows[2]};
+    while (info->next_scanline < info->image_height) {
+        unsigned char *padded = encoder->padded;
+        for (int c = 0; c < 3; c++) {
+            const int lines = info->comp_info[c].v_samp_factor * DCTSIZE,
+                      first = (int)info->next_scanline * info->comp_info[c].v_samp_factor / info->max_v_samp_factor;
+            const int blocks_width = (int)info->comp_info[c].width_in_blocks * DCTSIZE;
+            for (int i = 0; i < lines; i++) {
+                const int y = first + i < plane_height[c] ? first + i : plane_height[c] - 1;
+                const unsigned char *row = plane[c] + (size_t)y * (size_t)plane_width[c];
+                if (blocks_width > plane_width[c]) {
+                    memcpy(padded, row, (size_t)plane_width[c]);
+                    memset(padded + plane_width[c], row[plane_width[c] - 1], (size_t)(blocks_width - plane_width[c]));
+                    row = padded;
+                    padded += padded_stride;
+                }
+                rows[c][i] = (JSAMPROW)row;
+            }
+        }
+        jpeg_write_raw_data(info, arrays, (JDIMENSION)(info->max_v_samp_factor * DCTSIZE));
+    }
+    jpeg_finish_compress(info);
+    *size = *capacity - encoder->destination.manager.free_in_buffer;
+    return true;
+}
+
+#endif
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,399 @@
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// reads the luma DC coefficient of every 8x8 block straight from a baseline JPEG's entropy-coded data: Huffman codes
+// are decoded (AC coefficients only skipped), nothing is dequantised beyond DC and no IDCT or colour conversion runs;
+// each DC dequantises to the block's mean luma, so the result is a 1/8 scale greyscale thumbnail at a fraction of the
+// cost of decoding. Progressive and arithmetic coded JPEGs are not supported
+
+#define JPEG_COMPONENTS_MAX 4
+
+typedef struct {
+    uint8_t fast_length[512], fast_value[512]; // codes of up to 9 bits
+    uint8_t fast_skip[512];                    // such a code plus the coefficient bits following it
+    int32_t maxcode[18], valoffset[18];
+    uint8_t values[256];
+} __jpeg_huffman_t;
+
+typedef struct {
+    const unsigned char *p, *end;
+    uint64_t bits;
+    int count;
+    bool marker;
+} __jpeg_bits_t;
+
+bool __jpeg_huffman_build(__jpeg_huffman_t *huffman, const unsigned char *counts, const unsigned char *values,
+                          const size_t values_size) {
+    size_t total = 0;
+    for (int l = 0; l < 16; l++)
+        total += counts[l];
+    if (total > 256 || total > values_size)
+        return false;
+    memset(huffman, 0, sizeof(*huffman));
+    memcpy(huffman->values, values, total);
+    int32_t code = 0, k = 0;
+    for (int l = 1; l <= 16; l++) {
+        huffman->valoffset[l] = k - code;
+        for (int i = 0; i < counts[l - 1]; i++, k++, code++)
+            if (l <= 9)
+                for (int fill = 0; fill < (1 << (9 - l)); fill++) {
+                    huffman->fast_length[(code << (9 - l)) | fill] = (uint8_t)l;
+                    huffman->fast_value[(code << (9 - l)) | fill] = values[k];
+                    huffman->fast_skip[(code << (9 - l)) | fill] = (uint8_t)(l + (values[k] & 0x0F));
+                }
+        huffman->maxcode[l] = counts[l - 1] ? code - 1 : -1;
+        code <<= 1;
+    }
+    huffman->maxcode[17] = INT32_MAX;
+    return true;
+}
+
+void __jpeg_bits_fill(__jpeg_bits_t *bits) {
+    while (bits->count <= 56) {
+        unsigned int byte = 0;
+        if (!bits->marker && bits->p < bits->end) {
+            byte = *bits->p;
+            if (byte == 0xFF) {
+                const unsigned int next = bits->p + 1 < bits->end ? bits->p[1] : 0xD9;
+                if (next == 0x00)
+                    bits->p += 2;
+                else { // a marker ends the segment: stay on it and feed zeros
+                    bits->marker = true;
+                    byte = 0;
+                }
+            } else
+                bits->p++;
+        }
+        bits->bits |= (uint64_t)byte << (56 - bits->count);
+        bits->count += 8;
+    }
+}
+
+uint32_t __jpeg_bits_get(__jpeg_bits_t *bits, const int n) {
+    if (bits->count < n)
+        __jpeg_bits_fill(bits);
+    const uint32_t value = (uint32_t)(bits->bits >> (64 - n));
+    bits->bits <<= n;
+    bits->count -= n;
+    return value;
+}
+
+int __jpeg_decode(__jpeg_bits_t *bits, const __jpeg_huffman_t *huffman) {
+    if (bits->count < 16)
+        __jpeg_bits_fill(bits);
+    const uint32_t look = (uint32_t)(bits->bits >> (64 - 9));
+    const int length = huffman->fast_length[look];
+    if (length) {
+        bits->bits <<= length;
+        bits->count -= length;
+        return huffman->fast_value[look];
+    }
+    for (int l = 10; l <= 16; l++) {
+        const int32_t code = (int32_t)(bits->bits >> (64 - l));
+        if (code <= huffman->maxcode[l]) {
+            bits->bits <<= l;
+            bits->count -= l;
+            const int32_t index = huffman->valoffset[l] + code;
+            return index >= 0 && index < 256 ? huffman->values[index] : -1;
+        }
+    }
+    return -1;
+}
+
+int __jpeg_extend(const uint32_t value, const int s) {
+    return value < (1U << (s - 1)) ? (int)value - (1 << s) + 1 : (int)value;
+}
+
+// realigns on the RSTn marker expected after every restart interval
+bool __jpeg_restart(__jpeg_bits_t *bits) {
+    bits->bits = 0;
+    bits->count = 0;
+    bits->marker = false;
+    while (bits->p + 1 < bits->end && !(bits->p[0] == 0xFF && (bits->p[1] & 0xF8) == 0xD0))
+        bits->p++;
+    if (bits->p + 1 >= bits->end)
+        return false;
+    bits->p += 2;
+    return true;
+}
+
+typedef struct {
+    int id, h, v, tq;
+    int dc, ac;
+} __jpeg_component_t;
+
+// grid receives one mean luma value (0..255) per 8x8 block, row-major, *width x *height blocks; the buffer is
+// (re)allocated as needed
+bool jpeg_luma_dc(const unsigned char *data, const size_t size, unsigned char **grid, size_t *capacity, int *width,
+                  int *height) {
+    if (size < 4 || data[0] != 0xFF || data[1] != 0xD8)
+        return false;
+    __jpeg_huffman_t huffman_dc[4], huffman_ac[4];
+    uint16_t quant_dc[4] = {0, 0, 0, 0};
+    int huffman_defined = 0; // bit per table, AC tables in the upper four
+    __jpeg_component_t components[JPEG_COMPONENTS_MAX];
+    int component_count = 0, image_width = 0, image_height = 0, restart_interval = 0, h_max = 1, v_max = 1;
+    size_t p = 2;
+    while (p + 4 <= size) {
+        if (data[p] != 0xFF)
+            return false;
+        const int marker = data[p + 1];
+        if (marker == 0xFF) {
+            p++;
+            continue;
+        }
+        const size_t length = ((size_t)data[p + 2] << 8) | data[p + 3];
+        const unsigned char *segment = data + p + 4;
+        if (length < 2 || p + 2 + length > size)
+            return false;
+        const size_t segment_size = length - 2;
+        if (marker == 0xC0 || marker == 0xC1) { // baseline / extended sequential, Huffman
+            if (segment_size < 6)
+                return false;
+            image_height = (segment[1] << 8) | segment[2];
+            image_width = (segment[3] << 8) | segment[4];
+            component_count = segment[5];
+            if (component_count < 1 || component_count > JPEG_COMPONENTS_MAX ||
+                segment_size < 6 + (size_t)component_count * 3 || image_width == 0 || image_height == 0)
+                return false;
+            for (int i = 0; i < component_count; i++) {
+                components[i].id = segment[6 + i * 3];
+                components[i].h = segment[7 + i * 3] >> 4;
+                components[i].v = segment[7 + i * 3] & 0x0F;
+                components[i].tq = segment[8 + i * 3] & 0x03;
+                if (components[i].h < 1 || components[i].h > 4 || components[i].v < 1 || components[i].v > 4)
+                    return false;
+                if (components[i].h > h_max)
+                    h_max = components[i].h;
+                if (components[i].v > v_max)
+                    v_max = components[i].v;
+            }
+        } else if ((marker >= 0xC2 && marker <= 0xCF) && marker != 0xC4 && marker != 0xC8 && marker != 0xCC)
+            return false; // progressive, lossless, arithmetic
+        else if (marker == 0xDB) {
+            for (size_t q = 0; q < segment_size;) {
+                const int precision = segment[q] >> 4, table = segment[q] & 0x03;
+                const size_t table_size = precision ? 128 : 64;
+                if (q + 1 + table_size > segment_size)
+                    return false;
+                quant_dc[table] = precision ? (uint16_t)((segment[q + 1] << 8) | segment[q + 2]) : segment[q + 1];
+                q += 1 + table_size;
+            }
+        } else if (marker == 0xC4) {
+            for (size_t q = 0; q < segment_size;) {
+                if (q + 17 > segment_size)
+                    return false;
+                const int table_class = segment[q] >> 4, table = segment[q] & 0x03;
+                size_t total = 0;
+                for (int l = 0; l < 16; l++)
+                    total += segment[q + 1 + l];
+                if (q + 17 + total > segment_size ||
+                    !__jpeg_huffman_build(table_class ? &huffman_ac[table] : &huffman_dc[table], segment + q + 1,
+                                          segment + q + 17, total))
+                    return false;
+                huffman_defined |= 1 << (table_class ? 4 + table : table);
+                q += 17 + total;
+            }
+        } else if (marker == 0xDD) {
+            if (segment_size < 2)
+                return false;
+            restart_interval = (segment[0] << 8) | segment[1];
+        } else if (marker == 0xDA)
+            break;
+        else if (marker == 0xD9)
+            return false;
+        p += 2 + length;
+    }
+    if (p + 4 > size || data[p + 1] != 0xDA || component_count == 0)
+        return false;
+
+    // scan header: which components, with which tables, in MCU order
+    const unsigned char *segment = data + p + 4;
+    const size_t segment_size = (((size_t)data[p + 2] << 8) | data[p + 3]) - 2;
+    const int scan_count = segment[0];
+    if (scan_count < 1 || scan_count > component_count || segment_size < 1 + (size_t)scan_count * 2)
+        return false;
+    __jpeg_component_t *scan[JPEG_COMPONENTS_MAX];
+    for (int i = 0; i < scan_count; i++) {
+        scan[i] = NULL;
+        for (int c = 0; c < component_count; c++)
+            if (components[c].id == segment[1 + i * 2])
+                scan[i] = &components[c];
+        if (scan[i] == NULL)
+            return false;
+        scan[i]->dc = segment[2 + i * 2] >> 4 & 0x03;
+        scan[i]->ac = segment[2 + i * 2] & 0x03;
+        if (!(huffman_defined & (1 << scan[i]->dc)) || !(huffman_defined & (1 << (4 + scan[i]->ac))))
+            return false;
+    }
+    if (scan[0] != &components[0]) // luma must come first
+        return false;
+
+    // a single component scan is not interleaved: blocks cover the component itself, not padded MCUs
+    const __jpeg_component_t *luma = &components[0];
+    const bool interleaved = scan_count > 1;
+    const int luma_width = (image_width * luma->h + h_max - 1) / h_max,
+              luma_height = (image_height * luma->v + v_max - 1) / v_max;
+    const int mcus_x = interleaved ? (image_width + 8 * h_max - 1) / (8 * h_max) : (luma_width + 7) / 8,
+              mcus_y = interleaved ? (image_height + 8 * v_max - 1) / (8 * v_max) : (luma_height + 7) / 8;
+    const int grid_width = interleaved ? mcus_x * luma->h : mcus_x,
+              grid_height = interleaved ? mcus_y * luma->v : mcus_y;
+    const size_t grid_size = (size_t)grid_width * (size_t)grid_height;
+    if (grid_size > *capacity) {
+        unsigned char *grid_new = realloc(*grid, grid_size);
+        if (grid_new == NULL)
+            return false;
+        *grid = grid_new;
+        *capacity = grid_size;
+    }
+    const int quant = quant_dc[luma->tq] ? quant_dc[luma->tq] : 1;
+
+    __jpeg_bits_t bits = {.p = segment + segment_size, .end = data + size, .bits = 0, .count = 0, .marker = false};
+    int predictor[JPEG_COMPONENTS_MAX] = {0, 0, 0, 0};
+    int restarts_left = restart_interval;
+    for (int my = 0; my < mcus_y; my++)
+        for (int mx = 0; mx < mcus_x; mx++) {
+            if (restart_interval) {
+                if (restarts_left == 0) {
+                    if (!__jpeg_restart(&bits))
+                        return false;
+                    memset(predictor, 0, sizeof(predictor));
+                    restarts_left = restart_interval;
+                }
+                restarts_left--;
+            }
+            for (int i = 0; i < scan_count; i++) {
+                const __jpeg_component_t *component = scan[i];
+                const int blocks_h = interleaved ? component->h : 1, blocks_v = interleaved ? component->v : 1;
+                for (int by = 0; by < blocks_v; by++)
+                    for (int bx = 0; bx < blocks_h; bx++) {
+                        const int s = __jpeg_decode(&bits, &huffman_dc[component->dc]);
+                        if (s < 0 || s > 11)
+                            return false;
+                        if (s)
+                            predictor[i] += __jpeg_extend(__jpeg_bits_get(&bits, s), s);
+                        // AC coefficients are only skipped: short codes and their value bits go in one step
+                        const __jpeg_huffman_t *ac = &huffman_ac[component->ac];
+                        for (int k = 1; k < 64;) {
+                            if (bits.count < 32)
+                                __jpeg_bits_fill(&bits);
+                            const uint32_t look = (uint32_t)(bits.bits >> (64 - 9));
+                            int rs = ac->fast_value[look];
+                            const int skip = ac->fast_skip[look];
+                            if (skip) {
+                                bits.bits <<= skip;
+                                bits.count -= skip;
+                            } else {
+                                if ((rs = __jpeg_decode(&bits, ac)) < 0)
+                                    return false;
+                                if (rs & 0x0F)
+                                    __jpeg_bits_get(&bits, rs & 0x0F);
+                            }
+                            if (rs & 0x0F)
+                                k += (rs >> 4) + 1;
+                            else if (rs == 0xF0)
+                                k += 16;
+                            else
+                                break;
+                        }
+                        if (i == 0) {
+                            const int mean = predictor[0] * quant / 8 + 128;
+                            (*grid)[(size_t)(my * blocks_v + by) * (size_t)grid_width + (size_t)(mx * blocks_h + bx)] =
+                                (unsigned char)(mean < 0 ? 0 : mean > 255 ? 255 : mean);
+                        }
+                    }
+            }
+        }
+    *width = grid_width;
+    *height = grid_height;
+    return true;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// marker level checks for JPEGs passed through as the camera sent them: jpeg_validate walks the segments from SOI to
+// the first SOS, requiring a frame header, lengths that stay within the data and an EOI at the end (zero padding after
+// it is tolerated); jpeg_strip removes APP1..APP13, APP15 (EXIF, XMP, ICC profiles, vendor data) and COM segments in
+// place and returns the new size, keeping APP0 (JFIF) and APP14 (Adobe, which says how the components are coded)
+
+bool __jpeg_marker_standalone(const int marker) {
+    return marker == 0x01 || (marker >= 0xD0 && marker <= 0xD9);
+}
+
+// offset of the SOS marker, 0 when the headers do not parse
+size_t __jpeg_scan_offset(const unsigned char *data, const size_t size, bool *frame) {
+    if (size < 4 || data[0] != 0xFF || data[1] != 0xD8)
+        return 0;
+    *frame = false;
+    size_t p = 2;
+    while (p + 4 <= size) {
+        if (data[p] != 0xFF)
+            return 0;
+        const int marker = data[p + 1];
+        if (marker == 0xFF) { // fill byte
+            p++;
+            continue;
+        }
+        if (marker == 0x00 || __jpeg_marker_standalone(marker))
+            return 0;
+        const size_t length = ((size_t)data[p + 2] << 8) | data[p + 3];
+        if (length < 2 || p + 2 + length > size)
+            return 0;
+        if (marker == 0xDA)
+            return p;
+        if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC)
+            *frame = true;
+        p += 2 + length;
+    }
+    return 0;
+}
+
+bool jpeg_validate(const unsigned char *data, const size_t size) {
+    size_t end = size;
+    while (end > 4 && data[end - 1] == 0x00)
+        end--;
+    if (end < 4 || data[end - 2] != 0xFF || data[end - 1] != 0xD9)
+        return false;
+    bool frame;
+    const size_t scan = __jpeg_scan_offset(data, end, &frame);
+    return scan > 0 && frame && scan + 2 + (((size_t)data[scan + 2] << 8) | data[scan + 3]) < end - 2;
+}
+
+size_t jpeg_strip(unsigned char *data, const size_t size) {
+    bool frame;
+    const size_t scan = __jpeg_scan_offset(data, size, &frame);
+    if (scan == 0)
+        return size;
+    size_t p = 2, out = 2;
+    while (p < scan) {
+        const int marker = data[p + 1];
+        if (marker == 0xFF) {
+            p++;
+            continue;
+        }
+        const size_t length = 2 + (((size_t)data[p + 2] << 8) | data[p + 3]);
+        if (!((marker >= 0xE1 && marker <= 0xED) || marker == 0xEF || marker == 0xFE)) {
+            if (out != p)
+                memmove(data + out, data + p, length);
+            out += length;
+        }
+        p += length;
+    }
+    if (out == scan)
+        return size;
+    memmove(data + out, data + scan, size - scan);
+    return out + size - scan;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
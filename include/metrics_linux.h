@@ -0,0 +1,255 @@
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// latency histograms recorded in nanoseconds with lock-free counters (recorders are capture, stream, publisher and
+// mqtt threads), fixed 1-2.5-5 buckets from 10us to 60s, exported in seconds as Prometheus expects
+
+#define METRICS_BUCKET_COUNT 21
+
+const int64_t metrics_buckets[METRICS_BUCKET_COUNT] = {
+    10000LL,     25000LL,     50000LL,     100000LL,     250000LL,     500000LL,     1000000LL,
+    2500000LL,   5000000LL,   10000000LL,  25000000LL,   50000000LL,   100000000LL,  250000000LL,
+    500000000LL, 1000000000LL, 2500000000LL, 5000000000LL, 10000000000LL, 30000000000LL, 60000000000LL};
+
+typedef struct {
+    atomic_ulong buckets[METRICS_BUCKET_COUNT + 1]; // last is +Inf
+    atomic_ulong count;
+    atomic_llong sum, max;
+} metrics_histogram_t;
+
+int64_t metrics_timespec_ns(const struct timespec *ts) {
+    return (int64_t)ts->tv_sec * 1000000000LL + ts->tv_nsec;
+}
+
+void metrics_histogram_record(metrics_histogram_t *histogram, const int64_t ns) {
+    const int64_t value = ns < 0 ? 0 : ns;
+    int bucket = 0;
+    while (bucket < METRICS_BUCKET_COUNT && value > metrics_buckets[bucket])
+        bucket++;
+    atomic_fetch_add_explicit(&histogram->buckets[bucket], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&histogram->sum, value, memory_order_relaxed);
+    atomic_fetch_add_explicit(&histogram->count, 1, memory_order_relaxed);
+    long long max = atomic_load_explicit(&histogram->max, memory_order_relaxed);
+    while (value > max && !atomic_compare_exchange_weak_explicit(&histogram->max, &max, value, memory_order_relaxed,
+                                                                 memory_order_relaxed))
+        ;
+}
+
+// estimate of quantile q (0..1) in nanoseconds, interpolated within the bucket and capped at the largest value seen
+int64_t metrics_histogram_quantile(metrics_histogram_t *histogram, const double q) {
+    unsigned long counts[METRICS_BUCKET_COUNT + 1], total = 0;
+    for (int i = 0; i <= METRICS_BUCKET_COUNT; i++)
+        total += (counts[i] = atomic_load_explicit(&histogram->buckets[i], memory_order_relaxed));
+    const int64_t max = atomic_load_explicit(&histogram->max, memory_order_relaxed);
+    if (total == 0)
+        return 0;
+    const double rank = q * (double)total;
+    unsigned long below = 0;
+    for (int i = 0; i <= METRICS_BUCKET_COUNT; i++) {
+        if (counts[i] > 0 && (double)(below + counts[i]) >= rank) {
+            const int64_t lower = i == 0 ? 0 : metrics_buckets[i - 1];
+            const int64_t upper = i == METRICS_BUCKET_COUNT || metrics_buckets[i] > max ? max : metrics_buckets[i];
+            const double fraction = ((double)rank - (double)below) / (double)counts[i];
+            const int64_t value = lower + (int64_t)((double)(upper - lower) * (fraction < 0.0 ? 0.0 : fraction));
+            return value > max ? max : value;
+        }
+        below += counts[i];
+    }
+    return max;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// growing text buffer for rendering the exposition (and JSON stats)
+
+typedef struct {
+    char *data;
+    size_t size, capacity;
+} metrics_text_t;
+
+void metrics_text_printf(metrics_text_t *text, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+void metrics_text_printf(metrics_text_t *text, const char *format, ...) {
+    while (true) {
+        va_list arguments;
+        va_start(arguments, format);
+        const int length =
+            text->data ? vsnprintf(text->data + text->size, text->capacity - text->size, format, arguments) : -1;
+        va_end(arguments);
+        if (length >= 0 && text->size + (size_t)length < text->capacity) {
+            text->size += (size_t)length;
+            return;
+        }
+        const size_t capacity = text->capacity ? text->capacity * 2 : 16 * 1024;
+        char *data = realloc(text->data, capacity);
+        if (data == NULL)
+            return;
+        text->data = data;
+        text->capacity = capacity;
+    }
+}
+
+void metrics_text_end(metrics_text_t *text) {
+    free(text->data);
+    memset(text, 0, sizeof(*text));
+}
+
+// label values with '\' and '"' escaped
+void metrics_label(char *label, const size_t size, const char *value) {
+    size_t length = 0;
+    for (; *value && length + 2 < size; value++) {
+        if (*value == '\\' || *value == '"')
+            label[length++] = '\\';
+        label[length++] = *value;
+    }
+    label[length] = '\0';
+}
+
+// histogram samples for one series, 'labels' being the inner part of {...} without the le label
+void metrics_text_histogram(metrics_text_t *text, const char *name, const char *labels,
+                            metrics_histogram_t *histogram) {
+    unsigned long cumulative = 0;
+    for (int i = 0; i <= METRICS_BUCKET_COUNT; i++) {
+        cumulative += atomic_load_explicit(&histogram->buckets[i], memory_order_relaxed);
+        if (i < METRICS_BUCKET_COUNT)
+            metrics_text_printf(text, "%s_bucket{%s,le=\"%g\"} %lu\n", name, labels, (double)metrics_buckets[i] / 1e9,
+                                cumulative);
+        else
+            metrics_text_printf(text, "%s_bucket{%s,le=\"+Inf\"} %lu\n", name, labels, cumulative);
+    }
+    metrics_text_printf(text, "%s_sum{%s} %.9f\n", name, labels,
+                        (double)atomic_load_explicit(&histogram->sum, memory_order_relaxed) / 1e9);
+    metrics_text_printf(text, "%s_count{%s} %lu\n", name, labels,
+                        atomic_load_explicit(&histogram->count, memory_order_relaxed));
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// minimal HTTP/1.0 server for scrapes: one thread, one connection at a time, GET /metrics (or /) answered with the
+// text rendered by the callback, everything else 404
+
+typedef void (*metrics_render_t)(metrics_text_t *text);
+
+typedef struct {
+    int fd;
+    pthread_t thread;
+    metrics_render_t render;
+    metrics_text_t text;
+    unsigned long requests;
+} metrics_server_t;
+
+#define METRICS_REQUEST_MAX 2048
+#define METRICS_REQUEST_TIMEOUT 2 // seconds
+
+void __metrics_server_respond(metrics_server_t *server, const int client) {
+    const struct timeval timeout = {.tv_sec = METRICS_REQUEST_TIMEOUT};
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    char request[METRICS_REQUEST_MAX];
+    size_t length = 0;
+    while (length < sizeof(request) - 1) {
+        const ssize_t received = recv(client, request + length, sizeof(request) - 1 - length, 0);
+        if (received <= 0)
+            break;
+        length += (size_t)received;
+        request[length] = '\0';
+        if (strstr(request, "\r\n\r\n") || strstr(request, "\n\n"))
+            break;
+    }
+    request[length] = '\0';
+    const bool found = strncmp(request, "GET /metrics ", 13) == 0 || strncmp(request, "GET / ", 6) == 0;
+    server->text.size = 0;
+    if (found)
+        server->render(&server->text);
+    char header[256];
+    const int header_length =
+        found ? snprintf(header, sizeof(header),
+                         "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+                         "Content-Length: %zu\r\nConnection: close\r\n\r\n",
+                         server->text.size)
+              : snprintf(header, sizeof(header),
+                         "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+    if (send(client, header, (size_t)header_length, MSG_NOSIGNAL) == header_length && found) {
+        size_t sent = 0;
+        ssize_t result;
+        while (sent < server->text.size &&
+               (result = send(client, server->text.data + sent, server->text.size - sent, MSG_NOSIGNAL)) > 0)
+            sent += (size_t)result;
+    }
+    server->requests++;
+}
+
+void *__metrics_server_thread(void *context) {
+    metrics_server_t *server = (metrics_server_t *)context;
+    while (true) {
+        const int client = accept4(server->fd, NULL, NULL, SOCK_CLOEXEC);
+        if (client < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            break; // listening socket shut down
+        }
+        __metrics_server_respond(server, client);
+        close(client);
+    }
+    return NULL;
+}
+
+bool metrics_server_begin(metrics_server_t *server, const char *address, const int port, metrics_render_t render) {
+    memset(server, 0, sizeof(*server));
+    server->render = render;
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = htons((uint16_t)port)};
+    if (inet_pton(AF_INET, address, &addr.sin_addr) != 1) {
+        fprintf(stderr, "metrics: invalid address '%s'\n", address);
+        return false;
+    }
+    if ((server->fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0) {
+        fprintf(stderr, "metrics: socket failed (%s)\n", strerror(errno));
+        return false;
+    }
+    const int reuse = 1;
+    setsockopt(server->fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    if (bind(server->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(server->fd, 8) < 0) {
+        fprintf(stderr, "metrics: could not listen on %s:%d (%s)\n", address, port, strerror(errno));
+        close(server->fd);
+        return false;
+    }
+    if (pthread_create(&server->thread, NULL, __metrics_server_thread, server) != 0) {
+        fprintf(stderr, "metrics: failed to create thread\n");
+        close(server->fd);
+        return false;
+    }
+    printf("metrics: listening on http://%s:%d/metrics\n", address, port);
+    return true;
+}
+
+void metrics_server_end(metrics_server_t *server) {
+    shutdown(server->fd, SHUT_RDWR); // unblocks accept
+    pthread_join(server->thread, NULL);
+    close(server->fd);
+    metrics_text_end(&server->text);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,182 @@
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// splits a concatenated MJPEG byte stream (e.g. ffmpeg image2pipe) into frames: walks marker segments from SOI so that
+// nested SOI/EOI inside APPn (EXIF thumbnails) are skipped, then scans entropy-coded data for the terminating EOI
+
+#define MJPEG_MARKER_SOI 0xD8
+#define MJPEG_MARKER_EOI 0xD9
+#define MJPEG_MARKER_SOS 0xDA
+
+typedef enum { MJPEG_STATE_SEARCH, MJPEG_STATE_SEGMENT, MJPEG_STATE_ENTROPY } mjpeg_state_t;
+
+typedef void (*mjpeg_frame_callback_t)(const unsigned char *data, const size_t size, void *context);
+
+typedef struct {
+    unsigned char *data;
+    size_t size, capacity, limit;
+    size_t position, frame;
+    mjpeg_state_t state;
+    unsigned long frames, discards;
+} mjpeg_framer_t;
+
+bool mjpeg_framer_begin(mjpeg_framer_t *framer, const size_t capacity, const size_t limit) {
+    memset(framer, 0, sizeof(*framer));
+    if ((framer->data = malloc(capacity)) == NULL)
+        return false;
+    framer->capacity = capacity;
+    framer->limit = limit;
+    framer->state = MJPEG_STATE_SEARCH;
+    return true;
+}
+
+void mjpeg_framer_end(mjpeg_framer_t *framer) {
+    free(framer->data);
+    framer->data = NULL;
+    framer->size = framer->capacity = 0;
+}
+
+void mjpeg_framer_reset(mjpeg_framer_t *framer) {
+    framer->size = framer->position = 0;
+    framer->state = MJPEG_STATE_SEARCH;
+}
+
+void __mjpeg_framer_consume(mjpeg_framer_t *framer, const size_t length) {
+    memmove(framer->data, framer->data + length, framer->size - length);
+    framer->size -= length;
+    framer->position = 0;
+}
+
+void __mjpeg_framer_scan(mjpeg_framer_t *framer, mjpeg_frame_callback_t callback, void *context) {
+    while (true) {
+        const unsigned char *d = framer->data;
+        size_t p = framer->position;
+        if (framer->state == MJPEG_STATE_SEARCH) {
+            while (p + 1 < framer->size && !(d[p] == 0xFF && d[p + 1] == MJPEG_MARKER_SOI))
+                p++;
+            if (p + 1 >= framer->size) { // keep a possible trailing 0xFF
+                const size_t keep = (framer->size > 0 && d[framer->size - 1] == 0xFF) ? 1 : 0;
+                __mjpeg_framer_consume(framer, framer->size - keep);
+                return;
+            }
+            if (p > 0) {
+                __mjpeg_framer_consume(framer, p);
+                framer->discards++;
+            }
+            framer->position = 2;
+            framer->state = MJPEG_STATE_SEGMENT;
+        } else if (framer->state == MJPEG_STATE_SEGMENT) {
+            if (p + 2 > framer->size)
+                return;
+            if (d[p] != 0xFF || d[p + 1] == MJPEG_MARKER_SOI || d[p + 1] == MJPEG_MARKER_EOI) { // corrupt, resync
+                framer->discards++;
+                __mjpeg_framer_consume(framer, 1);
+                framer->state = MJPEG_STATE_SEARCH;
+                continue;
+            }
+            if (d[p + 1] == 0xFF) { // fill byte
+                framer->position = p + 1;
+                continue;
+            }
+            if (p + 4 > framer->size)
+                return;
+            const size_t length = ((size_t)d[p + 2] << 8) | d[p + 3];
+            if (length < 2) {
+                framer->discards++;
+                __mjpeg_framer_consume(framer, 1);
+                framer->state = MJPEG_STATE_SEARCH;
+                continue;
+            }
+            if (p + 2 + length > framer->size)
+                return;
+            framer->position = p + 2 + length;
+            if (d[p + 1] == MJPEG_MARKER_SOS)
+                framer->state = MJPEG_STATE_ENTROPY;
+        } else { // MJPEG_STATE_ENTROPY
+            while (p + 1 < framer->size &&
+                   !(d[p] == 0xFF && d[p + 1] != 0x00 && d[p + 1] != 0xFF && (d[p + 1] & 0xF8) != 0xD0))
+                p++;
+            if (p + 1 >= framer->size) {
+                framer->position = p;
+                return;
+            }
+            if (d[p + 1] == MJPEG_MARKER_EOI) {
+                const size_t length = p + 2;
+                framer->frames++;
+                framer->frame = length;
+                callback(framer->data, length, context);
+                if (framer->frame) // else the callback took the buffer and the remainder is already in place
+                    __mjpeg_framer_consume(framer, length);
+                framer->frame = 0;
+                framer->position = 0;
+                framer->state = MJPEG_STATE_SEARCH;
+            } else { // DHT / SOS etc between scans (progressive)
+                framer->position = p;
+                framer->state = MJPEG_STATE_SEGMENT;
+            }
+        }
+    }
+}
+
+bool mjpeg_framer_push(mjpeg_framer_t *framer, const unsigned char *data, const size_t length,
+                       mjpeg_frame_callback_t callback, void *context) {
+    if (framer->limit && framer->size + length > framer->limit) {
+        fprintf(stderr, "mjpeg: frame exceeds limit (%zu bytes), discarding\n", framer->limit);
+        framer->discards++;
+        mjpeg_framer_reset(framer);
+        if (length > framer->limit)
+            return false;
+    }
+    if (framer->size + length > framer->capacity) {
+        size_t capacity = framer->capacity ? framer->capacity : 4096;
+        while (capacity < framer->size + length)
+            capacity *= 2;
+        if (framer->limit && capacity > framer->limit)
+            capacity = framer->limit;
+        unsigned char *data_new = realloc(framer->data, capacity);
+        if (data_new == NULL)
+            return false;
+        framer->data = data_new;
+        framer->capacity = capacity;
+    }
+    memcpy(framer->data + framer->size, data, length);
+    framer->size += length;
+    __mjpeg_framer_scan(framer, callback, context);
+    return true;
+}
+
+// called from the frame callback: takes the buffer holding the frame (at its start) in exchange for another malloc'd
+// buffer, which receives any bytes already read beyond the frame, so the frame itself is never copied
+bool mjpeg_framer_exchange(mjpeg_framer_t *framer, unsigned char **buffer, size_t *capacity) {
+    if (framer->frame == 0)
+        return false;
+    const size_t remainder = framer->size - framer->frame;
+    if (*capacity < remainder) {
+        unsigned char *data = realloc(*buffer, remainder);
+        if (data == NULL)
+            return false;
+        *buffer = data;
+        *capacity = remainder;
+    }
+    memcpy(*buffer, framer->data + framer->frame, remainder);
+    unsigned char *data = framer->data;
+    const size_t data_capacity = framer->capacity;
+    framer->data = *buffer;
+    framer->capacity = *capacity;
+    framer->size = remainder;
+    *buffer = data;
+    *capacity = data_capacity;
+    framer->frame = 0;
+    return true;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
@@ -3,6 +3,10 @@
 // -----------------------------------------------------------------------------------------------------------------------------------------
 
 #include <mosquitto.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <time.h>
 
 // -----------------------------------------------------------------------------------------------------------------------------------------
 // -----------------------------------------------------------------------------------------------------------------------------------------
@@ -10,13 +14,29 @@
 typedef struct {
     const char *server;
     const char *client;
+    int version; // 3 (3.1.1) or 5
+    int qos;
+    int inflight;                     // messages in flight at QoS 1/2, 0 for unlimited
+    int reconnect_min, reconnect_max; // seconds, doubling in between
     bool debug;
 } MqttConfig;
 
 typedef struct {
-    void (*message_processor)(const char *);
+    void (*message_processor)(const char *topic, const unsigned char *payload, const size_t size);
 } mqtt_callback_data;
 
+#define MQTT_USER_PROPERTIES_MAX 12
+
+// MQTT 5 publish properties, ignored when connected with 3.1.1, and whether the message is retained (any version,
+// else MQTT_PUBLISH_RETAIN decides)
+typedef struct {
+    bool retain;
+    const char *content_type;
+    int expiry; // seconds, 0 for none
+    int user_count;
+    const char *user[MQTT_USER_PROPERTIES_MAX][2]; // name, value
+} mqtt_properties_t;
+
 // -----------------------------------------------------------------------------------------------------------------------------------------
 // -----------------------------------------------------------------------------------------------------------------------------------------
 
@@ -26,16 +46,99 @@ typedef struct {
 #ifndef MQTT_PUBLISH_QOS
 #define MQTT_PUBLISH_QOS 0
 #endif
+#ifndef MQTT_INFLIGHT_DEFAULT
+#define MQTT_INFLIGHT_DEFAULT 20
+#endif
+#ifndef MQTT_RECONNECT_MIN
+#define MQTT_RECONNECT_MIN 1
+#endif
+#ifndef MQTT_RECONNECT_MAX
+#define MQTT_RECONNECT_MAX 60
+#endif
 #ifndef MQTT_PUBLISH_RETAIN
 #define MQTT_PUBLISH_RETAIN false
 #endif
 #ifndef MQTT_SUBSCRIBE_QOS
 #define MQTT_SUBSCRIBE_QOS 0
 #endif
+#ifndef MQTT_SUBSCRIPTIONS_MAX
+#define MQTT_SUBSCRIPTIONS_MAX 256
+#endif
+#ifndef MQTT_TOPIC_ALIASES
+#define MQTT_TOPIC_ALIASES 1024 // our own cap, below it the broker's topic alias maximum applies
+#endif
 
 bool mosq_debug = false;
+int mosq_qos = MQTT_PUBLISH_QOS;
 struct mosquitto *mosq = NULL;
 mqtt_callback_data *mosq_callback_data = NULL;
+void (*mosq_publish_callback)(int mid) = NULL;
+void (*mosq_connection_callback)(bool connected) = NULL;
+
+// subscriptions are renewed on every connect, the session not being persistent
+char *mosq_subscriptions[MQTT_SUBSCRIPTIONS_MAX];
+int mosq_subscription_count = 0;
+pthread_mutex_t mosq_subscription_mutex = PTHREAD_MUTEX_INITIALIZER;
+atomic_bool mosq_connected = false;
+_Atomic int64_t mosq_connected_time = 0; // CLOCK_MONOTONIC nanoseconds of the latest connect
+bool mosq_v5 = false;
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// MQTT 5 topic aliases: each topic gets the next alias on first use (sent with the topic), later publishes send the
+// alias alone (once a publish carrying both has gone out on the same connection); aliases live as long as the
+// connection, so the table starts over on every connect and disconnect, and entries remember the connection they were
+// announced on. The lookup and the publish are made under the table's lock, which the connect and disconnect callbacks
+// take, so a reconnect cannot come between them; only QoS 0 omits the topic since QoS 1/2 messages may be resent by
+// libmosquitto on a new connection where the alias is unknown
+
+char *mosq_alias_topics[MQTT_TOPIC_ALIASES * 2]; // open addressing, alias in mosq_alias_values
+uint16_t mosq_alias_values[MQTT_TOPIC_ALIASES * 2];
+unsigned long mosq_alias_announced[MQTT_TOPIC_ALIASES * 2]; // the connection it went out on with its topic, 0 none
+unsigned long mosq_alias_connection = 0;                     // counted at every reset
+int mosq_alias_count = 0, mosq_alias_maximum = 0;
+pthread_mutex_t mosq_alias_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+void __mqtt_alias_reset(const int maximum) {
+    pthread_mutex_lock(&mosq_alias_mutex);
+    for (int i = 0; i < MQTT_TOPIC_ALIASES * 2; i++) {
+        free(mosq_alias_topics[i]);
+        mosq_alias_topics[i] = NULL;
+        mosq_alias_announced[i] = 0;
+    }
+    mosq_alias_count = 0;
+    mosq_alias_maximum = maximum < MQTT_TOPIC_ALIASES ? maximum : MQTT_TOPIC_ALIASES;
+    mosq_alias_connection++;
+    pthread_mutex_unlock(&mosq_alias_mutex);
+}
+
+// the topic's alias (0 if none is left) and whether the broker already knows it, with mosq_alias_mutex held
+uint16_t __mqtt_alias(const char *topic, bool *known, uint32_t *slot) {
+    uint32_t hash = 2166136261U;
+    for (const char *c = topic; *c; c++)
+        hash = (hash ^ (unsigned char)*c) * 16777619U;
+    uint16_t alias = 0;
+    *known = false;
+    uint32_t i = hash % (MQTT_TOPIC_ALIASES * 2);
+    for (;; i = (i + 1) % (MQTT_TOPIC_ALIASES * 2)) {
+        if (mosq_alias_topics[i] == NULL) {
+            if (mosq_alias_count < mosq_alias_maximum && (mosq_alias_topics[i] = strdup(topic)) != NULL)
+                alias = mosq_alias_values[i] = (uint16_t)++mosq_alias_count;
+            break;
+        }
+        if (strcmp(mosq_alias_topics[i], topic) == 0) {
+            alias = mosq_alias_values[i];
+            *known = mosq_alias_announced[i] == mosq_alias_connection;
+            break;
+        }
+    }
+    *slot = i;
+    return alias;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
 
 bool mqtt_parse(const char *string, char *host, const int length, int *port, bool *ssl) {
     host[0] = '\0';
@@ -65,7 +168,67 @@ void mqtt_connect_callback(struct mosquitto *m, void *o __attribute__((unused)),
         fprintf(stderr, "mqtt: connect failed: %s\n", mosquitto_connack_string(r));
         return;
     }
-    printf("mqtt: connected\n");
+    if (mosq_v5)
+        printf("mqtt: connected (MQTT 5, topic aliases=%d)\n", mosq_alias_maximum);
+    else
+        printf("mqtt: connected\n");
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    atomic_store(&mosq_connected_time, (int64_t)now.tv_sec * 1000000000 + now.tv_nsec);
+    atomic_store(&mosq_connected, true);
+    pthread_mutex_lock(&mosq_subscription_mutex);
+    for (int i = 0; i < mosq_subscription_count; i++) {
+        const int result = mosquitto_subscribe(m, NULL, mosq_subscriptions[i], MQTT_SUBSCRIBE_QOS);
+        if (result != MOSQ_ERR_SUCCESS)
+            fprintf(stderr, "mqtt: subscribe failed '%s': %s\n", mosq_subscriptions[i], mosquitto_strerror(result));
+    }
+    pthread_mutex_unlock(&mosq_subscription_mutex);
+    if (mosq_connection_callback)
+        mosq_connection_callback(true);
+}
+
+void mqtt_connect_v5_callback(struct mosquitto *m, void *o, int r, int flags __attribute__((unused)),
+                              const mosquitto_property *properties) {
+    if (m != mosq)
+        return;
+    uint16_t maximum = 0;
+    if (r == 0)
+        mosquitto_property_read_int16(properties, MQTT_PROP_TOPIC_ALIAS_MAXIMUM, &maximum, false);
+    __mqtt_alias_reset(maximum);
+    mqtt_connect_callback(m, o, r);
+}
+
+// the loop thread reconnects by itself (mosquitto_reconnect_delay_set), unless the disconnect was asked for
+void mqtt_disconnect_callback(struct mosquitto *m, void *o __attribute__((unused)), int r) {
+    if (m != mosq)
+        return;
+    if (mosq_v5)
+        __mqtt_alias_reset(0);
+    if (atomic_exchange(&mosq_connected, false)) {
+        if (r != 0)
+            fprintf(stderr, "mqtt: disconnected (%s), reconnecting\n", mosquitto_strerror(r));
+        else
+            printf("mqtt: disconnected\n");
+        if (mosq_connection_callback)
+            mosq_connection_callback(false);
+    }
+}
+
+bool mqtt_connected(void) {
+    return atomic_load(&mosq_connected);
+}
+
+// when the connection last came up, CLOCK_MONOTONIC nanoseconds (0 if it never has)
+int64_t mqtt_connected_time(void) {
+    return atomic_load(&mosq_connected_time);
+}
+
+// QoS 0: the message has been written to the socket, QoS 1/2: the broker acknowledged it
+void mqtt_publish_callback(struct mosquitto *m, void *o __attribute__((unused)), int mid) {
+    if (m != mosq)
+        return;
+    if (mosq_publish_callback)
+        mosq_publish_callback(mid);
 }
 
 bool mqtt_begin(const MqttConfig *config) {
@@ -73,12 +236,16 @@ bool mqtt_begin(const MqttConfig *config) {
     int port;
     bool ssl;
     mosq_debug = config->debug;
+    mosq_qos = config->qos < 0 ? 0 : config->qos > 2 ? 2 : config->qos;
+    mosq_v5 = config->version == 5;
     if (!mqtt_parse(config->server, host, sizeof(host), &port, &ssl)) {
         fprintf(stderr, "mqtt: error parsing details in '%s'\n", config->server);
         return false;
     }
-    printf("mqtt: connecting (host='%s', port=%d, ssl=%s, client='%s')\n", host, port, ssl ? "true" : "false",
-           config->client);
+    printf("mqtt: connecting (host='%s', port=%d, ssl=%s, client='%s', version=%s, qos=%d, inflight=%d, "
+           "reconnect=%d..%ds)\n",
+           host, port, ssl ? "true" : "false", config->client, mosq_v5 ? "5" : "3.1.1", mosq_qos, config->inflight,
+           config->reconnect_min, config->reconnect_max);
     char client_id[24];
     sprintf(client_id, "%s-%06X", config->client ? config->client : "mqtt-linux", rand() & 0xFFFFFF);
     int result;
@@ -91,17 +258,23 @@ bool mqtt_begin(const MqttConfig *config) {
     }
     if (ssl)
         mosquitto_tls_insecure_set(mosq, true); // Skip certificate validation
-    mosquitto_connect_callback_set(mosq, mqtt_connect_callback);
-    if ((result = mosquitto_connect(mosq, host, port, MQTT_CONNECT_TIMEOUT)) != MOSQ_ERR_SUCCESS) {
-        fprintf(stderr, "mqtt: error connecting to broker: %s\n", mosquitto_strerror(result));
-        mosquitto_destroy(mosq);
-        mosquitto_lib_cleanup();
-        mosq = NULL;
-        return false;
-    }
+    if (mosq_v5) {
+        mosquitto_int_option(mosq, MOSQ_OPT_PROTOCOL_VERSION, MQTT_PROTOCOL_V5);
+        mosquitto_connect_v5_callback_set(mosq, mqtt_connect_v5_callback);
+    } else
+        mosquitto_connect_callback_set(mosq, mqtt_connect_callback);
+    mosquitto_disconnect_callback_set(mosq, mqtt_disconnect_callback);
+    mosquitto_publish_callback_set(mosq, mqtt_publish_callback);
+    mosquitto_max_inflight_messages_set(mosq, (unsigned int)(config->inflight < 0 ? 0 : config->inflight));
+    mosquitto_reconnect_delay_set(mosq, (unsigned int)(config->reconnect_min < 1 ? 1 : config->reconnect_min),
+                                  (unsigned int)(config->reconnect_max < config->reconnect_min ? config->reconnect_min
+                                                                                               : config->reconnect_max),
+                                  true);
+    // an unreachable broker is not fatal: the loop thread keeps retrying, and until then mqtt_connected() is false
+    if ((result = mosquitto_connect_async(mosq, host, port, MQTT_CONNECT_TIMEOUT)) != MOSQ_ERR_SUCCESS)
+        fprintf(stderr, "mqtt: error connecting to broker: %s, will retry\n", mosquitto_strerror(result));
     if ((result = mosquitto_loop_start(mosq)) != MOSQ_ERR_SUCCESS) {
         fprintf(stderr, "mqtt: error starting loop: %s\n", mosquitto_strerror(result));
-        mosquitto_disconnect(mosq);
         mosquitto_destroy(mosq);
         mosquitto_lib_cleanup();
         mosq = NULL;
@@ -116,21 +289,60 @@ void mqtt_end(void) {
         mosq_callback_data = NULL;
     }
     if (mosq) {
+        atomic_store(&mosq_connected, false);
         mosquitto_loop_stop(mosq, true);
         mosquitto_disconnect(mosq);
         mosquitto_destroy(mosq);
         mosquitto_lib_cleanup();
         mosq = NULL;
     }
+    __mqtt_alias_reset(0);
+    for (int i = 0; i < mosq_subscription_count; i++)
+        free(mosq_subscriptions[i]);
+    mosq_subscription_count = 0;
 }
 
 // -----------------------------------------------------------------------------------------------------------------------------------------
 // -----------------------------------------------------------------------------------------------------------------------------------------
 
-bool mqtt_send(const char *topic, const unsigned char *message, const int length) {
-    if (!mosq)
+// *mid (if not NULL) receives the message id later passed to the publish callback, which may run before this returns;
+// fails while disconnected rather than letting libmosquitto queue QoS 1/2 messages in memory without bound; with
+// MQTT 5 the properties (may be NULL) are attached and the topic is aliased
+bool mqtt_send_properties(const char *topic, const unsigned char *message, const int length,
+                          const mqtt_properties_t *properties, int *mid) {
+    if (!mosq || !mqtt_connected())
         return false;
-    const int result = mosquitto_publish(mosq, NULL, topic, length, message, MQTT_PUBLISH_QOS, MQTT_PUBLISH_RETAIN);
+    const bool retain = MQTT_PUBLISH_RETAIN || (properties != NULL && properties->retain);
+    if (!mosq_v5) {
+        const int result = mosquitto_publish(mosq, mid, topic, length, message, mosq_qos, retain);
+        if (result != MOSQ_ERR_SUCCESS) {
+            fprintf(stderr, "mqtt: publish error: %s\n", mosquitto_strerror(result));
+            return false;
+        }
+        return true;
+    }
+    mosquitto_property *list = NULL;
+    if (properties != NULL) {
+        if (properties->content_type != NULL)
+            mosquitto_property_add_string(&list, MQTT_PROP_CONTENT_TYPE, properties->content_type);
+        if (properties->expiry > 0)
+            mosquitto_property_add_int32(&list, MQTT_PROP_MESSAGE_EXPIRY_INTERVAL, (uint32_t)properties->expiry);
+        for (int i = 0; i < properties->user_count && i < MQTT_USER_PROPERTIES_MAX; i++)
+            mosquitto_property_add_string_pair(&list, MQTT_PROP_USER_PROPERTY, properties->user[i][0],
+                                               properties->user[i][1]);
+    }
+    bool known = false;
+    uint32_t slot;
+    pthread_mutex_lock(&mosq_alias_mutex); // publishes only queue here, the loop thread writes them
+    const uint16_t alias = __mqtt_alias(topic, &known, &slot);
+    if (alias > 0)
+        mosquitto_property_add_int16(&list, MQTT_PROP_TOPIC_ALIAS, alias);
+    const int result = mosquitto_publish_v5(mosq, mid, alias > 0 && known && mosq_qos == 0 ? NULL : topic, length,
+                                            message, mosq_qos, retain, list);
+    if (result == MOSQ_ERR_SUCCESS && alias > 0 && !known)
+        mosq_alias_announced[slot] = mosq_alias_connection;
+    pthread_mutex_unlock(&mosq_alias_mutex);
+    mosquitto_property_free_all(&list);
     if (result != MOSQ_ERR_SUCCESS) {
         fprintf(stderr, "mqtt: publish error: %s\n", mosquitto_strerror(result));
         return false;
@@ -138,6 +350,24 @@ bool mqtt_send(const char *topic, const unsigned char *message, const int length
     return true;
 }
 
+bool mqtt_send_mid(const char *topic, const unsigned char *message, const int length, int *mid) {
+    return mqtt_send_properties(topic, message, length, NULL, mid);
+}
+
+bool mqtt_send(const char *topic, const unsigned char *message, const int length) {
+    return mqtt_send_mid(topic, message, length, NULL);
+}
+
+// called from the mqtt thread once a message is out (see mqtt_publish_callback)
+void mqtt_publish_callback_register(void (*publish_processor)(int mid)) {
+    mosq_publish_callback = publish_processor;
+}
+
+// called from the mqtt thread when the connection comes up or goes down
+void mqtt_connection_callback_register(void (*connection_processor)(bool connected)) {
+    mosq_connection_callback = connection_processor;
+}
+
 // -----------------------------------------------------------------------------------------------------------------------------------------
 // -----------------------------------------------------------------------------------------------------------------------------------------
 
@@ -146,7 +376,8 @@ void mqtt_message_callback(struct mosquitto *m, void *obj, const struct mosquitt
         return;
     const mqtt_callback_data *callback_data = (mqtt_callback_data *)obj;
     if (callback_data && callback_data->message_processor)
-        callback_data->message_processor(message->topic);
+        callback_data->message_processor(message->topic, (const unsigned char *)message->payload,
+                                         message->payloadlen > 0 ? (size_t)message->payloadlen : 0);
 }
 
 void mqtt_subscribe_callback(struct mosquitto *m, void *obj __attribute__((unused)), int mid,
@@ -157,10 +388,18 @@ void mqtt_subscribe_callback(struct mosquitto *m, void *obj __attribute__((unuse
         printf("mqtt: subscribed (mid=%d)\n", mid);
 }
 
+// kept and renewed on reconnect; while disconnected the subscription is only made once connected
 bool mqtt_subscribe(const char *topic) {
     if (!mosq)
         return false;
-    const int result = mosquitto_subscribe(mosq, NULL, topic, MQTT_SUBSCRIBE_QOS);
+    pthread_mutex_lock(&mosq_subscription_mutex);
+    char *copy = mosq_subscription_count < MQTT_SUBSCRIPTIONS_MAX ? strdup(topic) : NULL;
+    int result = MOSQ_ERR_NOMEM;
+    if (copy != NULL) {
+        mosq_subscriptions[mosq_subscription_count++] = copy;
+        result = mqtt_connected() ? mosquitto_subscribe(mosq, NULL, topic, MQTT_SUBSCRIBE_QOS) : MOSQ_ERR_SUCCESS;
+    }
+    pthread_mutex_unlock(&mosq_subscription_mutex);
     if (result != MOSQ_ERR_SUCCESS) {
         fprintf(stderr, "mqtt: subscribe failed '%s': %s\n", topic, mosquitto_strerror(result));
         return false;
@@ -172,11 +411,20 @@ bool mqtt_subscribe(const char *topic) {
 bool mqtt_unsubscribe(const char *topic) {
     if (!mosq)
         return false;
+    pthread_mutex_lock(&mosq_subscription_mutex);
+    for (int i = 0; i < mosq_subscription_count; i++)
+        if (strcmp(mosq_subscriptions[i], topic) == 0) {
+            free(mosq_subscriptions[i]);
+            mosq_subscriptions[i--] = mosq_subscriptions[--mosq_subscription_count];
+        }
+    pthread_mutex_unlock(&mosq_subscription_mutex);
     mosquitto_unsubscribe(mosq, NULL, topic);
     return true;
 }
 
-bool mqtt_message_callback_register(void (*message_processor)(const char *)) {
+// called from the mqtt thread for every message on a subscribed topic
+bool mqtt_message_callback_register(void (*message_processor)(const char *topic, const unsigned char *payload,
+                                                              const size_t size)) {
     if (!mosq)
         return false;
     if (mosq_callback_data)
@@ -0,0 +1,136 @@
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// bounded FIFO of opaque items between producer and consumer threads; when full, a push either evicts the oldest item
+// or refuses the new one, and the loser is handed back to the caller to release so producers never block
+
+typedef enum { QUEUE_DROP_OLDEST, QUEUE_DROP_NEWEST } queue_drop_t;
+
+typedef struct {
+    void **items;
+    int size, head, length, length_max;
+    queue_drop_t drop;
+    unsigned long pushed, popped, dropped;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    bool closed;
+} queue_t;
+
+typedef struct {
+    int depth, depth_max, size;
+    unsigned long pushed, popped, dropped;
+} queue_stats_t;
+
+bool queue_begin(queue_t *queue, const int size, const queue_drop_t drop) {
+    memset(queue, 0, sizeof(*queue));
+    if (size < 1 || (queue->items = calloc((size_t)size, sizeof(void *))) == NULL)
+        return false;
+    queue->size = size;
+    queue->drop = drop;
+    pthread_mutex_init(&queue->mutex, NULL);
+    pthread_condattr_t condattr;
+    pthread_condattr_init(&condattr);
+    pthread_condattr_setclock(&condattr, CLOCK_MONOTONIC);
+    pthread_cond_init(&queue->cond, &condattr);
+    pthread_condattr_destroy(&condattr);
+    return true;
+}
+
+// wakes consumers; items still queued can be popped until the queue is empty
+void queue_close(queue_t *queue) {
+    pthread_mutex_lock(&queue->mutex);
+    queue->closed = true;
+    pthread_cond_broadcast(&queue->cond);
+    pthread_mutex_unlock(&queue->mutex);
+}
+
+void queue_end(queue_t *queue) {
+    free(queue->items);
+    queue->items = NULL;
+    pthread_cond_destroy(&queue->cond);
+    pthread_mutex_destroy(&queue->mutex);
+}
+
+// returns false if the item was not queued; *dropped is set to the item the caller must release (the new item, or
+// the evicted oldest one), or NULL
+bool queue_push(queue_t *queue, void *item, void **dropped) {
+    *dropped = NULL;
+    pthread_mutex_lock(&queue->mutex);
+    if (queue->closed) {
+        pthread_mutex_unlock(&queue->mutex);
+        *dropped = item;
+        return false;
+    }
+    if (queue->length == queue->size) {
+        queue->dropped++;
+        if (queue->drop == QUEUE_DROP_NEWEST) {
+            pthread_mutex_unlock(&queue->mutex);
+            *dropped = item;
+            return false;
+        }
+        *dropped = queue->items[queue->head];
+        queue->head = (queue->head + 1) % queue->size;
+        queue->length--;
+    }
+    queue->items[(queue->head + queue->length) % queue->size] = item;
+    queue->length++;
+    queue->pushed++;
+    if (queue->length > queue->length_max)
+        queue->length_max = queue->length;
+    pthread_cond_signal(&queue->cond);
+    pthread_mutex_unlock(&queue->mutex);
+    return true;
+}
+
+// blocks until an item is available or, with a deadline (CLOCK_MONOTONIC, NULL for none), until then; *item is NULL
+// when the deadline passed first, and false is returned once the queue is closed and drained
+bool queue_pop_until(queue_t *queue, const struct timespec *deadline, void **item) {
+    *item = NULL;
+    pthread_mutex_lock(&queue->mutex);
+    while (!queue->closed && queue->length == 0)
+        if (deadline == NULL)
+            pthread_cond_wait(&queue->cond, &queue->mutex);
+        else if (pthread_cond_timedwait(&queue->cond, &queue->mutex, deadline) == ETIMEDOUT)
+            break;
+    if (queue->length > 0) {
+        *item = queue->items[queue->head];
+        queue->head = (queue->head + 1) % queue->size;
+        queue->length--;
+        queue->popped++;
+    }
+    const bool open = *item != NULL || !queue->closed;
+    pthread_mutex_unlock(&queue->mutex);
+    return open;
+}
+
+// blocks until an item is available, returns NULL once the queue is closed and drained
+void *queue_pop(queue_t *queue) {
+    void *item;
+    queue_pop_until(queue, NULL, &item);
+    return item;
+}
+
+void queue_stats(queue_t *queue, queue_stats_t *stats) {
+    pthread_mutex_lock(&queue->mutex);
+    stats->depth = queue->length;
+    stats->depth_max = queue->length_max;
+    stats->size = queue->size;
+    stats->pushed = queue->pushed;
+    stats->popped = queue->popped;
+    stats->dropped = queue->dropped;
+    pthread_mutex_unlock(&queue->mutex);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,1211 @@
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#ifdef RTSP_LIBAV
+#include <libavcodec/avcodec.h>
+#endif
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// minimal RTSP/1.0 client: TCP interleaved transport, Basic/Digest auth, first video track only. H.264/H.265 access
+// units are depacketised and only keyframes are decoded (libavcodec, when built with RTSP_LIBAV) and re-encoded as
+// JPEG; RFC 2435 JPEG payloads are reassembled into complete JPEG files without any decode
+
+#define RTSP_PORT_DEFAULT 554
+#define RTSP_TIMEOUT_DEFAULT 10
+#define RTSP_QUALITY_DEFAULT 6
+#define RTSP_RESPONSE_MAX 8192
+#define RTSP_PACKET_MAX (4 + 65535)
+#ifndef RTSP_FRAME_MAX
+#define RTSP_FRAME_MAX (8 * 1024 * 1024)
+#endif
+#define RTSP_USER_AGENT "rtsptomqtt"
+
+typedef enum { RTSP_CODEC_NONE, RTSP_CODEC_H264, RTSP_CODEC_H265, RTSP_CODEC_JPEG } rtsp_codec_t;
+
+typedef void (*rtsp_frame_callback_t)(const unsigned char *data, const size_t size, void *context);
+
+typedef struct {
+    int timeout;
+    int quality;
+    bool debug;
+} RtspConfig;
+
+typedef struct {
+    RtspConfig config;
+    char host[128], user[64], pass[64];
+    int port;
+    char url[512], base[512], control[512];
+    char session[256];
+    char realm[128], nonce[128], opaque[128];
+    bool auth_digest, auth_basic, auth_qop;
+    unsigned int auth_nc;
+    int sock;
+    int wake; // eventfd from rtsp_reset, written by rtsp_stop and polled with the socket
+    int cseq;
+    int keepalive_interval;
+    time_t keepalive_last;
+    rtsp_codec_t codec;
+    int payload_type;
+    int channel;
+    unsigned char params[1024];
+    size_t params_size;
+    unsigned char *unit;
+    size_t unit_size, unit_capacity;
+    uint32_t unit_timestamp;
+    bool unit_started, unit_broken, unit_keyframe, unit_params, unit_fragment;
+    uint16_t sequence;
+    bool sequence_valid;
+    unsigned char jpeg_qtables[128];
+    int jpeg_qtables_size, jpeg_type, jpeg_q, jpeg_width, jpeg_height, jpeg_dri;
+    size_t jpeg_headers_size;
+    unsigned char rx[2 * RTSP_PACKET_MAX];
+    size_t rx_size;
+    char response[RTSP_RESPONSE_MAX];
+    int response_status;
+    unsigned long frames, keyframes, errors;
+#ifdef RTSP_LIBAV
+    AVCodecContext *decoder, *encoder;
+    AVFrame *decoded;
+    AVPacket *packet;
+#endif
+} rtsp_client_t;
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+typedef struct {
+    uint32_t state[4];
+} __rtsp_md5_t;
+
+void __rtsp_md5_block(__rtsp_md5_t *md5, const unsigned char *block) {
+    static const uint32_t k[64] = {
+        0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+        0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+        0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+        0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+        0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+        0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+        0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+        0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391};
+    static const int r[64] = {7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 5, 9,  14, 20, 5, 9,
+                              14, 20, 5, 9,  14, 20, 5, 9,  14, 20, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+                              4,  11, 16, 23, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21};
+    uint32_t w[16];
+    for (int i = 0; i < 16; i++)
+        w[i] = (uint32_t)block[i * 4] | ((uint32_t)block[i * 4 + 1] << 8) | ((uint32_t)block[i * 4 + 2] << 16) |
+               ((uint32_t)block[i * 4 + 3] << 24);
+    uint32_t a = md5->state[0], b = md5->state[1], c = md5->state[2], d = md5->state[3];
+    for (int i = 0; i < 64; i++) {
+        uint32_t f;
+        int g;
+        if (i < 16)
+            f = (b & c) | (~b & d), g = i;
+        else if (i < 32)
+            f = (d & b) | (~d & c), g = (5 * i + 1) % 16;
+        else if (i < 48)
+            f = b ^ c ^ d, g = (3 * i + 5) % 16;
+        else
+            f = c ^ (b | ~d), g = (7 * i) % 16;
+        const uint32_t t = d;
+        d = c;
+        c = b;
+        f += a + k[i] + w[g];
+        b += (f << r[i]) | (f >> (32 - r[i]));
+        a = t;
+    }
+    md5->state[0] += a, md5->state[1] += b, md5->state[2] += c, md5->state[3] += d;
+}
+
+void __rtsp_md5_hex(const char *string, char *hex) {
+    __rtsp_md5_t md5 = {{0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476}};
+    const size_t length = strlen(string);
+    size_t i = 0;
+    for (; i + 64 <= length; i += 64)
+        __rtsp_md5_block(&md5, (const unsigned char *)string + i);
+    unsigned char tail[128] = {0};
+    const size_t rest = length - i;
+    memcpy(tail, string + i, rest);
+    tail[rest] = 0x80;
+    const size_t blocks = rest + 9 > 64 ? 2 : 1;
+    const uint64_t bits = (uint64_t)length * 8;
+    for (int j = 0; j < 8; j++)
+        tail[blocks * 64 - 8 + j] = (unsigned char)(bits >> (8 * j));
+    for (size_t j = 0; j < blocks; j++)
+        __rtsp_md5_block(&md5, tail + j * 64);
+    for (int j = 0; j < 16; j++)
+        sprintf(hex + j * 2, "%02x", (md5.state[j / 4] >> (8 * (j % 4))) & 0xFF);
+}
+
+void __rtsp_base64_encode(const char *input, char *output) {
+    static const char table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    const unsigned char *in = (const unsigned char *)input;
+    size_t length = strlen(input), o = 0;
+    for (size_t i = 0; i < length; i += 3) {
+        const uint32_t v = ((uint32_t)in[i] << 16) | (i + 1 < length ? (uint32_t)in[i + 1] << 8 : 0) |
+                           (i + 2 < length ? in[i + 2] : 0);
+        output[o++] = table[(v >> 18) & 0x3F];
+        output[o++] = table[(v >> 12) & 0x3F];
+        output[o++] = i + 1 < length ? table[(v >> 6) & 0x3F] : '=';
+        output[o++] = i + 2 < length ? table[v & 0x3F] : '=';
+    }
+    output[o] = '\0';
+}
+
+size_t __rtsp_base64_decode(const char *input, size_t length, unsigned char *output, const size_t size) {
+    uint32_t v = 0;
+    int bits = 0;
+    size_t o = 0;
+    for (size_t i = 0; i < length && input[i] != '='; i++) {
+        const char c = input[i];
+        int d;
+        if (c >= 'A' && c <= 'Z')
+            d = c - 'A';
+        else if (c >= 'a' && c <= 'z')
+            d = c - 'a' + 26;
+        else if (c >= '0' && c <= '9')
+            d = c - '0' + 52;
+        else if (c == '+' || c == '-')
+            d = 62;
+        else if (c == '/' || c == '_')
+            d = 63;
+        else
+            continue;
+        v = (v << 6) | (uint32_t)d;
+        if ((bits += 6) >= 8) {
+            bits -= 8;
+            if (o < size)
+                output[o++] = (unsigned char)(v >> bits);
+        }
+    }
+    return o;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// rtsp://[user[:pass]@]host[:port]/path -> request url without credentials
+bool rtsp_parse(const char *string, char *host, const int host_length, int *port, char *user, char *pass,
+                const int credential_length, char *url, const int url_length) {
+    host[0] = user[0] = pass[0] = url[0] = '\0';
+    *port = RTSP_PORT_DEFAULT;
+    if (strncasecmp(string, "rtsp://", 7) != 0)
+        return false;
+    const char *authority = string + 7, *path = strchr(authority, '/');
+    const size_t authority_length = path ? (size_t)(path - authority) : strlen(authority);
+    const char *at = memchr(authority, '@', authority_length);
+    if (at) {
+        const char *colon = memchr(authority, ':', (size_t)(at - authority));
+        const size_t user_length = (size_t)((colon ? colon : at) - authority);
+        snprintf(user, credential_length, "%.*s", (int)user_length, authority);
+        if (colon)
+            snprintf(pass, credential_length, "%.*s", (int)(at - colon - 1), colon + 1);
+    }
+    const char *host_start = at ? at + 1 : authority;
+    const size_t host_length_actual = (size_t)(authority + authority_length - host_start);
+    snprintf(host, host_length, "%.*s", (int)host_length_actual, host_start);
+    char *port_str = strchr(host, ':');
+    if (port_str) {
+        *port_str = '\0';
+        *port = atoi(port_str + 1);
+    }
+    snprintf(url, url_length, "rtsp://%.*s%s", (int)host_length_actual, host_start, path ? path : "/");
+    return host[0] != '\0';
+}
+
+bool __rtsp_header(const char *response, const char *name, char *value, const size_t length) {
+    const size_t name_length = strlen(name);
+    for (const char *line = response; line && *line; line = strstr(line, "\r\n") ? strstr(line, "\r\n") + 2 : NULL) {
+        if (line[0] == '\r')
+            break;
+        if (strncasecmp(line, name, name_length) == 0 && line[name_length] == ':') {
+            const char *v = line + name_length + 1;
+            while (*v == ' ' || *v == '\t')
+                v++;
+            const char *end = strstr(v, "\r\n");
+            const size_t n = end ? (size_t)(end - v) : strlen(v);
+            snprintf(value, length, "%.*s", (int)n, v);
+            return true;
+        }
+    }
+    return false;
+}
+
+// name=value or name="value" in a list, an unquoted value ending at any of separators
+bool __rtsp_parameter_until(const char *string, const char *name, const char *separators, char *value,
+                            const size_t length) {
+    const size_t name_length = strlen(name);
+    for (const char *p = string; (p = strcasestr(p, name)) != NULL; p += name_length) {
+        if (p != string && isalnum((unsigned char)p[-1]))
+            continue;
+        const char *v = p + name_length;
+        while (*v == ' ')
+            v++;
+        if (*v++ != '=')
+            continue;
+        const bool quoted = *v == '"';
+        if (quoted)
+            v++;
+        size_t n = 0;
+        while (v[n] && (quoted ? v[n] != '"' : strchr(separators, v[n]) == NULL))
+            n++;
+        snprintf(value, length, "%.*s", (int)n, v);
+        return true;
+    }
+    return false;
+}
+
+bool __rtsp_parameter(const char *string, const char *name, char *value, const size_t length) {
+    return __rtsp_parameter_until(string, name, ",; \r", value, length);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// wake (-1 for none) abandons the connect when readable
+int __rtsp_connect(const char *host, const int port, const int timeout, const int wake) {
+    struct addrinfo hints = {0}, *result, *rp;
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    char port_str[8];
+    snprintf(port_str, sizeof(port_str), "%d", port);
+    const int error = getaddrinfo(host, port_str, &hints, &result);
+    if (error != 0) {
+        fprintf(stderr, "rtsp: resolve '%s' failed: %s\n", host, gai_strerror(error));
+        return -1;
+    }
+    int sock = -1;
+    bool cancelled = false;
+    for (rp = result; rp != NULL && sock < 0 && !cancelled; rp = rp->ai_next) {
+        if ((sock = socket(rp->ai_family, rp->ai_socktype | SOCK_CLOEXEC | SOCK_NONBLOCK, rp->ai_protocol)) < 0)
+            continue;
+        const int connected = connect(sock, rp->ai_addr, rp->ai_addrlen);
+        if (connected < 0 && errno == EINPROGRESS) {
+            struct pollfd pfds[2] = {{.fd = sock, .events = POLLOUT}, {.fd = wake, .events = POLLIN}};
+            int so_error = ETIMEDOUT;
+            socklen_t so_length = sizeof(so_error);
+            const int ready = poll(pfds, 2, timeout * 1000);
+            if (ready > 0 && pfds[1].revents != 0)
+                cancelled = true;
+            else if (ready > 0)
+                getsockopt(sock, SOL_SOCKET, SO_ERROR, &so_error, &so_length);
+            if (so_error != 0 || cancelled) {
+                close(sock);
+                sock = -1;
+                errno = so_error;
+            }
+        } else if (connected < 0) {
+            close(sock);
+            sock = -1;
+        }
+    }
+    freeaddrinfo(result);
+    if (sock < 0 && cancelled)
+        return -1;
+    if (sock < 0) {
+        fprintf(stderr, "rtsp: connect '%s:%d' failed: %s\n", host, port, strerror(errno));
+        return -1;
+    }
+    const int flags = fcntl(sock, F_GETFL, 0);
+    fcntl(sock, F_SETFL, flags & ~O_NONBLOCK);
+    const int one = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return sock;
+}
+
+bool __rtsp_fill(rtsp_client_t *client) {
+    if (client->rx_size == sizeof(client->rx))
+        return false;
+    struct pollfd pfds[2] = {{.fd = client->sock, .events = POLLIN}, {.fd = client->wake, .events = POLLIN}};
+    int result;
+    while ((result = poll(pfds, 2, client->config.timeout * 1000)) == -1 && errno == EINTR)
+        ;
+    if (result == 0) {
+        fprintf(stderr, "rtsp: receive timeout (%d seconds)\n", client->config.timeout);
+        return false;
+    }
+    if (result < 0 || pfds[1].revents != 0) // stopped
+        return false;
+    const ssize_t bytes = recv(client->sock, client->rx + client->rx_size, sizeof(client->rx) - client->rx_size, 0);
+    if (bytes <= 0) {
+        if (bytes < 0)
+            fprintf(stderr, "rtsp: receive failed: %s\n", strerror(errno));
+        return false;
+    }
+    client->rx_size += (size_t)bytes;
+    return true;
+}
+
+void __rtsp_consume(rtsp_client_t *client, const size_t length) {
+    memmove(client->rx, client->rx + length, client->rx_size - length);
+    client->rx_size -= length;
+}
+
+bool __rtsp_send(rtsp_client_t *client, const char *data, const size_t length) {
+    size_t sent = 0;
+    while (sent < length) {
+        const ssize_t bytes = send(client->sock, data + sent, length - sent, MSG_NOSIGNAL);
+        if (bytes < 0) {
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "rtsp: send failed: %s\n", strerror(errno));
+            return false;
+        }
+        sent += (size_t)bytes;
+    }
+    return true;
+}
+
+// reads one response (skipping any interleaved packets ahead of it) into client->response
+bool __rtsp_response(rtsp_client_t *client) {
+    while (true) {
+        if (client->rx_size >= 4 && client->rx[0] == '$') {
+            const size_t length = 4 + (((size_t)client->rx[2] << 8) | client->rx[3]);
+            if (client->rx_size < length) {
+                if (!__rtsp_fill(client))
+                    return false;
+                continue;
+            }
+            __rtsp_consume(client, length);
+            continue;
+        }
+        const unsigned char *end =
+            client->rx_size >= 4 ? memmem(client->rx, client->rx_size, "\r\n\r\n", 4) : NULL;
+        if (end == NULL) {
+            if (client->rx_size >= RTSP_RESPONSE_MAX || !__rtsp_fill(client))
+                return false;
+            continue;
+        }
+        const size_t header_length = (size_t)(end - client->rx) + 4;
+        if (header_length >= RTSP_RESPONSE_MAX)
+            return false;
+        memcpy(client->response, client->rx, header_length);
+        client->response[header_length] = '\0';
+        char value[32];
+        const size_t body_length = __rtsp_header(client->response, "Content-Length", value, sizeof(value))
+                                       ? (size_t)strtoul(value, NULL, 10)
+                                       : 0;
+        if (header_length + body_length >= RTSP_RESPONSE_MAX) {
+            fprintf(stderr, "rtsp: response too large (%zu bytes)\n", header_length + body_length);
+            return false;
+        }
+        while (client->rx_size < header_length + body_length)
+            if (!__rtsp_fill(client))
+                return false;
+        memcpy(client->response + header_length, client->rx + header_length, body_length);
+        client->response[header_length + body_length] = '\0';
+        __rtsp_consume(client, header_length + body_length);
+        if (strncmp(client->response, "RTSP/1.0 ", 9) != 0)
+            return false;
+        client->response_status = atoi(client->response + 9);
+        if (client->config.debug)
+            printf("rtsp: <<<\n%s\n", client->response);
+        return true;
+    }
+}
+
+void __rtsp_authorization(rtsp_client_t *client, const char *method, const char *url, char *header,
+                          const size_t length) {
+    header[0] = '\0';
+    if (client->auth_digest) {
+        char buffer[512], ha1[33], ha2[33], response[33], cnonce[17] = "", qop[64] = "";
+        snprintf(buffer, sizeof(buffer), "%s:%s:%s", client->user, client->realm, client->pass);
+        __rtsp_md5_hex(buffer, ha1);
+        snprintf(buffer, sizeof(buffer), "%s:%s", method, url);
+        __rtsp_md5_hex(buffer, ha2);
+        if (client->auth_qop) {
+            snprintf(cnonce, sizeof(cnonce), "%08x%08x", (unsigned)rand(), (unsigned)rand());
+            client->auth_nc++;
+            snprintf(buffer, sizeof(buffer), "%s:%s:%08x:%s:auth:%s", ha1, client->nonce, client->auth_nc, cnonce, ha2);
+            snprintf(qop, sizeof(qop), ", qop=auth, nc=%08x, cnonce=\"%s\"", client->auth_nc, cnonce);
+        } else
+            snprintf(buffer, sizeof(buffer), "%s:%s:%s", ha1, client->nonce, ha2);
+        __rtsp_md5_hex(buffer, response);
+        int n = snprintf(header, length,
+                         "Authorization: Digest username=\"%s\", realm=\"%s\", nonce=\"%s\", uri=\"%s\", "
+                         "response=\"%s\"%s",
+                         client->user, client->realm, client->nonce, url, response, qop);
+        if (client->opaque[0] && n > 0 && (size_t)n < length)
+            n += snprintf(header + n, length - (size_t)n, ", opaque=\"%s\"", client->opaque);
+        if (n > 0 && (size_t)n < length)
+            snprintf(header + n, length - (size_t)n, "\r\n");
+    } else if (client->auth_basic) {
+        char credentials[160], encoded[224];
+        snprintf(credentials, sizeof(credentials), "%s:%s", client->user, client->pass);
+        __rtsp_base64_encode(credentials, encoded);
+        snprintf(header, length, "Authorization: Basic %s\r\n", encoded);
+    }
+}
+
+bool __rtsp_authenticate(rtsp_client_t *client) {
+    char value[512];
+    const char *p = client->response;
+    bool found = false;
+    // prefer Digest when several WWW-Authenticate headers are offered
+    while ((p = strcasestr(p, "\r\nWWW-Authenticate:")) != NULL) {
+        p += 19;
+        while (*p == ' ')
+            p++;
+        const char *end = strstr(p, "\r\n");
+        snprintf(value, sizeof(value), "%.*s", (int)(end ? end - p : (long)strlen(p)), p);
+        if (strncasecmp(value, "Digest", 6) == 0) {
+            client->auth_digest = true;
+            __rtsp_parameter(value, "realm", client->realm, sizeof(client->realm));
+            __rtsp_parameter(value, "nonce", client->nonce, sizeof(client->nonce));
+            if (!__rtsp_parameter(value, "opaque", client->opaque, sizeof(client->opaque)))
+                client->opaque[0] = '\0';
+            char qop[64];
+            client->auth_qop = __rtsp_parameter(value, "qop", qop, sizeof(qop)) && strcasestr(qop, "auth") != NULL;
+            client->auth_nc = 0;
+            found = true;
+        } else if (strncasecmp(value, "Basic", 5) == 0 && !client->auth_digest) {
+            client->auth_basic = true;
+            found = true;
+        }
+    }
+    return found;
+}
+
+bool __rtsp_request(rtsp_client_t *client, const char *method, const char *url, const char *headers) {
+    for (int attempt = 0; attempt < 2; attempt++) {
+        char authorization[768], session[288] = "", request[2048];
+        __rtsp_authorization(client, method, url, authorization, sizeof(authorization));
+        if (client->session[0])
+            snprintf(session, sizeof(session), "Session: %s\r\n", client->session);
+        const int length =
+            snprintf(request, sizeof(request), "%s %s RTSP/1.0\r\nCSeq: %d\r\nUser-Agent: %s\r\n%s%s%s\r\n", method,
+                     url, ++client->cseq, RTSP_USER_AGENT, authorization, session, headers ? headers : "");
+        if (length < 0 || (size_t)length >= sizeof(request))
+            return false;
+        if (client->config.debug)
+            printf("rtsp: >>>\n%s", request);
+        if (!__rtsp_send(client, request, (size_t)length) || !__rtsp_response(client))
+            return false;
+        if (client->response_status != 401 || attempt > 0 || !client->user[0])
+            break;
+        if (!__rtsp_authenticate(client))
+            break;
+    }
+    if (client->response_status != 200) {
+        fprintf(stderr, "rtsp: %s failed (status=%d)\n", method, client->response_status);
+        return false;
+    }
+    return true;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+void __rtsp_params_append(rtsp_client_t *client, const char *sprop) {
+    static const unsigned char start_code[4] = {0, 0, 0, 1};
+    // sprop-parameter-sets is a comma separated list of base64 NAL units
+    while (*sprop) {
+        size_t n = strcspn(sprop, ",;");
+        if (n > 0 && client->params_size + sizeof(start_code) < sizeof(client->params)) {
+            memcpy(client->params + client->params_size, start_code, sizeof(start_code));
+            const size_t decoded =
+                __rtsp_base64_decode(sprop, n, client->params + client->params_size + sizeof(start_code),
+                                     sizeof(client->params) - client->params_size - sizeof(start_code));
+            if (decoded > 0)
+                client->params_size += sizeof(start_code) + decoded;
+        }
+        sprop += n;
+        if (*sprop == ',')
+            sprop++;
+        else
+            break;
+    }
+}
+
+bool __rtsp_describe(rtsp_client_t *client) {
+    if (!__rtsp_request(client, "DESCRIBE", client->url, "Accept: application/sdp\r\n"))
+        return false;
+    if (!__rtsp_header(client->response, "Content-Base", client->base, sizeof(client->base)) &&
+        !__rtsp_header(client->response, "Content-Location", client->base, sizeof(client->base)))
+        snprintf(client->base, sizeof(client->base), "%s", client->url);
+    const char *sdp = strstr(client->response, "\r\n\r\n");
+    if (sdp == NULL)
+        return false;
+    bool video = false, found = false;
+    client->codec = RTSP_CODEC_NONE;
+    client->control[0] = '\0';
+    client->params_size = 0;
+    for (const char *line = sdp + 4; *line; line += strcspn(line, "\n"), line += (*line == '\n')) {
+        char text[512];
+        snprintf(text, sizeof(text), "%.*s", (int)strcspn(line, "\r\n"), line);
+        if (strncmp(text, "m=", 2) == 0) {
+            if (found)
+                break;
+            video = strncmp(text, "m=video ", 8) == 0;
+            if (video) {
+                const char *pt = strstr(text, "RTP/AVP ");
+                client->payload_type = pt ? atoi(pt + 8) : -1;
+                if (client->payload_type == 26)
+                    client->codec = RTSP_CODEC_JPEG;
+                found = true;
+            }
+        } else if (video && strncmp(text, "a=rtpmap:", 9) == 0 && atoi(text + 9) == client->payload_type) {
+            const char *name = strchr(text, ' ');
+            if (name && strncasecmp(name + 1, "H264/", 5) == 0)
+                client->codec = RTSP_CODEC_H264;
+            else if (name && (strncasecmp(name + 1, "H265/", 5) == 0 || strncasecmp(name + 1, "HEVC/", 5) == 0))
+                client->codec = RTSP_CODEC_H265;
+            else if (name && strncasecmp(name + 1, "JPEG/", 5) == 0)
+                client->codec = RTSP_CODEC_JPEG;
+        } else if (video && strncmp(text, "a=control:", 10) == 0) {
+            const char *control = text + 10;
+            if (strncasecmp(control, "rtsp://", 7) == 0)
+                snprintf(client->control, sizeof(client->control), "%s", control);
+            else if (strcmp(control, "*") == 0)
+                snprintf(client->control, sizeof(client->control), "%s", client->base);
+            else {
+                const size_t base_length = strlen(client->base);
+                const bool slash = base_length > 0 && client->base[base_length - 1] == '/';
+                if (snprintf(client->control, sizeof(client->control), "%s%s%s", client->base, slash ? "" : "/",
+                             control) >= (int)sizeof(client->control))
+                    fprintf(stderr, "rtsp: control url too long, truncated\n");
+            }
+        } else if (video && strncmp(text, "a=fmtp:", 7) == 0 && atoi(text + 7) == client->payload_type) {
+            // fmtp parameters are separated by ';' only, the sprop values are comma separated lists
+            char value[384];
+            if (__rtsp_parameter_until(text, "sprop-parameter-sets", "; \r", value, sizeof(value)))
+                __rtsp_params_append(client, value);
+            if (__rtsp_parameter_until(text, "sprop-vps", "; \r", value, sizeof(value)))
+                __rtsp_params_append(client, value);
+            if (__rtsp_parameter_until(text, "sprop-sps", "; \r", value, sizeof(value)))
+                __rtsp_params_append(client, value);
+            if (__rtsp_parameter_until(text, "sprop-pps", "; \r", value, sizeof(value)))
+                __rtsp_params_append(client, value);
+        }
+    }
+    if (!found || client->codec == RTSP_CODEC_NONE) {
+        fprintf(stderr, "rtsp: no supported video track (H264, H265, JPEG) in session description\n");
+        return false;
+    }
+    if (!client->control[0])
+        snprintf(client->control, sizeof(client->control), "%s", client->base);
+    return true;
+}
+
+bool __rtsp_setup(rtsp_client_t *client) {
+    if (!__rtsp_request(client, "SETUP", client->control, "Transport: RTP/AVP/TCP;unicast;interleaved=0-1\r\n"))
+        return false;
+    char value[256];
+    if (!__rtsp_header(client->response, "Session", value, sizeof(value))) {
+        fprintf(stderr, "rtsp: SETUP response without session\n");
+        return false;
+    }
+    char *timeout = strcasestr(value, ";timeout=");
+    client->keepalive_interval = timeout ? atoi(timeout + 9) / 2 : 30;
+    if (client->keepalive_interval < 5)
+        client->keepalive_interval = 5;
+    value[strcspn(value, ";")] = '\0';
+    snprintf(client->session, sizeof(client->session), "%s", value);
+    client->channel = 0;
+    if (__rtsp_header(client->response, "Transport", value, sizeof(value))) {
+        const char *interleaved = strcasestr(value, "interleaved=");
+        if (interleaved)
+            client->channel = atoi(interleaved + 12);
+    }
+    return true;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// RFC 2435 appendix A/B: quantisation tables (zigzag order) from the Q factor and the JPEG headers that the RTP
+// payload omits, so a complete JFIF-less baseline JPEG can be rebuilt around the scan data
+
+const unsigned char __rtsp_jpeg_luma_quantizer[64] = {
+    16, 11,  12,  14,  12,  10, 16, 14,  13,  14,  18,  17,  16,  19, 24,  40,  26,  24,  22,  22, 24, 49,
+    35, 37,  29,  40,  58,  51, 61, 60,  57,  51,  56,  55,  64,  72, 92,  78,  64,  68,  87,  69, 55, 56,
+    80, 109, 81,  87,  95,  98, 103, 104, 103, 62,  77,  113, 121, 112, 100, 120, 92, 101, 103, 99};
+const unsigned char __rtsp_jpeg_chroma_quantizer[64] = {
+    17, 18, 18, 24, 21, 24, 47, 26, 26, 47, 99, 66, 56, 66, 99, 99, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99};
+
+const unsigned char __rtsp_jpeg_luma_dc_lengths[16] = {0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0};
+const unsigned char __rtsp_jpeg_chroma_dc_lengths[16] = {0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0};
+const unsigned char __rtsp_jpeg_dc_symbols[12] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+const unsigned char __rtsp_jpeg_luma_ac_lengths[16] = {0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d};
+const unsigned char __rtsp_jpeg_luma_ac_symbols[162] = {
+    0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07, 0x22, 0x71,
+    0x14, 0x32, 0x81, 0x91, 0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0, 0x24, 0x33, 0x62, 0x72,
+    0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28, 0x29, 0x2a, 0x34, 0x35, 0x36, 0x37,
+    0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59,
+    0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83,
+    0x84, 0x85, 0x86, 0x87, 0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3,
+    0xa4, 0xa5, 0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
+    0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+    0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa};
+const unsigned char __rtsp_jpeg_chroma_ac_lengths[16] = {0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77};
+const unsigned char __rtsp_jpeg_chroma_ac_symbols[162] = {
+    0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71, 0x13, 0x22,
+    0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0, 0x15, 0x62, 0x72, 0xd1,
+    0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26, 0x27, 0x28, 0x29, 0x2a, 0x35, 0x36,
+    0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58,
+    0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a,
+    0x82, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a,
+    0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba,
+    0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+    0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa};
+
+void __rtsp_jpeg_tables(const int q, unsigned char *tables) {
+    const int factor = q < 1 ? 1 : (q > 99 ? 99 : q);
+    const int scale = q < 50 ? 5000 / factor : 200 - factor * 2;
+    for (int i = 0; i < 64; i++) {
+        const int lq = (__rtsp_jpeg_luma_quantizer[i] * scale + 50) / 100;
+        const int cq = (__rtsp_jpeg_chroma_quantizer[i] * scale + 50) / 100;
+        tables[i] = (unsigned char)(lq < 1 ? 1 : (lq > 255 ? 255 : lq));
+        tables[i + 64] = (unsigned char)(cq < 1 ? 1 : (cq > 255 ? 255 : cq));
+    }
+}
+
+size_t __rtsp_jpeg_huffman(unsigned char *p, const unsigned char *lengths, const unsigned char *symbols,
+                           const size_t symbols_count, const int class_id) {
+    p[0] = 0xFF, p[1] = 0xC4;
+    p[2] = (unsigned char)((3 + 16 + symbols_count) >> 8), p[3] = (unsigned char)(3 + 16 + symbols_count);
+    p[4] = (unsigned char)class_id;
+    memcpy(p + 5, lengths, 16);
+    memcpy(p + 21, symbols, symbols_count);
+    return 21 + symbols_count;
+}
+
+size_t __rtsp_jpeg_headers(unsigned char *p, const int type, const int width, const int height,
+                           const unsigned char *tables, const int tables_count, const int dri) {
+    size_t n = 0;
+    p[n++] = 0xFF, p[n++] = 0xD8;
+    p[n++] = 0xFF, p[n++] = 0xDB;
+    p[n++] = 0, p[n++] = (unsigned char)(2 + 65 * tables_count);
+    for (int i = 0; i < tables_count; i++) {
+        p[n++] = (unsigned char)i;
+        memcpy(p + n, tables + i * 64, 64);
+        n += 64;
+    }
+    if (dri > 0) {
+        p[n++] = 0xFF, p[n++] = 0xDD, p[n++] = 0, p[n++] = 4;
+        p[n++] = (unsigned char)(dri >> 8), p[n++] = (unsigned char)dri;
+    }
+    p[n++] = 0xFF, p[n++] = 0xC0, p[n++] = 0, p[n++] = 17, p[n++] = 8;
+    p[n++] = (unsigned char)(height >> 8), p[n++] = (unsigned char)height;
+    p[n++] = (unsigned char)(width >> 8), p[n++] = (unsigned char)width;
+    p[n++] = 3;
+    p[n++] = 1, p[n++] = (type & 0x3F) == 0 ? 0x21 : 0x22, p[n++] = 0;
+    p[n++] = 2, p[n++] = 0x11, p[n++] = tables_count > 1 ? 1 : 0;
+    p[n++] = 3, p[n++] = 0x11, p[n++] = tables_count > 1 ? 1 : 0;
+    n += __rtsp_jpeg_huffman(p + n, __rtsp_jpeg_luma_dc_lengths, __rtsp_jpeg_dc_symbols, 12, 0x00);
+    n += __rtsp_jpeg_huffman(p + n, __rtsp_jpeg_luma_ac_lengths, __rtsp_jpeg_luma_ac_symbols, 162, 0x10);
+    n += __rtsp_jpeg_huffman(p + n, __rtsp_jpeg_chroma_dc_lengths, __rtsp_jpeg_dc_symbols, 12, 0x01);
+    n += __rtsp_jpeg_huffman(p + n, __rtsp_jpeg_chroma_ac_lengths, __rtsp_jpeg_chroma_ac_symbols, 162, 0x11);
+    p[n++] = 0xFF, p[n++] = 0xDA, p[n++] = 0, p[n++] = 12, p[n++] = 3;
+    p[n++] = 1, p[n++] = 0x00;
+    p[n++] = 2, p[n++] = 0x11;
+    p[n++] = 3, p[n++] = 0x11;
+    p[n++] = 0, p[n++] = 63, p[n++] = 0;
+    return n;
+}
+
+#define RTSP_JPEG_HEADERS_MAX 1024
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+bool __rtsp_unit_append(rtsp_client_t *client, const unsigned char *data, const size_t length, const bool start_code) {
+    const size_t needed = client->unit_size + length + (start_code ? 4 : 0);
+    if (needed > RTSP_FRAME_MAX) {
+        client->unit_broken = true;
+        return false;
+    }
+#ifdef RTSP_LIBAV
+    const size_t padding = AV_INPUT_BUFFER_PADDING_SIZE;
+#else
+    const size_t padding = 0;
+#endif
+    if (needed + padding > client->unit_capacity) {
+        size_t capacity = client->unit_capacity ? client->unit_capacity : 256 * 1024;
+        while (capacity < needed + padding)
+            capacity *= 2;
+        unsigned char *unit = realloc(client->unit, capacity);
+        if (unit == NULL) {
+            client->unit_broken = true;
+            return false;
+        }
+        client->unit = unit;
+        client->unit_capacity = capacity;
+    }
+    if (start_code) {
+        static const unsigned char code[4] = {0, 0, 0, 1};
+        memcpy(client->unit + client->unit_size, code, 4);
+        client->unit_size += 4;
+    }
+    memcpy(client->unit + client->unit_size, data, length);
+    client->unit_size += length;
+    return true;
+}
+
+void __rtsp_unit_nal(rtsp_client_t *client, const int type) {
+    if (client->codec == RTSP_CODEC_H264) {
+        if (type == 5)
+            client->unit_keyframe = true;
+        else if (type == 7 || type == 8)
+            client->unit_params = true;
+    } else {
+        if (type >= 16 && type <= 21)
+            client->unit_keyframe = true;
+        else if (type >= 32 && type <= 34)
+            client->unit_params = true;
+    }
+}
+
+void __rtsp_depacketise_h26x(rtsp_client_t *client, const unsigned char *p, const size_t length) {
+    const bool h265 = client->codec == RTSP_CODEC_H265;
+    const size_t header = h265 ? 2 : 1;
+    if (length < header + 1)
+        return;
+    const int type = h265 ? (p[0] >> 1) & 0x3F : p[0] & 0x1F;
+    const int aggregate = h265 ? 48 : 24, fragment = h265 ? 49 : 28;
+    if (type == aggregate) {
+        for (size_t offset = header; offset + 2 < length;) {
+            const size_t size = ((size_t)p[offset] << 8) | p[offset + 1];
+            offset += 2;
+            if (size == 0 || offset + size > length)
+                break;
+            __rtsp_unit_nal(client, h265 ? (p[offset] >> 1) & 0x3F : p[offset] & 0x1F);
+            __rtsp_unit_append(client, p + offset, size, true);
+            offset += size;
+        }
+    } else if (type == fragment) {
+        const unsigned char fu = p[header];
+        const int fu_type = h265 ? fu & 0x3F : fu & 0x1F;
+        if (fu & 0x80) {
+            unsigned char nal[2];
+            if (h265)
+                nal[0] = (unsigned char)((p[0] & 0x81) | (fu_type << 1)), nal[1] = p[1];
+            else
+                nal[0] = (unsigned char)((p[0] & 0xE0) | fu_type);
+            __rtsp_unit_nal(client, fu_type);
+            __rtsp_unit_append(client, nal, header, true);
+            client->unit_fragment = true;
+        } else if (!client->unit_fragment) {
+            client->unit_broken = true;
+            return;
+        }
+        __rtsp_unit_append(client, p + header + 1, length - header - 1, false);
+        if (fu & 0x40)
+            client->unit_fragment = false;
+    } else {
+        __rtsp_unit_nal(client, type);
+        __rtsp_unit_append(client, p, length, true);
+    }
+}
+
+void __rtsp_depacketise_jpeg(rtsp_client_t *client, const unsigned char *p, const size_t length) {
+    if (length < 8)
+        return;
+    const size_t fragment_offset = ((size_t)p[1] << 16) | ((size_t)p[2] << 8) | p[3];
+    const int type = p[4], q = p[5];
+    size_t offset = 8;
+    if (fragment_offset == 0) {
+        client->unit_size = 0;
+        client->unit_broken = false;
+        client->jpeg_type = type;
+        client->jpeg_q = q;
+        client->jpeg_width = p[6] * 8;
+        client->jpeg_height = p[7] * 8;
+        client->jpeg_dri = 0;
+    } else if (fragment_offset + client->jpeg_headers_size != client->unit_size)
+        client->unit_broken = true;
+    if (type >= 64 && type <= 127) {
+        if (length < offset + 4)
+            return;
+        if (fragment_offset == 0)
+            client->jpeg_dri = (p[offset] << 8) | p[offset + 1];
+        offset += 4;
+    }
+    if (fragment_offset == 0) {
+        if (q >= 128) {
+            if (length < offset + 4)
+                return;
+            const int precision = p[offset + 1];
+            const size_t tables_length = ((size_t)p[offset + 2] << 8) | p[offset + 3];
+            offset += 4;
+            if (tables_length > 0) { // else tables were sent in an earlier frame and are reused
+                if (precision != 0 || tables_length > sizeof(client->jpeg_qtables) || length < offset + tables_length) {
+                    client->unit_broken = true;
+                    return;
+                }
+                memcpy(client->jpeg_qtables, p + offset, tables_length);
+                client->jpeg_qtables_size = (int)tables_length;
+                offset += tables_length;
+            } else if (client->jpeg_qtables_size == 0)
+                client->unit_broken = true;
+        } else {
+            __rtsp_jpeg_tables(q, client->jpeg_qtables);
+            client->jpeg_qtables_size = 128;
+        }
+        // the frame is assembled in place behind its reconstructed headers, so it is complete without another copy
+        unsigned char headers[RTSP_JPEG_HEADERS_MAX];
+        client->jpeg_headers_size =
+            client->unit_broken ? 0
+                                : __rtsp_jpeg_headers(headers, type, client->jpeg_width, client->jpeg_height,
+                                                      client->jpeg_qtables, client->jpeg_qtables_size / 64,
+                                                      client->jpeg_dri);
+        if (!client->unit_broken)
+            __rtsp_unit_append(client, headers, client->jpeg_headers_size, false);
+    }
+    __rtsp_unit_append(client, p + offset, length - offset, false);
+    client->unit_keyframe = true;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+#ifdef RTSP_LIBAV
+
+void __rtsp_decoder_end(rtsp_client_t *client) {
+    avcodec_free_context(&client->decoder);
+    avcodec_free_context(&client->encoder);
+    av_frame_free(&client->decoded);
+    av_packet_free(&client->packet);
+}
+
+bool __rtsp_decoder_begin(rtsp_client_t *client) {
+    const AVCodec *codec = avcodec_find_decoder(client->codec == RTSP_CODEC_H264 ? AV_CODEC_ID_H264 : AV_CODEC_ID_HEVC);
+    if (codec == NULL || (client->decoder = avcodec_alloc_context3(codec)) == NULL) {
+        fprintf(stderr, "rtsp: decoder unavailable\n");
+        return false;
+    }
+    client->decoder->skip_frame = AVDISCARD_NONKEY;
+    client->decoder->flags |= AV_CODEC_FLAG_LOW_DELAY;
+    client->decoder->thread_count = 1;
+    if (avcodec_open2(client->decoder, codec, NULL) < 0 || (client->decoded = av_frame_alloc()) == NULL ||
+        (client->packet = av_packet_alloc()) == NULL) {
+        fprintf(stderr, "rtsp: decoder open failed\n");
+        __rtsp_decoder_end(client);
+        return false;
+    }
+    return true;
+}
+
+bool __rtsp_encoder_prepare(rtsp_client_t *client, const AVFrame *frame) {
+    AVCodecContext *encoder = client->encoder;
+    if (encoder && encoder->width == frame->width && encoder->height == frame->height &&
+        (int)encoder->pix_fmt == frame->format)
+        return true;
+    avcodec_free_context(&client->encoder);
+    const AVCodec *codec = avcodec_find_encoder(AV_CODEC_ID_MJPEG);
+    if (codec == NULL || (encoder = avcodec_alloc_context3(codec)) == NULL)
+        return false;
+    encoder->width = frame->width;
+    encoder->height = frame->height;
+    encoder->pix_fmt = (enum AVPixelFormat)frame->format;
+    encoder->color_range = AVCOL_RANGE_JPEG;
+    encoder->time_base = (AVRational){1, 25};
+    encoder->flags |= AV_CODEC_FLAG_QSCALE;
+    encoder->global_quality = FF_QP2LAMBDA * client->config.quality;
+    encoder->strict_std_compliance = FF_COMPLIANCE_UNOFFICIAL;
+    if (avcodec_open2(encoder, codec, NULL) < 0) {
+        fprintf(stderr, "rtsp: encoder open failed (%dx%d, format=%d)\n", frame->width, frame->height, frame->format);
+        avcodec_free_context(&encoder);
+        return false;
+    }
+    client->encoder = encoder;
+    return true;
+}
+
+bool __rtsp_decode(rtsp_client_t *client, const unsigned char *data, const size_t size,
+                   rtsp_frame_callback_t callback, void *context) {
+    bool delivered = false;
+    client->packet->data = (uint8_t *)data;
+    client->packet->size = (int)size;
+    client->packet->flags = AV_PKT_FLAG_KEY;
+    // keyframes are decoded in isolation: send, drain, then reset the decoder for the next one
+    if (avcodec_send_packet(client->decoder, client->packet) == 0 && avcodec_send_packet(client->decoder, NULL) == 0)
+        while (avcodec_receive_frame(client->decoder, client->decoded) == 0) {
+            if (__rtsp_encoder_prepare(client, client->decoded)) {
+                client->decoded->quality = client->encoder->global_quality;
+                client->decoded->pict_type = AV_PICTURE_TYPE_NONE;
+                AVPacket *jpeg = av_packet_alloc();
+                if (jpeg && avcodec_send_frame(client->encoder, client->decoded) == 0)
+                    while (avcodec_receive_packet(client->encoder, jpeg) == 0) {
+                        callback(jpeg->data, (size_t)jpeg->size, context);
+                        delivered = true;
+                        av_packet_unref(jpeg);
+                    }
+                av_packet_free(&jpeg);
+            }
+            av_frame_unref(client->decoded);
+        }
+    avcodec_flush_buffers(client->decoder);
+    client->packet->data = NULL;
+    client->packet->size = 0;
+    return delivered;
+}
+
+#endif
+
+void __rtsp_unit_finish(rtsp_client_t *client, rtsp_frame_callback_t callback, void *context) {
+    if (client->unit_started && !client->unit_broken && client->unit_keyframe && client->unit_size > 0) {
+        if (client->codec == RTSP_CODEC_JPEG) {
+            static const unsigned char eoi[2] = {0xFF, 0xD9};
+            const size_t n = client->unit_size;
+            if ((n >= 2 && client->unit[n - 2] == 0xFF && client->unit[n - 1] == 0xD9) ||
+                __rtsp_unit_append(client, eoi, sizeof(eoi), false)) {
+                client->keyframes++;
+                callback(client->unit, client->unit_size, context);
+            }
+        } else {
+#ifdef RTSP_LIBAV
+            // prepend out-of-band parameter sets from the SDP when the keyframe does not carry them
+            if (!client->unit_params && client->params_size > 0 &&
+                __rtsp_unit_append(client, client->params, client->params_size, false)) {
+                memmove(client->unit + client->params_size, client->unit, client->unit_size - client->params_size);
+                memcpy(client->unit, client->params, client->params_size);
+            }
+            memset(client->unit + client->unit_size, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+            client->keyframes++;
+            if (!__rtsp_decode(client, client->unit, client->unit_size, callback, context))
+                client->errors++;
+#else
+            (void)callback, (void)context;
+#endif
+        }
+    }
+    client->unit_size = client->jpeg_headers_size = 0;
+    client->unit_started = client->unit_broken = client->unit_keyframe = false;
+    client->unit_params = client->unit_fragment = false;
+}
+
+void __rtsp_rtp(rtsp_client_t *client, const unsigned char *p, size_t length, rtsp_frame_callback_t callback,
+                void *context) {
+    if (length < 12 || (p[0] >> 6) != 2)
+        return;
+    const bool padding = p[0] & 0x20, extension = p[0] & 0x10, marker = p[1] & 0x80;
+    const int csrc = p[0] & 0x0F, payload_type = p[1] & 0x7F;
+    const uint16_t sequence = (uint16_t)((p[2] << 8) | p[3]);
+    const uint32_t timestamp = ((uint32_t)p[4] << 24) | ((uint32_t)p[5] << 16) | ((uint32_t)p[6] << 8) | p[7];
+    if (payload_type != client->payload_type)
+        return;
+    size_t offset = 12 + (size_t)csrc * 4;
+    if (extension) {
+        if (length < offset + 4)
+            return;
+        offset += 4 + 4 * (((size_t)p[offset + 2] << 8) | p[offset + 3]);
+    }
+    if (offset >= length)
+        return;
+    if (padding) {
+        // the padding count comes off the wire, a packet it does not fit in is dropped
+        if (p[length - 1] == 0 || p[length - 1] > length - offset)
+            return;
+        length -= p[length - 1];
+        if (offset >= length)
+            return;
+    }
+    client->frames += marker;
+    // a gap may belong to the unit in progress or the one starting here, so both are discarded
+    const bool lost = client->sequence_valid && sequence != (uint16_t)(client->sequence + 1);
+    if (lost)
+        client->unit_broken = true;
+    if (client->unit_started && timestamp != client->unit_timestamp) // marker lost or not set by the sender
+        __rtsp_unit_finish(client, callback, context);
+    if (lost)
+        client->unit_broken = true;
+    client->sequence = sequence;
+    client->sequence_valid = true;
+    client->unit_started = true;
+    client->unit_timestamp = timestamp;
+    if (client->codec == RTSP_CODEC_JPEG)
+        __rtsp_depacketise_jpeg(client, p + offset, length - offset);
+    else
+        __rtsp_depacketise_h26x(client, p + offset, length - offset);
+    if (marker)
+        __rtsp_unit_finish(client, callback, context);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+void __rtsp_close(rtsp_client_t *client) {
+    if (client->sock >= 0) {
+        if (client->session[0]) {
+            char request[512];
+            const int length =
+                snprintf(request, sizeof(request), "TEARDOWN %s RTSP/1.0\r\nCSeq: %d\r\nSession: %s\r\n\r\n",
+                         client->url, ++client->cseq, client->session);
+            if (length > 0 && (size_t)length < sizeof(request))
+                send(client->sock, request, (size_t)length, MSG_NOSIGNAL | MSG_DONTWAIT);
+        }
+        close(client->sock);
+        client->sock = -1;
+    }
+#ifdef RTSP_LIBAV
+    __rtsp_decoder_end(client);
+#endif
+    free(client->unit);
+    client->unit = NULL;
+    client->unit_capacity = 0;
+}
+
+void rtsp_end(rtsp_client_t *client) {
+    __rtsp_close(client);
+    if (client->wake >= 0)
+        close(client->wake);
+    client->wake = -1;
+}
+
+// clears the client for rtsp_begin; a client stopped from another thread is reset under the lock held there to call
+// rtsp_stop, so that no stop is lost, and rtsp_stop may then interrupt the connect and handshake as well as the session
+// until rtsp_end, which always follows
+void rtsp_reset(rtsp_client_t *client) {
+    memset(client, 0, sizeof(*client));
+    client->sock = -1;
+    client->wake = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+}
+
+bool rtsp_begin(rtsp_client_t *client, const char *url, const RtspConfig *config) {
+    client->config = *config;
+    if (client->config.timeout <= 0)
+        client->config.timeout = RTSP_TIMEOUT_DEFAULT;
+    if (client->config.quality <= 0)
+        client->config.quality = RTSP_QUALITY_DEFAULT;
+    if (!rtsp_parse(url, client->host, sizeof(client->host), &client->port, client->user, client->pass,
+                    sizeof(client->user), client->url, sizeof(client->url))) {
+        fprintf(stderr, "rtsp: error parsing details in '%s'\n", url);
+        return false;
+    }
+    if ((client->sock = __rtsp_connect(client->host, client->port, client->config.timeout, client->wake)) < 0)
+        return false;
+    if (!__rtsp_request(client, "OPTIONS", client->url, NULL) || !__rtsp_describe(client)) {
+        __rtsp_close(client);
+        return false;
+    }
+#ifdef RTSP_LIBAV
+    if (client->codec != RTSP_CODEC_JPEG && !__rtsp_decoder_begin(client)) {
+        __rtsp_close(client);
+        return false;
+    }
+#else
+    if (client->codec != RTSP_CODEC_JPEG) {
+        fprintf(stderr, "rtsp: %s stream requires libavcodec (build with LIBAV=1)\n",
+                client->codec == RTSP_CODEC_H264 ? "H264" : "H265");
+        __rtsp_close(client);
+        return false;
+    }
+#endif
+    if (!__rtsp_setup(client) || !__rtsp_request(client, "PLAY", client->url, "Range: npt=0.000-\r\n")) {
+        __rtsp_close(client);
+        return false;
+    }
+    client->keepalive_last = time(NULL);
+    printf("rtsp: playing (host='%s', port=%d, codec=%s, channel=%d)\n", client->host, client->port,
+           client->codec == RTSP_CODEC_H264 ? "H264" : (client->codec == RTSP_CODEC_H265 ? "H265" : "JPEG"),
+           client->channel);
+    return true;
+}
+
+// processes one interleaved packet (or stray response), delivering any completed frame; false when the session is lost
+bool rtsp_process(rtsp_client_t *client, rtsp_frame_callback_t callback, void *context) {
+    const time_t now = time(NULL);
+    if (now - client->keepalive_last >= client->keepalive_interval) {
+        char request[1024], authorization[768];
+        __rtsp_authorization(client, "GET_PARAMETER", client->url, authorization, sizeof(authorization));
+        const int length =
+            snprintf(request, sizeof(request), "GET_PARAMETER %s RTSP/1.0\r\nCSeq: %d\r\n%sSession: %s\r\n\r\n",
+                     client->url, ++client->cseq, authorization, client->session);
+        if (length < 0 || (size_t)length >= sizeof(request) || !__rtsp_send(client, request, (size_t)length))
+            return false;
+        client->keepalive_last = now;
+    }
+    while (client->rx_size < 4)
+        if (!__rtsp_fill(client))
+            return false;
+    if (client->rx[0] == '$') {
+        const size_t length = ((size_t)client->rx[2] << 8) | client->rx[3];
+        while (client->rx_size < 4 + length)
+            if (!__rtsp_fill(client))
+                return false;
+        if (client->rx[1] == client->channel)
+            __rtsp_rtp(client, client->rx + 4, length, callback, context);
+        __rtsp_consume(client, 4 + length);
+    } else if (memcmp(client->rx, "RTSP", 4) == 0) { // keepalive response
+        if (!__rtsp_response(client))
+            return false;
+    } else
+        __rtsp_consume(client, 1);
+    return true;
+}
+
+// called from the frame callback: takes the buffer holding the frame in exchange for another malloc'd buffer, so the
+// frame is not copied; only frames assembled in the client's own buffer (JPEG payloads) can be taken this way
+bool rtsp_frame_exchange(rtsp_client_t *client, const unsigned char *data, unsigned char **buffer, size_t *capacity) {
+    if (data == NULL || data != client->unit)
+        return false;
+    unsigned char *unit = client->unit;
+    const size_t unit_capacity = client->unit_capacity;
+    client->unit = *buffer;
+    client->unit_capacity = *capacity;
+    *buffer = unit;
+    *capacity = unit_capacity;
+    return true;
+}
+
+// unblocks a thread inside rtsp_begin or rtsp_process (e.g. on shutdown), between rtsp_reset and rtsp_end
+void rtsp_stop(rtsp_client_t *client) {
+    const uint64_t one = 1;
+    if (client->wake >= 0 && write(client->wake, &one, sizeof(one)) < 0)
+        fprintf(stderr, "rtsp: stop failed: %s\n", strerror(errno));
+}
+
+// liveness check without a session: connects, sends OPTIONS and reads the status line, within timeout seconds for
+// each; returns the status (any answer, 401 included, means the server is up) or -1 when there was none
+int rtsp_probe(const char *string, const int timeout) {
+    char host[256], user[64], pass[64], url[512];
+    int port;
+    if (!rtsp_parse(string, host, sizeof(host), &port, user, pass, sizeof(user), url, sizeof(url)))
+        return -1;
+    const int seconds = timeout > 0 ? timeout : RTSP_TIMEOUT_DEFAULT;
+    const int sock = __rtsp_connect(host, port, seconds, -1);
+    if (sock < 0)
+        return -1;
+    char request[640], response[256];
+    const int length =
+        snprintf(request, sizeof(request), "OPTIONS %s RTSP/1.0\r\nCSeq: 1\r\nUser-Agent: %s\r\n\r\n", url,
+                 RTSP_USER_AGENT);
+    size_t size = 0;
+    if (length > 0 && (size_t)length < sizeof(request) &&
+        send(sock, request, (size_t)length, MSG_NOSIGNAL) == (ssize_t)length) {
+        struct pollfd pfd = {.fd = sock, .events = POLLIN};
+        while (size < sizeof(response) - 1 && memchr(response, '\n', size) == NULL &&
+               poll(&pfd, 1, seconds * 1000) == 1) {
+            const ssize_t bytes = recv(sock, response + size, sizeof(response) - 1 - size, 0);
+            if (bytes <= 0)
+                break;
+            size += (size_t)bytes;
+        }
+    }
+    close(sock);
+    response[size] = '\0';
+    int status = -1;
+    if (strncmp(response, "RTSP/1.", 7) != 0 || sscanf(response, "RTSP/1.%*d %d", &status) != 1)
+        return -1;
+    return status;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,201 @@
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// deadlines are CLOCK_MONOTONIC nanoseconds, so NTP steps never stretch or squeeze the cadence; the wait sleeps in one
+// epoll on a timerfd armed with the absolute deadline and returns early for schedule_wake (an eventfd, safe to write
+// from a signal handler, and remembered if the wake comes before the wait), when the wall clock is set, which is the
+// cue to recompute deadlines aligned to wall-clock boundaries, or for SIGINT/SIGTERM/SIGHUP, taken from a signalfd
+// (they must be blocked in every thread, see schedule_signals_block); other descriptors (child pipes, pidfds) are added
+// with schedule_watch and their handlers run from within the wait
+
+#define SCHEDULE_NS_PER_SECOND 1000000000LL
+#define SCHEDULE_NS_PER_MS 1000000LL
+#define SCHEDULE_EVENTS_MAX 32
+
+// in rising priority: when several happen in one wait the highest is returned
+typedef enum { SCHEDULE_IO, SCHEDULE_TIMER, SCHEDULE_WAKE, SCHEDULE_CLOCK, SCHEDULE_SIGNAL } schedule_event_t;
+
+typedef struct {
+    int epoll, timer, wake, clock, signal;
+    int signal_number; // of the last SCHEDULE_SIGNAL
+} schedule_t;
+
+// handlers must cope with being called when nothing is ready (the descriptor was replaced within one wait)
+typedef void (*schedule_handler_t)(void *context);
+
+typedef struct {
+    int fd;
+    schedule_handler_t handler;
+    void *context;
+} schedule_watch_t;
+
+int64_t schedule_monotonic(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * SCHEDULE_NS_PER_SECOND + ts.tv_nsec;
+}
+
+// wall clock in the local time zone, so that aligned hours and days follow local midnight
+int64_t __schedule_local(void) {
+    struct timespec ts;
+    struct tm tm;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    localtime_r(&ts.tv_sec, &tm);
+    return ((int64_t)ts.tv_sec + tm.tm_gmtoff) * SCHEDULE_NS_PER_SECOND + ts.tv_nsec;
+}
+
+// the first monotonic time after 'after' at which the local wall clock is a whole multiple of interval
+int64_t schedule_align(const int64_t interval, const int64_t after) {
+    const int64_t offset = __schedule_local() - schedule_monotonic();
+    return ((after + offset) / interval + 1) * interval - offset;
+}
+
+// arms (or re-arms) a realtime timer a year out that is cancelled whenever the wall clock is set
+bool __schedule_clock_arm(schedule_t *schedule) {
+    struct itimerspec spec = {0};
+    clock_gettime(CLOCK_REALTIME, &spec.it_value);
+    spec.it_value.tv_sec += 365 * 24 * 60 * 60;
+    return timerfd_settime(schedule->clock, TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET, &spec, NULL) == 0;
+}
+
+// to be called before any thread is created, so that all of them inherit the mask
+void schedule_signals_block(void) {
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+}
+
+void schedule_end(schedule_t *schedule) {
+    const int fds[] = {schedule->signal, schedule->clock, schedule->wake, schedule->timer, schedule->epoll};
+    for (int i = 0; i < (int)(sizeof(fds) / sizeof(fds[0])); i++)
+        if (fds[i] >= 0)
+            close(fds[i]);
+    schedule->epoll = schedule->timer = schedule->wake = schedule->clock = schedule->signal = -1;
+}
+
+bool __schedule_add(schedule_t *schedule, const int fd, void *tag) {
+    struct epoll_event event = {.events = EPOLLIN, .data.ptr = tag};
+    return epoll_ctl(schedule->epoll, EPOLL_CTL_ADD, fd, &event) == 0;
+}
+
+bool schedule_begin(schedule_t *schedule) {
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGHUP);
+    schedule->epoll = epoll_create1(EPOLL_CLOEXEC);
+    schedule->timer = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    schedule->wake = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    schedule->clock = timerfd_create(CLOCK_REALTIME, TFD_CLOEXEC | TFD_NONBLOCK);
+    schedule->signal = signalfd(-1, &mask, SFD_CLOEXEC | SFD_NONBLOCK);
+    schedule->signal_number = 0;
+    if (schedule->epoll < 0 || schedule->timer < 0 || schedule->wake < 0 || schedule->clock < 0 ||
+        schedule->signal < 0 || !__schedule_clock_arm(schedule) ||
+        !__schedule_add(schedule, schedule->timer, &schedule->timer) ||
+        !__schedule_add(schedule, schedule->wake, &schedule->wake) ||
+        !__schedule_add(schedule, schedule->clock, &schedule->clock) ||
+        !__schedule_add(schedule, schedule->signal, &schedule->signal)) {
+        fprintf(stderr, "schedule: failed to create timers (%s)\n", strerror(errno));
+        schedule_end(schedule);
+        return false;
+    }
+    return true;
+}
+
+bool schedule_watch(schedule_t *schedule, schedule_watch_t *watch, const int fd, schedule_handler_t handler,
+                    void *context) {
+    watch->handler = handler;
+    watch->context = context;
+    watch->fd = fd;
+    if (__schedule_add(schedule, fd, watch))
+        return true;
+    fprintf(stderr, "schedule: failed to watch descriptor (%s)\n", strerror(errno));
+    watch->fd = -1;
+    return false;
+}
+
+void schedule_unwatch(schedule_t *schedule, schedule_watch_t *watch) {
+    if (watch->fd >= 0)
+        epoll_ctl(schedule->epoll, EPOLL_CTL_DEL, watch->fd, NULL);
+    watch->fd = -1;
+}
+
+// async-signal-safe
+void schedule_wake(schedule_t *schedule) {
+    const uint64_t one = 1;
+    if (schedule->wake >= 0 && write(schedule->wake, &one, sizeof(one)) < 0) {
+        // counter saturated: a wake is already pending
+    }
+}
+
+schedule_event_t schedule_wait(schedule_t *schedule, const int64_t deadline) {
+    const struct itimerspec spec = {.it_value = {.tv_sec = (time_t)(deadline / SCHEDULE_NS_PER_SECOND),
+                                                 .tv_nsec = (long)(deadline % SCHEDULE_NS_PER_SECOND)}};
+    if (deadline <= schedule_monotonic() || timerfd_settime(schedule->timer, TFD_TIMER_ABSTIME, &spec, NULL) != 0)
+        return SCHEDULE_TIMER;
+    struct epoll_event events[SCHEDULE_EVENTS_MAX];
+    int count;
+    while ((count = epoll_wait(schedule->epoll, events, SCHEDULE_EVENTS_MAX, -1)) < 0)
+        if (errno != EINTR)
+            return SCHEDULE_TIMER;
+    schedule_event_t result = SCHEDULE_IO;
+    for (int i = 0; i < count; i++) {
+        void *tag = events[i].data.ptr;
+        uint64_t value;
+        schedule_event_t event = SCHEDULE_IO;
+        if (tag == &schedule->wake) {
+            if (read(schedule->wake, &value, sizeof(value)) < 0) {
+                // consumed by a concurrent wait
+            }
+            event = SCHEDULE_WAKE;
+        } else if (tag == &schedule->clock) {
+            const bool set = read(schedule->clock, &value, sizeof(value)) < 0 && errno == ECANCELED;
+            __schedule_clock_arm(schedule);
+            if (set)
+                event = SCHEDULE_CLOCK;
+        } else if (tag == &schedule->timer) {
+            if (read(schedule->timer, &value, sizeof(value)) < 0) {
+                // already consumed, the deadline has passed either way
+            }
+            event = SCHEDULE_TIMER;
+        } else if (tag == &schedule->signal) {
+            struct signalfd_siginfo info;
+            if (read(schedule->signal, &info, sizeof(info)) == sizeof(info)) {
+                schedule->signal_number = (int)info.ssi_signo;
+                event = SCHEDULE_SIGNAL;
+            }
+        } else {
+            schedule_watch_t *watch = (schedule_watch_t *)tag;
+            if (watch->fd >= 0)
+                watch->handler(watch->context);
+        }
+        if (event > result)
+            result = event;
+    }
+    return result;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
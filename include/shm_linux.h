@@ -0,0 +1,240 @@
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// ring of frames in a POSIX shared memory object (shm_open, i.e. /dev/shm/<name>) for readers on the same host to map
+// and read in place, without a copy per reader; one writer, any number of readers, integers in native byte order:
+//
+//   offset  size  field
+//        0     4  magic "RTSM"
+//        4     4  version (1)
+//        8     4  slot count
+//       12     4  slot size, the largest frame a slot holds
+//       16     8  frames written, the newest in slot (written - 1) % slot count
+//       24     4  notify, incremented after every frame: FUTEX_WAIT on it (not private, the mapping is shared) to sleep
+//                 until the next one
+//       28     4  reserved
+//       32    64  camera name, NUL padded
+//       96        slots, each 64 + slot size (rounded up to 64) bytes:
+//        0     4  sequence, odd while the slot is being written (a seqlock)
+//        4     4  frame size
+//        8     8  frame number (the value of 'frames written' once it is in)
+//       16     8  time written, seconds since the epoch
+//       24     4  nanoseconds
+//       28    36  reserved
+//       64        the frame (JPEG)
+//
+// a reader takes the slot's sequence (acquire), skips the slot while it is odd, reads the frame where it is, then
+// takes the sequence again after an acquire fence: the frame is intact only if both are the same, even value.
+// shm_ring_latest and shm_ring_valid do this in C, tools/shm_read.py in python. The object is kept when the writer
+// ends, and taken over by the next writer of the same geometry (a restart or config reload) so readers carry on
+
+#define SHM_MAGIC "RTSM"
+#define SHM_VERSION 1
+#define SHM_HEADER_SIZE 96
+#define SHM_SLOT_HEADER_SIZE 64
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t slot_count, slot_size;
+    _Atomic uint64_t written;
+    _Atomic uint32_t notify;
+    uint32_t reserved;
+    char camera[64];
+} shm_header_t;
+
+typedef struct {
+    _Atomic uint32_t sequence;
+    uint32_t size;
+    uint64_t frame;
+    int64_t time_sec;
+    int32_t time_nsec;
+    char reserved[36];
+} shm_slot_t;
+
+_Static_assert(sizeof(shm_header_t) == SHM_HEADER_SIZE, "shm header layout");
+_Static_assert(sizeof(shm_slot_t) == SHM_SLOT_HEADER_SIZE, "shm slot layout");
+
+typedef struct {
+    char name[NAME_MAX];
+    int fd;
+    unsigned char *map;
+    size_t map_size, stride;
+    shm_header_t *header;
+} shm_ring_t;
+
+size_t __shm_stride(const uint32_t slot_size) {
+    return SHM_SLOT_HEADER_SIZE + ((size_t)slot_size + 63) / 64 * 64;
+}
+
+shm_slot_t *__shm_slot(const shm_ring_t *ring, const uint64_t frame) {
+    return (shm_slot_t *)(ring->map + SHM_HEADER_SIZE + ((frame - 1) % ring->header->slot_count) * ring->stride);
+}
+
+void shm_ring_end(shm_ring_t *ring) {
+    if (ring->map != NULL)
+        munmap(ring->map, ring->map_size);
+    if (ring->fd >= 0)
+        close(ring->fd);
+    ring->map = NULL;
+    ring->header = NULL;
+    ring->fd = -1;
+}
+
+// name as for shm_open ('/rtsptomqtt.garden'); an existing ring of the same geometry is carried on, anything else there
+// is replaced
+bool shm_ring_begin(shm_ring_t *ring, const char *name, const char *camera, const int slot_count,
+                    const size_t slot_size) {
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = -1;
+    snprintf(ring->name, sizeof(ring->name), "%s", name);
+    if (slot_count < 1 || slot_size < 1 || slot_size > UINT32_MAX) {
+        fprintf(stderr, "shm: %s: invalid geometry (slots=%d, size=%zu)\n", name, slot_count, slot_size);
+        return false;
+    }
+    ring->stride = __shm_stride((uint32_t)slot_size);
+    ring->map_size = SHM_HEADER_SIZE + (size_t)slot_count * ring->stride;
+    if ((ring->fd = shm_open(name, O_RDWR | O_CREAT | O_CLOEXEC, 0640)) < 0) {
+        fprintf(stderr, "shm: %s: open failed (%s)\n", name, strerror(errno));
+        return false;
+    }
+    struct stat status;
+    const bool existing = fstat(ring->fd, &status) == 0 && (size_t)status.st_size == ring->map_size;
+    if ((!existing && ftruncate(ring->fd, (off_t)ring->map_size) != 0) ||
+        (ring->map = mmap(NULL, ring->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, ring->fd, 0)) == MAP_FAILED) {
+        fprintf(stderr, "shm: %s: could not size or map %zu bytes (%s)\n", name, ring->map_size, strerror(errno));
+        ring->map = NULL;
+        shm_ring_end(ring);
+        return false;
+    }
+    ring->header = (shm_header_t *)ring->map;
+    if (existing && memcmp(ring->header->magic, SHM_MAGIC, 4) == 0 && ring->header->version == SHM_VERSION &&
+        ring->header->slot_count == (uint32_t)slot_count && ring->header->slot_size == (uint32_t)slot_size) {
+        // a writer killed mid-frame left its slot odd: made even (never the newest, written was not advanced to it)
+        // so that shm_ring_write keeps odd meaning 'being written'
+        for (uint64_t frame = 1; frame <= (uint64_t)slot_count; frame++) {
+            shm_slot_t *slot = __shm_slot(ring, frame);
+            const uint32_t sequence = atomic_load_explicit(&slot->sequence, memory_order_relaxed);
+            if ((sequence & 1) != 0)
+                atomic_store_explicit(&slot->sequence, sequence + 1, memory_order_release);
+        }
+        return true;
+    }
+    memset(ring->map, 0, SHM_HEADER_SIZE); // slots start out zero (even, nothing written) as the object is resized
+    if (existing)
+        memset(ring->map + SHM_HEADER_SIZE, 0, ring->map_size - SHM_HEADER_SIZE);
+    ring->header->version = SHM_VERSION;
+    ring->header->slot_count = (uint32_t)slot_count;
+    ring->header->slot_size = (uint32_t)slot_size;
+    snprintf(ring->header->camera, sizeof(ring->header->camera), "%s", camera);
+    atomic_thread_fence(memory_order_release);
+    memcpy(ring->header->magic, SHM_MAGIC, 4);
+    return true;
+}
+
+// from the one writer only; false for a frame larger than a slot
+bool shm_ring_write(shm_ring_t *ring, const unsigned char *data, const size_t size, const struct timespec *time) {
+    if (size > ring->header->slot_size)
+        return false;
+    const uint64_t frame = atomic_load_explicit(&ring->header->written, memory_order_relaxed) + 1;
+    shm_slot_t *slot = __shm_slot(ring, frame);
+    const uint32_t sequence = atomic_load_explicit(&slot->sequence, memory_order_relaxed);
+    atomic_store_explicit(&slot->sequence, sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    memcpy((unsigned char *)slot + SHM_SLOT_HEADER_SIZE, data, size);
+    slot->size = (uint32_t)size;
+    slot->frame = frame;
+    slot->time_sec = (int64_t)time->tv_sec;
+    slot->time_nsec = (int32_t)time->tv_nsec;
+    atomic_store_explicit(&slot->sequence, sequence + 2, memory_order_release);
+    atomic_store_explicit(&ring->header->written, frame, memory_order_release);
+    atomic_fetch_add_explicit(&ring->header->notify, 1, memory_order_release);
+    syscall(SYS_futex, &ring->header->notify, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+    return true;
+}
+
+// readers: maps an existing ring read-only
+bool shm_ring_open(shm_ring_t *ring, const char *name) {
+    memset(ring, 0, sizeof(*ring));
+    snprintf(ring->name, sizeof(ring->name), "%s", name);
+    struct stat status;
+    if ((ring->fd = shm_open(name, O_RDONLY | O_CLOEXEC, 0)) < 0 || fstat(ring->fd, &status) != 0 ||
+        (size_t)status.st_size < SHM_HEADER_SIZE) {
+        shm_ring_end(ring);
+        return false;
+    }
+    ring->map_size = (size_t)status.st_size;
+    if ((ring->map = mmap(NULL, ring->map_size, PROT_READ, MAP_SHARED, ring->fd, 0)) == MAP_FAILED) {
+        ring->map = NULL;
+        shm_ring_end(ring);
+        return false;
+    }
+    ring->header = (shm_header_t *)ring->map;
+    ring->stride = __shm_stride(ring->header->slot_size);
+    if (memcmp(ring->header->magic, SHM_MAGIC, 4) != 0 || ring->header->version != SHM_VERSION ||
+        ring->header->slot_count == 0 ||
+        SHM_HEADER_SIZE + (size_t)ring->header->slot_count * ring->stride > ring->map_size) {
+        shm_ring_end(ring);
+        return false;
+    }
+    return true;
+}
+
+// sleeps until a frame after the given count of frames written is in, or timeout milliseconds (-1 for none) pass;
+// returns the count now
+uint64_t shm_ring_wait(const shm_ring_t *ring, const uint64_t written, const int timeout) {
+    const struct timespec interval = {.tv_sec = timeout / 1000, .tv_nsec = (long)(timeout % 1000) * 1000000};
+    uint32_t notify = atomic_load_explicit(&ring->header->notify, memory_order_acquire);
+    uint64_t now;
+    while ((now = atomic_load_explicit(&ring->header->written, memory_order_acquire)) == written) {
+        if (syscall(SYS_futex, &ring->header->notify, FUTEX_WAIT, notify, timeout < 0 ? NULL : &interval, NULL, 0) !=
+                0 &&
+            errno == ETIMEDOUT)
+            break;
+        notify = atomic_load_explicit(&ring->header->notify, memory_order_acquire);
+    }
+    return now;
+}
+
+// the newest frame in place (0 when nothing is written yet or the slot is being rewritten), to be checked with
+// shm_ring_valid once read
+uint64_t shm_ring_latest(const shm_ring_t *ring, const unsigned char **data, size_t *size, uint32_t *sequence) {
+    const uint64_t written = atomic_load_explicit(&ring->header->written, memory_order_acquire);
+    if (written == 0)
+        return 0;
+    const shm_slot_t *slot = __shm_slot(ring, written);
+    *sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+    if ((*sequence & 1) != 0 || slot->frame != written || slot->size > ring->header->slot_size)
+        return 0;
+    *data = (const unsigned char *)slot + SHM_SLOT_HEADER_SIZE;
+    *size = slot->size;
+    return written;
+}
+
+// whether the frame read since shm_ring_latest was left alone by the writer meanwhile
+bool shm_ring_valid(const shm_ring_t *ring, const uint64_t frame, const uint32_t sequence) {
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(&__shm_slot(ring, frame)->sequence, memory_order_relaxed) == sequence;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
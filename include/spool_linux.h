@@ -0,0 +1,518 @@
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// bounded on-disk spool for messages that could not be published: records are appended to numbered segment files
+// (<directory>/<sequence>.spool) which are sealed once segment_max is reached, and beyond size_max the oldest segments
+// are dropped; a drain thread maps the oldest segment and replays it at 'rate' messages per second while connected,
+// deleting the segment once every record in it is acknowledged, so delivery is at least once (a disconnect part way
+// replays from the last acknowledged record); segments left by a previous run are replayed too; each record may
+// carry opaque attributes (e.g. message properties) that are handed back to the sender with it
+
+#define SPOOL_MAGIC 0x4c4f5053 // "SPOL"
+#define SPOOL_SUFFIX ".spool"
+#define SPOOL_INFLIGHT_MAX 64
+#define SPOOL_TOPIC_MAX 1024
+#define SPOOL_ATTRIBUTES_MAX 4096
+#define SPOOL_ACK_TIMEOUT 30 // seconds to wait for the acks of a replayed segment
+
+typedef struct {
+    uint32_t magic;
+    uint32_t crc; // of topic, attributes and payload
+    uint32_t topic_size, attributes_size, payload_size, reserved;
+    int64_t time; // wall clock seconds when spooled
+} spool_record_t;  // followed by topic, attributes, payload and padding to 8 bytes
+
+typedef struct {
+    unsigned long sequence;
+    size_t size, acked; // acked: replayed and acknowledged up to here
+} spool_segment_t;
+
+// *mid receives the message id whose ack completes the record, or stays 0 if there is nothing to wait for (the sender
+// chose to skip the record, e.g. because it expired)
+typedef bool (*spool_send_t)(const char *topic, const unsigned char *attributes, size_t attributes_size,
+                             const unsigned char *data, size_t size, int64_t spooled, int *mid);
+typedef bool (*spool_connected_t)(void);
+
+typedef struct {
+    size_t size;
+    int segments;
+    unsigned long appended, replayed, skipped, evicted, corrupt;
+} spool_stats_t;
+
+typedef struct {
+    char directory[PATH_MAX - 32]; // room for the segment names
+    size_t size_max, segment_max;
+    double rate;
+    int inflight_max;
+    spool_send_t send;
+    spool_connected_t connected;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond; // CLOCK_MONOTONIC
+    pthread_t thread;
+    bool running;
+    spool_segment_t *segments; // oldest first; while fd >= 0 the last one is being appended to
+    int segment_count, segment_capacity;
+    int fd;
+    size_t size;
+    unsigned long draining; // sequence being replayed, never evicted
+    struct {
+        int mid;
+        bool acked;
+        size_t end;
+    } inflight[SPOOL_INFLIGHT_MAX];
+    int inflight_head, inflight_count;
+    size_t inflight_acked;
+    bool sending;
+    int early[8]; // acks that arrived while their send was still returning
+    int early_next;
+    unsigned long appended, replayed, skipped, evicted, corrupt;
+} spool_t;
+
+uint32_t __spool_crc_table[256];
+pthread_once_t __spool_crc_once = PTHREAD_ONCE_INIT;
+
+void __spool_crc_init(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++)
+            c = c & 1 ? 0xedb88320U ^ (c >> 1) : c >> 1;
+        __spool_crc_table[i] = c;
+    }
+}
+
+// CRC-32 (as zlib), chainable
+uint32_t __spool_crc(uint32_t crc, const unsigned char *data, size_t size) {
+    pthread_once(&__spool_crc_once, __spool_crc_init);
+    crc = ~crc;
+    while (size--)
+        crc = __spool_crc_table[(crc ^ *data++) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+void __spool_path(const spool_t *spool, const unsigned long sequence, char *path, const size_t size) {
+    snprintf(path, size, "%s/%020lu" SPOOL_SUFFIX, spool->directory, sequence);
+}
+
+size_t __spool_padded(const size_t size) {
+    return (size + 7) & ~(size_t)7;
+}
+
+bool __spool_segment_push(spool_t *spool, const unsigned long sequence, const size_t size) {
+    if (spool->segment_count == spool->segment_capacity) {
+        const int capacity = spool->segment_capacity ? spool->segment_capacity * 2 : 16;
+        spool_segment_t *segments = realloc(spool->segments, (size_t)capacity * sizeof(spool_segment_t));
+        if (segments == NULL)
+            return false;
+        spool->segments = segments;
+        spool->segment_capacity = capacity;
+    }
+    spool->segments[spool->segment_count++] = (spool_segment_t){.sequence = sequence, .size = size};
+    return true;
+}
+
+void __spool_segment_remove(spool_t *spool, const int index) {
+    char path[PATH_MAX];
+    __spool_path(spool, spool->segments[index].sequence, path, sizeof(path));
+    if (unlink(path) < 0 && errno != ENOENT)
+        fprintf(stderr, "spool: could not remove '%s' (%s)\n", path, strerror(errno));
+    spool->size -= spool->segments[index].size;
+    memmove(&spool->segments[index], &spool->segments[index + 1],
+            (size_t)(spool->segment_count - index - 1) * sizeof(spool_segment_t));
+    spool->segment_count--;
+}
+
+// closes the segment being appended to, the next append starts a new one
+void __spool_seal(spool_t *spool) {
+    if (spool->fd >= 0) {
+        fdatasync(spool->fd);
+        close(spool->fd);
+        spool->fd = -1;
+    }
+}
+
+// drops the oldest segments (other than those being replayed or appended to) until within size_max
+void __spool_evict(spool_t *spool) {
+    int index = 0;
+    while (spool->size > spool->size_max && index < spool->segment_count) {
+        const spool_segment_t *segment = &spool->segments[index];
+        if (segment->sequence == spool->draining || (spool->fd >= 0 && index == spool->segment_count - 1)) {
+            index++;
+            continue;
+        }
+        fprintf(stderr, "spool: full, dropped segment %lu (%zu bytes)\n", segment->sequence, segment->size);
+        __spool_segment_remove(spool, index);
+        spool->evicted++;
+    }
+}
+
+int __spool_segment_compare(const void *a, const void *b) {
+    const unsigned long x = ((const spool_segment_t *)a)->sequence, y = ((const spool_segment_t *)b)->sequence;
+    return x < y ? -1 : x > y ? 1 : 0;
+}
+
+// segments left by a previous run, oldest first
+bool __spool_scan(spool_t *spool) {
+    DIR *dir = opendir(spool->directory);
+    if (dir == NULL) {
+        fprintf(stderr, "spool: could not open '%s' (%s)\n", spool->directory, strerror(errno));
+        return false;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        char *end;
+        const unsigned long sequence = strtoul(entry->d_name, &end, 10);
+        if (end == entry->d_name || strcmp(end, SPOOL_SUFFIX) != 0 || sequence == 0)
+            continue;
+        char path[PATH_MAX];
+        struct stat st;
+        __spool_path(spool, sequence, path, sizeof(path));
+        if (stat(path, &st) < 0 || !S_ISREG(st.st_mode))
+            continue;
+        if (st.st_size == 0) {
+            unlink(path);
+            continue;
+        }
+        if (!__spool_segment_push(spool, sequence, (size_t)st.st_size))
+            break;
+        spool->size += (size_t)st.st_size;
+    }
+    closedir(dir);
+    qsort(spool->segments, (size_t)spool->segment_count, sizeof(spool_segment_t), __spool_segment_compare);
+    return true;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+bool spool_append(spool_t *spool, const char *topic, const unsigned char *attributes, const size_t attributes_size,
+                  const unsigned char *data, const size_t size) {
+    const size_t topic_size = strlen(topic),
+                 length = sizeof(spool_record_t) + topic_size + attributes_size + size;
+    if (topic_size > SPOOL_TOPIC_MAX || attributes_size > SPOOL_ATTRIBUTES_MAX || size > UINT32_MAX)
+        return false;
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    spool_record_t record = {.magic = SPOOL_MAGIC,
+                             .topic_size = (uint32_t)topic_size,
+                             .attributes_size = (uint32_t)attributes_size,
+                             .payload_size = (uint32_t)size,
+                             .time = (int64_t)ts.tv_sec};
+    record.crc = __spool_crc(
+        __spool_crc(__spool_crc(0, (const unsigned char *)topic, topic_size), attributes, attributes_size), data, size);
+    static const unsigned char padding[8] = {0};
+    struct iovec iov[5] = {{.iov_base = &record, .iov_len = sizeof(record)},
+                           {.iov_base = (void *)topic, .iov_len = topic_size},
+                           {.iov_base = (void *)attributes, .iov_len = attributes_size},
+                           {.iov_base = (void *)data, .iov_len = size},
+                           {.iov_base = (void *)padding, .iov_len = __spool_padded(length) - length}};
+    pthread_mutex_lock(&spool->mutex);
+    spool_segment_t *segment = spool->fd >= 0 ? &spool->segments[spool->segment_count - 1] : NULL;
+    if (segment != NULL && segment->size > 0 && segment->size + __spool_padded(length) > spool->segment_max) {
+        __spool_seal(spool);
+        segment = NULL;
+    }
+    if (segment == NULL) {
+        const unsigned long sequence =
+            spool->segment_count > 0 ? spool->segments[spool->segment_count - 1].sequence + 1 : 1;
+        char path[PATH_MAX];
+        __spool_path(spool, sequence, path, sizeof(path));
+        if ((spool->fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_APPEND | O_CLOEXEC, 0640)) < 0) {
+            fprintf(stderr, "spool: could not create '%s' (%s)\n", path, strerror(errno));
+            pthread_mutex_unlock(&spool->mutex);
+            return false;
+        }
+        if (!__spool_segment_push(spool, sequence, 0)) {
+            close(spool->fd);
+            spool->fd = -1;
+            unlink(path);
+            pthread_mutex_unlock(&spool->mutex);
+            return false;
+        }
+        segment = &spool->segments[spool->segment_count - 1];
+    }
+    const ssize_t written = writev(spool->fd, iov, 5);
+    if (written != (ssize_t)__spool_padded(length)) {
+        fprintf(stderr, "spool: write failed (%s)\n", written < 0 ? strerror(errno) : "short write");
+        if (ftruncate(spool->fd, (off_t)segment->size) < 0)
+            __spool_seal(spool); // leave the torn record for replay to stop at
+        pthread_mutex_unlock(&spool->mutex);
+        return false;
+    }
+    segment->size += (size_t)written;
+    spool->size += (size_t)written;
+    spool->appended++;
+    __spool_evict(spool);
+    pthread_cond_broadcast(&spool->cond);
+    pthread_mutex_unlock(&spool->mutex);
+    return true;
+}
+
+// records count as acknowledged in order, up to the oldest one still in flight; called with the mutex held
+void __spool_inflight_advance(spool_t *spool) {
+    while (spool->inflight_count > 0 && spool->inflight[spool->inflight_head].acked) {
+        spool->inflight_acked = spool->inflight[spool->inflight_head].end;
+        spool->inflight_head = (spool->inflight_head + 1) % SPOOL_INFLIGHT_MAX;
+        spool->inflight_count--;
+    }
+}
+
+// called from the mqtt thread for every ack: true if it was for a replayed record
+bool spool_acked(spool_t *spool, const int mid) {
+    bool found = false;
+    pthread_mutex_lock(&spool->mutex);
+    for (int i = 0; i < spool->inflight_count && !found; i++) {
+        const int index = (spool->inflight_head + i) % SPOOL_INFLIGHT_MAX;
+        if (spool->inflight[index].mid == mid && !spool->inflight[index].acked)
+            found = spool->inflight[index].acked = true;
+    }
+    __spool_inflight_advance(spool);
+    if (!found && spool->sending) {
+        spool->early[spool->early_next] = mid;
+        spool->early_next = (spool->early_next + 1) % (int)(sizeof(spool->early) / sizeof(spool->early[0]));
+    }
+    if (found)
+        pthread_cond_broadcast(&spool->cond);
+    pthread_mutex_unlock(&spool->mutex);
+    return found;
+}
+
+// wakes the drain thread, e.g. on connect
+void spool_wake(spool_t *spool) {
+    pthread_mutex_lock(&spool->mutex);
+    pthread_cond_broadcast(&spool->cond);
+    pthread_mutex_unlock(&spool->mutex);
+}
+
+void spool_stats(spool_t *spool, spool_stats_t *stats) {
+    pthread_mutex_lock(&spool->mutex);
+    *stats = (spool_stats_t){.size = spool->size,
+                             .segments = spool->segment_count,
+                             .appended = spool->appended,
+                             .replayed = spool->replayed,
+                             .skipped = spool->skipped,
+                             .evicted = spool->evicted,
+                             .corrupt = spool->corrupt};
+    pthread_mutex_unlock(&spool->mutex);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// called and returns with the mutex held
+void __spool_wait(spool_t *spool, const int64_t deadline) {
+    const struct timespec ts = {.tv_sec = (time_t)(deadline / 1000000000LL),
+                                .tv_nsec = (long)(deadline % 1000000000LL)};
+    pthread_cond_timedwait(&spool->cond, &spool->mutex, &ts);
+}
+
+int64_t __spool_monotonic(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// called with the mutex held
+void __spool_inflight_push(spool_t *spool, const int mid, const bool acked, const size_t end) {
+    const int index = (spool->inflight_head + spool->inflight_count) % SPOOL_INFLIGHT_MAX;
+    spool->inflight[index].mid = mid;
+    spool->inflight[index].acked = acked;
+    spool->inflight[index].end = end;
+    spool->inflight_count++;
+    __spool_inflight_advance(spool);
+}
+
+// replays the segment from 'offset', called and returns with the mutex held (released while sending); returns the
+// offset up to which records are acknowledged, the segment size if all of them are (or the rest is unreadable)
+size_t __spool_replay(spool_t *spool, const unsigned long sequence, const size_t size, size_t offset) {
+    char path[PATH_MAX];
+    __spool_path(spool, sequence, path, sizeof(path));
+    pthread_mutex_unlock(&spool->mutex);
+    const int fd = open(path, O_RDONLY | O_CLOEXEC);
+    const unsigned char *map = fd < 0 ? MAP_FAILED : mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (fd >= 0)
+        close(fd);
+    pthread_mutex_lock(&spool->mutex);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "spool: could not map '%s' (%s), dropping it\n", path, strerror(errno));
+        return size;
+    }
+    madvise((void *)map, size, MADV_SEQUENTIAL);
+    spool->inflight_head = spool->inflight_count = 0;
+    spool->inflight_acked = offset;
+    size_t end = size;
+    const int64_t period = (int64_t)(1e9 / spool->rate);
+    int64_t next = __spool_monotonic();
+    char topic[SPOOL_TOPIC_MAX + 1];
+    while (offset < end && spool->running && spool->connected()) {
+        if (spool->inflight_count >= spool->inflight_max) {
+            __spool_wait(spool, __spool_monotonic() + 100 * 1000000LL);
+            continue;
+        }
+        const int64_t now = __spool_monotonic();
+        if (now < next) {
+            __spool_wait(spool, next);
+            continue;
+        }
+        next = (next + period < now ? now : next + period);
+        spool_record_t record;
+        if (end - offset >= sizeof(record))
+            memcpy(&record, map + offset, sizeof(record));
+        const size_t length = sizeof(record) + (size_t)record.topic_size + (size_t)record.attributes_size +
+                              (size_t)record.payload_size;
+        if (end - offset < sizeof(record) || record.magic != SPOOL_MAGIC || record.topic_size > SPOOL_TOPIC_MAX ||
+            record.attributes_size > SPOOL_ATTRIBUTES_MAX || length > end - offset) {
+            fprintf(stderr, "spool: segment %lu unreadable from offset %zu, skipping the rest\n", sequence, offset);
+            spool->corrupt++;
+            end = offset;
+            break;
+        }
+        const unsigned char *attributes = map + offset + sizeof(record) + record.topic_size,
+                            *payload = attributes + record.attributes_size;
+        const size_t record_end = offset + __spool_padded(length) > end ? end : offset + __spool_padded(length);
+        if (__spool_crc(__spool_crc(__spool_crc(0, map + offset + sizeof(record), record.topic_size), attributes,
+                                    record.attributes_size),
+                        payload, record.payload_size) != record.crc) {
+            fprintf(stderr, "spool: segment %lu record at offset %zu is corrupt, skipping it\n", sequence, offset);
+            spool->corrupt++;
+            __spool_inflight_push(spool, 0, true, record_end);
+            offset = record_end;
+            continue;
+        }
+        memcpy(topic, map + offset + sizeof(record), record.topic_size);
+        topic[record.topic_size] = '\0';
+        int mid = 0;
+        spool->sending = true;
+        spool->early_next = 0;
+        memset(spool->early, 0, sizeof(spool->early));
+        pthread_mutex_unlock(&spool->mutex);
+        const bool sent =
+            spool->send(topic, attributes, record.attributes_size, payload, record.payload_size, record.time, &mid);
+        pthread_mutex_lock(&spool->mutex);
+        spool->sending = false;
+        if (!sent)
+            break;
+        bool early = mid == 0;
+        for (int i = 0; i < (int)(sizeof(spool->early) / sizeof(spool->early[0])) && !early; i++)
+            early = spool->early[i] == mid;
+        __spool_inflight_push(spool, mid, early, record_end);
+        if (mid == 0)
+            spool->skipped++;
+        else
+            spool->replayed++;
+        offset = record_end;
+    }
+    const int64_t timeout = __spool_monotonic() + (int64_t)SPOOL_ACK_TIMEOUT * 1000000000LL;
+    while (spool->inflight_count > 0 && spool->running && spool->connected() && __spool_monotonic() < timeout)
+        __spool_wait(spool, __spool_monotonic() + 100 * 1000000LL);
+    const size_t acked = spool->inflight_acked;
+    spool->inflight_head = spool->inflight_count = 0;
+    munmap((void *)map, size);
+    return acked >= end ? size : acked;
+}
+
+void *__spool_thread(void *context) {
+    spool_t *spool = (spool_t *)context;
+    pthread_mutex_lock(&spool->mutex);
+    while (spool->running) {
+        const bool pending = spool->segment_count > 1 || (spool->segment_count == 1 && spool->segments[0].size > 0);
+        if (!pending || !spool->connected()) {
+            __spool_wait(spool, __spool_monotonic() + 1000 * 1000000LL);
+            continue;
+        }
+        if (spool->segment_count == 1 && spool->fd >= 0)
+            __spool_seal(spool); // the oldest is still being appended to: later appends go to a new segment
+        const spool_segment_t segment = spool->segments[0];
+        spool->draining = segment.sequence;
+        if (segment.acked == 0)
+            printf("spool: replaying segment %lu (%zu bytes, %d segments spooled)\n", segment.sequence, segment.size,
+                   spool->segment_count);
+        const size_t acked = __spool_replay(spool, segment.sequence, segment.size, segment.acked);
+        spool->draining = 0;
+        if (spool->segment_count > 0 && spool->segments[0].sequence == segment.sequence) {
+            if (acked >= segment.size)
+                __spool_segment_remove(spool, 0);
+            else
+                spool->segments[0].acked = acked;
+        }
+    }
+    pthread_mutex_unlock(&spool->mutex);
+    return NULL;
+}
+
+bool spool_begin(spool_t *spool, const char *directory, const size_t size_max, const size_t segment_max,
+                 const double rate, const int inflight, spool_send_t send, spool_connected_t connected) {
+    memset(spool, 0, sizeof(*spool));
+    snprintf(spool->directory, sizeof(spool->directory), "%s", directory);
+    spool->size_max = size_max;
+    spool->segment_max = segment_max > size_max / 4 ? size_max / 4 : segment_max;
+    spool->rate = rate > 0.0 ? rate : 1.0;
+    spool->inflight_max = inflight < 1 ? 1 : inflight > SPOOL_INFLIGHT_MAX ? SPOOL_INFLIGHT_MAX : inflight;
+    spool->send = send;
+    spool->connected = connected;
+    spool->fd = -1;
+    if (mkdir(directory, 0750) < 0 && errno != EEXIST) {
+        fprintf(stderr, "spool: could not create '%s' (%s)\n", directory, strerror(errno));
+        return false;
+    }
+    if (!__spool_scan(spool))
+        return false;
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&spool->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_mutex_init(&spool->mutex, NULL);
+    spool->running = true;
+    if (pthread_create(&spool->thread, NULL, __spool_thread, spool) != 0) {
+        fprintf(stderr, "spool: failed to create thread\n");
+        pthread_cond_destroy(&spool->cond);
+        pthread_mutex_destroy(&spool->mutex);
+        free(spool->segments);
+        return false;
+    }
+    printf("spool: '%s' (size=%zu, segment=%zu, rate=%.2f/s, inflight=%d, pending=%zu bytes in %d segments)\n",
+           directory, spool->size_max, spool->segment_max, spool->rate, spool->inflight_max, spool->size,
+           spool->segment_count);
+    return true;
+}
+
+// what is not replayed yet stays on disk for the next run
+void spool_end(spool_t *spool) {
+    pthread_mutex_lock(&spool->mutex);
+    spool->running = false;
+    pthread_cond_broadcast(&spool->cond);
+    pthread_mutex_unlock(&spool->mutex);
+    pthread_join(spool->thread, NULL);
+    __spool_seal(spool);
+    printf("spool: appended=%lu, replayed=%lu, skipped=%lu, evicted=%lu segments, corrupt=%lu, pending=%zu bytes in %d "
+           "segments\n",
+           spool->appended, spool->replayed, spool->skipped, spool->evicted, spool->corrupt, spool->size,
+           spool->segment_count);
+    free(spool->segments);
+    pthread_cond_destroy(&spool->cond);
+    pthread_mutex_destroy(&spool->mutex);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,50 @@
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// sd_notify(3) without libsystemd: the state ('READY=1', 'STATUS=...', newline separated) goes as one datagram to the
+// unix socket named in $NOTIFY_SOCKET, a path or, starting with '@', an abstract name; false when not run by systemd
+// with Type=notify (no socket) or the datagram could not be sent
+
+bool systemd_notify(const char *format, ...) __attribute__((format(printf, 1, 2)));
+
+bool systemd_notify(const char *format, ...) {
+    const char *socket_name = getenv("NOTIFY_SOCKET");
+    struct sockaddr_un address = {.sun_family = AF_UNIX};
+    const size_t length = socket_name ? strlen(socket_name) : 0;
+    if (length < 2 || (socket_name[0] != '/' && socket_name[0] != '@') || length >= sizeof(address.sun_path))
+        return false;
+    memcpy(address.sun_path, socket_name, length);
+    if (address.sun_path[0] == '@')
+        address.sun_path[0] = '\0';
+    char state[512];
+    va_list arguments;
+    va_start(arguments, format);
+    const int size = vsnprintf(state, sizeof(state), format, arguments);
+    va_end(arguments);
+    if (size < 0 || size >= (int)sizeof(state))
+        return false;
+    const int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return false;
+    const bool sent = sendto(fd, state, (size_t)size, MSG_NOSIGNAL, (const struct sockaddr *)&address,
+                             (socklen_t)(offsetof(struct sockaddr_un, sun_path) + length)) == size;
+    close(fd);
+    return sent;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
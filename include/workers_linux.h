@@ -0,0 +1,163 @@
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// fixed-size thread pool fed from a bounded FIFO of opaque jobs; the handler receives the worker index so callers can
+// keep per-worker resources (buffers, codec handles) without locking
+
+typedef void (*workers_handler_t)(void *job, const int worker);
+
+typedef struct {
+    workers_handler_t handler;
+    pthread_t *threads;
+    int count;
+    void **queue;
+    int queue_size, queue_head, queue_length;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    bool running;
+} workers_t;
+
+typedef struct {
+    workers_t *workers;
+    int index;
+} __workers_thread_t;
+
+void *__workers_thread(void *context) {
+    __workers_thread_t *thread = (__workers_thread_t *)context;
+    workers_t *workers = thread->workers;
+    const int index = thread->index;
+    free(thread);
+    pthread_mutex_lock(&workers->mutex);
+    while (true) {
+        while (workers->running && workers->queue_length == 0)
+            pthread_cond_wait(&workers->cond, &workers->mutex);
+        if (!workers->running)
+            break;
+        void *job = workers->queue[workers->queue_head];
+        workers->queue_head = (workers->queue_head + 1) % workers->queue_size;
+        workers->queue_length--;
+        pthread_mutex_unlock(&workers->mutex);
+        workers->handler(job, index);
+        pthread_mutex_lock(&workers->mutex);
+    }
+    pthread_mutex_unlock(&workers->mutex);
+    return NULL;
+}
+
+void workers_end(workers_t *workers) {
+    pthread_mutex_lock(&workers->mutex);
+    workers->running = false;
+    pthread_cond_broadcast(&workers->cond);
+    pthread_mutex_unlock(&workers->mutex);
+    for (int i = 0; i < workers->count; i++)
+        pthread_join(workers->threads[i], NULL);
+    free(workers->threads);
+    free(workers->queue);
+    workers->threads = NULL;
+    workers->queue = NULL;
+    workers->count = 0;
+    pthread_cond_destroy(&workers->cond);
+    pthread_mutex_destroy(&workers->mutex);
+}
+
+bool workers_begin(workers_t *workers, const int count, const int queue_size, workers_handler_t handler) {
+    memset(workers, 0, sizeof(*workers));
+    workers->handler = handler;
+    workers->queue_size = queue_size;
+    if ((workers->threads = calloc((size_t)count, sizeof(pthread_t))) == NULL ||
+        (workers->queue = calloc((size_t)queue_size, sizeof(void *))) == NULL) {
+        free(workers->threads);
+        return false;
+    }
+    pthread_mutex_init(&workers->mutex, NULL);
+    pthread_cond_init(&workers->cond, NULL);
+    workers->running = true;
+    for (int i = 0; i < count; i++) {
+        __workers_thread_t *thread = malloc(sizeof(__workers_thread_t));
+        if (thread == NULL)
+            break;
+        thread->workers = workers;
+        thread->index = i;
+        if (pthread_create(&workers->threads[i], NULL, __workers_thread, thread) != 0) {
+            free(thread);
+            break;
+        }
+        workers->count++;
+    }
+    if (workers->count != count) {
+        fprintf(stderr, "workers: failed to create threads (%d of %d)\n", workers->count, count);
+        workers_end(workers);
+        return false;
+    }
+    return true;
+}
+
+bool workers_submit(workers_t *workers, void *job) {
+    pthread_mutex_lock(&workers->mutex);
+    const bool accepted = workers->running && workers->queue_length < workers->queue_size;
+    if (accepted) {
+        workers->queue[(workers->queue_head + workers->queue_length) % workers->queue_size] = job;
+        workers->queue_length++;
+        pthread_cond_signal(&workers->cond);
+    }
+    pthread_mutex_unlock(&workers->mutex);
+    return accepted;
+}
+
+// a cpu list as in taskset and cpuset ('0,2-3'), into at most capacity cpus; -1 when it does not parse
+int workers_cpus(const char *list, int *cpus, const int capacity) {
+    int count = 0;
+    const char *p = list;
+    while (*p != '\0') {
+        char *end;
+        const long first = strtol(p, &end, 10);
+        long last = first;
+        if (end == p || first < 0 || first >= CPU_SETSIZE)
+            return -1;
+        p = end;
+        if (*p == '-') {
+            last = strtol(p + 1, &end, 10);
+            if (end == p + 1 || last < first || last >= CPU_SETSIZE)
+                return -1;
+            p = end;
+        }
+        for (long cpu = first; cpu <= last && count < capacity; cpu++)
+            cpus[count++] = (int)cpu;
+        if (*p == ',')
+            p++;
+        else if (*p != '\0')
+            return -1;
+    }
+    return count;
+}
+
+// worker i runs on cpus[i % count] only, so the kernel does not move a worker (and the codec state and buffers it
+// keeps warm in that core's cache) around, nor stack two on one core while others are idle
+bool workers_pin(workers_t *workers, const int *cpus, const int count) {
+    bool pinned = count > 0;
+    for (int i = 0; i < workers->count && count > 0; i++) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpus[i % count], &set);
+        const int result = pthread_setaffinity_np(workers->threads[i], sizeof(set), &set);
+        if (result != 0) {
+            fprintf(stderr, "workers: could not pin worker %d to cpu %d (%s)\n", i, cpus[i % count], strerror(result));
+            pinned = false;
+        }
+    }
+    return pinned;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
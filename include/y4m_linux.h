@@ -0,0 +1,196 @@
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// splits a yuv4mpegpipe byte stream (ffmpeg -f yuv4mpegpipe) into raw frames: a stream header line ('YUV4MPEG2 W<width>
+// H<height> ... C<colourspace>') gives the frame size, then each frame is a 'FRAME' line followed by the Y, Cb and Cr
+// planes; only 8-bit 4:2:0 is accepted (C420jpeg, C420mpeg2, C420paldv, C420, or no C at all)
+
+#define Y4M_LINE_MAX 256
+
+typedef enum { Y4M_STATE_HEADER, Y4M_STATE_FRAME, Y4M_STATE_DATA } y4m_state_t;
+
+typedef void (*y4m_frame_callback_t)(const unsigned char *data, const size_t size, void *context);
+
+typedef struct {
+    unsigned char *data;
+    size_t size, capacity, limit;
+    size_t frame; // bytes per frame, from the header
+    int width, height;
+    y4m_state_t state;
+    bool exchanged;
+    unsigned long frames, discards;
+} y4m_framer_t;
+
+size_t y4m_frame_size(const int width, const int height) {
+    return (size_t)width * (size_t)height + 2 * (size_t)((width + 1) / 2) * (size_t)((height + 1) / 2);
+}
+
+// the stream header line, without its newline
+bool __y4m_header(const char *line, const size_t length, int *width, int *height) {
+    if (length < 10 || memcmp(line, "YUV4MPEG2 ", 10) != 0)
+        return false;
+    char text[Y4M_LINE_MAX], *saveptr = NULL;
+    snprintf(text, sizeof(text), "%.*s", (int)length, line);
+    *width = *height = 0;
+    for (const char *token = strtok_r(text + 10, " ", &saveptr); token != NULL; token = strtok_r(NULL, " ", &saveptr))
+        if (token[0] == 'W')
+            *width = atoi(token + 1);
+        else if (token[0] == 'H')
+            *height = atoi(token + 1);
+        else if (token[0] == 'C' && strncmp(token, "C420", 4) != 0)
+            return false;
+        else if (token[0] == 'C' && token[4] != '\0' && strcmp(token, "C420jpeg") != 0 &&
+                 strcmp(token, "C420mpeg2") != 0 && strcmp(token, "C420paldv") != 0)
+            return false;
+    return *width > 0 && *height > 0 && *width <= 65500 && *height <= 65500;
+}
+
+// the first frame of a whole yuv4mpegpipe stream held in memory (spawn mode's ffmpeg output): where its planes start
+bool y4m_frame(const unsigned char *data, const size_t size, size_t *offset, int *width, int *height) {
+    const unsigned char *header_end = memchr(data, '\n', size < Y4M_LINE_MAX ? size : Y4M_LINE_MAX);
+    if (header_end == NULL || !__y4m_header((const char *)data, (size_t)(header_end - data), width, height))
+        return false;
+    const size_t frame_line = (size_t)(header_end - data) + 1;
+    if (size < frame_line + 5 || memcmp(data + frame_line, "FRAME", 5) != 0)
+        return false;
+    const unsigned char *frame_end = memchr(data + frame_line, '\n', size - frame_line);
+    if (frame_end == NULL)
+        return false;
+    *offset = (size_t)(frame_end - data) + 1;
+    return size - *offset >= y4m_frame_size(*width, *height);
+}
+
+bool y4m_framer_begin(y4m_framer_t *framer, const size_t limit) {
+    memset(framer, 0, sizeof(*framer));
+    if ((framer->data = malloc(Y4M_LINE_MAX)) == NULL)
+        return false;
+    framer->capacity = Y4M_LINE_MAX;
+    framer->limit = limit;
+    framer->state = Y4M_STATE_HEADER;
+    return true;
+}
+
+void y4m_framer_end(y4m_framer_t *framer) {
+    free(framer->data);
+    framer->data = NULL;
+    framer->size = framer->capacity = 0;
+}
+
+// a new stream (ffmpeg restarted) begins with its own header
+void y4m_framer_reset(y4m_framer_t *framer) {
+    framer->size = 0;
+    framer->state = Y4M_STATE_HEADER;
+}
+
+void __y4m_framer_consume(y4m_framer_t *framer, const size_t length) {
+    memmove(framer->data, framer->data + length, framer->size - length);
+    framer->size -= length;
+}
+
+bool __y4m_framer_reserve(y4m_framer_t *framer, const size_t size) {
+    if (size <= framer->capacity)
+        return true;
+    size_t capacity = framer->capacity ? framer->capacity : Y4M_LINE_MAX;
+    while (capacity < size)
+        capacity *= 2;
+    unsigned char *data = realloc(framer->data, capacity);
+    if (data == NULL)
+        return false;
+    framer->data = data;
+    framer->capacity = capacity;
+    return true;
+}
+
+bool __y4m_framer_scan(y4m_framer_t *framer, y4m_frame_callback_t callback, void *context) {
+    while (true) {
+        if (framer->state == Y4M_STATE_DATA) {
+            if (framer->size < framer->frame)
+                return true;
+            framer->frames++;
+            framer->exchanged = false;
+            callback(framer->data, framer->frame, context);
+            if (!framer->exchanged) // else the callback took the buffer and the remainder is already in place
+                __y4m_framer_consume(framer, framer->frame);
+            framer->state = Y4M_STATE_FRAME;
+            continue;
+        }
+        const unsigned char *end = memchr(framer->data, '\n', framer->size);
+        if (end == NULL) {
+            if (framer->size < Y4M_LINE_MAX)
+                return true;
+            framer->discards++; // not a line of this format, resync on the next stream header
+            framer->size = 0;
+            framer->state = Y4M_STATE_HEADER;
+            return true;
+        }
+        const size_t length = (size_t)(end - framer->data);
+        if (length >= 9 && memcmp(framer->data, "YUV4MPEG2", 9) == 0) {
+            int width, height;
+            if (!__y4m_header((const char *)framer->data, length, &width, &height)) {
+                fprintf(stderr, "y4m: unsupported stream '%.*s'\n", (int)(length < 80 ? length : 80), framer->data);
+                return false;
+            }
+            framer->width = width;
+            framer->height = height;
+            framer->frame = y4m_frame_size(width, height);
+            if (framer->limit && framer->frame > framer->limit) {
+                fprintf(stderr, "y4m: frame exceeds limit (%zu bytes)\n", framer->limit);
+                return false;
+            }
+            framer->state = Y4M_STATE_FRAME;
+        } else if (framer->state == Y4M_STATE_FRAME && length >= 5 && memcmp(framer->data, "FRAME", 5) == 0)
+            framer->state = Y4M_STATE_DATA;
+        else
+            framer->discards++;
+        __y4m_framer_consume(framer, length + 1);
+        if (framer->state == Y4M_STATE_DATA && !__y4m_framer_reserve(framer, framer->frame))
+            return false;
+    }
+}
+
+bool y4m_framer_push(y4m_framer_t *framer, const unsigned char *data, const size_t length,
+                     y4m_frame_callback_t callback, void *context) {
+    if (!__y4m_framer_reserve(framer, framer->size + length))
+        return false;
+    memcpy(framer->data + framer->size, data, length);
+    framer->size += length;
+    return __y4m_framer_scan(framer, callback, context);
+}
+
+// called from the frame callback: takes the buffer holding the frame (at its start) in exchange for another malloc'd
+// buffer, which receives any bytes already read beyond the frame, so the frame itself is never copied
+bool y4m_framer_exchange(y4m_framer_t *framer, unsigned char **buffer, size_t *capacity) {
+    if (framer->state != Y4M_STATE_DATA || framer->exchanged)
+        return false;
+    const size_t remainder = framer->size - framer->frame;
+    const size_t needed = remainder > framer->frame ? remainder : framer->frame;
+    if (*capacity < needed) { // sized for the next frame too, so it is read without growing
+        unsigned char *data = realloc(*buffer, needed);
+        if (data == NULL)
+            return false;
+        *buffer = data;
+        *capacity = needed;
+    }
+    memcpy(*buffer, framer->data + framer->frame, remainder);
+    unsigned char *data = framer->data;
+    const size_t data_capacity = framer->capacity;
+    framer->data = *buffer;
+    framer->capacity = *capacity;
+    framer->size = remainder;
+    *buffer = data;
+    *capacity = data_capacity;
+    framer->exchanged = true;
+    return true;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
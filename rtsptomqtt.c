@@ -9,12 +9,20 @@
 // -----------------------------------------------------------------------------------------------------------------------------------------
 // -----------------------------------------------------------------------------------------------------------------------------------------
 
+#define _GNU_SOURCE
+
+#include <ctype.h>
 #include <errno.h>
+#include <limits.h>
+#include <pthread.h>
 #include <signal.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/inotify.h>
+#include <sys/resource.h>
 #include <time.h>
 
 // -----------------------------------------------------------------------------------------------------------------------------------------
@@ -24,19 +32,71 @@
 
 #define RTSP_URL_DEFAULT ""
 
-#define INTERVAL_DEFAULT 30
+#define INTERVAL_DEFAULT 30    // seconds, fractions allowed (millisecond resolution)
+#define INTERVAL_MINIMUM 0.001 // seconds
+#define QUALITY_DEFAULT 6
+#define WORKERS_DEFAULT 4
+#define WORKERS_CPUS_DEFAULT "" // not pinned
+#define PUBLISH_QUEUE_DEFAULT 8
+#define PUBLISH_DROP_DEFAULT "oldest"
+
+#define CAPTURE_MODE_DEFAULT "spawn"
+#define CAPTURE_RATE_DEFAULT 0
+#define CAPTURE_TIMEOUT_DEFAULT 10
+#define PASSTHROUGH_DEFAULT "false"
+#define ENCODER_DEFAULT "ffmpeg"
+#define RING_DEFAULT 0 // recent frames kept for snapshot commands, none
+#define SHM_DEFAULT 0  // shared memory slots, disabled
+#define SHM_SLOT_SIZE_DEFAULT 1024 // KB
+#define RING_MAX 64
+
+#define RENDITIONS_MAX 4
+#define RENDITION_QUALITY_DEFAULT 80 // JPEG quality 1..100
+
+#define HEALTH_FAILURES_DEFAULT 3       // failures in a row before a camera is down
+#define HEALTH_BACKOFF_MIN_DEFAULT 5    // seconds
+#define HEALTH_BACKOFF_MAX_DEFAULT 300  // seconds
+#define HEALTH_PROBE_TIMEOUT_DEFAULT 3  // seconds
+
+#define ADAPTIVE_PERIOD_DEFAULT 10      // seconds
+#define ADAPTIVE_QUALITY_MAX_DEFAULT 20 // ffmpeg -q:v, higher is coarser
+#define ADAPTIVE_SCALE_MIN_DEFAULT 0.5
+#define ADAPTIVE_INTERVAL_FACTOR 4 // adaptive-interval-max defaults to this many intervals
+
+#define BATCH_DEFAULT 0      // frames, disabled
+#define BATCH_TIME_DEFAULT 0 // milliseconds, disabled
+
+#define CHANGE_THRESHOLD_DEFAULT 1.0 // percent of blocks
+#define CHANGE_DELTA_DEFAULT 12      // luma levels
+#define CHANGE_SILENCE_DEFAULT 600   // seconds
+
+#define METRICS_PORT_DEFAULT 0 // disabled
+#define METRICS_ADDRESS_DEFAULT "127.0.0.1"
+#define STATS_INTERVAL_DEFAULT 0 // seconds, disabled
+
+#define STARTUP_TIMEOUT_DEFAULT 60 // seconds
+
+#define SPOOL_DIRECTORY_DEFAULT "" // disabled
+#define SPOOL_SIZE_DEFAULT 256     // MB
+#define SPOOL_SEGMENT_DEFAULT 16   // MB
+#define SPOOL_RATE_DEFAULT 10      // messages per second
 
 #define MQTT_SERVER_DEFAULT "mqtt://localhost"
 #define MQTT_CLIENT_DEFAULT "rtsptomqtt"
 #define MQTT_TOPIC_DEFAULT "snapshots"
+#define MQTT_VERSION_DEFAULT 3
+#define MQTT_EXPIRY_DEFAULT 0 // seconds, none
 
+#define FRAME_SIZE_INITIAL (256 * 1024) // until the pool has seen real frames
 #ifndef MAX_BUFFER_SIZE
-#define MAX_BUFFER_SIZE 5 * 1024 * 1024 // 5MB
+#define MAX_BUFFER_SIZE (64 * 1024 * 1024) // 64MB, ceiling for a single frame, buffers only grow this far on demand
 #endif
 
 // -----------------------------------------------------------------------------------------------------------------------------------------
 // -----------------------------------------------------------------------------------------------------------------------------------------
 
+#define CONFIG_MAX_ENTRIES 512
+
 #include "include/config_linux.h"
 
 #define MQTT_CONNECT_TIMEOUT 60
@@ -46,6 +106,28 @@
 #include "include/mqtt_linux.h"
 
 #include "include/exec_linux.h"
+#include "include/frame_linux.h"
+
+#include "include/mjpeg_linux.h"
+#include "include/y4m_linux.h"
+
+#include "include/jpeg_linux.h"
+
+#include "include/change_linux.h"
+
+#include "include/image_linux.h"
+
+#include "include/rtsp_linux.h"
+
+#include "include/batch_linux.h"
+#include "include/health_linux.h"
+#include "include/metrics_linux.h"
+#include "include/queue_linux.h"
+#include "include/schedule_linux.h"
+#include "include/shm_linux.h"
+#include "include/spool_linux.h"
+#include "include/systemd_linux.h"
+#include "include/workers_linux.h"
 
 // -----------------------------------------------------------------------------------------------------------------------------------------
 // -----------------------------------------------------------------------------------------------------------------------------------------
@@ -53,113 +135,3071 @@
 const struct option config_options[] = {{"config", required_argument, 0, 0},      // config
                                         {"mqtt-client", required_argument, 0, 0}, // mqtt
                                         {"mqtt-server", required_argument, 0, 0},
-                                        {"rtsp-url", required_argument, 0, 0}, // rtsp
-                                        {"interval", required_argument, 0, 0}, // interval
-                                        {"debug", required_argument, 0, 0},    // debug
+                                        {"mqtt-version", required_argument, 0, 0},
+                                        {"mqtt-qos", required_argument, 0, 0},
+                                        {"rtsp-url", required_argument, 0, 0},     // rtsp
+                                        {"interval", required_argument, 0, 0},     // interval
+                                        {"capture-mode", required_argument, 0, 0}, // capture
+                                        {"workers", required_argument, 0, 0},
+                                        {"publish-queue", required_argument, 0, 0}, // publish
+                                        {"publish-drop", required_argument, 0, 0},
+                                        {"spool-directory", required_argument, 0, 0},
+                                        {"metrics-port", required_argument, 0, 0}, // metrics
+                                        {"stats-interval", required_argument, 0, 0},
+                                        {"debug", required_argument, 0, 0}, // debug
                                         {0, 0, 0, 0}};
 
 MqttConfig mqtt_config;
-const char *mqtt_topic;
+bool metadata_properties = false;
 
 bool config(const int argc, const char *argv[]) {
     if (!config_load(CONFIG_FILE_DEFAULT, argc, argv, config_options))
         return false;
     mqtt_config.server = config_get_string("mqtt-server", MQTT_SERVER_DEFAULT);
     mqtt_config.client = config_get_string("mqtt-client", MQTT_CLIENT_DEFAULT);
+    mqtt_config.version = config_get_integer("mqtt-version", MQTT_VERSION_DEFAULT);
+    if (mqtt_config.version != 3 && mqtt_config.version != 5) {
+        fprintf(stderr, "config: invalid mqtt-version %d, using %d\n", mqtt_config.version, MQTT_VERSION_DEFAULT);
+        mqtt_config.version = MQTT_VERSION_DEFAULT;
+    }
+    mqtt_config.qos = config_get_integer("mqtt-qos", MQTT_PUBLISH_QOS);
+    mqtt_config.inflight = config_get_integer("mqtt-inflight", MQTT_INFLIGHT_DEFAULT);
+    mqtt_config.reconnect_min = config_get_integer("mqtt-reconnect-min", MQTT_RECONNECT_MIN);
+    mqtt_config.reconnect_max = config_get_integer("mqtt-reconnect-max", MQTT_RECONNECT_MAX);
     mqtt_config.debug = config_get_bool("debug", false);
-    mqtt_topic = config_get_string("mqtt-topic", MQTT_TOPIC_DEFAULT);
+    metadata_properties = config_get_bool("metadata-properties", false);
+    if (metadata_properties && mqtt_config.version != 5) {
+        fprintf(stderr, "config: metadata-properties needs mqtt-version=5, ignoring\n");
+        metadata_properties = false;
+    }
     return true;
 }
 
 // -----------------------------------------------------------------------------------------------------------------------------------------
 // -----------------------------------------------------------------------------------------------------------------------------------------
 
-unsigned char snapshot_buffer[MAX_BUFFER_SIZE];
-int snapshot_skipped = 0;
+#define FFMPEG_COMMAND "ffmpeg"
+
+// copy passes the camera's JPEGs through untouched (no decode, no re-encode), which leaves nothing for rate, quality
+// and filter (e.g. a scale, NULL for none) to act on; raw has ffmpeg decode only, writing planar 4:2:0 frames as
+// yuv4mpegpipe for encoding in-process (encoder=libjpeg), so quality does not apply either
+void ffmpeg_arguments(const char **arguments, const char *rtsp_url, const bool persistent, const char *rate,
+                      const char *quality, const char *filter, const bool copy, const bool raw) {
+    int n = 0;
+    arguments[n++] = FFMPEG_COMMAND;
+    arguments[n++] = "-y";
+    arguments[n++] = "-loglevel";
+    arguments[n++] = "quiet";
+    arguments[n++] = "-rtsp_transport";
+    arguments[n++] = "tcp";
+    arguments[n++] = "-i";
+    arguments[n++] = rtsp_url;
+    if (!persistent) {
+        arguments[n++] = "-vframes";
+        arguments[n++] = "1";
+    } else if (rate != NULL && !copy) {
+        arguments[n++] = "-r";
+        arguments[n++] = rate;
+    }
+    if (copy) {
+        arguments[n++] = "-c:v";
+        arguments[n++] = "copy";
+    } else {
+        if (filter != NULL) {
+            arguments[n++] = "-vf";
+            arguments[n++] = filter;
+        }
+        if (!raw) {
+            arguments[n++] = "-q:v";
+            arguments[n++] = quality;
+        }
+        arguments[n++] = "-pix_fmt";
+        arguments[n++] = "yuvj420p";
+        arguments[n++] = "-chroma_sample_location";
+        arguments[n++] = "center";
+    }
+    if (raw) {
+        arguments[n++] = "-strict";
+        arguments[n++] = "-1";
+    }
+    arguments[n++] = "-f";
+    arguments[n++] = raw ? "yuv4mpegpipe" : "image2pipe";
+    arguments[n++] = "-";
+    arguments[n++] = NULL;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// per camera counters and per stage latencies, the stages being: spawn (fork and exec of ffmpeg), connect (RTSP
+// session set up to PLAY), first_byte (from spawn or PLAY to the first media byte), frame (capture start until the
+// frame is in hand), enqueue (time waiting for the publisher) and ack (mqtt send until written out at QoS 0, or
+// acknowledged at QoS 1/2); together they show whether the camera, ffmpeg or the broker is the slow part
+
+typedef enum {
+    STAGE_SPAWN,
+    STAGE_CONNECT,
+    STAGE_FIRST_BYTE,
+    STAGE_FRAME,
+    STAGE_ENQUEUE,
+    STAGE_ACK,
+    STAGE_ENCODE,
+    STAGE_COUNT
+} stage_t;
 
-bool capture(const char *rtsp_url) {
+const char *stage_names[STAGE_COUNT] = {"spawn", "connect", "first_byte", "frame", "enqueue", "ack", "encode"};
 
-    const time_t time_entry = time(NULL);
+typedef struct {
+    metrics_histogram_t stages[STAGE_COUNT];
+    atomic_ulong frames, bytes, failures, skips, drops, unchanged, publish_failures, spooled, invalid, timeouts;
+    atomic_ulong shm_frames, shm_oversize, probes, probe_failures, held;
+} capture_metrics_t;
 
-    const char *const ffmpeg_command = "ffmpeg";
-    const char *const ffmpeg_arguments[] = {ffmpeg_command, "-y", "-loglevel",  "quiet",    "-rtsp_transport",
-                                            "tcp",          "-i", rtsp_url,     "-vframes", "1",
-                                            "-q:v",         "6",  "-pix_fmt",   "yuvj420p", "-chroma_sample_location",
-                                            "center",       "-f", "image2pipe", "-",        NULL};
+void capture_stage(capture_metrics_t *metrics, const stage_t stage, const int64_t begin, const int64_t end) {
+    if (begin > 0 && end >= begin)
+        metrics_histogram_record(&metrics->stages[stage], end - begin);
+}
+
+// spool-directory keeps messages that cannot be published (broker unreachable, or refusing them) on disk, up to
+// spool-size MB in spool-segment MB files, oldest dropped first, and replays them with their original topics at
+// spool-rate messages per second once connected again; replayed metadata still carries the capture time, and
+// messages with an expiry go out with what is left of it, or not at all once it has passed
+
+spool_t publish_spool;
+bool spool_active = false;
+
+// properties as spool attributes: "<expiry>\0<content type>\0" then "<name>\0<value>\0" per user property; false
+// when they do not fit, rather than spool a message that would go out without them
+bool publish_properties_pack(const mqtt_properties_t *properties, unsigned char *buffer, const size_t size,
+                             size_t *length) {
+    *length = 0;
+    if (properties == NULL)
+        return true;
+    char expiry[16];
+    snprintf(expiry, sizeof(expiry), "%d", properties->expiry);
+    const char *strings[2 + MQTT_USER_PROPERTIES_MAX * 2];
+    int count = 0;
+    strings[count++] = expiry;
+    strings[count++] = properties->content_type ? properties->content_type : "";
+    for (int i = 0; i < properties->user_count && i < MQTT_USER_PROPERTIES_MAX; i++) {
+        strings[count++] = properties->user[i][0];
+        strings[count++] = properties->user[i][1];
+    }
+    for (int i = 0; i < count; i++) {
+        const size_t n = strlen(strings[i]) + 1;
+        if (*length + n > size)
+            return false;
+        memcpy(buffer + *length, strings[i], n);
+        *length += n;
+    }
+    return true;
+}
 
-    size_t total_bytes = exec(ffmpeg_command, ffmpeg_arguments, snapshot_buffer, sizeof(snapshot_buffer));
-    if (total_bytes == 0)
+bool publish_properties_unpack(const unsigned char *buffer, const size_t size, mqtt_properties_t *properties) {
+    memset(properties, 0, sizeof(*properties));
+    if (size == 0 || buffer[size - 1] != '\0')
+        return size == 0;
+    const char *strings[2 + MQTT_USER_PROPERTIES_MAX * 2];
+    int count = 0;
+    for (size_t offset = 0; offset < size && count < (int)(sizeof(strings) / sizeof(strings[0]));
+         offset += strlen((const char *)buffer + offset) + 1)
+        strings[count++] = (const char *)buffer + offset;
+    if (count < 2)
         return false;
+    properties->expiry = atoi(strings[0]);
+    properties->content_type = strings[1][0] ? strings[1] : NULL;
+    for (int i = 2; i + 1 < count; i += 2, properties->user_count++) {
+        properties->user[properties->user_count][0] = strings[i];
+        properties->user[properties->user_count][1] = strings[i + 1];
+    }
+    return true;
+}
 
-    const time_t total_time = time(NULL) - time_entry;
-    char timestamp[15 + 1];
-    strftime(timestamp, sizeof(timestamp) - 1, "%Y%m%d%H%M%S", localtime(&time_entry));
-    char metadata[256];
-    snprintf(metadata, sizeof(metadata), "{\"time\":\"%s\",\"size\":%zu}", timestamp, total_bytes);
+bool publish_spool_send(const char *topic, const unsigned char *attributes, size_t attributes_size,
+                        const unsigned char *data, size_t size, int64_t spooled, int *mid) {
+    mqtt_properties_t properties;
+    if (!publish_properties_unpack(attributes, attributes_size, &properties))
+        fprintf(stderr, "spool: invalid properties for '%s', sending without\n", topic);
+    if (properties.expiry > 0) {
+        const int64_t remaining = (int64_t)properties.expiry - ((int64_t)time(NULL) - spooled);
+        if (remaining <= 0)
+            return true; // expired, *mid stays 0
+        properties.expiry = (int)remaining;
+    }
+    return mqtt_send_properties(topic, data, (int)size, &properties, mid);
+}
+
+void publish_spool_connection(bool connected __attribute__((unused))) {
+    if (spool_active)
+        spool_wake(&publish_spool);
+}
+
+void publish_spool_begin(void) {
+    const char *directory = config_get_string("spool-directory", SPOOL_DIRECTORY_DEFAULT);
+    if (directory[0] == '\0')
+        return;
+    const int size = config_get_integer("spool-size", SPOOL_SIZE_DEFAULT),
+              segment = config_get_integer("spool-segment", SPOOL_SEGMENT_DEFAULT);
+    spool_active = spool_begin(&publish_spool, directory, (size_t)(size < 1 ? 1 : size) * 1024 * 1024,
+                               (size_t)(segment < 1 ? 1 : segment) * 1024 * 1024,
+                               config_get_double("spool-rate", SPOOL_RATE_DEFAULT), mqtt_config.inflight,
+                               publish_spool_send, mqtt_connected);
+    if (spool_active)
+        mqtt_connection_callback_register(publish_spool_connection);
+}
+
+void publish_spool_end(void) {
+    if (spool_active) {
+        mqtt_connection_callback_register(NULL);
+        spool_end(&publish_spool);
+        spool_active = false;
+    }
+}
+
+// acks are matched to sends by message id; the ack can overtake the return from the send, so whichever side comes
+// second records the latency
+#define ACK_PENDING_SIZE 256
+
+typedef struct {
+    int mid;
+    int64_t sent, acked;
+    capture_metrics_t *metrics;
+} ack_pending_t;
+
+ack_pending_t ack_pending[ACK_PENDING_SIZE];
+pthread_mutex_t ack_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+void capture_acked(int mid) {
+    if (spool_active && spool_acked(&publish_spool, mid))
+        return;
+    const int64_t now = schedule_monotonic();
+    pthread_mutex_lock(&ack_mutex);
+    ack_pending_t *pending = &ack_pending[(unsigned int)mid % ACK_PENDING_SIZE];
+    if (pending->mid == mid && pending->metrics != NULL) {
+        capture_stage(pending->metrics, STAGE_ACK, pending->sent, now);
+        pending->mid = 0;
+    } else
+        *pending = (ack_pending_t){.mid = mid, .acked = now};
+    pthread_mutex_unlock(&ack_mutex);
+}
+
+// a camera being unloaded: its sends still awaiting their ack are no longer timed
+void capture_acks_forget(const capture_metrics_t *metrics) {
+    pthread_mutex_lock(&ack_mutex);
+    for (int i = 0; i < ACK_PENDING_SIZE; i++)
+        if (ack_pending[i].metrics == metrics)
+            ack_pending[i] = (ack_pending_t){0};
+    pthread_mutex_unlock(&ack_mutex);
+}
+
+// a message that cannot be sent goes to the spool, if there is one, and sets *spooled
+bool capture_send(capture_metrics_t *metrics, const char *topic, const unsigned char *data, const size_t size,
+                  const mqtt_properties_t *properties, bool *spooled) {
+    const int64_t sent = schedule_monotonic();
+    int mid = 0;
+    if (!mqtt_send_properties(topic, data, (int)size, properties, &mid)) {
+        unsigned char attributes[SPOOL_ATTRIBUTES_MAX];
+        size_t attributes_size;
+        if (!spool_active)
+            return false;
+        if (!publish_properties_pack(properties, attributes, sizeof(attributes), &attributes_size)) {
+            fprintf(stderr, "spool: properties of '%s' too large to keep, not spooled\n", topic);
+            return false;
+        }
+        if (!spool_append(&publish_spool, topic, attributes, attributes_size, data, size))
+            return false;
+        atomic_fetch_add(&metrics->spooled, 1);
+        *spooled = true;
+        return true;
+    }
+    pthread_mutex_lock(&ack_mutex);
+    ack_pending_t *pending = &ack_pending[(unsigned int)mid % ACK_PENDING_SIZE];
+    if (pending->mid == mid && pending->metrics == NULL) {
+        capture_stage(metrics, STAGE_ACK, sent, pending->acked);
+        pending->mid = 0;
+    } else
+        *pending = (ack_pending_t){.mid = mid, .sent = sent, .metrics = metrics};
+    pthread_mutex_unlock(&ack_mutex);
+    return true;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// passthrough=true has ffmpeg copy the camera's own JPEGs out (an MJPEG stream or substream) instead of decoding and
+// re-encoding every frame, so quality no longer applies; passthrough=auto tries that and goes back to re-encoding for
+// good when the stream turns out not to be JPEG (H.264 and the like); rtsp mode passes MJPEG through in any case.
+// jpeg-validate=true drops frames whose markers do not check out, jpeg-strip=true removes EXIF/XMP/ICC/comment
+// segments before publishing
+
+typedef enum { PASSTHROUGH_OFF, PASSTHROUGH_AUTO, PASSTHROUGH_ON } passthrough_t;
+
+const char *passthrough_names[] = {"false", "auto", "true"};
+
+typedef struct {
+    passthrough_t passthrough;
+    bool validate, strip;
+} capture_jpeg_t;
+
+// decides passthrough=auto on the first bytes ffmpeg copied out; true when re-encoding has to take over
+bool capture_jpeg_fallback(capture_jpeg_t *jpeg, const char *name, const unsigned char *data, const size_t size) {
+    if (jpeg->passthrough != PASSTHROUGH_AUTO || size == 0 || (data[0] == 0xFF && (size < 2 || data[1] == 0xD8)))
+        return false;
+    jpeg->passthrough = PASSTHROUGH_OFF;
+    fprintf(stderr, "%s: stream is not JPEG, passthrough off, re-encoding\n", name);
+    return true;
+}
+
+// runs on frames nobody else holds yet; false drops the frame
+bool capture_jpeg_check(const capture_jpeg_t *jpeg, capture_metrics_t *metrics, const char *name, unsigned char *data,
+                        size_t *size) {
+    if (jpeg->validate && !jpeg_validate(data, *size)) {
+        const unsigned long invalid = atomic_fetch_add(&metrics->invalid, 1) + 1;
+        if ((invalid & (invalid - 1)) == 0) // 1, 2, 4, 8, ... so a broken stream does not flood the log
+            fprintf(stderr, "%s: invalid JPEG dropped (%zu bytes, %lu so far)\n", name, *size, invalid);
+        return false;
+    }
+    if (jpeg->strip)
+        *size = jpeg_strip(data, *size);
+    return true;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// persistent mode: one long-lived ffmpeg per camera keeps the RTSP session open and streams JPEGs over its pipe, the
+// framer splits them out and the latest frame is retained for capture() to collect; rtsp mode does the same with the
+// in-process client so no ffmpeg is spawned at all; with ring=N the last N frames are also kept (by reference, as
+// received) for snapshot commands asking for frames from before the command; a raw stream (encoder=libjpeg) has
+// ffmpeg write decoded frames, kept as they are and encoded only when captured
+
+typedef enum { STREAM_SOURCE_FFMPEG, STREAM_SOURCE_RTSP } stream_source_t;
+
+typedef struct {
+    const char *name;
+    const char *rtsp_url;
+    stream_source_t source;
+    char rate[16], quality[16], filter[64]; // quality and filter change under the mutex, see stream_configure
+    bool restart;
+    int timeout; // seconds without output before ffmpeg is restarted
+    health_t health; // the stream's own, paces restarts
+    int probe_timeout;
+    exec_stream_t exec;
+    bool raw;
+    mjpeg_framer_t framer;
+    y4m_framer_t y4m; // raw streams
+    rtsp_client_t *rtsp;
+    RtspConfig rtsp_config;
+    bool rtsp_active;
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    atomic_bool running; // changed under the mutex, for the waiters on cond
+    frame_pool_t *pool;
+    frame_t *frame;
+    unsigned long frame_sequence;
+    _Atomic int64_t ready; // monotonic nanoseconds of the first frame, 0 before
+    frame_t *ring[RING_MAX]; // oldest at ring_head once full
+    int ring_size, ring_count, ring_head;
+    capture_metrics_t *metrics;
+    capture_jpeg_t *jpeg; // the camera's
+} stream_t;
+
+extern schedule_t capture_schedule; // woken by a stream's first frame, see startup_camera
+
+// the latest frame is held by reference; where the source allows it the frame takes over the source's buffer (which
+// gets a pooled one in return) so that the only copy left is the one made when publishing
+void stream_frame(const unsigned char *data, const size_t size, void *context) {
+    stream_t *stream = (stream_t *)context;
+    frame_t *frame = frame_alloc(stream->pool);
+    if (frame == NULL) {
+        fprintf(stderr, "stream: %s: failed to allocate frame\n", stream->name);
+        return;
+    }
+    const bool exchanged = stream->source == STREAM_SOURCE_RTSP
+                               ? rtsp_frame_exchange(stream->rtsp, data, &frame->data, &frame->capacity)
+                           : stream->raw ? y4m_framer_exchange(&stream->y4m, &frame->data, &frame->capacity)
+                                         : mjpeg_framer_exchange(&stream->framer, &frame->data, &frame->capacity);
+    if (!exchanged) {
+        if (!frame_reserve(frame, size)) {
+            frame_unref(frame);
+            return;
+        }
+        memcpy(frame->data, data, size);
+    }
+    frame->size = size;
+    if (stream->raw) {
+        frame->width = stream->y4m.width;
+        frame->height = stream->y4m.height;
+    } else if (!capture_jpeg_check(stream->jpeg, stream->metrics, stream->name, frame->data, &frame->size)) {
+        frame_unref(frame);
+        return;
+    }
+    frame_t *evicted = NULL;
+    pthread_mutex_lock(&stream->mutex);
+    frame_t *previous = stream->frame;
+    stream->frame = frame;
+    const bool first = ++stream->frame_sequence == 1;
+    if (first)
+        atomic_store(&stream->ready, schedule_monotonic());
+    if (stream->ring_size > 0) {
+        const int slot = (stream->ring_head + stream->ring_count) % stream->ring_size;
+        if (stream->ring_count == stream->ring_size) {
+            evicted = stream->ring[stream->ring_head];
+            stream->ring_head = (stream->ring_head + 1) % stream->ring_size;
+        } else
+            stream->ring_count++;
+        stream->ring[slot] = frame_ref(frame);
+    }
+    pthread_cond_broadcast(&stream->cond);
+    pthread_mutex_unlock(&stream->mutex);
+    frame_unref(previous);
+    frame_unref(evicted);
+    if (first)
+        schedule_wake(&capture_schedule);
+}
+
+// whether a frame came in after the one at sequence
+bool stream_fresh(stream_t *stream, const unsigned long sequence) {
+    pthread_mutex_lock(&stream->mutex);
+    const bool fresh = stream->frame_sequence != sequence;
+    pthread_mutex_unlock(&stream->mutex);
+    return fresh;
+}
+
+void stream_wait(stream_t *stream, const int64_t delay) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += (time_t)(delay / SCHEDULE_NS_PER_SECOND);
+    deadline.tv_nsec += (long)(delay % SCHEDULE_NS_PER_SECOND);
+    if (deadline.tv_nsec >= SCHEDULE_NS_PER_SECOND) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= SCHEDULE_NS_PER_SECOND;
+    }
+    pthread_mutex_lock(&stream->mutex);
+    while (atomic_load(&stream->running) &&
+           pthread_cond_timedwait(&stream->cond, &stream->mutex, &deadline) != ETIMEDOUT)
+        ;
+    pthread_mutex_unlock(&stream->mutex);
+}
 
-    char topic[128];
-    snprintf(topic, sizeof(topic), "%s/imagedata", mqtt_topic);
-    if (!mqtt_send(topic, snapshot_buffer, total_bytes))
+bool stream_run_ffmpeg(stream_t *stream, const char *const arguments[]) {
+    const int64_t begin = schedule_monotonic();
+    pthread_mutex_lock(&stream->mutex);
+    const bool started = atomic_load(&stream->running) && exec_stream_begin(&stream->exec, FFMPEG_COMMAND, arguments);
+    if (started && stream->restart) // reconfigured since the arguments were taken, while there was no ffmpeg to stop
+        exec_stream_stop(&stream->exec);
+    pthread_mutex_unlock(&stream->mutex);
+    if (!started)
         return false;
-    snprintf(topic, sizeof(topic), "%s/metadata", mqtt_topic);
-    if (!mqtt_send(topic, (unsigned char *)metadata, strlen(metadata)))
+    const int64_t spawned = schedule_monotonic();
+    capture_stage(stream->metrics, STAGE_SPAWN, begin, spawned);
+    printf("stream: %s: started (pid=%d)\n", stream->name, stream->exec.pid);
+    unsigned char buffer[64 * 1024];
+    ssize_t bytes_read;
+    bool first = true;
+    while ((bytes_read = exec_stream_read(&stream->exec, buffer, sizeof(buffer), stream->timeout)) > 0) {
+        if (first) {
+            capture_stage(stream->metrics, STAGE_FIRST_BYTE, spawned, schedule_monotonic());
+            first = false;
+            if (capture_jpeg_fallback(stream->jpeg, stream->name, buffer, (size_t)bytes_read))
+                break;
+        }
+        if (!(stream->raw ? y4m_framer_push(&stream->y4m, buffer, (size_t)bytes_read, stream_frame, stream)
+                          : mjpeg_framer_push(&stream->framer, buffer, (size_t)bytes_read, stream_frame, stream)))
+            break;
+    }
+    if (bytes_read < 0 && errno == ETIMEDOUT && atomic_load(&stream->running)) {
+        atomic_fetch_add(&stream->metrics->timeouts, 1);
+        fprintf(stderr, "stream: %s: no output for %d seconds, stopping ffmpeg\n", stream->name, stream->timeout);
+    }
+    pthread_mutex_lock(&stream->mutex); // reaped unlocked, it may take EXEC_KILL_GRACE
+    const pid_t pid = exec_stream_detach(&stream->exec);
+    pthread_mutex_unlock(&stream->mutex);
+    const int status = exec_stream_reap(pid);
+    mjpeg_framer_reset(&stream->framer);
+    y4m_framer_reset(&stream->y4m);
+    if (atomic_load(&stream->running))
+        fprintf(stderr, "stream: %s: ffmpeg exited (status=%d)\n", stream->name, status);
+    return true;
+}
+
+bool stream_run_rtsp(stream_t *stream) {
+    const int64_t begin = schedule_monotonic();
+    // active from here, so that stream_stop interrupts the connect and handshake too
+    pthread_mutex_lock(&stream->mutex);
+    const bool active = stream->rtsp_active = atomic_load(&stream->running);
+    if (active)
+        rtsp_reset(stream->rtsp);
+    pthread_mutex_unlock(&stream->mutex);
+    if (!active)
         return false;
+    const bool started = rtsp_begin(stream->rtsp, stream->rtsp_url, &stream->rtsp_config);
+    if (started) {
+        const int64_t playing = schedule_monotonic();
+        capture_stage(stream->metrics, STAGE_CONNECT, begin, playing);
+        if (atomic_load(&stream->running) && rtsp_process(stream->rtsp, stream_frame, stream)) {
+            capture_stage(stream->metrics, STAGE_FIRST_BYTE, playing, schedule_monotonic());
+            while (atomic_load(&stream->running) && rtsp_process(stream->rtsp, stream_frame, stream))
+                ;
+        }
+    }
+    pthread_mutex_lock(&stream->mutex);
+    stream->rtsp_active = false;
+    pthread_mutex_unlock(&stream->mutex);
+    if (started && atomic_load(&stream->running))
+        fprintf(stderr, "stream: %s: rtsp session lost (frames=%lu, keyframes=%lu)\n", stream->name,
+                stream->rtsp->frames, stream->rtsp->keyframes);
+    rtsp_end(stream->rtsp);
+    return started;
+}
+
+// restarts after a failure are paced by the stream's own backoff (health-backoff-min to health-backoff-max, with
+// jitter, reset by a run that gave frames), and an ffmpeg stream is only started again once the camera answers an
+// RTSP OPTIONS probe, so a dead camera costs a connect attempt rather than an ffmpeg launch each time
+void *stream_thread(void *context) {
+    stream_t *stream = (stream_t *)context;
+    const char *arguments[32];
+    char rate[sizeof(stream->rate)], quality[sizeof(stream->quality)], filter[sizeof(stream->filter)];
+    while (atomic_load(&stream->running)) {
+        const passthrough_t passthrough = stream->jpeg->passthrough;
+        pthread_mutex_lock(&stream->mutex); // the settings as of now, a later stream_configure restarts with its own
+        memcpy(rate, stream->rate, sizeof(rate));
+        memcpy(quality, stream->quality, sizeof(quality));
+        memcpy(filter, stream->filter, sizeof(filter));
+        stream->restart = false;
+        pthread_mutex_unlock(&stream->mutex);
+        ffmpeg_arguments(arguments, stream->rtsp_url, true, rate[0] ? rate : NULL, quality, filter[0] ? filter : NULL,
+                         passthrough != PASSTHROUGH_OFF, stream->raw);
+        const unsigned long sequence = stream->frame_sequence; // only this thread changes it
+        bool started = false;
+        if (stream->source == STREAM_SOURCE_FFMPEG && atomic_load(&stream->health.failures) > 0) {
+            atomic_fetch_add(&stream->metrics->probes, 1);
+            if (rtsp_probe(stream->rtsp_url, stream->probe_timeout) < 0)
+                atomic_fetch_add(&stream->metrics->probe_failures, 1);
+            else
+                started = stream_run_ffmpeg(stream, arguments);
+        } else
+            started = stream->source == STREAM_SOURCE_RTSP ? stream_run_rtsp(stream)
+                                                           : stream_run_ffmpeg(stream, arguments);
+        if (!atomic_load(&stream->running))
+            break;
+        if (stream->frame_sequence != sequence)
+            health_success(&stream->health, schedule_monotonic());
+        pthread_mutex_lock(&stream->mutex);
+        const bool restart = stream->restart;
+        stream->restart = false;
+        pthread_mutex_unlock(&stream->mutex);
+        if (restart || stream->jpeg->passthrough != passthrough)
+            continue; // reconfigured, or fell back to re-encoding: restart straight away
+        const int64_t now = schedule_monotonic();
+        health_failure(&stream->health, now);
+        const int64_t delay = health_retry(&stream->health) - now;
+        fprintf(stderr, "stream: %s: %s, retrying in %.1f seconds\n", stream->name,
+                started ? "ended" : "failed to start", (double)delay / SCHEDULE_NS_PER_SECOND);
+        stream_wait(stream, delay);
+    }
+    return NULL;
+}
 
-    printf("published '%s' (%zu bytes) [%ld seconds]\n", timestamp, total_bytes, total_time);
+// health gives the backoff for restarts, probe_timeout the seconds an OPTIONS probe may take
+bool stream_begin(stream_t *stream, const char *name, const stream_source_t source, const char *rtsp_url,
+                  const int rate, const int ring, const bool raw, const RtspConfig *rtsp_config, frame_pool_t *pool,
+                  capture_metrics_t *metrics, capture_jpeg_t *jpeg, const health_t *health, const int probe_timeout) {
+    memset(stream, 0, sizeof(*stream));
+    stream->name = name;
+    stream->raw = raw && source == STREAM_SOURCE_FFMPEG;
+    stream->ring_size = ring < 0 ? 0 : ring > RING_MAX ? RING_MAX : ring;
+    stream->pool = pool;
+    stream->metrics = metrics;
+    stream->jpeg = jpeg;
+    stream->rtsp_url = rtsp_url;
+    stream->source = source;
+    if (rate > 0)
+        snprintf(stream->rate, sizeof(stream->rate), "%d", rate);
+    snprintf(stream->quality, sizeof(stream->quality), "%d", rtsp_config->quality);
+    stream->timeout = rtsp_config->timeout;
+    health_begin(&stream->health, 0, health->backoff_min, health->backoff_max, health->seed);
+    stream->probe_timeout = probe_timeout;
+    stream->exec.pid = stream->exec.fd = -1;
+    if (source == STREAM_SOURCE_RTSP) {
+        if ((stream->rtsp = malloc(sizeof(rtsp_client_t))) == NULL)
+            return false;
+        stream->rtsp->sock = stream->rtsp->wake = -1;
+        stream->rtsp_config = *rtsp_config;
+    }
+    if (!mjpeg_framer_begin(&stream->framer, FRAME_SIZE_INITIAL, MAX_BUFFER_SIZE)) {
+        free(stream->rtsp);
+        return false;
+    }
+    if (!y4m_framer_begin(&stream->y4m, MAX_BUFFER_SIZE)) {
+        mjpeg_framer_end(&stream->framer);
+        free(stream->rtsp);
+        return false;
+    }
+    pthread_condattr_t condattr;
+    pthread_condattr_init(&condattr);
+    pthread_condattr_setclock(&condattr, CLOCK_MONOTONIC);
+    pthread_cond_init(&stream->cond, &condattr);
+    pthread_condattr_destroy(&condattr);
+    pthread_mutex_init(&stream->mutex, NULL);
+    atomic_store(&stream->running, true);
+    if (pthread_create(&stream->thread, NULL, stream_thread, stream) != 0) {
+        fprintf(stderr, "stream: %s: failed to create thread\n", name);
+        atomic_store(&stream->running, false);
+        mjpeg_framer_end(&stream->framer);
+        y4m_framer_end(&stream->y4m);
+        free(stream->rtsp);
+        return false;
+    }
     return true;
 }
 
-void execute(volatile bool *running) {
-    const int interval = config_get_integer("interval", INTERVAL_DEFAULT);
-    const char *rtsp_url = config_get_string("rtsp-url", RTSP_URL_DEFAULT);
-    printf("executing (interval=%d seconds)\n", interval);
-    while (*running) {
-        const time_t time_entry = time(NULL);
-        if (!capture(rtsp_url))
-            fprintf(stderr, "capture error, will retry\n");
-        const time_t time_leave = time(NULL);
-        time_t next = time_entry + interval;
-        int skipped = 0;
-        while (next < time_leave) {
-            skipped++;
-            next += interval;
+// new encoding settings for an ffmpeg stream, which is restarted with them when they differ
+void stream_configure(stream_t *stream, const int quality, const char *filter) {
+    char quality_text[sizeof(stream->quality)];
+    snprintf(quality_text, sizeof(quality_text), "%d", quality);
+    pthread_mutex_lock(&stream->mutex);
+    if (stream->source == STREAM_SOURCE_FFMPEG &&
+        (strcmp(stream->quality, quality_text) != 0 || strcmp(stream->filter, filter ? filter : "") != 0)) {
+        snprintf(stream->quality, sizeof(stream->quality), "%s", quality_text);
+        snprintf(stream->filter, sizeof(stream->filter), "%s", filter ? filter : "");
+        stream->restart = true;
+        exec_stream_stop(&stream->exec);
+    }
+    pthread_mutex_unlock(&stream->mutex);
+}
+
+// wakes the stream thread and any snapshot waiters, stream_end then joins and releases
+void stream_stop(stream_t *stream) {
+    pthread_mutex_lock(&stream->mutex);
+    atomic_store(&stream->running, false);
+    exec_stream_stop(&stream->exec);
+    if (stream->rtsp_active)
+        rtsp_stop(stream->rtsp);
+    pthread_cond_broadcast(&stream->cond);
+    pthread_mutex_unlock(&stream->mutex);
+}
+
+void stream_end(stream_t *stream) {
+    stream_stop(stream);
+    pthread_join(stream->thread, NULL);
+    mjpeg_framer_end(&stream->framer);
+    y4m_framer_end(&stream->y4m);
+    pthread_cond_destroy(&stream->cond);
+    pthread_mutex_destroy(&stream->mutex);
+    frame_unref(stream->frame);
+    stream->frame = NULL;
+    for (int i = 0; i < stream->ring_count; i++)
+        frame_unref(stream->ring[(stream->ring_head + i) % stream->ring_size]);
+    stream->ring_count = 0;
+    free(stream->rtsp);
+    stream->rtsp = NULL;
+}
+
+// waits for a frame newer than the last one collected, so a snapshot is at most one frame time old; the caller owns
+// the returned reference
+frame_t *stream_snapshot(stream_t *stream, unsigned long *sequence, const int timeout) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout;
+    frame_t *frame = NULL;
+    pthread_mutex_lock(&stream->mutex);
+    while (atomic_load(&stream->running) && stream->frame_sequence == *sequence)
+        if (pthread_cond_timedwait(&stream->cond, &stream->mutex, &deadline) == ETIMEDOUT)
+            break;
+    if (stream->frame_sequence != *sequence) {
+        frame = frame_ref(stream->frame);
+        *sequence = stream->frame_sequence;
+    } else if (atomic_load(&stream->running))
+        fprintf(stderr, "stream: %s: no frame within %d seconds\n", stream->name, timeout);
+    pthread_mutex_unlock(&stream->mutex);
+    return frame;
+}
+
+// references to the newest frames (at most count, oldest first, the latest frame alone without a ring) and the
+// sequence of the newest, from which stream_snapshot can go on; the caller owns the references
+int stream_recent(stream_t *stream, frame_t **frames, const int count, unsigned long *sequence) {
+    int n = 0;
+    pthread_mutex_lock(&stream->mutex);
+    if (stream->ring_count > 0) {
+        const int first = stream->ring_count > count ? stream->ring_count - count : 0;
+        for (int i = first; i < stream->ring_count; i++)
+            frames[n++] = frame_ref(stream->ring[(stream->ring_head + i) % stream->ring_size]);
+    } else if (stream->frame != NULL && count > 0)
+        frames[n++] = frame_ref(stream->frame);
+    *sequence = stream->frame_sequence;
+    pthread_mutex_unlock(&stream->mutex);
+    return n;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// cameras are either the global rtsp-url (topic is mqtt-topic) or '[name]' config sections with an rtsp-url (topic
+// defaults to mqtt-topic/name); per camera keys fall back to the global ones
+
+typedef enum { CAPTURE_SPAWN, CAPTURE_PERSISTENT, CAPTURE_RTSP } capture_mode_t;
+
+// renditions ('renditions=full,640:640:80,thumb:320:70', i.e. name[:width[:quality]]) are published as
+// imagedata/<name>; width 0 keeps the captured size and quality 0 the captured JPEG itself, anything else is rendered
+// from one decode of the frame
+
+typedef struct {
+    char name[32];
+    int width, quality;
+} rendition_t;
+
+const char *capture_mode_names[] = {"spawn", "persistent", "rtsp"};
+
+// encoder=libjpeg has ffmpeg only decode (spawn and persistent modes, when not passing JPEGs through) and encodes the
+// frames captured in the workers instead, each with a libjpeg(-turbo) compressor of its own, kept from frame to frame;
+// workers-cpus pins the workers to cores, one each in turn; quality keeps ffmpeg's -q:v scale, see encoder_quality
+typedef enum { ENCODER_FFMPEG, ENCODER_LIBJPEG } encoder_t;
+
+const char *encoder_names[] = {"ffmpeg", "libjpeg"};
+
+// ffmpeg's -q:v (2 finest .. 31) as the libjpeg quality (1..100) quantising about as coarsely: -q:v q scales the
+// standard tables by q/8, which is libjpeg's quality 100 - 6.25q, or 400/q past q=8
+int encoder_quality(const int q) {
+    const int quality = q <= 8 ? 100 - (q * 25 + 2) / 4 : 400 / q;
+    return quality < 1 ? 1 : quality > 100 ? 100 : quality;
+}
+
+// a snapshot command being answered: frames from before it (the ring) and after it, and the id it asked to be echoed
+typedef struct {
+    int last, next;
+    char id[64];
+} command_t;
+
+// why a frame is published: the interval, or a command, as one of a burst of frames
+typedef struct {
+    bool command;
+    int index, count;
+    char id[64];
+} capture_trigger_t;
+
+// adaptive=true: one degradation level per camera, each step first coarsens the JPEG quality, then scales the frame
+// down, then stretches the interval, within the configured bounds; the levels that apply depend on how the camera
+// captures (only the interval when nothing is re-encoded), and the level is shared with the publisher through level
+typedef enum { ADAPT_NONE, ADAPT_CPU, ADAPT_BANDWIDTH, ADAPT_BACKLOG, ADAPT_RECOVERED } adapt_reason_t;
+
+const char *adapt_reason_names[] = {"none", "cpu", "bandwidth", "backlog", "recovered"};
+
+#define ADAPT_QUALITY_STEP 2
+#define ADAPT_SCALE_STEP 0.75
+#define ADAPT_INTERVAL_STEP 1.25
+
+typedef struct {
+    bool active;
+    int quality_max;
+    double scale_min;
+    int64_t interval_base, interval_max; // nanoseconds
+    atomic_int level, reason;
+    int calm; // periods without pressure, recovery waits for a few
+    unsigned long skips;
+} adapt_t;
+
+typedef struct {
+    int64_t interval;
+    int quality;
+    double scale;
+    char filter[64]; // ffmpeg scale filter, empty at full size
+} adapt_settings_t;
+
+// a reload marks the cameras whose settings it changed (or whose section it removed), and the scheduler tears each
+// down and loads it again in its slot once idle
+typedef enum { CAMERA_KEEP, CAMERA_RELOAD, CAMERA_REMOVE } camera_reload_t;
+
+// a key the camera's settings were read from and the value found then (NULL for none), see camera_changed
+typedef struct {
+    char *key;
+    bool inherit; // looked up in the camera's section first
+    const char *value;
+} camera_trace_t;
+
+typedef struct {
+    const char *name;
+    const char *section; // NULL for the default camera
+    const char *rtsp_url;
+    char mqtt_topic[128];
+    char command_topic[160];
+    int expiry;       // seconds, MQTT 5 message expiry
+    int64_t interval; // nanoseconds
+    bool interval_align;
+    int quality;
+    int timeout; // seconds
+    capture_jpeg_t jpeg;
+    capture_mode_t mode;
+    encoder_t encoder;
+    frame_pool_t raw_pool; // encoder=libjpeg, frames as ffmpeg decoded them
+    adapt_t adapt;
+    bool change_active;
+    change_t change;
+    rendition_t renditions[RENDITIONS_MAX];
+    int rendition_count;
+    image_t image_decoded, image_scaled;
+    frame_pool_t pool;
+    stream_t stream;
+    bool stream_active;
+    unsigned long stream_sequence;
+    exec_async_t exec; // spawn mode, run by the scheduler
+    schedule_watch_t exec_output, exec_exit;
+    bool exec_active;
+    frame_t *exec_frame; // captured, for the worker
+    time_t exec_time;
+    int64_t exec_begin, exec_deadline;
+    pthread_mutex_t command_mutex;
+    command_t command; // received, merged until started
+    atomic_bool command_pending;
+    bool job_command; // the job started is answering job_request
+    command_t job_request;
+    health_t health; // outcomes from whoever holds busy, see capture_admit
+    int probe_timeout;
+    bool job_probe;           // the job started is an OPTIONS probe
+    atomic_bool probe_passed; // by the probe, the next capture is let through
+    int status_logged, status_published; // health states, main thread only
+    char status_topic[160];
+    shm_ring_t shm; // written by the worker capturing, one at a time
+    bool shm_active, shm_notify;
+    char shm_topic[160];
+    batch_t batch; // publisher thread only
+    int batch_frames;
+    int64_t batch_time, batch_due; // monotonic nanoseconds
+    int64_t next, due;             // monotonic nanoseconds
+    atomic_bool busy;
+    atomic_int publishing; // jobs with the publisher
+    bool loaded;           // the slot holds a camera, changed under cameras_lock
+    camera_reload_t reload;
+    camera_trace_t *trace;
+    int trace_count, trace_capacity; // count -1 when the trace could not be kept
+    capture_metrics_t metrics;
+    unsigned long started;
+    int64_t late_total, late_max; // capture start behind schedule, nanoseconds
+    bool startup;                 // first capture still to be made, see startup_camera
+    int64_t startup_begin;        // monotonic nanoseconds, when loaded
+    _Atomic int64_t startup_frame, startup_live; // first frame in hand (spawn mode), first published while connected
+} camera_t;
+
+#define CAMERAS_MAX (CONFIG_MAX_SECTIONS + 1)
+
+// slots up to camera_count, some emptied by a reload; threads other than the scheduler hold cameras_lock for reading
+// while they walk them, the scheduler takes it for writing to fill or empty a slot
+camera_t cameras[CAMERAS_MAX];
+int camera_count = 0;
+pthread_rwlock_t cameras_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+camera_t *camera_loading = NULL; // whose config reads are traced
+
+// the raw value behind a camera setting, recorded in the trace of the camera being loaded
+const char *camera_config_trace(const char *section, const char *key) {
+    const char *value = section ? config_get_section_string(section, key, NULL) : config_get_string(key, NULL);
+    camera_t *camera = camera_loading;
+    if (camera == NULL || camera->trace_count < 0)
+        return value;
+    if (camera->trace_count == camera->trace_capacity) {
+        const int capacity = camera->trace_capacity ? camera->trace_capacity * 2 : 32;
+        camera_trace_t *trace = realloc(camera->trace, (size_t)capacity * sizeof(camera_trace_t));
+        if (trace == NULL) {
+            for (int i = 0; i < camera->trace_count; i++)
+                free(camera->trace[i].key);
+            free(camera->trace);
+            camera->trace = NULL;
+            camera->trace_count = -1;
+            return value;
+        }
+        camera->trace = trace;
+        camera->trace_capacity = capacity;
+    }
+    camera->trace[camera->trace_count++] =
+        (camera_trace_t){.key = strdup(key), .inherit = section != NULL, .value = value};
+    return value;
+}
+
+const char *camera_config_string(const char *section, const char *key, const char *default_value) {
+    const char *value = camera_config_trace(section, key);
+    return value ? value : default_value;
+}
+
+int camera_config_integer(const char *section, const char *key, const int default_value) {
+    camera_config_trace(section, key);
+    return section ? config_get_section_integer(section, key, default_value) : config_get_integer(key, default_value);
+}
+
+double camera_config_double(const char *section, const char *key, const double default_value) {
+    camera_config_trace(section, key);
+    return section ? config_get_section_double(section, key, default_value) : config_get_double(key, default_value);
+}
+
+bool camera_config_bool(const char *section, const char *key, const bool default_value) {
+    camera_config_trace(section, key);
+    return section ? config_get_section_bool(section, key, default_value) : config_get_bool(key, default_value);
+}
+
+// whether loading the camera from the config as it is now would read anything different from what it did
+bool camera_changed(const camera_t *camera) {
+    if (camera->trace_count < 0)
+        return true;
+    for (int i = 0; i < camera->trace_count; i++) {
+        const camera_trace_t *trace = &camera->trace[i];
+        const char *value = trace->inherit ? config_get_section_string(camera->section, trace->key, NULL)
+                                           : config_get_string(trace->key, NULL);
+        if ((value == NULL) != (trace->value == NULL) || (value != NULL && strcmp(value, trace->value) != 0))
+            return true;
+    }
+    return false;
+}
+
+void camera_trace_end(camera_t *camera) {
+    for (int i = 0; i < camera->trace_count; i++)
+        free(camera->trace[i].key);
+    free(camera->trace);
+    camera->trace = NULL;
+    camera->trace_count = camera->trace_capacity = 0;
+}
+
+// quality and scale only apply where ffmpeg re-encodes the frames
+bool camera_encoding(const camera_t *camera) {
+    return camera->mode != CAPTURE_RTSP && camera->jpeg.passthrough == PASSTHROUGH_OFF;
+}
+
+// what the camera's adaptive level (and the levers available to it) comes to; returns the highest level
+int camera_adapt_settings(const camera_t *camera, const int level, adapt_settings_t *settings) {
+    const adapt_t *adapt = &camera->adapt;
+    settings->interval = adapt->active ? adapt->interval_base : camera->interval;
+    settings->quality = camera->quality;
+    settings->scale = 1.0;
+    settings->filter[0] = '\0';
+    int steps = 0;
+    if (!adapt->active)
+        return 0;
+    if (camera_encoding(camera)) {
+        for (int quality = camera->quality; quality < adapt->quality_max; steps++) {
+            quality = quality + ADAPT_QUALITY_STEP > adapt->quality_max ? adapt->quality_max
+                                                                        : quality + ADAPT_QUALITY_STEP;
+            if (steps < level)
+                settings->quality = quality;
+        }
+        for (double scale = ADAPT_SCALE_STEP; scale >= adapt->scale_min - 1e-9; scale *= ADAPT_SCALE_STEP, steps++)
+            if (steps < level)
+                settings->scale = scale;
+    }
+    for (int64_t interval = adapt->interval_base; interval < adapt->interval_max; steps++) {
+        interval = (int64_t)((double)interval * ADAPT_INTERVAL_STEP);
+        if (interval > adapt->interval_max)
+            interval = adapt->interval_max;
+        if (steps < level)
+            settings->interval = interval;
+    }
+    if (settings->scale < 1.0)
+        snprintf(settings->filter, sizeof(settings->filter), "scale=trunc(iw*%.4f/2)*2:-2", settings->scale);
+    return steps;
+}
+
+int camera_renditions_load(rendition_t *renditions, const char *name, const char *section) {
+    const char *value = camera_config_string(section, "renditions", NULL);
+    if (value == NULL)
+        return 0;
+    char *list = strdup(value), *saveptr = NULL;
+    if (list == NULL)
+        return 0;
+    int count = 0;
+    for (const char *item = strtok_r(list, ",", &saveptr); item != NULL; item = strtok_r(NULL, ",", &saveptr)) {
+        while (*item == ' ')
+            item++;
+        rendition_t rendition = {.name = "", .width = 0, .quality = -1};
+        if (sscanf(item, "%31[^:]:%d:%d", rendition.name, &rendition.width, &rendition.quality) < 1 ||
+            rendition.width < 0) {
+            fprintf(stderr, "config: invalid rendition '%s' for camera '%s', ignoring\n", item, name);
+            continue;
+        }
+        // names go into the metadata JSON as they are
+        bool plain = true;
+        for (const char *c = rendition.name; *c; c++)
+            plain = plain && *c != '"' && *c != '\\' && !iscntrl((unsigned char)*c);
+        if (!plain) {
+            fprintf(stderr, "config: invalid rendition name '%s' for camera '%s' (quote, backslash), ignoring\n",
+                    rendition.name, name);
+            continue;
         }
-        if (skipped) {
-            snapshot_skipped += skipped;
-            printf("capture skipped (%d now / %d all)\n", skipped, snapshot_skipped);
+        if (rendition.quality < 0)
+            rendition.quality = rendition.width > 0 ? RENDITION_QUALITY_DEFAULT : 0;
+        if (rendition.quality > 100)
+            rendition.quality = 100;
+#ifndef IMAGE_LIBJPEG
+        if (rendition.quality > 0) {
+            fprintf(stderr, "config: rendition '%s' for camera '%s' requires libjpeg (build with LIBJPEG=1)\n",
+                    rendition.name, name);
+            continue;
+        }
+#endif
+        if (count == RENDITIONS_MAX) {
+            fprintf(stderr, "config: too many renditions for camera '%s', ignoring '%s'\n", name, rendition.name);
+            continue;
+        }
+        renditions[count++] = rendition;
+    }
+    free(list);
+    return count;
+}
+
+bool __camera_load(camera_t *camera, const char *name, const char *section) {
+    const char *mqtt_topic = camera_config_string(NULL, "mqtt-topic", MQTT_TOPIC_DEFAULT);
+    if (section) { // rtsp-url and mqtt-topic are not inherited from the global keys
+        char key[strlen(section) + sizeof(".mqtt-topic")];
+        snprintf(key, sizeof(key), "%s.rtsp-url", section);
+        camera->rtsp_url = camera_config_string(NULL, key, RTSP_URL_DEFAULT);
+        snprintf(key, sizeof(key), "%s.mqtt-topic", section);
+        const char *topic = camera_config_string(NULL, key, NULL);
+        if (topic)
+            snprintf(camera->mqtt_topic, sizeof(camera->mqtt_topic), "%s", topic);
+        else
+            snprintf(camera->mqtt_topic, sizeof(camera->mqtt_topic), "%s/%s", mqtt_topic, name);
+    } else {
+        camera->rtsp_url = camera_config_string(NULL, "rtsp-url", RTSP_URL_DEFAULT);
+        snprintf(camera->mqtt_topic, sizeof(camera->mqtt_topic), "%s", mqtt_topic);
+    }
+    if (!camera->rtsp_url[0])
+        return false;
+    snprintf(camera->command_topic, sizeof(camera->command_topic), "%s/command/snapshot", camera->mqtt_topic);
+    if (!frame_pool_begin(&camera->pool, FRAME_SIZE_INITIAL, MAX_BUFFER_SIZE))
+        return false;
+    double interval = camera_config_double(section, "interval", INTERVAL_DEFAULT);
+    if (!(interval >= INTERVAL_MINIMUM)) {
+        fprintf(stderr, "config: interval for camera '%s' below %.3f seconds, using %.3f\n", name, INTERVAL_MINIMUM,
+                INTERVAL_MINIMUM);
+        interval = INTERVAL_MINIMUM;
+    }
+    camera->interval = (int64_t)(interval * 1000.0 + 0.5) * SCHEDULE_NS_PER_MS;
+    camera->interval_align = camera_config_bool(section, "interval-align", false);
+    camera->quality = camera_config_integer(section, "quality", QUALITY_DEFAULT);
+    camera->timeout = camera_config_integer(section, "capture-timeout", CAPTURE_TIMEOUT_DEFAULT);
+    if (camera->timeout < 1)
+        camera->timeout = 1;
+    camera->expiry = camera_config_integer(section, "mqtt-expiry", MQTT_EXPIRY_DEFAULT);
+    health_begin(&camera->health, camera_config_integer(section, "health-failures", HEALTH_FAILURES_DEFAULT),
+                 (int64_t)(camera_config_double(section, "health-backoff-min", HEALTH_BACKOFF_MIN_DEFAULT) * 1000.0) *
+                     SCHEDULE_NS_PER_MS,
+                 (int64_t)(camera_config_double(section, "health-backoff-max", HEALTH_BACKOFF_MAX_DEFAULT) * 1000.0) *
+                     SCHEDULE_NS_PER_MS,
+                 (unsigned int)schedule_monotonic() ^ (unsigned int)(camera - cameras) * 2654435761u);
+    camera->probe_timeout = camera_config_integer(section, "health-probe-timeout", HEALTH_PROBE_TIMEOUT_DEFAULT);
+    camera->status_logged = camera->status_published = -1;
+    snprintf(camera->status_topic, sizeof(camera->status_topic), "%s/status", camera->mqtt_topic);
+    const char *passthrough = camera_config_string(section, "passthrough", PASSTHROUGH_DEFAULT);
+    camera->jpeg.passthrough = PASSTHROUGH_OFF;
+    for (int i = 0; i < (int)(sizeof(passthrough_names) / sizeof(passthrough_names[0])); i++)
+        if (strcmp(passthrough, passthrough_names[i]) == 0)
+            camera->jpeg.passthrough = (passthrough_t)i;
+    if (camera->jpeg.passthrough == PASSTHROUGH_OFF && strcmp(passthrough, "false") != 0)
+        fprintf(stderr, "config: invalid passthrough '%s' for camera '%s', using 'false'\n", passthrough, name);
+    camera->jpeg.validate = camera_config_bool(section, "jpeg-validate", false);
+    camera->jpeg.strip = camera_config_bool(section, "jpeg-strip", false);
+    camera->rendition_count = camera_renditions_load(camera->renditions, name, section);
+    camera->batch_frames = camera_config_integer(section, "batch", BATCH_DEFAULT);
+    camera->batch_time = (int64_t)camera_config_integer(section, "batch-time", BATCH_TIME_DEFAULT) * SCHEDULE_NS_PER_MS;
+    if (camera->batch_frames > BATCH_FRAMES_MAX || (camera->batch_frames <= 0 && camera->batch_time > 0))
+        camera->batch_frames = BATCH_FRAMES_MAX;
+    if (camera->batch_frames > 1 || camera->batch_time > 0)
+        printf("camera: '%s' batch (frames=%d, time=%.3f seconds)\n", name, camera->batch_frames,
+               (double)camera->batch_time / SCHEDULE_NS_PER_SECOND);
+    else
+        camera->batch_frames = 0;
+    for (int i = 0; i < camera->rendition_count; i++)
+        printf("camera: '%s' rendition '%s' (width=%d, quality=%d)\n", name, camera->renditions[i].name,
+               camera->renditions[i].width, camera->renditions[i].quality);
+    if (camera_config_bool(section, "change-detect", false)) {
+        const ChangeConfig change_config = {
+            .threshold = camera_config_double(section, "change-threshold", CHANGE_THRESHOLD_DEFAULT),
+            .delta = camera_config_integer(section, "change-delta", CHANGE_DELTA_DEFAULT),
+            .silence = camera_config_integer(section, "change-silence", CHANGE_SILENCE_DEFAULT)};
+        camera->change_active = change_begin(&camera->change, &change_config);
+        printf("camera: '%s' change-detect (threshold=%.2f%%, delta=%d, silence=%d seconds)\n", name,
+               change_config.threshold, change_config.delta, change_config.silence);
+    }
+    const char *capture_mode = camera_config_string(section, "capture-mode", CAPTURE_MODE_DEFAULT);
+    camera->mode = CAPTURE_SPAWN;
+    for (int i = 0; i < (int)(sizeof(capture_mode_names) / sizeof(capture_mode_names[0])); i++)
+        if (strcmp(capture_mode, capture_mode_names[i]) == 0)
+            camera->mode = (capture_mode_t)i;
+    if (camera->mode == CAPTURE_SPAWN && strcmp(capture_mode, "spawn") != 0)
+        fprintf(stderr, "config: invalid capture-mode '%s' for camera '%s', using 'spawn'\n", capture_mode, name);
+    const char *encoder = camera_config_string(section, "encoder", ENCODER_DEFAULT);
+    camera->encoder = ENCODER_FFMPEG;
+    if (strcmp(encoder, encoder_names[ENCODER_LIBJPEG]) == 0) {
+#ifdef IMAGE_LIBJPEG
+        if (camera->mode == CAPTURE_RTSP || camera->jpeg.passthrough != PASSTHROUGH_OFF)
+            fprintf(stderr, "config: encoder=libjpeg for camera '%s' needs ffmpeg to re-encode (spawn or persistent, "
+                    "passthrough=false), using 'ffmpeg'\n", name);
+        else if (frame_pool_begin(&camera->raw_pool, FRAME_SIZE_INITIAL, MAX_BUFFER_SIZE))
+            camera->encoder = ENCODER_LIBJPEG;
+#else
+        fprintf(stderr, "config: encoder=libjpeg for camera '%s' requires libjpeg (build with LIBJPEG=1), using "
+                "'ffmpeg'\n", name);
+#endif
+    } else if (strcmp(encoder, encoder_names[ENCODER_FFMPEG]) != 0)
+        fprintf(stderr, "config: invalid encoder '%s' for camera '%s', using 'ffmpeg'\n", encoder, name);
+    if (camera->mode != CAPTURE_SPAWN) {
+        const RtspConfig rtsp_config = {
+            .timeout = camera->timeout, .quality = camera->quality, .debug = camera_config_bool(NULL, "debug", false)};
+        const stream_source_t source = camera->mode == CAPTURE_RTSP ? STREAM_SOURCE_RTSP : STREAM_SOURCE_FFMPEG;
+        if (!stream_begin(&camera->stream, name, source, camera->rtsp_url,
+                          camera_config_integer(section, "capture-rate", CAPTURE_RATE_DEFAULT),
+                          camera_config_integer(section, "ring", RING_DEFAULT), camera->encoder == ENCODER_LIBJPEG,
+                          &rtsp_config, camera->encoder == ENCODER_LIBJPEG ? &camera->raw_pool : &camera->pool,
+                          &camera->metrics, &camera->jpeg, &camera->health, camera->probe_timeout)) {
+            fprintf(stderr, "stream: failed to begin for camera '%s', using 'spawn'\n", name);
+            camera->mode = CAPTURE_SPAWN;
+        } else
+            camera->stream_active = true;
+    }
+    if (camera_config_bool(section, "adaptive", false)) {
+        adapt_t *adapt = &camera->adapt;
+        adapt->active = true;
+        adapt->interval_base = camera->interval;
+        const double interval_max =
+            camera_config_double(section, "adaptive-interval-max",
+                                 (double)camera->interval * ADAPTIVE_INTERVAL_FACTOR / SCHEDULE_NS_PER_SECOND);
+        adapt->interval_max = (int64_t)(interval_max * 1000.0 + 0.5) * SCHEDULE_NS_PER_MS;
+        if (!(adapt->interval_max >= camera->interval))
+            adapt->interval_max = camera->interval;
+        adapt->quality_max = camera_config_integer(section, "adaptive-quality-max", ADAPTIVE_QUALITY_MAX_DEFAULT);
+        adapt->scale_min = camera_config_double(section, "adaptive-scale-min", ADAPTIVE_SCALE_MIN_DEFAULT);
+        if (!(adapt->scale_min > 0.0 && adapt->scale_min <= 1.0)) {
+            fprintf(stderr, "config: invalid adaptive-scale-min for camera '%s', using %.2f\n", name,
+                    ADAPTIVE_SCALE_MIN_DEFAULT);
+            adapt->scale_min = ADAPTIVE_SCALE_MIN_DEFAULT;
         }
-        while (*running && time(NULL) < next)
-            sleep(1);
+        adapt_settings_t settings;
+        const int levels = camera_adapt_settings(camera, INT_MAX, &settings);
+        printf("camera: '%s' adaptive (levels=%d, interval up to %.3f seconds, quality up to %d, scale down to %.2f)\n",
+               name, levels, (double)settings.interval / SCHEDULE_NS_PER_SECOND, settings.quality, settings.scale);
+    }
+    const int shm_slots = camera_config_integer(section, "shm", SHM_DEFAULT);
+    if (shm_slots > 0) {
+        char shm_name[NAME_MAX];
+        snprintf(shm_name, sizeof(shm_name), "/rtsptomqtt.%s", name);
+        const char *shm_name_config = camera_config_string(section, "shm-name", shm_name);
+        const int slot_size = camera_config_integer(section, "shm-slot-size", SHM_SLOT_SIZE_DEFAULT);
+        camera->shm_active = shm_ring_begin(&camera->shm, shm_name_config, name, shm_slots,
+                                            slot_size > 0 ? (size_t)slot_size * 1024 : 0);
+        camera->shm_notify = camera->shm_active && camera_config_bool(section, "shm-notify", false);
+        snprintf(camera->shm_topic, sizeof(camera->shm_topic), "%s/shm", camera->mqtt_topic);
+        if (camera->shm_active)
+            printf("camera: '%s' shm '%s' (slots=%d, slot-size=%d KB, frames written=%lu%s)\n", name,
+                   camera->shm.name, shm_slots, slot_size, (unsigned long)atomic_load(&camera->shm.header->written),
+                   camera->shm_notify ? ", notify" : "");
+    }
+    pthread_mutex_init(&camera->command_mutex, NULL);
+    printf("camera: '%s' (topic='%s', interval=%.3f seconds%s, quality=%d, capture-mode=%s, encoder=%s, "
+           "passthrough=%s%s%s)\n",
+           name, camera->mqtt_topic, (double)camera->interval / SCHEDULE_NS_PER_SECOND,
+           camera->interval_align ? " aligned" : "", camera->quality, capture_mode_names[camera->mode],
+           encoder_names[camera->encoder], passthrough_names[camera->jpeg.passthrough],
+           camera->jpeg.validate ? ", jpeg-validate" : "", camera->jpeg.strip ? ", jpeg-strip" : "");
+    return true;
+}
+
+// false, with nothing to end, for a camera without an rtsp-url
+bool camera_load(camera_t *camera, const char *name, const char *section) {
+    memset(camera, 0, sizeof(*camera));
+    camera->name = name;
+    camera->section = section;
+    camera->startup = true;
+    camera->startup_begin = schedule_monotonic();
+    camera_loading = camera;
+    const bool loaded = __camera_load(camera, name, section);
+    camera_loading = NULL;
+    if (!loaded)
+        camera_trace_end(camera);
+    return loaded;
+}
+
+void camera_end(camera_t *camera) {
+    if (camera->stream_active) {
+        stream_end(&camera->stream);
+        camera->stream_active = false;
     }
+    if (camera->change_active) {
+        change_end(&camera->change);
+        camera->change_active = false;
+    }
+    image_end(&camera->image_decoded);
+    image_end(&camera->image_scaled);
+    frame_pool_end(&camera->pool);
+    if (camera->encoder == ENCODER_LIBJPEG)
+        frame_pool_end(&camera->raw_pool);
+    if (camera->shm_active) {
+        shm_ring_end(&camera->shm);
+        camera->shm_active = false;
+    }
+    batch_end(&camera->batch);
+    pthread_mutex_destroy(&camera->command_mutex);
+    camera_trace_end(camera);
+}
+
+int cameras_begin(void) {
+    camera_count = 0;
+    if (camera_load(&cameras[camera_count], "default", NULL))
+        cameras[camera_count++].loaded = true;
+    const char *sections[CONFIG_MAX_SECTIONS];
+    const int section_count = config_get_sections(sections, CONFIG_MAX_SECTIONS);
+    for (int i = 0; i < section_count && camera_count < CAMERAS_MAX; i++)
+        if (camera_load(&cameras[camera_count], sections[i], sections[i]))
+            cameras[camera_count++].loaded = true;
+    return camera_count;
+}
+
+void cameras_stop(void) {
+    for (int i = 0; i < camera_count; i++)
+        if (cameras[i].stream_active)
+            stream_stop(&cameras[i].stream);
+}
+
+void cameras_end(void) {
+    for (int i = 0; i < camera_count; i++)
+        if (cameras[i].loaded) {
+            camera_end(&cameras[i]);
+            cameras[i].loaded = false;
+        }
+    camera_count = 0;
 }
 
 // -----------------------------------------------------------------------------------------------------------------------------------------
 // -----------------------------------------------------------------------------------------------------------------------------------------
 
-volatile bool running = true;
+// not time(), which reads the coarse clock and can still show the previous second when an aligned capture starts
+// exactly on the boundary
+time_t capture_time(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec;
+}
+
+#ifdef IMAGE_LIBJPEG
+image_encoder_t *capture_encoders; // one per worker, set up by the worker on first use
+int capture_encoder_count = 0;
+
+image_encoder_t *capture_encoder(const int worker) {
+    image_encoder_t *encoder = &capture_encoders[worker];
+    return encoder->active || image_encoder_begin(encoder) ? encoder : NULL;
+}
+
+// encoder=libjpeg: the raw frame is encoded on the worker's compressor into a frame from the camera's pool, at the
+// adaptive level's quality, and released; spawn mode's is still all of ffmpeg's output, a stream of one frame
+frame_t *capture_encode(camera_t *camera, frame_t *raw, const int worker) {
+    int width = raw->width, height = raw->height;
+    size_t offset = 0;
+    if (width == 0 && !y4m_frame(raw->data, raw->size, &offset, &width, &height)) {
+        fprintf(stderr, "%s: no frame in ffmpeg output (%zu bytes)\n", camera->name, raw->size);
+        frame_unref(raw);
+        return NULL;
+    }
+    adapt_settings_t settings;
+    camera_adapt_settings(camera, atomic_load(&camera->adapt.level), &settings);
+    const int64_t begin = schedule_monotonic();
+    image_encoder_t *encoder = capture_encoder(worker);
+    frame_t *frame = frame_alloc(&camera->pool);
+    const bool encoded = encoder != NULL && frame != NULL &&
+                         image_encode_planar(encoder, raw->data + offset, width, height,
+                                             encoder_quality(settings.quality), &frame->data, &frame->capacity,
+                                             &frame->size);
+    if (encoded) {
+        capture_stage(&camera->metrics, STAGE_ENCODE, begin, schedule_monotonic());
+        frame->time = raw->time;
+    } else {
+        fprintf(stderr, "%s: failed to encode frame (%dx%d)\n", camera->name, width, height);
+        frame_unref(frame);
+    }
+    frame_unref(raw);
+    return encoded ? frame : NULL;
+}
+#endif
+
+bool capture_encoders_begin(const int count __attribute__((unused))) {
+#ifdef IMAGE_LIBJPEG
+    if ((capture_encoders = calloc((size_t)count, sizeof(image_encoder_t))) == NULL)
+        return false;
+    capture_encoder_count = count;
+#endif
+    return true;
+}
+
+void capture_encoders_end(void) {
+#ifdef IMAGE_LIBJPEG
+    for (int i = 0; i < capture_encoder_count; i++)
+        image_encoder_end(&capture_encoders[i]);
+    free(capture_encoders);
+    capture_encoders = NULL;
+    capture_encoder_count = 0;
+#endif
+}
+
+// renders each rendition from a single decode of the frame (the decoder already reduces by 1/2..1/8 when the largest
+// rendition allows it) on the worker's compressor; renditions keeping the captured JPEG share the frame instead of
+// copying it
+bool capture_render(camera_t *camera, frame_t *frame, const int worker __attribute__((unused)), frame_t **renditions) {
+    int width_minimum = 0;
+    for (int i = 0; i < camera->rendition_count; i++) {
+        renditions[i] = NULL;
+        if (camera->renditions[i].quality > 0 &&
+            (camera->renditions[i].width == 0 || camera->renditions[i].width > width_minimum))
+            width_minimum = camera->renditions[i].width == 0 ? INT_MAX : camera->renditions[i].width;
+    }
+#ifdef IMAGE_LIBJPEG
+    if (width_minimum > 0 && !image_decode(&camera->image_decoded, frame->data, frame->size, width_minimum)) {
+        fprintf(stderr, "%s: failed to decode frame for renditions\n", camera->name);
+        return false;
+    }
+#endif
+    for (int i = 0; i < camera->rendition_count; i++) {
+        const rendition_t *rendition = &camera->renditions[i];
+        if (rendition->quality == 0) {
+            renditions[i] = frame_ref(frame);
+            continue;
+        }
+#ifdef IMAGE_LIBJPEG
+        const image_t *decoded = &camera->image_decoded, *image = decoded;
+        if (rendition->width > 0 && rendition->width < decoded->width) {
+            int height = (int)(((long)decoded->height * rendition->width + decoded->width / 2) / decoded->width);
+            if (!image_scale(decoded, &camera->image_scaled, rendition->width, height < 1 ? 1 : height))
+                return false;
+            image = &camera->image_scaled;
+        }
+        image_encoder_t *encoder = capture_encoder(worker);
+        if (encoder == NULL || (renditions[i] = frame_alloc(&camera->pool)) == NULL)
+            return false;
+        renditions[i]->time = frame->time;
+        if (!image_encode(encoder, image, rendition->quality, &renditions[i]->data, &renditions[i]->capacity,
+                          &renditions[i]->size)) {
+            fprintf(stderr, "%s: failed to encode rendition '%s'\n", camera->name, rendition->name);
+            return false;
+        }
+#endif
+    }
+    return true;
+}
+
+void capture_property(mqtt_properties_t *properties, const char *name, const char *value) {
+    if (properties->user_count < MQTT_USER_PROPERTIES_MAX) {
+        properties->user[properties->user_count][0] = name;
+        properties->user[properties->user_count][1] = value;
+        properties->user_count++;
+    }
+}
+
+// batch=K collects frames into one message (see batch_linux.h for the format) published to <topic>/batch once it
+// holds K frames or, with batch-time=T, T milliseconds after its first frame, whichever comes first; the index in the
+// message carries each frame's usual metadata, unchanged frames are recorded without their image, with renditions
+// the first one is what is batched, and frames answering a command are published on their own as usual
+
+bool capture_batch_flush(camera_t *camera) {
+    batch_t *batch = &camera->batch;
+    if (batch->count == 0)
+        return true;
+    const int count = batch->count;
+    bool spooled = false, sent = false;
+    if (batch_pack(batch, camera->name)) {
+        char topic[192], count_text[16];
+        snprintf(topic, sizeof(topic), "%s/batch", camera->mqtt_topic);
+        snprintf(count_text, sizeof(count_text), "%d", count);
+        mqtt_properties_t properties = {.content_type = "application/vnd.rtsptomqtt.batch", .expiry = camera->expiry};
+        if (metadata_properties) {
+            capture_property(&properties, "camera", camera->name);
+            capture_property(&properties, "frames", count_text);
+        }
+        if ((sent = capture_send(&camera->metrics, topic, batch->data, batch->size, &properties, &spooled))) {
+            atomic_fetch_add(&camera->metrics.bytes, batch->size);
+            printf("%s: %s batch of %d frames (%zu bytes)\n", camera->name, spooled ? "spooled" : "published", count,
+                   batch->size);
+        }
+    }
+    batch_reset(batch);
+    camera->batch_due = 0;
+    return sent;
+}
+
+bool capture_batch_add(camera_t *camera, const frame_t *frame, const char *metadata) {
+    batch_t *batch = &camera->batch;
+    if (batch->count == 0 && camera->batch_time > 0)
+        camera->batch_due = schedule_monotonic() + camera->batch_time;
+    if (!batch_add(batch, frame ? frame->data : NULL, frame ? frame->size : 0, metadata))
+        return false;
+    if (frame == NULL)
+        atomic_fetch_add(&camera->metrics.unchanged, 1);
+    return batch->count < camera->batch_frames || capture_batch_flush(camera);
+}
 
-void signal_handler(int sig __attribute__((unused))) {
-    if (running) {
-        printf("stopping\n");
-        running = false;
+// flushes the batches whose time is up, or all of them; returns the next batch deadline, 0 for none
+int64_t capture_batch_expire(const bool all) {
+    const int64_t now = schedule_monotonic();
+    int64_t next = 0;
+    pthread_rwlock_rdlock(&cameras_lock);
+    for (int i = 0; i < camera_count; i++) {
+        camera_t *camera = &cameras[i];
+        if (!camera->loaded)
+            continue;
+        if (camera->batch.count > 0 && (all || (camera->batch_due > 0 && now >= camera->batch_due)) &&
+            !capture_batch_flush(camera)) {
+            atomic_fetch_add(&camera->metrics.publish_failures, 1);
+            fprintf(stderr, "%s: batch publish error\n", camera->name);
+        }
+        if (camera->batch_due > 0 && (next == 0 || camera->batch_due < next))
+            next = camera->batch_due;
     }
+    pthread_rwlock_unlock(&cameras_lock);
+    return next;
 }
 
+// with change detection active, frames judged unchanged only publish their metadata, which records the decision;
+// with metadata-properties (MQTT 5) each image carries time, camera, size and change as user properties instead, so
+// metadata is only published on its own for unchanged frames; frames answering a command say so, with their place in
+// the burst
+bool capture_publish(camera_t *camera, const frame_t *frame, frame_t *const *renditions, const time_t time_entry,
+                     const change_result_t *change, const capture_trigger_t *trigger) {
+
+    const size_t total_bytes = frame->size;
+
+    const time_t total_time = capture_time() - time_entry;
+    char timestamp[15 + 1];
+    struct tm tm;
+    strftime(timestamp, sizeof(timestamp) - 1, "%Y%m%d%H%M%S", localtime_r(&time_entry, &tm));
+    char metadata[1024], change_json[128] = "", trigger_json[160] = "", burst_text[24] = "";
+    // ,"<name>":<size> per rendition, names as loaded need no escapes
+    char renditions_json[24 + (size_t)camera->rendition_count * (sizeof(camera->renditions[0].name) + 24)];
+    renditions_json[0] = '\0';
+    char request_json[80] = "", adaptive_json[160] = "", adaptive_text[128] = "";
+    if (camera->adapt.active) {
+        adapt_settings_t settings;
+        const int level = atomic_load(&camera->adapt.level);
+        camera_adapt_settings(camera, level, &settings);
+        const char *reason = adapt_reason_names[atomic_load(&camera->adapt.reason)];
+        const double interval = (double)settings.interval / SCHEDULE_NS_PER_SECOND;
+        if (camera_encoding(camera)) {
+            snprintf(adaptive_json, sizeof(adaptive_json),
+                     ",\"adaptive\":{\"level\":%d,\"interval\":%.3f,\"quality\":%d,\"scale\":%.2f,\"reason\":\"%s\"}",
+                     level, interval, settings.quality, settings.scale, reason);
+            snprintf(adaptive_text, sizeof(adaptive_text), "level=%d interval=%.3f quality=%d scale=%.2f reason=%s",
+                     level, interval, settings.quality, settings.scale, reason);
+        } else {
+            snprintf(adaptive_json, sizeof(adaptive_json),
+                     ",\"adaptive\":{\"level\":%d,\"interval\":%.3f,\"reason\":\"%s\"}", level, interval, reason);
+            snprintf(adaptive_text, sizeof(adaptive_text), "level=%d interval=%.3f reason=%s", level, interval, reason);
+        }
+    }
+    if (trigger->command) {
+        snprintf(burst_text, sizeof(burst_text), "%d/%d", trigger->index + 1, trigger->count);
+        if (trigger->id[0])
+            snprintf(request_json, sizeof(request_json), ",\"request\":\"%s\"", trigger->id);
+        snprintf(trigger_json, sizeof(trigger_json), ",\"trigger\":\"command\"%s,\"burst\":{\"index\":%d,\"count\":%d}",
+                 request_json, trigger->index + 1, trigger->count);
+    }
+    if (change->reason != NULL) {
+        if (change->score >= 0.0)
+            snprintf(change_json, sizeof(change_json),
+                     ",\"change\":{\"decision\":\"%s\",\"reason\":\"%s\",\"score\":%.2f}",
+                     change->publish ? "publish" : "skip", change->reason, change->score);
+        else
+            snprintf(change_json, sizeof(change_json), ",\"change\":{\"decision\":\"%s\",\"reason\":\"%s\"}",
+                     change->publish ? "publish" : "skip", change->reason);
+    }
+    if (change->publish && camera->rendition_count > 0) {
+        size_t length = (size_t)snprintf(renditions_json, sizeof(renditions_json), ",\"renditions\":{");
+        for (int i = 0; i < camera->rendition_count && length < sizeof(renditions_json); i++)
+            length += (size_t)snprintf(renditions_json + length, sizeof(renditions_json) - length, "%s\"%s\":%zu",
+                                       i ? "," : "", camera->renditions[i].name, renditions[i]->size);
+        if (length < sizeof(renditions_json))
+            snprintf(renditions_json + length, sizeof(renditions_json) - length, "}");
+    }
+    snprintf(metadata, sizeof(metadata), "{\"time\":\"%s\",\"size\":%zu%s%s%s%s}", timestamp, total_bytes,
+             change_json, renditions_json, trigger_json, adaptive_json);
+    if (camera->batch_frames > 0 && !trigger->command)
+        return capture_batch_add(camera,
+                                 !change->publish ? NULL : camera->rendition_count > 0 ? renditions[0] : frame,
+                                 metadata);
+
+    mqtt_properties_t properties = {.content_type = "image/jpeg", .expiry = camera->expiry};
+    char size_text[24], score_text[16];
+    if (metadata_properties) {
+        capture_property(&properties, "time", timestamp);
+        capture_property(&properties, "camera", camera->name);
+        if (change->reason != NULL) {
+            capture_property(&properties, "change", change->reason);
+            if (change->score >= 0.0) {
+                snprintf(score_text, sizeof(score_text), "%.2f", change->score);
+                capture_property(&properties, "change-score", score_text);
+            }
+        }
+        if (trigger->command) {
+            capture_property(&properties, "trigger", "command");
+            if (trigger->id[0])
+                capture_property(&properties, "request", trigger->id);
+            capture_property(&properties, "burst", burst_text);
+        }
+        if (adaptive_text[0])
+            capture_property(&properties, "adaptive", adaptive_text);
+    }
+    const int user_count = properties.user_count;
+
+    char topic[192];
+    bool spooled = false;
+    if (change->publish && camera->rendition_count == 0) {
+        snprintf(topic, sizeof(topic), "%s/imagedata", camera->mqtt_topic);
+        snprintf(size_text, sizeof(size_text), "%zu", total_bytes);
+        if (metadata_properties)
+            capture_property(&properties, "size", size_text);
+        if (!capture_send(&camera->metrics, topic, frame->data, total_bytes, &properties, &spooled))
+            return false;
+        atomic_fetch_add(&camera->metrics.bytes, total_bytes);
+    }
+    for (int i = 0; change->publish && i < camera->rendition_count; i++) {
+        snprintf(topic, sizeof(topic), "%s/imagedata/%s", camera->mqtt_topic, camera->renditions[i].name);
+        snprintf(size_text, sizeof(size_text), "%zu", renditions[i]->size);
+        properties.user_count = user_count;
+        if (metadata_properties) {
+            capture_property(&properties, "rendition", camera->renditions[i].name);
+            capture_property(&properties, "size", size_text);
+        }
+        if (!capture_send(&camera->metrics, topic, renditions[i]->data, renditions[i]->size, &properties, &spooled))
+            return false;
+        atomic_fetch_add(&camera->metrics.bytes, renditions[i]->size);
+    }
+    if (!metadata_properties || !change->publish) {
+        const mqtt_properties_t json = {.content_type = "application/json", .expiry = camera->expiry};
+        snprintf(topic, sizeof(topic), "%s/metadata", camera->mqtt_topic);
+        if (!capture_send(&camera->metrics, topic, (unsigned char *)metadata, strlen(metadata), &json, &spooled))
+            return false;
+    }
+
+    if (change->publish && trigger->command)
+        printf("%s: %s '%s' (%zu bytes) [command%s%s%s %s]\n", camera->name, spooled ? "spooled" : "published",
+               timestamp, total_bytes, trigger->id[0] ? " '" : "", trigger->id, trigger->id[0] ? "'" : "", burst_text);
+    else if (change->publish)
+        printf("%s: %s '%s' (%zu bytes) [%ld seconds]\n", camera->name, spooled ? "spooled" : "published", timestamp,
+               total_bytes, total_time);
+    else {
+        atomic_fetch_add(&camera->metrics.unchanged, 1);
+        printf("%s: unchanged '%s' (score %.2f%%), metadata only%s [%ld seconds]\n", camera->name, timestamp,
+               change->score, spooled ? ", spooled" : "", total_time);
+    }
+    return true;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// startup: the broker connection (mqtt_begin does not wait for it) and the cameras' streams (started as each camera
+// loads) come up side by side, and each camera's first capture is made as soon as it can give a frame, at once in
+// spawn mode and on the stream's first frame in the stream modes, rather than at its place in the interval
+// (startup-capture=false keeps that); the pipeline is live once the broker is connected and every camera has
+// published a frame since, which is logged with how long the broker, each camera's first frame and first publish
+// took, and reported to systemd (Type=notify) as READY=1, or after startup-timeout seconds (default 60) whatever the
+// state, so one dead camera does not hold the service back; reloads are reported as RELOADING=1 then READY=1
+
+typedef struct {
+    bool capture;
+    int64_t begin, timeout;          // monotonic nanoseconds
+    _Atomic int64_t connected, live; // nanoseconds after begin, 0 until reached
+    bool ready;                      // READY=1 sent, main thread only
+} startup_t;
+
+startup_t startup = {.capture = true};
+
+bool schedule_start(camera_t *camera);
+
+void startup_begin(void) {
+    startup.begin = schedule_monotonic();
+    startup.capture = config_get_bool("startup-capture", true);
+    startup.timeout = (int64_t)config_get_integer("startup-timeout", STARTUP_TIMEOUT_DEFAULT) * SCHEDULE_NS_PER_SECOND;
+}
+
+// monotonic nanoseconds of the camera's first frame, 0 before
+int64_t startup_frame(camera_t *camera) {
+    return camera->stream_active ? atomic_load(&camera->stream.ready) : atomic_load(&camera->startup_frame);
+}
+
+// from the publisher, for every frame published
+void startup_published(camera_t *camera) {
+    if (atomic_load(&camera->startup_live) != 0 || !mqtt_connected())
+        return;
+    const int64_t now = schedule_monotonic();
+    atomic_store(&camera->startup_live, now);
+    printf("startup: '%s' first frame in %.0f ms, live in %.0f ms\n", camera->name,
+           (double)(startup_frame(camera) - camera->startup_begin) / SCHEDULE_NS_PER_MS,
+           (double)(now - camera->startup_begin) / SCHEDULE_NS_PER_MS);
+    if (atomic_load(&startup.live) == 0)
+        schedule_wake(&capture_schedule);
+}
+
+// the camera's first capture, as soon as it can give a frame: spawn mode at once, the stream modes on the stream's
+// first frame (which wakes the scheduler) or, failing that, after capture-timeout; false while waiting, with the
+// camera's deadline kept from falling behind so the wait is not counted as skipped captures
+bool startup_camera(camera_t *camera, const int64_t now, int64_t *next) {
+    const int64_t timeout = camera->startup_begin + (int64_t)camera->timeout * SCHEDULE_NS_PER_SECOND;
+    if (startup.capture && camera->stream_active && atomic_load(&camera->stream.ready) == 0 && now < timeout) {
+        if (camera->next < now)
+            camera->next = now;
+        if (timeout < *next)
+            *next = timeout;
+        return false;
+    }
+    camera->startup = false;
+    if (startup.capture && camera->next > now) { // else it is due anyway
+        camera->due = now;
+        schedule_start(camera);
+    }
+    return true;
+}
+
+// main thread: follows startup until live, returning when it next needs to look
+int64_t startup_update(const int64_t now) {
+    if (atomic_load(&startup.live) != 0)
+        return INT64_MAX;
+    const int64_t connected = mqtt_connected_time();
+    if (connected > 0 && atomic_load(&startup.connected) == 0) {
+        atomic_store(&startup.connected, connected - startup.begin);
+        printf("startup: mqtt connected in %.0f ms\n", (double)(connected - startup.begin) / SCHEDULE_NS_PER_MS);
+    }
+    int count = 0, live = 0;
+    for (int i = 0; i < camera_count; i++)
+        if (cameras[i].loaded) {
+            count++;
+            live += atomic_load(&cameras[i].startup_live) != 0;
+        }
+    if (connected > 0 && live == count) {
+        atomic_store(&startup.live, now - startup.begin);
+        printf("startup: live in %.0f ms (cameras=%d)\n", (double)(now - startup.begin) / SCHEDULE_NS_PER_MS, count);
+        systemd_notify("%sSTATUS=live, cameras=%d", startup.ready ? "" : "READY=1\n", count);
+        startup.ready = true;
+        return INT64_MAX;
+    }
+    if (!startup.ready && now >= startup.begin + startup.timeout) {
+        fprintf(stderr, "startup: not live after %.0f seconds (mqtt %s, cameras live=%d/%d), carrying on\n",
+                (double)startup.timeout / SCHEDULE_NS_PER_SECOND, connected > 0 ? "connected" : "not connected", live,
+                count);
+        systemd_notify("READY=1\nSTATUS=starting, mqtt %s, cameras live=%d/%d",
+                       connected > 0 ? "connected" : "not connected", live, count);
+        startup.ready = true;
+    }
+    return startup.ready ? INT64_MAX : startup.begin + startup.timeout;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// captures hand their frames to a single publisher thread through a bounded queue, so a stalled broker costs queued
+// (and, once full, dropped) snapshots instead of capture cadence, and a slow camera never holds up another's publish
+
+typedef struct {
+    camera_t *camera;
+    frame_t *frame;
+    time_t time_entry;
+    int64_t enqueued;
+    change_result_t change;
+    capture_trigger_t trigger;
+    frame_t *renditions[RENDITIONS_MAX];
+} publish_job_t;
+
+const char *publish_drop_names[] = {"oldest", "newest"};
+
+queue_t publish_queue;
+pthread_t publish_thread;
+
+// the frames go back to the camera's pool, so the camera is only done with once they have
+void publish_release(publish_job_t *job) {
+    for (int i = 0; i < RENDITIONS_MAX; i++)
+        frame_unref(job->renditions[i]);
+    frame_unref(job->frame);
+    atomic_fetch_sub(&job->camera->publishing, 1);
+    free(job);
+}
+
+// also flushes batches as their time runs out, and what is left of them once the queue is closed
+void *publish_run(void *context __attribute__((unused))) {
+    publish_job_t *job;
+    int64_t batch_due = 0;
+    while (true) {
+        const struct timespec deadline = {.tv_sec = batch_due / SCHEDULE_NS_PER_SECOND,
+                                          .tv_nsec = batch_due % SCHEDULE_NS_PER_SECOND};
+        if (!queue_pop_until(&publish_queue, batch_due > 0 ? &deadline : NULL, (void **)&job))
+            break;
+        if (job == NULL) {
+            batch_due = capture_batch_expire(false);
+            continue;
+        }
+        capture_stage(&job->camera->metrics, STAGE_ENQUEUE, job->enqueued, schedule_monotonic());
+        if (!capture_publish(job->camera, job->frame, job->renditions, job->time_entry, &job->change,
+                             &job->trigger)) {
+            atomic_fetch_add(&job->camera->metrics.publish_failures, 1);
+            fprintf(stderr, "%s: publish error\n", job->camera->name);
+        } else if (job->change.publish)
+            startup_published(job->camera);
+        publish_release(job);
+        batch_due = capture_batch_expire(false);
+    }
+    capture_batch_expire(true);
+    return NULL;
+}
+
+bool publish_begin(void) {
+    mqtt_publish_callback_register(capture_acked);
+    publish_spool_begin();
+    const int size = config_get_integer("publish-queue", PUBLISH_QUEUE_DEFAULT);
+    const char *drop = config_get_string("publish-drop", PUBLISH_DROP_DEFAULT);
+    queue_drop_t policy = QUEUE_DROP_OLDEST;
+    if (strcmp(drop, publish_drop_names[QUEUE_DROP_NEWEST]) == 0)
+        policy = QUEUE_DROP_NEWEST;
+    else if (strcmp(drop, publish_drop_names[QUEUE_DROP_OLDEST]) != 0)
+        fprintf(stderr, "config: invalid publish-drop '%s', using '%s'\n", drop, publish_drop_names[policy]);
+    if (!queue_begin(&publish_queue, size < 1 ? 1 : size, policy)) {
+        publish_spool_end();
+        return false;
+    }
+    if (pthread_create(&publish_thread, NULL, publish_run, NULL) != 0) {
+        fprintf(stderr, "publish: failed to create thread\n");
+        queue_end(&publish_queue);
+        publish_spool_end();
+        return false;
+    }
+    printf("publish: queue (size=%d, drop=%s)\n", publish_queue.size, publish_drop_names[policy]);
+    return true;
+}
+
+// drains what is already queued (to the spool, while disconnected), then stops the publisher
+void publish_end(void) {
+    queue_close(&publish_queue);
+    pthread_join(publish_thread, NULL);
+    queue_stats_t stats;
+    queue_stats(&publish_queue, &stats);
+    printf("publish: queued=%lu, dequeued=%lu, dropped=%lu, depth max=%d/%d\n", stats.pushed, stats.popped,
+           stats.dropped, stats.depth_max, stats.size);
+    queue_end(&publish_queue);
+    publish_spool_end();
+    mqtt_publish_callback_register(NULL);
+}
+
+// takes ownership of the frame and renditions; trigger is NULL for scheduled captures
+bool publish_submit(camera_t *camera, frame_t *frame, frame_t *const *renditions, const time_t time_entry,
+                    const change_result_t *change, const capture_trigger_t *trigger) {
+    publish_job_t *job = malloc(sizeof(publish_job_t));
+    if (job == NULL) {
+        for (int i = 0; i < RENDITIONS_MAX; i++)
+            frame_unref(renditions[i]);
+        frame_unref(frame);
+        return false;
+    }
+    job->camera = camera;
+    job->frame = frame;
+    job->time_entry = time_entry;
+    job->enqueued = schedule_monotonic();
+    job->change = *change;
+    if (trigger != NULL)
+        job->trigger = *trigger;
+    else
+        memset(&job->trigger, 0, sizeof(job->trigger));
+    memcpy(job->renditions, renditions, sizeof(job->renditions));
+    atomic_fetch_add(&camera->publishing, 1);
+    publish_job_t *dropped;
+    const bool queued = queue_push(&publish_queue, job, (void **)&dropped);
+    if (dropped != NULL) {
+        const unsigned long count = atomic_fetch_add(&dropped->camera->metrics.drops, 1) + 1;
+        queue_stats_t stats;
+        queue_stats(&publish_queue, &stats);
+        printf("%s: snapshot dropped, publish queue full (%d/%d, %lu camera / %lu all)\n", dropped->camera->name,
+               stats.depth, stats.size, count, stats.dropped);
+        publish_release(dropped);
+    }
+    return queued;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// health: every capture's outcome (a frame from the camera or none) moves the camera between healthy, degraded (after
+// a failure) and down (after health-failures in a row, default 3, 0 for never), see health_linux.h; a camera that is
+// down is not captured until a retry, health-backoff-min seconds (default 5) doubling up to health-backoff-max (default
+// 300), with jitter, and then only once it is found answering: an RTSP OPTIONS probe (health-probe-timeout seconds,
+// default 3) in spawn mode, a frame since the last in the stream modes, whose streams pace their own restarts in the
+// same way; each change is logged and published, retained, as JSON to <topic>/status
+
+// by whoever holds busy, wakes the scheduler to report a change
+void capture_health(camera_t *camera, const bool captured) {
+    const int64_t now = schedule_monotonic();
+    if (captured ? health_success(&camera->health, now) : health_failure(&camera->health, now))
+        schedule_wake(&capture_schedule);
+}
+
+// the probe job, for a camera that is down and due its retry: the next capture goes ahead if the camera answers
+void capture_probe(camera_t *camera) {
+    atomic_fetch_add(&camera->metrics.probes, 1);
+    const int status = rtsp_probe(camera->rtsp_url, camera->probe_timeout);
+    if (status < 0) {
+        atomic_fetch_add(&camera->metrics.probe_failures, 1);
+        capture_health(camera, false);
+        return;
+    }
+    printf("%s: camera answers (rtsp status %d), trying a capture\n", camera->name, status);
+    atomic_store(&camera->probe_passed, true);
+}
+
+// monotonic nanoseconds as wall clock seconds
+double capture_health_time(const int64_t monotonic, const int64_t now) {
+    struct timespec wall;
+    clock_gettime(CLOCK_REALTIME, &wall);
+    return (double)wall.tv_sec + (double)wall.tv_nsec / SCHEDULE_NS_PER_SECOND -
+           (double)(now - monotonic) / SCHEDULE_NS_PER_SECOND;
+}
+
+// main thread: logs the camera's changes of health and publishes the latest once connected
+void capture_status(camera_t *camera, const int64_t now) {
+    const health_t *health = &camera->health;
+    if (!atomic_load(&health->known))
+        return;
+    const int state = (int)health_state(health), failures = atomic_load(&health->failures);
+    if (state != camera->status_logged) {
+        if (state == HEALTH_DOWN)
+            fprintf(stderr, "%s: down after %d failures, retrying in %.1f seconds\n", camera->name, failures,
+                    (double)(health_retry(health) - now) / SCHEDULE_NS_PER_SECOND);
+        else if (state == HEALTH_DEGRADED)
+            fprintf(stderr, "%s: degraded (failures=%d)\n", camera->name, failures);
+        else if (camera->status_logged >= 0)
+            printf("%s: healthy again\n", camera->name);
+        camera->status_logged = state;
+    }
+    if (state == camera->status_published || !mqtt_connected())
+        return;
+    char text[256], retry[48] = "";
+    if (state == HEALTH_DOWN)
+        snprintf(retry, sizeof(retry), ",\"retry\":%.3f", capture_health_time(health_retry(health), now));
+    const int length = snprintf(text, sizeof(text), "{\"state\":\"%s\",\"failures\":%d,\"since\":%.3f%s}",
+                                health_state_names[state], failures,
+                                capture_health_time(atomic_load(&health->since), now), retry);
+    const mqtt_properties_t json = {.retain = true, .content_type = "application/json"};
+    if (length > 0 && length < (int)sizeof(text) &&
+        mqtt_send_properties(camera->status_topic, (unsigned char *)text, length, &json, NULL))
+        camera->status_published = state;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// shm=N also writes each frame published to a ring of N slots in shared memory (see shm_linux.h) for local readers,
+// which wait on the ring's futex or, with shm-notify=true, a small JSON message on <topic>/shm naming the slot
+void capture_shm(camera_t *camera, const frame_t *frame) {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    if (!shm_ring_write(&camera->shm, frame->data, frame->size, &now)) {
+        const unsigned long count = atomic_fetch_add(&camera->metrics.shm_oversize, 1) + 1;
+        if ((count & (count - 1)) == 0) // 1, 2, 4, ...
+            fprintf(stderr, "%s: shm frame of %zu bytes exceeds slot size %u, not written (%lu so far)\n",
+                    camera->name, frame->size, camera->shm.header->slot_size, count);
+        return;
+    }
+    atomic_fetch_add(&camera->metrics.shm_frames, 1);
+    if (!camera->shm_notify)
+        return;
+    const uint64_t written = atomic_load_explicit(&camera->shm.header->written, memory_order_relaxed);
+    char name[2 * NAME_MAX], text[640];
+    metrics_label(name, sizeof(name), camera->shm.name); // '"' and '\\' escaped, as in JSON
+    const int length =
+        snprintf(text, sizeof(text), "{\"name\":\"%s\",\"frame\":%llu,\"slot\":%llu,\"size\":%zu,\"time\":%lld.%03ld}",
+                 name, (unsigned long long)written,
+                 (unsigned long long)((written - 1) % camera->shm.header->slot_count), frame->size,
+                 (long long)now.tv_sec, now.tv_nsec / 1000000);
+    const mqtt_properties_t json = {.content_type = "application/json", .expiry = camera->expiry};
+    if (length > 0 && length < (int)sizeof(text))
+        mqtt_send_properties(camera->shm_topic, (unsigned char *)text, length, &json, NULL);
+}
+
+// encoding (encoder=libjpeg), change detection, renditions and publishing of a frame in hand, however it was
+// captured, on the given worker; frames answering a command are published whether changed or not
+bool capture_frame(camera_t *camera, frame_t *frame, const int worker, const time_t time_entry, const int64_t begin,
+                   const capture_trigger_t *trigger) {
+    capture_stage(&camera->metrics, STAGE_FRAME, begin, schedule_monotonic());
+    if (atomic_load(&camera->startup_frame) == 0)
+        atomic_store(&camera->startup_frame, schedule_monotonic());
+#ifdef IMAGE_LIBJPEG
+    if (camera->encoder == ENCODER_LIBJPEG && (frame = capture_encode(camera, frame, worker)) == NULL)
+        return false;
+#endif
+    atomic_fetch_add(&camera->metrics.frames, 1);
+    change_result_t change = {.publish = true, .reason = NULL, .score = -1.0};
+    if (camera->change_active && trigger == NULL)
+        change = change_evaluate(&camera->change, frame->data, frame->size, time_entry);
+    frame_t *renditions[RENDITIONS_MAX] = {NULL};
+    if (change.publish && camera->rendition_count > 0 && !capture_render(camera, frame, worker, renditions)) {
+        for (int i = 0; i < RENDITIONS_MAX; i++)
+            frame_unref(renditions[i]);
+        frame_unref(frame);
+        return false;
+    }
+    if (change.publish && camera->shm_active)
+        capture_shm(camera, frame);
+    publish_submit(camera, frame, renditions, time_entry, &change, trigger);
+    return true;
+}
+
+// persistent and rtsp modes, spawn mode captures are run by the scheduler
+bool capture(camera_t *camera, const int worker) {
+    const time_t time_entry = capture_time();
+    const int64_t begin = schedule_monotonic();
+    frame_t *frame = stream_snapshot(&camera->stream, &camera->stream_sequence, camera->timeout);
+    capture_health(camera, frame != NULL);
+    if (frame == NULL)
+        return false;
+    return capture_frame(camera, frame, worker, time_entry, begin, NULL);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// metrics-port serves the counters and stage histograms of every camera in the Prometheus text format (on
+// metrics-address, loopback by default), and stats-interval publishes a JSON summary to each camera's <topic>/stats
+
+metrics_server_t metrics_server;
+bool metrics_active = false;
+int stats_interval = STATS_INTERVAL_DEFAULT;
+
+const char *metrics_counter_names[] = {"frames",     "bytes",            "failures", "skips",   "drops",
+                                       "unchanged",  "publish_failures", "spooled",  "invalid", "timeouts",
+                                       "shm_frames", "shm_oversize",     "probes",   "probe_failures", "held"};
+
+void metrics_counters(capture_metrics_t *metrics, unsigned long *counters) {
+    atomic_ulong *sources[] = {&metrics->frames,    &metrics->bytes,            &metrics->failures, &metrics->skips,
+                               &metrics->drops,     &metrics->unchanged,        &metrics->publish_failures,
+                               &metrics->spooled,   &metrics->invalid,          &metrics->timeouts,
+                               &metrics->shm_frames, &metrics->shm_oversize,   &metrics->probes,
+                               &metrics->probe_failures, &metrics->held};
+    for (int i = 0; i < (int)(sizeof(sources) / sizeof(sources[0])); i++)
+        counters[i] = atomic_load(sources[i]);
+}
+
+#define METRICS_COUNTER_COUNT (int)(sizeof(metrics_counter_names) / sizeof(metrics_counter_names[0]))
+
+void metrics_render(metrics_text_t *text) {
+    char label[128], labels[192];
+    metrics_text_printf(text, "# HELP rtsptomqtt_stage_seconds Latency of each capture and publish stage.\n"
+                              "# TYPE rtsptomqtt_stage_seconds histogram\n");
+    pthread_rwlock_rdlock(&cameras_lock);
+    for (int i = 0; i < camera_count; i++) {
+        if (!cameras[i].loaded)
+            continue;
+        metrics_label(label, sizeof(label), cameras[i].name);
+        for (int stage = 0; stage < STAGE_COUNT; stage++) {
+            snprintf(labels, sizeof(labels), "camera=\"%s\",stage=\"%s\"", label, stage_names[stage]);
+            metrics_text_histogram(text, "rtsptomqtt_stage_seconds", labels, &cameras[i].metrics.stages[stage]);
+        }
+    }
+    for (int counter = 0; counter < METRICS_COUNTER_COUNT; counter++) {
+        metrics_text_printf(text, "# TYPE rtsptomqtt_%s_total counter\n", metrics_counter_names[counter]);
+        for (int i = 0; i < camera_count; i++) {
+            if (!cameras[i].loaded)
+                continue;
+            unsigned long counters[METRICS_COUNTER_COUNT];
+            metrics_counters(&cameras[i].metrics, counters);
+            metrics_label(label, sizeof(label), cameras[i].name);
+            metrics_text_printf(text, "rtsptomqtt_%s_total{camera=\"%s\"} %lu\n", metrics_counter_names[counter],
+                                label, counters[counter]);
+        }
+    }
+    metrics_text_printf(text, "# TYPE rtsptomqtt_camera_startup_seconds gauge\n");
+    for (int i = 0; i < camera_count; i++) {
+        if (!cameras[i].loaded)
+            continue;
+        const int64_t times[] = {startup_frame(&cameras[i]), atomic_load(&cameras[i].startup_live)};
+        const char *phases[] = {"frame", "live"};
+        metrics_label(label, sizeof(label), cameras[i].name);
+        for (int phase = 0; phase < 2; phase++)
+            if (times[phase] > 0)
+                metrics_text_printf(text, "rtsptomqtt_camera_startup_seconds{camera=\"%s\",phase=\"%s\"} %.3f\n",
+                                    label, phases[phase],
+                                    (double)(times[phase] - cameras[i].startup_begin) / SCHEDULE_NS_PER_SECOND);
+    }
+    metrics_text_printf(text, "# HELP rtsptomqtt_camera_health Camera health: 0 healthy, 1 degraded, 2 down.\n"
+                              "# TYPE rtsptomqtt_camera_health gauge\n");
+    for (int i = 0; i < camera_count; i++)
+        if (cameras[i].loaded) {
+            metrics_label(label, sizeof(label), cameras[i].name);
+            metrics_text_printf(text, "rtsptomqtt_camera_health{camera=\"%s\"} %d\n", label,
+                                (int)health_state(&cameras[i].health));
+        }
+    metrics_text_printf(text, "# TYPE rtsptomqtt_camera_down_total counter\n");
+    for (int i = 0; i < camera_count; i++)
+        if (cameras[i].loaded) {
+            metrics_label(label, sizeof(label), cameras[i].name);
+            metrics_text_printf(text, "rtsptomqtt_camera_down_total{camera=\"%s\"} %lu\n", label,
+                                atomic_load(&cameras[i].health.trips));
+        }
+    pthread_rwlock_unlock(&cameras_lock);
+    queue_stats_t stats;
+    queue_stats(&publish_queue, &stats);
+    metrics_text_printf(text,
+                        "# TYPE rtsptomqtt_publish_queue_depth gauge\nrtsptomqtt_publish_queue_depth %d\n"
+                        "# TYPE rtsptomqtt_publish_queue_depth_max gauge\nrtsptomqtt_publish_queue_depth_max %d\n"
+                        "# TYPE rtsptomqtt_publish_queue_size gauge\nrtsptomqtt_publish_queue_size %d\n"
+                        "# TYPE rtsptomqtt_publish_queue_dropped_total counter\n"
+                        "rtsptomqtt_publish_queue_dropped_total %lu\n",
+                        stats.depth, stats.depth_max, stats.size, stats.dropped);
+    metrics_text_printf(text, "# TYPE rtsptomqtt_mqtt_connected gauge\nrtsptomqtt_mqtt_connected %d\n",
+                        mqtt_connected() ? 1 : 0);
+    metrics_text_printf(text, "# TYPE rtsptomqtt_startup_seconds gauge\n");
+    const int64_t connected = atomic_load(&startup.connected), live = atomic_load(&startup.live);
+    if (connected > 0)
+        metrics_text_printf(text, "rtsptomqtt_startup_seconds{phase=\"mqtt\"} %.3f\n",
+                            (double)connected / SCHEDULE_NS_PER_SECOND);
+    if (live > 0)
+        metrics_text_printf(text, "rtsptomqtt_startup_seconds{phase=\"live\"} %.3f\n",
+                            (double)live / SCHEDULE_NS_PER_SECOND);
+    if (spool_active) {
+        spool_stats_t spool;
+        spool_stats(&publish_spool, &spool);
+        metrics_text_printf(text,
+                            "# TYPE rtsptomqtt_spool_bytes gauge\nrtsptomqtt_spool_bytes %zu\n"
+                            "# TYPE rtsptomqtt_spool_segments gauge\nrtsptomqtt_spool_segments %d\n"
+                            "# TYPE rtsptomqtt_spool_replayed_total counter\nrtsptomqtt_spool_replayed_total %lu\n"
+                            "# TYPE rtsptomqtt_spool_evicted_segments_total counter\n"
+                            "rtsptomqtt_spool_evicted_segments_total %lu\n"
+                            "# TYPE rtsptomqtt_spool_corrupt_total counter\nrtsptomqtt_spool_corrupt_total %lu\n",
+                            spool.size, spool.segments, spool.replayed, spool.evicted, spool.corrupt);
+    }
+}
+
+// {"frames":..,...,"stages":{"spawn":{"count":..,"p50":..,"p99":..,"max":..},...}} with times in milliseconds
+void metrics_stats_publish(metrics_text_t *text) {
+    if (!mqtt_connected())
+        return;
+    for (int i = 0; i < camera_count; i++) {
+        camera_t *camera = &cameras[i];
+        if (!camera->loaded)
+            continue;
+        unsigned long counters[METRICS_COUNTER_COUNT];
+        metrics_counters(&camera->metrics, counters);
+        text->size = 0;
+        metrics_text_printf(text, "{");
+        for (int counter = 0; counter < METRICS_COUNTER_COUNT; counter++)
+            metrics_text_printf(text, "\"%s\":%lu,", metrics_counter_names[counter], counters[counter]);
+        metrics_text_printf(text, "\"stages\":{");
+        for (int stage = 0, first = 1; stage < STAGE_COUNT; stage++) {
+            metrics_histogram_t *histogram = &camera->metrics.stages[stage];
+            const unsigned long count = atomic_load(&histogram->count);
+            if (count == 0)
+                continue;
+            metrics_text_printf(text, "%s\"%s\":{\"count\":%lu,\"p50\":%.3f,\"p99\":%.3f,\"max\":%.3f}",
+                                first ? "" : ",", stage_names[stage], count,
+                                (double)metrics_histogram_quantile(histogram, 0.50) / SCHEDULE_NS_PER_MS,
+                                (double)metrics_histogram_quantile(histogram, 0.99) / SCHEDULE_NS_PER_MS,
+                                (double)atomic_load(&histogram->max) / SCHEDULE_NS_PER_MS);
+            first = 0;
+        }
+        metrics_text_printf(text, "}}");
+        char topic[192];
+        snprintf(topic, sizeof(topic), "%s/stats", camera->mqtt_topic);
+        const mqtt_properties_t json = {.content_type = "application/json", .expiry = stats_interval};
+        if (text->data == NULL ||
+            !mqtt_send_properties(topic, (unsigned char *)text->data, (int)text->size, &json, NULL))
+            fprintf(stderr, "%s: stats publish error\n", camera->name);
+    }
+}
+
+void metrics_begin(void) {
+    const int port = config_get_integer("metrics-port", METRICS_PORT_DEFAULT);
+    if (port > 0)
+        metrics_active = metrics_server_begin(
+            &metrics_server, config_get_string("metrics-address", METRICS_ADDRESS_DEFAULT), port, metrics_render);
+    stats_interval = config_get_integer("stats-interval", STATS_INTERVAL_DEFAULT);
+    if (stats_interval > 0)
+        printf("metrics: stats every %d seconds\n", stats_interval);
+}
+
+void metrics_end(void) {
+    if (metrics_active) {
+        metrics_server_end(&metrics_server);
+        metrics_active = false;
+    }
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// every adaptive-period seconds (default 10) the scheduler weighs the last period against the budgets: the CPU used by
+// the process and its ffmpeg children against cpu-budget (percent of one core), the bytes published against
+// bandwidth-cap (kbit/s), and the backlog, i.e. publish drops or a publish queue over half full for all cameras, and
+// skipped captures for the camera concerned; any pressure moves each adaptive camera it concerns one level coarser,
+// and ADAPT_CALM periods in a row below ADAPT_RECOVER of every budget, without backlog, move it one level back
+
+#define ADAPT_RECOVER 0.75
+#define ADAPT_CALM 3
+
+typedef struct {
+    int period;           // seconds, 0 when no camera is adaptive
+    double cpu_budget;    // percent of one core, 0 for none
+    double bandwidth_cap; // bytes per second, 0 for none
+    int64_t last;         // monotonic nanoseconds
+    double cpu;           // seconds used by then
+    unsigned long bytes, drops;
+} adaptive_t;
+
+adaptive_t adaptive;
+
+// user and system time of a live child, from /proc/<pid>/stat
+double adaptive_child_cpu(const pid_t pid) {
+    char path[64], stat[512];
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+        return 0.0;
+    const size_t size = fread(stat, 1, sizeof(stat) - 1, file);
+    fclose(file);
+    stat[size] = '\0';
+    const char *fields = strrchr(stat, ')');
+    unsigned long utime, stime;
+    if (fields == NULL ||
+        sscanf(fields + 1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2)
+        return 0.0;
+    return (double)(utime + stime) / (double)sysconf(_SC_CLK_TCK);
+}
+
+// the process, its reaped children (spawn mode ffmpeg) and the persistent ffmpeg still running, in seconds
+double adaptive_cpu(void) {
+    struct rusage self, children;
+    getrusage(RUSAGE_SELF, &self);
+    getrusage(RUSAGE_CHILDREN, &children);
+    double seconds = (double)(self.ru_utime.tv_sec + self.ru_stime.tv_sec + children.ru_utime.tv_sec +
+                              children.ru_stime.tv_sec) +
+                     (double)(self.ru_utime.tv_usec + self.ru_stime.tv_usec + children.ru_utime.tv_usec +
+                              children.ru_stime.tv_usec) /
+                         1e6;
+    for (int i = 0; i < camera_count; i++)
+        if (cameras[i].stream_active && cameras[i].mode == CAPTURE_PERSISTENT) {
+            pthread_mutex_lock(&cameras[i].stream.mutex);
+            const pid_t pid = cameras[i].stream.exec.pid;
+            pthread_mutex_unlock(&cameras[i].stream.mutex);
+            if (pid > 0)
+                seconds += adaptive_child_cpu(pid);
+        }
+    return seconds;
+}
+
+void adaptive_apply(camera_t *camera, const int level, const adapt_reason_t reason, const char *detail) {
+    adapt_settings_t settings;
+    camera_adapt_settings(camera, level, &settings);
+    const int previous = atomic_exchange(&camera->adapt.level, level);
+    atomic_store(&camera->adapt.reason, (int)reason);
+    camera->interval = settings.interval;
+    if (camera->mode == CAPTURE_PERSISTENT && camera->stream_active) // quality is the workers' with libjpeg
+        stream_configure(&camera->stream, camera->encoder == ENCODER_LIBJPEG ? camera->quality : settings.quality,
+                         settings.filter[0] ? settings.filter : NULL);
+    printf("%s: adaptive level %d -> %d (%s%s%s): interval=%.3f seconds, quality=%d, scale=%.2f\n", camera->name,
+           previous, level, adapt_reason_names[reason], detail[0] ? ", " : "", detail,
+           (double)settings.interval / SCHEDULE_NS_PER_SECOND, settings.quality, settings.scale);
+}
+
+void adaptive_update(void) {
+    const int64_t now = schedule_monotonic();
+    const double elapsed = (double)(now - adaptive.last) / SCHEDULE_NS_PER_SECOND, cpu = adaptive_cpu();
+    unsigned long bytes = 0, drops = 0;
+    for (int i = 0; i < camera_count; i++) {
+        bytes += atomic_load(&cameras[i].metrics.bytes);
+        drops += atomic_load(&cameras[i].metrics.drops);
+    }
+    queue_stats_t stats;
+    queue_stats(&publish_queue, &stats);
+    const double cpu_used = elapsed > 0.0 ? (cpu - adaptive.cpu) / elapsed * 100.0 : 0.0,
+                 bandwidth_used = elapsed > 0.0 ? (double)(bytes - adaptive.bytes) / elapsed : 0.0;
+    const double cpu_ratio = adaptive.cpu_budget > 0.0 ? cpu_used / adaptive.cpu_budget : 0.0,
+                 bandwidth_ratio = adaptive.bandwidth_cap > 0.0 ? bandwidth_used / adaptive.bandwidth_cap : 0.0;
+    const bool backlog = drops > adaptive.drops || stats.depth * 2 > stats.size;
+    adapt_reason_t pressure = ADAPT_NONE;
+    char detail[64] = "";
+    if (cpu_ratio > 1.0) {
+        pressure = ADAPT_CPU;
+        snprintf(detail, sizeof(detail), "cpu %.1f%% of %.1f%%", cpu_used, adaptive.cpu_budget);
+    } else if (bandwidth_ratio > 1.0) {
+        pressure = ADAPT_BANDWIDTH;
+        snprintf(detail, sizeof(detail), "%.0f of %.0f kbit/s", bandwidth_used * 8 / 1000,
+                 adaptive.bandwidth_cap * 8 / 1000);
+    } else if (backlog) {
+        pressure = ADAPT_BACKLOG;
+        snprintf(detail, sizeof(detail), "publish queue %d/%d, %lu dropped", stats.depth, stats.size,
+                 drops - adaptive.drops);
+    }
+    const bool calm = pressure == ADAPT_NONE && cpu_ratio < ADAPT_RECOVER && bandwidth_ratio < ADAPT_RECOVER;
+    adaptive.last = now;
+    adaptive.cpu = cpu;
+    adaptive.bytes = bytes;
+    adaptive.drops = drops;
+    for (int i = 0; i < camera_count; i++) {
+        camera_t *camera = &cameras[i];
+        adapt_t *adapt = &camera->adapt;
+        if (!adapt->active)
+            continue;
+        const unsigned long skips = atomic_load(&camera->metrics.skips);
+        const unsigned long skipped = skips - adapt->skips;
+        adapt->skips = skips;
+        adapt_settings_t settings;
+        const int level = atomic_load(&adapt->level), levels = camera_adapt_settings(camera, INT_MAX, &settings);
+        if (pressure != ADAPT_NONE || skipped > 0) {
+            adapt->calm = 0;
+            if (level < levels) {
+                char skipped_detail[64];
+                snprintf(skipped_detail, sizeof(skipped_detail), "%lu captures skipped", skipped);
+                adaptive_apply(camera, level + 1, pressure != ADAPT_NONE ? pressure : ADAPT_BACKLOG,
+                               pressure != ADAPT_NONE ? detail : skipped_detail);
+            }
+        } else if (!calm)
+            adapt->calm = 0;
+        else if (++adapt->calm >= ADAPT_CALM && level > 0) {
+            adapt->calm = 0;
+            adaptive_apply(camera, level > levels ? levels : level - 1, ADAPT_RECOVERED, "");
+        }
+    }
+}
+
+void adaptive_begin(void) {
+    adaptive.period = 0;
+    for (int i = 0; i < camera_count; i++)
+        if (cameras[i].adapt.active)
+            adaptive.period = config_get_integer("adaptive-period", ADAPTIVE_PERIOD_DEFAULT);
+    if (adaptive.period <= 0)
+        return;
+    adaptive.cpu_budget = config_get_double("cpu-budget", 0.0);
+    adaptive.bandwidth_cap = config_get_double("bandwidth-cap", 0.0) * 1000 / 8;
+    adaptive.last = schedule_monotonic();
+    adaptive.cpu = adaptive_cpu();
+    adaptive.bytes = adaptive.drops = 0;
+    for (int i = 0; i < camera_count; i++) {
+        adaptive.bytes += atomic_load(&cameras[i].metrics.bytes);
+        adaptive.drops += atomic_load(&cameras[i].metrics.drops);
+        cameras[i].adapt.skips = atomic_load(&cameras[i].metrics.skips);
+    }
+    printf("adaptive: every %d seconds (cpu-budget=%.1f%%, bandwidth-cap=%.0f kbit/s)\n", adaptive.period,
+           adaptive.cpu_budget, adaptive.bandwidth_cap * 8 / 1000);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// one scheduler (the main thread) runs a single epoll loop: the schedule's timerfd for capture deadlines, a signalfd
+// for SIGINT/SIGTERM (SIGHUP reloads), and the output pipe and pidfd of every spawn mode ffmpeg; due cameras in the
+// stream modes go to a fixed worker pool, spawn mode captures are started by the scheduler and handed to the workers
+// once the frame is in hand. Deadlines are monotonic, so each camera keeps its cadence however long captures take or
+// the wall clock jumps, and after the first capture (see startup) deadlines are spread evenly across each camera's
+// interval so a large site does not run every capture at once; interval-align=true instead captures on wall-clock
+// multiples of the interval (interval=30 at :00 and :30), re-aligned when the clock is set; how late each capture
+// starts against its deadline (queueing for a worker included) is reported per camera on shutdown
+
+workers_t capture_workers;
+schedule_t capture_schedule = {.epoll = -1, .timer = -1, .wake = -1, .clock = -1, .signal = -1};
+int snapshot_skipped = 0;
+
+#define CAPTURE_REAP_POLL (10 * SCHEDULE_NS_PER_MS) // for children without a pidfd
+
+void capture_started(camera_t *camera) {
+    const int64_t late = schedule_monotonic() - camera->due;
+    camera->started++;
+    camera->late_total += late;
+    if (late > camera->late_max)
+        camera->late_max = late;
+}
+
+void capture_failed(camera_t *camera) {
+    atomic_fetch_add(&camera->metrics.failures, 1);
+    fprintf(stderr, "%s: capture error, will retry\n", camera->name);
+}
+
+// the camera is free for its next capture, a command that came in meanwhile is answered straight away
+void capture_release(camera_t *camera) {
+    camera->job_command = false;
+    camera->job_probe = false;
+    atomic_store(&camera->busy, false);
+    if (atomic_load(&camera->command_pending))
+        schedule_wake(&capture_schedule);
+}
+
+bool capture_command(camera_t *camera, const int worker);
+
+void capture_job(void *job, const int worker) {
+    camera_t *camera = (camera_t *)job;
+    frame_t *frame = camera->exec_frame;
+    bool captured;
+    if (camera->job_probe) {
+        capture_probe(camera);
+        capture_release(camera);
+        schedule_wake(&capture_schedule); // to start the capture, once released
+        return;
+    }
+    if (frame != NULL) { // spawn mode, already captured
+        camera->exec_frame = NULL;
+        capture_trigger_t trigger = {.command = true, .index = 0, .count = 1};
+        snprintf(trigger.id, sizeof(trigger.id), "%s", camera->job_request.id);
+        captured = capture_frame(camera, frame, worker, camera->exec_time, camera->exec_begin,
+                                 camera->job_command ? &trigger : NULL);
+    } else if (camera->job_command)
+        captured = capture_command(camera, worker);
+    else {
+        capture_started(camera);
+        captured = capture(camera, worker);
+    }
+    if (!captured)
+        capture_failed(camera);
+    capture_release(camera);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// spawn mode: no thread sits blocked while ffmpeg connects and decodes, its output is read as it arrives and its exit
+// collected from the pidfd, and a capture still running capture-timeout seconds (default 10) after it started is
+// killed and counted in timeouts; the camera stays busy, so later deadlines are skipped, until the capture is done
+
+void capture_spawn_event(void *context);
+
+bool capture_spawn_start(camera_t *camera) {
+    adapt_settings_t settings;
+    camera_adapt_settings(camera, atomic_load(&camera->adapt.level), &settings);
+    char quality[16];
+    snprintf(quality, sizeof(quality), "%d", settings.quality);
+    const char *arguments[32];
+    ffmpeg_arguments(arguments, camera->rtsp_url, false, NULL, quality, settings.filter[0] ? settings.filter : NULL,
+                     camera->jpeg.passthrough != PASSTHROUGH_OFF, camera->encoder == ENCODER_LIBJPEG);
+    const int64_t begin = schedule_monotonic();
+    if (!exec_async_begin(&camera->exec, FFMPEG_COMMAND, arguments))
+        return false;
+    camera->exec_output.fd = camera->exec_exit.fd = -1;
+    if (!schedule_watch(&capture_schedule, &camera->exec_output, camera->exec.fd, capture_spawn_event, camera) ||
+        (camera->exec.pidfd >= 0 &&
+         !schedule_watch(&capture_schedule, &camera->exec_exit, camera->exec.pidfd, capture_spawn_event, camera))) {
+        schedule_unwatch(&capture_schedule, &camera->exec_output);
+        exec_async_end(&camera->exec);
+        return false;
+    }
+    capture_stage(&camera->metrics, STAGE_SPAWN, begin, metrics_timespec_ns(&camera->exec.timing.spawned));
+    camera->exec_active = true;
+    return true;
+}
+
+void capture_spawn_stop(camera_t *camera) {
+    schedule_unwatch(&capture_schedule, &camera->exec_output);
+    schedule_unwatch(&capture_schedule, &camera->exec_exit);
+    exec_async_end(&camera->exec);
+    camera->exec_active = false;
+}
+
+bool capture_spawn_begin(camera_t *camera) {
+    if (!camera->job_command)
+        capture_started(camera);
+    camera->exec_time = capture_time();
+    camera->exec_begin = schedule_monotonic();
+    camera->exec_deadline = camera->exec_begin + (int64_t)camera->timeout * SCHEDULE_NS_PER_SECOND;
+    if ((camera->exec_frame = frame_alloc(camera->encoder == ENCODER_LIBJPEG ? &camera->raw_pool : &camera->pool)) ==
+        NULL)
+        return false;
+    if (!capture_spawn_start(camera)) {
+        frame_unref(camera->exec_frame);
+        camera->exec_frame = NULL;
+        return false;
+    }
+    return true;
+}
+
+// output and exit are both in: hand the frame to the workers, or restart without passthrough
+void capture_spawn_finish(camera_t *camera) {
+    const exec_async_t *run = &camera->exec;
+    frame_t *frame = camera->exec_frame;
+    const int64_t spawned = metrics_timespec_ns(&run->timing.spawned);
+    capture_stage(&camera->metrics, STAGE_FIRST_BYTE, spawned, metrics_timespec_ns(&run->timing.first_byte));
+    if (!run->killed && WIFEXITED(run->status) && WEXITSTATUS(run->status) != 0)
+        fprintf(stderr, "%s: ffmpeg exited with status %d\n", camera->name, WEXITSTATUS(run->status));
+    const bool fallback = !run->killed && capture_jpeg_fallback(&camera->jpeg, camera->name, frame->data, run->size);
+    frame->size = exec_async_result(run);
+    capture_spawn_stop(camera);
+    if (fallback && capture_spawn_start(camera))
+        return;
+    capture_health(camera, frame->size > 0);
+    if (frame->size > 0 &&
+        (camera->encoder == ENCODER_LIBJPEG ||
+         capture_jpeg_check(&camera->jpeg, &camera->metrics, camera->name, frame->data, &frame->size)) &&
+        workers_submit(&capture_workers, camera))
+        return;
+    frame_unref(frame);
+    camera->exec_frame = NULL;
+    capture_failed(camera);
+    capture_release(camera);
+}
+
+void capture_spawn_event(void *context) {
+    camera_t *camera = (camera_t *)context;
+    if (!camera->exec_active)
+        return;
+    frame_t *frame = camera->exec_frame;
+    if (!exec_async_read(&camera->exec, &frame->data, &frame->capacity, MAX_BUFFER_SIZE))
+        schedule_unwatch(&capture_schedule, &camera->exec_output);
+    if (exec_async_reap(&camera->exec))
+        schedule_unwatch(&capture_schedule, &camera->exec_exit);
+    if (exec_async_done(&camera->exec))
+        capture_spawn_finish(camera);
+}
+
+// kills the captures past their deadline and polls those without a pidfd; returns when it next needs to run
+int64_t capture_spawn_supervise(const int64_t now) {
+    int64_t next = INT64_MAX;
+    for (int i = 0; i < camera_count; i++) {
+        camera_t *camera = &cameras[i];
+        if (!camera->exec_active)
+            continue;
+        if (!camera->exec.killed && now >= camera->exec_deadline) {
+            atomic_fetch_add(&camera->metrics.timeouts, 1);
+            fprintf(stderr, "%s: capture timed out after %d seconds, killing ffmpeg (pid=%d)\n", camera->name,
+                    camera->timeout, camera->exec.pid);
+            exec_async_kill(&camera->exec);
+        }
+        if (camera->exec.pidfd < 0) {
+            capture_spawn_event(camera);
+            if (camera->exec_active && now + CAPTURE_REAP_POLL < next)
+                next = now + CAPTURE_REAP_POLL;
+        } else if (!camera->exec.killed && camera->exec_deadline < next)
+            next = camera->exec_deadline;
+    }
+    return next;
+}
+
+// captures in progress at shutdown are abandoned
+void capture_spawn_end(void) {
+    for (int i = 0; i < camera_count; i++)
+        if (cameras[i].exec_active) {
+            capture_spawn_stop(&cameras[i]);
+            frame_unref(cameras[i].exec_frame);
+            cameras[i].exec_frame = NULL;
+            cameras[i].job_command = false;
+            atomic_store(&cameras[i].busy, false);
+        }
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// commands=true subscribes <topic>/command/snapshot for each camera: an empty payload or "now" publishes the latest
+// frame at once, without waiting for the interval or change detection; {"last":N,"next":M,"id":"..."} publishes the N
+// most recent frames (from the ring, ring=N, in the stream modes) and the M that follow, each to the usual topics with
+// metadata naming the trigger, the request id and its place in the burst; spawn mode answers with one fresh capture.
+// Commands arriving while a capture is in progress are merged and answered as soon as it is done
+
+bool commands_active = false;
+
+#define COMMAND_FRAMES_MAX RING_MAX // for each of last and next
+
+const char *__command_skip(const char *p, const char *end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n'))
+        p++;
+    return p;
+}
+
+// a string of id characters ([A-Za-z0-9._:-]), anything else (escapes included) is rejected
+const char *__command_string(const char *p, const char *end, char *value, const size_t size) {
+    if (p >= end || *p++ != '"')
+        return NULL;
+    size_t length = 0;
+    for (; p < end && *p != '"'; p++) {
+        if (!isalnum((unsigned char)*p) && strchr("._:-", *p) == NULL)
+            return NULL;
+        if (length + 1 >= size)
+            return NULL;
+        value[length++] = *p;
+    }
+    value[length] = '\0';
+    return p < end ? p + 1 : NULL;
+}
+
+const char *__command_integer(const char *p, const char *end, int *value) {
+    int result = 0, digits = 0;
+    for (; p < end && isdigit((unsigned char)*p) && digits < 6; p++, digits++)
+        result = result * 10 + (*p - '0');
+    if (digits == 0 || (p < end && isdigit((unsigned char)*p)))
+        return NULL;
+    *value = result > COMMAND_FRAMES_MAX ? COMMAND_FRAMES_MAX : result;
+    return p;
+}
+
+// "", "now", or a flat JSON object with any of "last", "next" (non-negative integers) and "id"; asking for nothing is
+// asking for the latest frame
+bool command_parse(const unsigned char *payload, const size_t size, command_t *command) {
+    memset(command, 0, sizeof(*command));
+    const char *end = (const char *)payload + size, *p = __command_skip((const char *)payload, end);
+    while (end > p && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r' || end[-1] == '\n'))
+        end--;
+    if (p == end || (end - p == 3 && strncmp(p, "now", 3) == 0)) {
+        command->last = 1;
+        return true;
+    }
+    if (*p++ != '{')
+        return false;
+    p = __command_skip(p, end);
+    if (p < end && *p == '}')
+        p++;
+    else
+        while (true) {
+            char key[16];
+            if ((p = __command_string(p, end, key, sizeof(key))) == NULL)
+                return false;
+            p = __command_skip(p, end);
+            if (p >= end || *p++ != ':')
+                return false;
+            p = __command_skip(p, end);
+            if (strcmp(key, "last") == 0)
+                p = __command_integer(p, end, &command->last);
+            else if (strcmp(key, "next") == 0)
+                p = __command_integer(p, end, &command->next);
+            else if (strcmp(key, "id") == 0)
+                p = __command_string(p, end, command->id, sizeof(command->id));
+            else
+                return false;
+            if (p == NULL)
+                return false;
+            p = __command_skip(p, end);
+            if (p < end && *p == ',') {
+                p = __command_skip(p + 1, end);
+                continue;
+            }
+            if (p >= end || *p++ != '}')
+                return false;
+            break;
+        }
+    if (__command_skip(p, end) != end)
+        return false;
+    if (command->last == 0 && command->next == 0)
+        command->last = 1;
+    return true;
+}
+
+// from the mqtt thread: the command is merged into any still pending (the larger of each count, the latest id) and
+// the scheduler woken to start it
+void commands_message(const char *topic, const unsigned char *payload, const size_t size) {
+    pthread_rwlock_rdlock(&cameras_lock);
+    for (int i = 0; i < camera_count; i++) {
+        camera_t *camera = &cameras[i];
+        if (!camera->loaded || strcmp(topic, camera->command_topic) != 0)
+            continue;
+        command_t command;
+        if (!command_parse(payload, size, &command)) {
+            fprintf(stderr, "%s: invalid snapshot command ignored (%zu bytes)\n", camera->name, size);
+            continue;
+        }
+        pthread_mutex_lock(&camera->command_mutex);
+        if (atomic_load(&camera->command_pending)) {
+            if (camera->command.last > command.last)
+                command.last = camera->command.last;
+            if (camera->command.next > command.next)
+                command.next = camera->command.next;
+            if (!command.id[0])
+                memcpy(command.id, camera->command.id, sizeof(command.id));
+        }
+        camera->command = command;
+        atomic_store(&camera->command_pending, true);
+        pthread_mutex_unlock(&camera->command_mutex);
+        schedule_wake(&capture_schedule);
+    }
+    pthread_rwlock_unlock(&cameras_lock);
+}
+
+// stream modes: the most recent frames, oldest first, then the next ones as they arrive
+bool capture_command(camera_t *camera, const int worker) {
+    const command_t *request = &camera->job_request;
+    frame_t *frames[COMMAND_FRAMES_MAX];
+    unsigned long sequence;
+    const int recent = stream_recent(&camera->stream, frames, request->last, &sequence);
+    capture_trigger_t trigger = {.command = true, .index = 0, .count = recent + request->next};
+    snprintf(trigger.id, sizeof(trigger.id), "%s", request->id);
+    bool captured = trigger.count > 0;
+    for (int i = 0; i < recent; i++, trigger.index++)
+        if (!capture_frame(camera, frames[i], worker, frames[i]->time.tv_sec, schedule_monotonic(), &trigger))
+            captured = false;
+    for (int i = 0; i < request->next; i++, trigger.index++) {
+        const time_t time_entry = capture_time();
+        const int64_t begin = schedule_monotonic();
+        frame_t *frame = stream_snapshot(&camera->stream, &sequence, camera->timeout);
+        if (frame == NULL)
+            return false;
+        if (!capture_frame(camera, frame, worker, time_entry, begin, &trigger))
+            captured = false;
+    }
+    return captured;
+}
+
+// starts the pending command unless the camera is busy, capture_release calls back once it is not
+void schedule_command(camera_t *camera) {
+    if (!atomic_load(&camera->command_pending) || atomic_exchange(&camera->busy, true))
+        return;
+    pthread_mutex_lock(&camera->command_mutex);
+    camera->job_request = camera->command;
+    atomic_store(&camera->command_pending, false);
+    pthread_mutex_unlock(&camera->command_mutex);
+    camera->job_command = true;
+    const command_t *request = &camera->job_request;
+    printf("%s: snapshot command%s%s%s (last=%d, next=%d)%s\n", camera->name, request->id[0] ? " '" : "", request->id,
+           request->id[0] ? "'" : "", request->last, request->next,
+           camera->mode == CAPTURE_SPAWN && (request->last > 1 || request->next > 0) ? ", one capture in spawn mode"
+                                                                                    : "");
+    const bool started = camera->mode == CAPTURE_SPAWN ? capture_spawn_begin(camera)
+                                                       : workers_submit(&capture_workers, camera);
+    if (!started) {
+        capture_failed(camera);
+        capture_release(camera);
+    }
+}
+
+bool commands_begin(void) {
+    if (!config_get_bool("commands", false))
+        return true;
+    if (!mqtt_message_callback_register(commands_message))
+        return false;
+    for (int i = 0; i < camera_count; i++)
+        if (cameras[i].loaded)
+            mqtt_subscribe(cameras[i].command_topic);
+    commands_active = true;
+    return true;
+}
+
+void commands_end(void) {
+    if (!commands_active)
+        return;
+    mqtt_message_callback_cancel();
+    for (int i = 0; i < camera_count; i++)
+        if (cameras[i].loaded)
+            mqtt_unsubscribe(cameras[i].command_topic);
+    commands_active = false;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// SIGHUP, or the config file being written (watched with inotify unless config-watch=false, and read once writes have
+// settled for RELOAD_SETTLE), reloads the config: cameras whose settings come out the same carry on untouched, stream
+// and all; changed ones finish what they are doing, then are torn down and loaded again, removed ones are unloaded
+// and new ones loaded, all without touching the MQTT connection. Changes to what is only read at start (the broker,
+// workers, publish queue, spool, metrics server, commands) are reported and take effect on the next restart
+
+#define RELOAD_SETTLE (250 * SCHEDULE_NS_PER_MS)
+#define RELOAD_POLL (100 * SCHEDULE_NS_PER_MS) // while a camera to reconcile is still busy
+
+const char *reload_restart_keys[] = {"mqtt-server",        "mqtt-client",         "mqtt-version",
+                                     "mqtt-qos",           "mqtt-inflight",       "mqtt-reconnect-min",
+                                     "mqtt-reconnect-max", "metadata-properties", "workers",
+                                     "publish-queue",      "publish-drop",        "spool-directory",
+                                     "spool-size",         "spool-segment",       "spool-rate",
+                                     "metrics-port",       "metrics-address",     "commands",
+                                     "config-watch",       "workers-cpus",        "startup-capture",
+                                     "startup-timeout"};
+
+int reload_inotify = -1;
+schedule_watch_t reload_watch = {.fd = -1};
+const char *reload_name; // of the config file, within the directory watched
+int64_t reload_due = 0;  // monotonic nanoseconds, 0 for none
+
+void reload_event(void *context __attribute__((unused))) {
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t size;
+    while ((size = read(reload_inotify, buffer, sizeof(buffer))) > 0)
+        for (const char *p = buffer; p < buffer + size;) {
+            const struct inotify_event *event = (const struct inotify_event *)p;
+            if (event->len > 0 && strcmp(event->name, reload_name) == 0)
+                reload_due = schedule_monotonic() + RELOAD_SETTLE;
+            p += sizeof(struct inotify_event) + event->len;
+        }
+}
+
+// the directory rather than the file, so editors that save by writing a new file and renaming it are seen too
+void reload_begin(void) {
+    if (!config_get_bool("config-watch", true))
+        return;
+    char directory[PATH_MAX];
+    snprintf(directory, sizeof(directory), "%s", config_path());
+    char *slash = strrchr(directory, '/');
+    reload_name = strrchr(config_path(), '/') ? strrchr(config_path(), '/') + 1 : config_path();
+    if (slash == NULL)
+        snprintf(directory, sizeof(directory), ".");
+    else if (slash == directory)
+        slash[1] = '\0';
+    else
+        *slash = '\0';
+    if ((reload_inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0 ||
+        inotify_add_watch(reload_inotify, directory, IN_CLOSE_WRITE | IN_MOVED_TO) < 0 ||
+        !schedule_watch(&capture_schedule, &reload_watch, reload_inotify, reload_event, NULL)) {
+        fprintf(stderr, "config: could not watch '%s' (%s), reload with SIGHUP\n", directory, strerror(errno));
+        if (reload_inotify >= 0)
+            close(reload_inotify);
+        reload_inotify = -1;
+        return;
+    }
+    printf("config: watching '%s' for changes\n", config_path());
+}
+
+void reload_end(void) {
+    if (reload_inotify < 0)
+        return;
+    schedule_unwatch(&capture_schedule, &reload_watch);
+    close(reload_inotify);
+    reload_inotify = -1;
+}
+
+camera_t *cameras_find(const char *section) {
+    for (int i = 0; i < camera_count; i++)
+        if (cameras[i].loaded && (section == NULL ? cameras[i].section == NULL
+                                                  : cameras[i].section && strcmp(cameras[i].section, section) == 0))
+            return &cameras[i];
+    return NULL;
+}
+
+// loads a camera into the given slot, or the first free one (slot -1), and starts its captures from now
+bool cameras_place(int slot, const char *name, const char *section, const int64_t now) {
+    if (slot < 0)
+        for (slot = 0; slot < camera_count && cameras[slot].loaded; slot++)
+            ;
+    if (slot >= CAMERAS_MAX) {
+        fprintf(stderr, "config: too many cameras, ignoring '%s'\n", name);
+        return false;
+    }
+    camera_t *camera = &cameras[slot];
+    pthread_rwlock_wrlock(&cameras_lock);
+    camera->loaded = camera_load(camera, name, section);
+    if (camera->loaded && slot == camera_count)
+        camera_count++;
+    pthread_rwlock_unlock(&cameras_lock);
+    if (!camera->loaded)
+        return false;
+    camera->next = camera->interval_align ? schedule_align(camera->interval, now) : now;
+    if (commands_active)
+        mqtt_subscribe(camera->command_topic);
+    return true;
+}
+
+// readers are kept out before anything is torn down, and the slot is cleared for the next camera
+void cameras_unload(camera_t *camera) {
+    pthread_rwlock_wrlock(&cameras_lock);
+    camera->loaded = false;
+    pthread_rwlock_unlock(&cameras_lock);
+    if (commands_active)
+        mqtt_unsubscribe(camera->command_topic);
+    if (camera->batch.count > 0 && !capture_batch_flush(camera))
+        fprintf(stderr, "%s: batch publish error\n", camera->name);
+    capture_acks_forget(&camera->metrics);
+    camera_end(camera);
+    printf("camera: '%s' unloaded\n", camera->name);
+    pthread_rwlock_wrlock(&cameras_lock);
+    memset(camera, 0, sizeof(*camera));
+    pthread_rwlock_unlock(&cameras_lock);
+}
+
+// reads the config again and marks what it changed; false, with everything left as it was, when it cannot be read
+bool cameras_reload(const int64_t now) {
+    if (!config_reload()) {
+        fprintf(stderr, "config: reload failed, keeping the config running\n");
+        return false;
+    }
+    int changed = 0, removed = 0, added = 0;
+    for (int i = 0; i < camera_count; i++) {
+        camera_t *camera = &cameras[i];
+        if (!camera->loaded)
+            continue;
+        camera_reload_t reload = CAMERA_KEEP;
+        if (camera->section != NULL && !config_has_section(camera->section))
+            reload = CAMERA_REMOVE;
+        else if (camera->reload != CAMERA_KEEP || camera_changed(camera))
+            reload = CAMERA_RELOAD;
+        if (reload != camera->reload && reload != CAMERA_KEEP)
+            printf("camera: '%s' %s once idle\n", camera->name,
+                   reload == CAMERA_REMOVE ? "removed, unloading" : "changed, reloading");
+        if (reload == CAMERA_REMOVE)
+            removed++;
+        else if (reload == CAMERA_RELOAD)
+            changed++;
+        camera->reload = reload;
+    }
+    const char *sections[CONFIG_MAX_SECTIONS];
+    const int section_count = config_get_sections(sections, CONFIG_MAX_SECTIONS);
+    for (int i = -1; i < section_count; i++) {
+        const char *section = i < 0 ? NULL : sections[i];
+        if (cameras_find(section) == NULL && cameras_place(-1, section ? section : "default", section, now))
+            added++;
+    }
+    for (int i = 0; i < (int)(sizeof(reload_restart_keys) / sizeof(reload_restart_keys[0])); i++)
+        if (config_changed(reload_restart_keys[i]))
+            fprintf(stderr, "config: '%s' changed, takes effect on restart\n", reload_restart_keys[i]);
+    printf("config: cameras changed=%d, removed=%d, added=%d\n", changed, removed, added);
+    if (added > 0)
+        adaptive_begin();
+    return true;
+}
+
+// cameras marked by a reload, once nothing of theirs is left running: no capture, and no frame with the publisher;
+// with none left, the values the reloads replaced are freed. Returns when it next needs to look
+int64_t cameras_reconcile(const int64_t now) {
+    int64_t next = INT64_MAX;
+    bool reconciled = false;
+    for (int i = 0; i < camera_count; i++) {
+        camera_t *camera = &cameras[i];
+        if (!camera->loaded || camera->reload == CAMERA_KEEP)
+            continue;
+        if (atomic_load(&camera->busy) || atomic_load(&camera->publishing) > 0) {
+            next = now + RELOAD_POLL;
+            continue;
+        }
+        const camera_reload_t reload = camera->reload;
+        const char *name = camera->name, *section = camera->section;
+        cameras_unload(camera);
+        if (reload == CAMERA_RELOAD && !cameras_place(i, name, section, now))
+            printf("camera: '%s' removed, no rtsp-url\n", name);
+        reconciled = true;
+    }
+    if (reconciled)
+        adaptive_begin();
+    if (next == INT64_MAX)
+        config_release();
+    return next;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+typedef enum { ADMIT_RUN, ADMIT_HOLD, ADMIT_PROBE } admit_t;
+
+// the breaker, under busy: a camera that is down is held back until its retry is due, then in spawn mode probed (the
+// probe job keeps busy, and has the scheduler start the capture if the camera answers), in the stream modes let
+// through only if its stream has a frame since the last; a camera not answering is held back for a longer while
+admit_t capture_admit(camera_t *camera, const int64_t now) {
+    if (health_state(&camera->health) != HEALTH_DOWN || atomic_exchange(&camera->probe_passed, false))
+        return ADMIT_RUN;
+    if (!health_due(&camera->health, now)) {
+        atomic_fetch_add(&camera->metrics.held, 1);
+        return ADMIT_HOLD;
+    }
+    if (camera->stream_active) {
+        if (stream_fresh(&camera->stream, camera->stream_sequence))
+            return ADMIT_RUN;
+        capture_health(camera, false);
+        return ADMIT_HOLD;
+    }
+    camera->job_probe = true;
+    return workers_submit(&capture_workers, camera) ? ADMIT_PROBE : ADMIT_HOLD;
+}
+
+// starts the camera's capture, false if it is still busy with the previous one or no worker could take it; a camera
+// held back by its breaker is not counted as skipped
+bool schedule_start(camera_t *camera) {
+    if (atomic_exchange(&camera->busy, true))
+        return false;
+    const admit_t admit = capture_admit(camera, schedule_monotonic());
+    if (admit != ADMIT_RUN) {
+        if (admit == ADMIT_HOLD)
+            capture_release(camera);
+        return true;
+    }
+    if (camera->mode == CAPTURE_SPAWN) {
+        if (!capture_spawn_begin(camera)) {
+            capture_failed(camera);
+            capture_release(camera);
+        }
+    } else if (!workers_submit(&capture_workers, camera)) {
+        capture_release(camera);
+        return false;
+    }
+    return true;
+}
+
+// starts the camera's capture, then moves its deadline past now, counting the deadlines that were missed on the way
+void schedule_camera(camera_t *camera, const int64_t now) {
+    int skipped = 0;
+    camera->due = camera->next;
+    if (!schedule_start(camera))
+        skipped++;
+    if (camera->interval_align) {
+        skipped += (int)((now - camera->next) / camera->interval);
+        camera->next = schedule_align(camera->interval, now);
+    } else {
+        camera->next += camera->interval;
+        if (camera->next <= now) {
+            const int64_t missed = (now - camera->next) / camera->interval + 1;
+            skipped += (int)missed;
+            camera->next += missed * camera->interval;
+        }
+    }
+    if (skipped) {
+        const unsigned long count =
+            atomic_fetch_add(&camera->metrics.skips, (unsigned long)skipped) + (unsigned long)skipped;
+        snapshot_skipped += skipped;
+        printf("%s: capture skipped (%d now / %lu camera / %d all)\n", camera->name, skipped, count, snapshot_skipped);
+    }
+}
+
+void schedule_report(void) {
+    for (int i = 0; i < camera_count; i++) {
+        camera_t *camera = &cameras[i];
+        if (camera->started > 0)
+            printf("%s: captures=%lu, skipped=%lu, start late avg=%.3f ms, max=%.3f ms\n", camera->name,
+                   camera->started, atomic_load(&camera->metrics.skips),
+                   (double)camera->late_total / (double)camera->started / SCHEDULE_NS_PER_MS,
+                   (double)camera->late_max / SCHEDULE_NS_PER_MS);
+    }
+}
+
+void execute(void) {
+    // before the cameras, whose streams wake it on their first frame
+    if (!schedule_begin(&capture_schedule))
+        return;
+    if (cameras_begin() == 0) {
+        fprintf(stderr, "config: no cameras (rtsp-url) configured\n");
+        schedule_end(&capture_schedule);
+        return;
+    }
+    int workers = config_get_integer("workers", camera_count < WORKERS_DEFAULT ? camera_count : WORKERS_DEFAULT);
+    if (workers < 1)
+        workers = 1;
+    if (!capture_encoders_begin(workers)) {
+        cameras_end();
+        schedule_end(&capture_schedule);
+        return;
+    }
+    if (!publish_begin()) {
+        schedule_end(&capture_schedule);
+        capture_encoders_end();
+        cameras_end();
+        return;
+    }
+    if (!workers_begin(&capture_workers, workers, CAMERAS_MAX, capture_job)) {
+        publish_end();
+        schedule_end(&capture_schedule);
+        capture_encoders_end();
+        cameras_end();
+        return;
+    }
+    const char *workers_cpus_list = config_get_string("workers-cpus", WORKERS_CPUS_DEFAULT);
+    if (workers_cpus_list[0]) {
+        int cpus[CPU_SETSIZE];
+        const int cpu_count = workers_cpus(workers_cpus_list, cpus, CPU_SETSIZE);
+        if (cpu_count <= 0)
+            fprintf(stderr, "config: invalid workers-cpus '%s', workers not pinned\n", workers_cpus_list);
+        else if (workers_pin(&capture_workers, cpus, cpu_count))
+            printf("workers: pinned to cpus %s\n", workers_cpus_list);
+    }
+    if (!commands_begin())
+        fprintf(stderr, "commands: failed to subscribe, snapshot commands disabled\n");
+    metrics_begin();
+    adaptive_begin();
+    reload_begin();
+    metrics_text_t stats_text = {0};
+    const int64_t start = schedule_monotonic();
+    int64_t stats_next = start + (int64_t)stats_interval * SCHEDULE_NS_PER_SECOND;
+    for (int i = 0; i < camera_count; i++)
+        cameras[i].next = cameras[i].interval_align ? schedule_align(cameras[i].interval, start)
+                                                    : start + (int64_t)i * cameras[i].interval / camera_count;
+    printf("executing (cameras=%d, workers=%d)\n", camera_count, workers);
+    while (true) {
+        const int64_t now = schedule_monotonic();
+        int64_t next = now + (int64_t)INTERVAL_DEFAULT * SCHEDULE_NS_PER_SECOND;
+        if (reload_due > 0) {
+            if (now >= reload_due) {
+                reload_due = 0;
+                if (startup.ready)
+                    systemd_notify("RELOADING=1\nMONOTONIC_USEC=%lld", (long long)(now / 1000));
+                if (cameras_reload(now)) {
+                    stats_interval = config_get_integer("stats-interval", STATS_INTERVAL_DEFAULT);
+                    stats_next = now + (int64_t)stats_interval * SCHEDULE_NS_PER_SECOND;
+                }
+                if (startup.ready)
+                    systemd_notify("READY=1");
+            } else if (reload_due < next)
+                next = reload_due;
+        }
+        const int64_t reconcile = cameras_reconcile(now);
+        if (reconcile < next)
+            next = reconcile;
+        for (int i = 0; i < camera_count; i++) {
+            if (!cameras[i].loaded || cameras[i].reload != CAMERA_KEEP)
+                continue;
+            schedule_command(&cameras[i]);
+            capture_status(&cameras[i], now);
+            if (atomic_load(&cameras[i].probe_passed)) { // answered its probe, captured now rather than at its deadline
+                cameras[i].due = now;
+                schedule_start(&cameras[i]);
+            }
+            if (cameras[i].startup && !startup_camera(&cameras[i], now, &next))
+                continue;
+            if (now >= cameras[i].next)
+                schedule_camera(&cameras[i], now);
+            if (cameras[i].next < next)
+                next = cameras[i].next;
+        }
+        if (stats_interval > 0) {
+            if (now >= stats_next) {
+                metrics_stats_publish(&stats_text);
+                stats_next += (int64_t)stats_interval * SCHEDULE_NS_PER_SECOND;
+                if (stats_next <= now)
+                    stats_next = now + (int64_t)stats_interval * SCHEDULE_NS_PER_SECOND;
+            }
+            if (stats_next < next)
+                next = stats_next;
+        }
+        if (adaptive.period > 0) {
+            if (now >= adaptive.last + (int64_t)adaptive.period * SCHEDULE_NS_PER_SECOND)
+                adaptive_update();
+            if (adaptive.last + (int64_t)adaptive.period * SCHEDULE_NS_PER_SECOND < next)
+                next = adaptive.last + (int64_t)adaptive.period * SCHEDULE_NS_PER_SECOND;
+        }
+        const int64_t supervise = capture_spawn_supervise(now);
+        if (supervise < next)
+            next = supervise;
+        const int64_t starting = startup_update(now);
+        if (starting < next)
+            next = starting;
+        const schedule_event_t event = schedule_wait(&capture_schedule, next);
+        if (event == SCHEDULE_SIGNAL && capture_schedule.signal_number == SIGHUP) {
+            printf("config: reload (%s)\n", strsignal(capture_schedule.signal_number));
+            reload_due = schedule_monotonic();
+        } else if (event == SCHEDULE_SIGNAL) {
+            printf("stopping (%s)\n", strsignal(capture_schedule.signal_number));
+            systemd_notify("STOPPING=1");
+            break;
+        }
+        if (event == SCHEDULE_CLOCK) {
+            printf("schedule: wall clock changed, re-aligning\n");
+            const int64_t changed = schedule_monotonic();
+            for (int i = 0; i < camera_count; i++)
+                if (cameras[i].interval_align)
+                    cameras[i].next = schedule_align(cameras[i].interval, changed);
+        }
+    }
+    reload_end();
+    commands_end();
+    capture_spawn_end();
+    cameras_stop();
+    workers_end(&capture_workers);
+    capture_encoders_end();
+    metrics_end();
+    metrics_text_end(&stats_text);
+    publish_end();
+    schedule_report();
+    schedule_end(&capture_schedule);
+    cameras_end();
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
 int main(int argc, const char **argv) {
     setbuf(stdout, NULL);
     printf("starting\n");
-    signal(SIGINT, signal_handler);
-    signal(SIGTERM, signal_handler);
+    schedule_signals_block(); // taken from the schedule's signalfd, by every thread created from here on
     if (!config(argc, argv)) {
         fprintf(stderr, "failed to load config\n");
         return EXIT_FAILURE;
     }
+    startup_begin();
     if (!mqtt_begin(&mqtt_config)) {
-        fprintf(stderr, "failed to connect mqtt\n");
+        fprintf(stderr, "failed to start mqtt\n");
         return EXIT_FAILURE;
     }
-    execute(&running);
+    execute();
     mqtt_end();
+    config_end();
     printf("stopped\n");
     return EXIT_SUCCESS;
 }
@@ -0,0 +1,69 @@
+#!/usr/bin/env python3
+"""
+Decoder for the batch container published to <topic>/batch (batch=K / batch-time=T, format in include/batch_linux.h):
+prints the index and optionally writes each frame out as <directory>/<time>-<n>.jpg, e.g.
+
+  mosquitto_sub -t snapshots/batch -C 1 -N > batch.bin && python3 tools/batch_decode.py batch.bin --output frames
+
+or, as a module, batch_decode.decode(payload) -> (index, [frame bytes, ...]) for subscribers.
+"""
+
+import argparse
+import json
+import os
+import struct
+import sys
+
+MAGIC, VERSION, HEADER = b"RTMB", 1, struct.Struct("!4sBBHII")
+
+
+def decode(payload):
+    """(index dict, list of frame bytes, empty for frames recorded without an image)"""
+    if len(payload) < HEADER.size:
+        raise ValueError("truncated header")
+    magic, version, _, count, index_offset, index_length = HEADER.unpack_from(payload)
+    if magic != MAGIC or version != VERSION:
+        raise ValueError(f"not a version {VERSION} batch")
+    if index_offset < HEADER.size or index_offset + index_length > len(payload):
+        raise ValueError("index out of range")
+    index = json.loads(payload[index_offset : index_offset + index_length])
+    frames, offset = [], HEADER.size
+    while offset < index_offset:
+        (length,) = struct.unpack_from("!I", payload, offset)
+        if offset + 4 + length > index_offset:
+            raise ValueError("truncated frame")
+        frames.append(payload[offset + 4 : offset + 4 + length])
+        offset += 4 + length
+    if len(frames) != count or len(index.get("frames", [])) != count:
+        raise ValueError(f"{count} frames expected, found {len(frames)} and {len(index.get('frames', []))} in index")
+    return index, frames
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("file", nargs="?", help="container (default: stdin)")
+    parser.add_argument("--output", metavar="DIRECTORY", help="write the frames here")
+    arguments = parser.parse_args()
+    if arguments.file:
+        with open(arguments.file, "rb") as f:
+            payload = f.read()
+    else:
+        payload = sys.stdin.buffer.read()
+    try:
+        index, frames = decode(payload)
+    except (ValueError, struct.error) as error:
+        print(f"batch_decode: {error}", file=sys.stderr)
+        return 1
+    if arguments.output:
+        os.makedirs(arguments.output, exist_ok=True)
+    print(f"camera {index.get('camera')}, {len(frames)} frames")
+    for n, (metadata, frame) in enumerate(zip(index["frames"], frames)):
+        print(f"{n:4d} {len(frame):9d} {json.dumps(metadata)}")
+        if arguments.output and frame:
+            with open(os.path.join(arguments.output, f"{metadata.get('time', 'frame')}-{n}.jpg"), "wb") as f:
+                f.write(frame)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,93 @@
+#!/usr/bin/env python3
+"""
+Reader for the shared memory frame ring (shm=N, format in include/shm_linux.h): follows the newest frame, printing
+each one seen and optionally writing it out as <directory>/<frame>.jpg, e.g.
+
+  python3 tools/shm_read.py /rtsptomqtt.garden --output frames
+
+or, as a module, shm_read.Ring(name).latest() -> (frame number, time, bytes) or None, for local consumers. It polls
+(--poll) rather than wait on the ring's futex, which python cannot do portably; see shm_ring_wait for C readers.
+"""
+
+import argparse
+import mmap
+import os
+import struct
+import sys
+import time
+
+MAGIC, VERSION = b"RTSM", 1
+HEADER, SLOT = struct.Struct("=4sIIIQII64s"), struct.Struct("=IIQqi")
+HEADER_SIZE, SLOT_HEADER_SIZE = 96, 64
+
+
+class Ring:
+    def __init__(self, name):
+        path = "/dev/shm/" + name.lstrip("/")
+        with open(path, "rb") as f:
+            self.map = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+        magic, version, self.slot_count, self.slot_size, _, _, _, camera = HEADER.unpack_from(self.map)
+        if magic != MAGIC or version != VERSION or self.slot_count == 0:
+            raise ValueError(f"{path}: not a version {VERSION} ring")
+        self.camera = camera.rstrip(b"\0").decode(errors="replace")
+        self.stride = SLOT_HEADER_SIZE + (self.slot_size + 63) // 64 * 64
+        if HEADER_SIZE + self.slot_count * self.stride > len(self.map):
+            raise ValueError(f"{path}: truncated")
+
+    def written(self):
+        return struct.unpack_from("=Q", self.map, 16)[0]
+
+    def latest(self):
+        """(frame number, time written, frame bytes), or None while nothing is written or the slot is rewritten"""
+        written = self.written()
+        if written == 0:
+            return None
+        offset = HEADER_SIZE + (written - 1) % self.slot_count * self.stride
+        sequence, size, frame, seconds, nanoseconds = SLOT.unpack_from(self.map, offset)
+        if sequence & 1 or frame != written or size > self.slot_size:
+            return None
+        data = self.map[offset + SLOT_HEADER_SIZE : offset + SLOT_HEADER_SIZE + size]
+        if struct.unpack_from("=I", self.map, offset)[0] != sequence:
+            return None
+        return frame, seconds + nanoseconds / 1e9, data
+
+    def close(self):
+        self.map.close()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("name", help="shm-name of the camera, e.g. /rtsptomqtt.default")
+    parser.add_argument("--output", metavar="DIRECTORY", help="write the frames here")
+    parser.add_argument("--poll", type=float, default=0.05, metavar="SECONDS", help="between looks (default: 0.05)")
+    parser.add_argument("--count", type=int, default=0, help="stop after this many frames (default: none)")
+    arguments = parser.parse_args()
+    try:
+        ring = Ring(arguments.name)
+    except (OSError, ValueError, struct.error) as error:
+        print(f"shm_read: {error}", file=sys.stderr)
+        return 1
+    if arguments.output:
+        os.makedirs(arguments.output, exist_ok=True)
+    print(f"camera {ring.camera}, {ring.slot_count} slots of {ring.slot_size} bytes, {ring.written()} written")
+    last, seen = ring.written(), 0
+    try:
+        while not arguments.count or seen < arguments.count:
+            latest = ring.latest()
+            if latest is None or latest[0] == last:
+                time.sleep(arguments.poll)
+                continue
+            frame, written, data = latest
+            print(f"{frame:8d} {len(data):9d} {written:.3f}{'' if frame == last + 1 else f' ({frame - last - 1} missed)'}")
+            if arguments.output:
+                with open(os.path.join(arguments.output, f"{frame}.jpg"), "wb") as f:
+                    f.write(data)
+            last, seen = frame, seen + 1
+    except KeyboardInterrupt:
+        pass
+    ring.close()
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())